@@ -128,7 +128,7 @@ void
 Camera::lcmHandler(lcm_t* lcm)
 {
 	// Subscribe to MAVLink messages on the image channel
-	mavconn_mavlink_msg_container_t_subscription_t* imgSub = mavconn_mavlink_msg_container_t_subscribe(lcm, MAVLINK_IMAGES, &imageHandler, this);
+	mavconn_mavlink_compact_subscription_t* imgSub = mavconn_mavlink_compact_subscribe(lcm, MAVLINK_IMAGES, &imageHandler, this);
 
 	while (1)
 	{
@@ -0,0 +1,343 @@
+#include "ImageStreamFEC.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace px
+{
+
+namespace
+{
+
+/** @brief Arithmetic in GF(2^8) with the polynomial 0x11d */
+struct GF256
+{
+	uint8_t exp[512];
+	uint8_t log[256];
+
+	GF256()
+	{
+		int x = 1;
+		for (int i = 0; i < 255; ++i)
+		{
+			exp[i] = x;
+			log[x] = i;
+			x <<= 1;
+			if (x & 0x100) x ^= 0x11d;
+		}
+		for (int i = 255; i < 512; ++i)
+		{
+			exp[i] = exp[i - 255];
+		}
+		log[0] = 0;
+	}
+
+	uint8_t mul(uint8_t a, uint8_t b) const
+	{
+		return (a && b) ? exp[log[a] + log[b]] : 0;
+	}
+
+	uint8_t inv(uint8_t a) const
+	{
+		return exp[255 - log[a]];
+	}
+};
+
+const GF256& gf(void)
+{
+	static const GF256 table;
+	return table;
+}
+
+/** dst ^= c * src */
+void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t length)
+{
+	if (c == 0)
+	{
+		return;
+	}
+	if (c == 1)
+	{
+		for (size_t i = 0; i < length; ++i) dst[i] ^= src[i];
+		return;
+	}
+	uint8_t row[256];
+	for (int v = 0; v < 256; ++v) row[v] = gf().mul(c, v);
+	for (size_t i = 0; i < length; ++i) dst[i] ^= row[src[i]];
+}
+
+}
+
+ImageStreamFEC::ImageStreamFEC(ImageStreamFECScheme scheme, int k, int m)
+ : scheme(scheme)
+ , k(std::max(1, std::min(k, IMAGESTREAM_FEC_MAX_DATA)))
+ , m(std::max(1, std::min(m, IMAGESTREAM_FEC_MAX_PARITY)))
+{
+	if (scheme == IMAGESTREAM_FEC_XOR)
+	{
+		this->m = 1;
+	}
+}
+
+ImageStreamFEC
+ImageStreamFEC::fromOverhead(ImageStreamFECScheme scheme, float overhead, int k)
+{
+	if (scheme == IMAGESTREAM_FEC_NONE || overhead <= 0.0f)
+	{
+		return ImageStreamFEC();
+	}
+	if (scheme == IMAGESTREAM_FEC_XOR)
+	{
+		return ImageStreamFEC(scheme, (int)floorf(1.0f / overhead + 0.5f), 1);
+	}
+	return ImageStreamFEC(scheme, k, (int)ceilf(overhead * k - 0.001f));
+}
+
+ImageStreamFEC
+ImageStreamFEC::fromHandshake(const mavlink_data_transmission_handshake_t& handshake, uint32_t* size)
+{
+	ImageStreamFECScheme scheme = (ImageStreamFECScheme)((handshake.type & ~IMAGESTREAM_HANDSHAKE_REPEAT) >> 4);
+	if (scheme != IMAGESTREAM_FEC_XOR && scheme != IMAGESTREAM_FEC_RS)
+	{
+		if (size) *size = handshake.size;
+		return ImageStreamFEC();
+	}
+	if (size) *size = handshake.size & 0xffffff;
+	return ImageStreamFEC(scheme, ((handshake.size >> 24) & 0x1f) + 1, (handshake.size >> 29) + 1);
+}
+
+void
+ImageStreamFEC::toHandshake(mavlink_data_transmission_handshake_t& handshake) const
+{
+	if (scheme == IMAGESTREAM_FEC_NONE)
+	{
+		return;
+	}
+	handshake.type = (handshake.type & 0x0f) | (scheme << 4);
+	handshake.size = (handshake.size & 0xffffff) | ((uint32_t)(k - 1) << 24) | ((uint32_t)(m - 1) << 29);
+}
+
+bool
+ImageStreamFEC::isJPEG(const mavlink_data_transmission_handshake_t& handshake)
+{
+	return (handshake.type & 0x0f) == DATA_TYPE_JPEG_IMAGE;
+}
+
+bool
+ImageStreamFEC::isTiles(const mavlink_data_transmission_handshake_t& handshake)
+{
+	return (handshake.type & 0x0f) == IMAGESTREAM_TYPE_TILES;
+}
+
+bool
+ImageStreamFEC::isRepeat(const mavlink_data_transmission_handshake_t& handshake)
+{
+	return (handshake.type & IMAGESTREAM_HANDSHAKE_REPEAT) != 0;
+}
+
+uint16_t
+ImageStreamFEC::getGroups(uint16_t packets) const
+{
+	return (scheme == IMAGESTREAM_FEC_NONE) ? 0 : (packets + k - 1) / k;
+}
+
+uint16_t
+ImageStreamFEC::getParityPackets(uint16_t packets) const
+{
+	return getGroups(packets) * m;
+}
+
+uint8_t
+ImageStreamFEC::coefficient(int row, int column) const
+{
+	if (scheme == IMAGESTREAM_FEC_XOR)
+	{
+		return 1;
+	}
+	// Cauchy matrix, any square submatrix of it is invertible
+	return gf().inv((IMAGESTREAM_FEC_MAX_DATA + row) ^ column);
+}
+
+void
+ImageStreamFEC::encode(const uint8_t* data, uint16_t packets, std::vector<uint8_t>& parity) const
+{
+	const uint16_t groups = getGroups(packets);
+	parity.assign((size_t)groups * m * IMAGESTREAM_PACKET_PAYLOAD, 0);
+
+	for (uint16_t g = 0; g < groups; ++g)
+	{
+		for (int j = 0; j < m; ++j)
+		{
+			uint8_t* out = &parity[((size_t)g * m + j) * IMAGESTREAM_PACKET_PAYLOAD];
+			int t = 0;
+			for (uint32_t i = g; i < packets; i += groups, ++t)
+			{
+				mulAdd(out, data + (size_t)i * IMAGESTREAM_PACKET_PAYLOAD, coefficient(j, t), IMAGESTREAM_PACKET_PAYLOAD);
+			}
+		}
+	}
+}
+
+bool
+ImageStreamFEC::isDecodable(uint16_t packets, const std::vector<bool>& received) const
+{
+	const uint16_t groups = getGroups(packets);
+
+	if (groups == 0)
+	{
+		for (uint16_t i = 0; i < packets; ++i)
+		{
+			if (!received[i]) return false;
+		}
+		return true;
+	}
+	for (uint16_t g = 0; g < groups; ++g)
+	{
+		int missing = 0;
+		for (uint32_t i = g; i < packets; i += groups)
+		{
+			if (!received[i]) ++missing;
+		}
+		for (int j = 0; j < m; ++j)
+		{
+			if (received[packets + g * m + j]) --missing;
+		}
+		if (missing > 0) return false;
+	}
+	return true;
+}
+
+int
+ImageStreamFEC::decode(uint8_t* data, uint16_t packets, const std::vector<bool>& received, const uint8_t* parity) const
+{
+	const uint16_t groups = getGroups(packets);
+	int rebuilt = 0;
+
+	if (!isDecodable(packets, received))
+	{
+		return -1;
+	}
+
+	for (uint16_t g = 0; g < groups; ++g)
+	{
+		// missing data packets of the group, by index in the group
+		int erased[IMAGESTREAM_FEC_MAX_PARITY];
+		int rows[IMAGESTREAM_FEC_MAX_PARITY];
+		int e = 0;
+		int t = 0;
+		for (uint32_t i = g; i < packets; i += groups, ++t)
+		{
+			if (!received[i]) erased[e++] = t;
+		}
+		if (e == 0) continue;
+
+		// the first e parity packets that arrived, syndromes computed in place
+		uint8_t syndromes[IMAGESTREAM_FEC_MAX_PARITY][IMAGESTREAM_PACKET_PAYLOAD];
+		int r = 0;
+		for (int j = 0; j < m && r < e; ++j)
+		{
+			if (!received[packets + g * m + j]) continue;
+			rows[r] = j;
+			memcpy(syndromes[r], parity + ((size_t)g * m + j) * IMAGESTREAM_PACKET_PAYLOAD, IMAGESTREAM_PACKET_PAYLOAD);
+			t = 0;
+			for (uint32_t i = g; i < packets; i += groups, ++t)
+			{
+				if (received[i])
+				{
+					mulAdd(syndromes[r], data + (size_t)i * IMAGESTREAM_PACKET_PAYLOAD, coefficient(j, t), IMAGESTREAM_PACKET_PAYLOAD);
+				}
+			}
+			++r;
+		}
+
+		// invert the e x e matrix of the erased columns, Gauss-Jordan
+		uint8_t a[IMAGESTREAM_FEC_MAX_PARITY][IMAGESTREAM_FEC_MAX_PARITY];
+		uint8_t b[IMAGESTREAM_FEC_MAX_PARITY][IMAGESTREAM_FEC_MAX_PARITY];
+		for (int row = 0; row < e; ++row)
+		{
+			for (int col = 0; col < e; ++col)
+			{
+				a[row][col] = coefficient(rows[row], erased[col]);
+				b[row][col] = (row == col);
+			}
+		}
+		for (int col = 0; col < e; ++col)
+		{
+			int pivot = col;
+			while (a[pivot][col] == 0) ++pivot;
+			if (pivot != col)
+			{
+				std::swap_ranges(a[pivot], a[pivot] + e, a[col]);
+				std::swap_ranges(b[pivot], b[pivot] + e, b[col]);
+			}
+			uint8_t scale = gf().inv(a[col][col]);
+			for (int c = 0; c < e; ++c)
+			{
+				a[col][c] = gf().mul(a[col][c], scale);
+				b[col][c] = gf().mul(b[col][c], scale);
+			}
+			for (int row = 0; row < e; ++row)
+			{
+				uint8_t f = a[row][col];
+				if (row == col || f == 0) continue;
+				for (int c = 0; c < e; ++c)
+				{
+					a[row][c] ^= gf().mul(f, a[col][c]);
+					b[row][c] ^= gf().mul(f, b[col][c]);
+				}
+			}
+		}
+
+		for (int x = 0; x < e; ++x)
+		{
+			uint8_t* out = data + ((size_t)g + (size_t)erased[x] * groups) * IMAGESTREAM_PACKET_PAYLOAD;
+			memset(out, 0, IMAGESTREAM_PACKET_PAYLOAD);
+			for (int row = 0; row < e; ++row)
+			{
+				mulAdd(out, syndromes[row], b[x][row], IMAGESTREAM_PACKET_PAYLOAD);
+			}
+			++rebuilt;
+		}
+	}
+	return rebuilt;
+}
+
+void
+ImageStreamFEC::pack(uint8_t sysid, uint8_t compid, std::vector<uint8_t>& jpg,
+					 mavlink_data_transmission_handshake_t& handshake,
+					 std::vector<mavlink_message_t>& packets, uint8_t type) const
+{
+	handshake.type = type;
+	handshake.size = static_cast<uint32_t>( jpg.size() );
+	handshake.packets = static_cast<uint16_t>( (jpg.size() + IMAGESTREAM_PACKET_PAYLOAD - 1) / IMAGESTREAM_PACKET_PAYLOAD );
+	handshake.payload = static_cast<uint8_t>( IMAGESTREAM_PACKET_PAYLOAD );
+	toHandshake(handshake);
+
+	// the last data packet is padded with zeros
+	jpg.resize((size_t)handshake.packets * IMAGESTREAM_PACKET_PAYLOAD, 0);
+	std::vector<uint8_t> parity;
+	encode(jpg.empty() ? NULL : &jpg[0], handshake.packets, parity);
+	const uint16_t parityPackets = parity.size() / IMAGESTREAM_PACKET_PAYLOAD;
+	const size_t repeat = (parityPackets > 0) ? 1 : 0;
+
+	packets.resize(1 + handshake.packets + repeat + parityPackets);
+	mavlink_msg_data_transmission_handshake_encode(sysid, compid, &packets[0], &handshake);
+	for (uint16_t i = 0; i < handshake.packets; ++i)
+	{
+		mavlink_msg_encapsulated_data_pack(sysid, compid, &packets[1 + i], i, &jpg[(size_t)i * IMAGESTREAM_PACKET_PAYLOAD]);
+	}
+	if (repeat)
+	{
+		mavlink_data_transmission_handshake_t again = handshake;
+		again.type |= IMAGESTREAM_HANDSHAKE_REPEAT;
+		mavlink_msg_data_transmission_handshake_encode(sysid, compid, &packets[1 + handshake.packets], &again);
+	}
+	for (uint16_t j = 0; j < parityPackets; ++j)
+	{
+		mavlink_msg_encapsulated_data_pack(sysid, compid, &packets[1 + handshake.packets + repeat + j],
+										   handshake.packets + j, &parity[(size_t)j * IMAGESTREAM_PACKET_PAYLOAD]);
+	}
+}
+
+}
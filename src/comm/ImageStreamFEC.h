@@ -0,0 +1,156 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Erasure coding of image stream packets.
+*
+*   The data packets of a frame are split into groups, packet i going to
+*   group i % groups so that a burst of losses hits many groups once
+*   instead of one group many times. Every group of up to k data packets
+*   gets m parity packets, which are sent after all data packets with the
+*   sequence numbers following them. A group can be rebuilt from any k of
+*   its packets with Reed-Solomon, or from all but one with XOR parity
+*   (m is always 1 then).
+*
+*   The handshake keeps announcing the data packets only, the scheme is
+*   carried in the upper bits of its type and k and m in the otherwise
+*   unused upper byte of its size:
+*
+*     type = DATA_TYPE_JPEG_IMAGE | scheme << 4
+*     size = JPEG bytes | (k - 1) << 24 | (m - 1) << 29
+*
+*   Receivers that do not know the scheme see an unknown type and ignore
+*   the frame. Without FEC the handshake is unchanged.
+*
+*   A lost handshake would lose the frame however many parity packets
+*   arrive, so with FEC it is sent a second time after the data packets,
+*   with IMAGESTREAM_HANDSHAKE_REPEAT set in its type.
+*
+*/
+
+#ifndef IMAGESTREAMFEC_H
+#define IMAGESTREAMFEC_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <pixhawk/mavlink.h>
+
+#define IMAGESTREAM_PACKET_PAYLOAD	253	///< bytes of image data per ENCAPSULATED_DATA packet
+#define IMAGESTREAM_FEC_MAX_DATA	32	///< k, data packets per group
+#define IMAGESTREAM_FEC_MAX_PARITY	8	///< m, parity packets per group
+#define IMAGESTREAM_TYPE_TILES		8	///< handshake type of a tile frame, see ImageStreamTiles.h
+#define IMAGESTREAM_HANDSHAKE_REPEAT	0x80	///< handshake type flag of the repeated handshake
+
+namespace px
+{
+
+enum ImageStreamFECScheme
+{
+	IMAGESTREAM_FEC_NONE = 0,
+	IMAGESTREAM_FEC_XOR = 1,	///< One XOR parity packet per group
+	IMAGESTREAM_FEC_RS = 2		///< Reed-Solomon over GF(256), m parity packets per group
+};
+
+class ImageStreamFEC
+{
+public:
+	ImageStreamFEC(ImageStreamFECScheme scheme = IMAGESTREAM_FEC_NONE, int k = 1, int m = 1);
+
+	/**
+	 * Choose k and m for an overhead ratio m/k. For Reed-Solomon m is
+	 * derived from the group size k, for XOR k is derived from the ratio.
+	 */
+	static ImageStreamFEC fromOverhead(ImageStreamFECScheme scheme, float overhead, int k = 16);
+
+	/** @return the FEC announced by a handshake and its JPEG size */
+	static ImageStreamFEC fromHandshake(const mavlink_data_transmission_handshake_t& handshake, uint32_t* size = 0);
+
+	/** @brief Announce this FEC in a handshake, size has to be set before */
+	void toHandshake(mavlink_data_transmission_handshake_t& handshake) const;
+
+	/** @return whether the handshake type is DATA_TYPE_JPEG_IMAGE, with or without FEC */
+	static bool isJPEG(const mavlink_data_transmission_handshake_t& handshake);
+
+	/** @return whether the handshake type is IMAGESTREAM_TYPE_TILES, with or without FEC */
+	static bool isTiles(const mavlink_data_transmission_handshake_t& handshake);
+
+	/** @return whether this is the handshake repeated after the data packets */
+	static bool isRepeat(const mavlink_data_transmission_handshake_t& handshake);
+
+	ImageStreamFECScheme getScheme(void) const { return scheme; }
+	int getDataPerGroup(void) const { return k; }
+	int getParityPerGroup(void) const { return m; }
+
+	/** @return the number of groups the data packets of a frame are split into */
+	uint16_t getGroups(uint16_t packets) const;
+	uint16_t getParityPackets(uint16_t packets) const;
+
+	/**
+	 * Compute the parity packets of a frame.
+	 *
+	 * @param data packets * IMAGESTREAM_PACKET_PAYLOAD bytes, zero padded
+	 * @param parity resized to getParityPackets(packets) * IMAGESTREAM_PACKET_PAYLOAD bytes
+	 */
+	void encode(const uint8_t* data, uint16_t packets, std::vector<uint8_t>& parity) const;
+
+	/**
+	 * Rebuild the missing data packets of a frame.
+	 *
+	 * @param data packets * IMAGESTREAM_PACKET_PAYLOAD bytes, missing packets are filled in
+	 * @param received one flag per data packet followed by one per parity packet
+	 * @param parity the parity packets as received
+	 * @return the number of data packets rebuilt, -1 if a group has too few packets
+	 */
+	int decode(uint8_t* data, uint16_t packets, const std::vector<bool>& received, const uint8_t* parity) const;
+
+	/** @return whether decode() would succeed with the given packets */
+	bool isDecodable(uint16_t packets, const std::vector<bool>& received) const;
+
+	/**
+	 * Split a JPEG image into a handshake, the data packets, the repeated
+	 * handshake and the parity packets of this FEC, in the order they are
+	 * sent. Without FEC there is no repeat and no parity.
+	 *
+	 * @param jpg the image, zero padded to whole packets on return
+	 * @param handshake width, height and jpg_quality have to be set, the
+	 *        other fields are filled in
+	 * @param type announced in the handshake, IMAGESTREAM_TYPE_TILES for a tile frame
+	 */
+	void pack(uint8_t sysid, uint8_t compid, std::vector<uint8_t>& jpg,
+			  mavlink_data_transmission_handshake_t& handshake,
+			  std::vector<mavlink_message_t>& packets,
+			  uint8_t type = DATA_TYPE_JPEG_IMAGE) const;
+
+protected:
+	uint8_t coefficient(int row, int column) const;
+
+	ImageStreamFECScheme scheme;
+	int k;
+	int m;
+};
+
+}
+
+#endif
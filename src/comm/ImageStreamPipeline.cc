@@ -0,0 +1,397 @@
+#include "ImageStreamPipeline.h"
+#include "ImageStreamRateController.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#define PACKETS_PER_BATCH	16	///< ENCAPSULATED_DATA packets published at once
+
+namespace px
+{
+
+static uint64_t
+monotonicUsecs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool
+isHandshake(const mavlink_message_t& msg)
+{
+	return msg.msgid == MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE;
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+ : rate(rate)
+ , burst(burst)
+ , tokens(burst)
+ , last(monotonicUsecs())
+{
+
+}
+
+void
+TokenBucket::setRate(double rate)
+{
+	refill();
+	this->rate = rate;
+}
+
+void
+TokenBucket::refill(void)
+{
+	uint64_t now = monotonicUsecs();
+	tokens = std::min(burst, tokens + rate * (now - last) / 1e6);
+	last = now;
+}
+
+uint64_t
+TokenBucket::take(size_t bytes)
+{
+	if (rate <= 0.0)
+	{
+		return 0;
+	}
+
+	refill();
+	// a request larger than the burst is granted once the bucket is full
+	double needed = std::min((double)bytes, burst);
+	if (tokens >= needed)
+	{
+		tokens -= bytes;
+		return 0;
+	}
+	return (uint64_t)((needed - tokens) / rate * 1e6) + 1;
+}
+
+ImageStreamPipeline::ImageStreamPipeline(lcm_t* lcm, int sysid, int compid, double linkRate, bool verbose)
+ : lcm(lcm)
+ , sysid(sysid)
+ , compid(compid)
+ , linkRate(linkRate)
+ , verbose(verbose)
+ , running(false)
+ , encodeThread(NULL)
+ , sendThread(NULL)
+ , hasRaw(false)
+ , rawSubmitted(0)
+ , hasFrame(false)
+ , lastAccepted(0)
+ , bucket(0.0, PACKETS_PER_BATCH * MAVLINK_MAX_PACKET_LEN)
+ , controller(NULL)
+{
+	if (!g_thread_supported())
+	{
+		g_thread_init(NULL);
+	}
+	mutex = g_mutex_new();
+	rawCond = g_cond_new();
+	frameCond = g_cond_new();
+	memset(&stats, 0, sizeof(stats));
+}
+
+ImageStreamPipeline::~ImageStreamPipeline()
+{
+	stop();
+	g_cond_free(frameCond);
+	g_cond_free(rawCond);
+	g_mutex_free(mutex);
+}
+
+bool
+ImageStreamPipeline::start(void)
+{
+	GError* err = NULL;
+
+	running = true;
+	encodeThread = g_thread_create((GThreadFunc)encodeLoop, this, TRUE, &err);
+	if (encodeThread)
+	{
+		sendThread = g_thread_create((GThreadFunc)sendLoop, this, TRUE, &err);
+	}
+	if (!sendThread)
+	{
+		fprintf(stderr, "# ERROR: Thread create for image stream failed: %s\n", err->message);
+		g_error_free(err);
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void
+ImageStreamPipeline::stop(void)
+{
+	g_mutex_lock(mutex);
+	running = false;
+	g_cond_broadcast(rawCond);
+	g_cond_broadcast(frameCond);
+	g_mutex_unlock(mutex);
+
+	if (encodeThread) g_thread_join(encodeThread);
+	if (sendThread) g_thread_join(sendThread);
+	encodeThread = NULL;
+	sendThread = NULL;
+}
+
+bool
+ImageStreamPipeline::isDue(float interval) const
+{
+	g_mutex_lock(mutex);
+	bool due = lastAccepted == 0 || monotonicUsecs() - lastAccepted >= (uint64_t)(interval * 1e6);
+	g_mutex_unlock(mutex);
+	return due;
+}
+
+void
+ImageStreamPipeline::submit(const cv::Mat& img, const ImageStreamSettings& settings)
+{
+	g_mutex_lock(mutex);
+	if (hasRaw)
+	{
+		++stats.superseded;
+	}
+	raw = img;
+	rawSettings = settings;
+	hasRaw = true;
+	lastAccepted = monotonicUsecs();
+	rawSubmitted = lastAccepted;
+	++stats.submitted;
+	g_cond_signal(rawCond);
+	g_mutex_unlock(mutex);
+}
+
+void
+ImageStreamPipeline::setLinkRate(double rate)
+{
+	g_mutex_lock(mutex);
+	linkRate = rate;
+	g_mutex_unlock(mutex);
+}
+
+void
+ImageStreamPipeline::setRateController(ImageStreamRateController* controller)
+{
+	g_mutex_lock(mutex);
+	this->controller = controller;
+	g_mutex_unlock(mutex);
+}
+
+ImageStreamStats
+ImageStreamPipeline::getStats(void) const
+{
+	g_mutex_lock(mutex);
+	ImageStreamStats s = stats;
+	g_mutex_unlock(mutex);
+	return s;
+}
+
+void
+ImageStreamPipeline::encode(const cv::Mat& img, const ImageStreamSettings& settings, Frame& frame)
+{
+	// Check for valid jpg_quality in request and adjust if necessary
+	int quality = (settings.jpegQuality < 1 || settings.jpegQuality > 100) ? 60 : settings.jpegQuality;
+
+	// Encode image as JPEG
+	std::vector<uint8_t> jpg; ///< container for JPEG image data
+	std::vector<int> p(4); ///< params for cv::imencode. Sets the JPEG quality.
+	p[0] = CV_IMWRITE_JPEG_QUALITY;
+	p[1] = quality;
+	p[2] = 4; //CV_IMWRITE_JPEG_RST_INTERVAL
+	p[3] = 7500;
+	cv::Mat scaled = img;
+	if (settings.scale > 0.0f && settings.scale < 1.0f)
+	{
+		cv::resize(img, scaled, cv::Size(), settings.scale, settings.scale, CV_INTER_AREA);
+	}
+	mavlink_data_transmission_handshake_t ack;
+	memset(&ack, 0, sizeof(ack));
+	ack.jpg_quality = quality;
+	if (settings.tileSize > 0)
+	{
+		// The receiver places the tiles by the exact image size
+		tileEncoder.setup(settings.tileSize, settings.tileThreshold, settings.tileRefresh);
+		tileEncoder.encode(scaled, quality, jpg, frame.tiles);
+		frame.image = scaled;
+		ack.width = scaled.cols;
+		ack.height = scaled.rows;
+	}
+	else
+	{
+		cv::imencode(".jpg", scaled, jpg, p);
+		frame.image = cv::Mat();
+		frame.tiles.clear();
+		ack.width = (settings.scale < 1.0f) ? (uint16_t)(settings.width * settings.scale + 0.5f) : settings.width;
+		ack.height = (settings.scale < 1.0f) ? (uint16_t)(settings.height * settings.scale + 0.5f) : settings.height;
+	}
+
+	g_mutex_lock(mutex);
+	ImageStreamRateController* rateController = controller;
+	g_mutex_unlock(mutex);
+	if (rateController)
+	{
+		// Per pixel of the whole image, tile frames included
+		rateController->onFrameEncoded(jpg.size(), quality, scaled.rows * scaled.cols);
+	}
+
+	// Parity packets continue the sequence numbers of the data packets
+	settings.fec.pack(sysid, compid, jpg, ack, frame.packets,
+					  (settings.tileSize > 0) ? IMAGESTREAM_TYPE_TILES : DATA_TYPE_JPEG_IMAGE);
+
+	frame.bytes = 0;
+	for (size_t i = 0; i < frame.packets.size(); ++i)
+	{
+		frame.bytes += MAVLINK_NUM_NON_PAYLOAD_BYTES + frame.packets[i].len;
+	}
+	frame.copies = std::max(settings.copies, 1);
+	frame.interval = settings.interval;
+}
+
+void*
+ImageStreamPipeline::encodeLoop(void* data)
+{
+	ImageStreamPipeline* self = static_cast<ImageStreamPipeline*>(data);
+	cv::Mat img;
+	ImageStreamSettings settings;
+	Frame frame;
+
+	g_mutex_lock(self->mutex);
+	while (self->running)
+	{
+		if (!self->hasRaw)
+		{
+			g_cond_wait(self->rawCond, self->mutex);
+			continue;
+		}
+		img = self->raw;
+		self->raw = cv::Mat();
+		settings = self->rawSettings;
+		frame.submitted = self->rawSubmitted;
+		self->hasRaw = false;
+		g_mutex_unlock(self->mutex);
+
+		self->encode(img, settings, frame);
+		img = cv::Mat();
+
+		g_mutex_lock(self->mutex);
+		++self->stats.encoded;
+		if (self->hasFrame)
+		{
+			++self->stats.superseded;
+		}
+		// keeps the packet buffer of the replaced frame for the next one
+		std::swap(self->frame, frame);
+		self->hasFrame = true;
+		g_cond_signal(self->frameCond);
+	}
+	g_mutex_unlock(self->mutex);
+	return NULL;
+}
+
+void
+ImageStreamPipeline::send(const Frame& frame)
+{
+	if (verbose) printf("there are %02d packets waiting to be sent (%05d bytes). start sending...\n",
+						(int)frame.packets.size() - 1, (int)frame.bytes);
+
+	// The handshakes are only sent with the first copy, so the receiver
+	// knows a repeated handshake after a copy began is of the next frame
+	for (int k = 0; k < frame.copies; ++k)
+	{
+		size_t count;
+		for (size_t i = 0; i < frame.packets.size(); i += count)
+		{
+			if (k > 0 && isHandshake(frame.packets[i]))
+			{
+				count = 1;
+				continue;
+			}
+			count = std::min((size_t)PACKETS_PER_BATCH, frame.packets.size() - i);
+			for (size_t j = i + 1; j < i + count; ++j)
+			{
+				if (isHandshake(frame.packets[j]))
+				{
+					count = j - i;
+					break;
+				}
+			}
+			size_t bytes = 0;
+			for (size_t j = i; j < i + count; ++j)
+			{
+				bytes += MAVLINK_NUM_NON_PAYLOAD_BYTES + frame.packets[j].len;
+			}
+
+			uint64_t wait;
+			while ((wait = bucket.take(bytes)) > 0)
+			{
+				// Wake up regularly to notice stop()
+				if (!running) return;
+				g_usleep(std::min(wait, (uint64_t)100000));
+			}
+
+			sendMAVLinkMessages(lcm, &frame.packets[i], count);
+
+			g_mutex_lock(mutex);
+			stats.bytes += bytes;
+			g_mutex_unlock(mutex);
+		}
+		if (verbose) printf("sent %02d packets (copy %d) at %.0f bytes/s\n",
+							(int)frame.packets.size() - 1, k, bucket.getRate());
+	}
+
+	g_mutex_lock(mutex);
+	++stats.sent;
+	ImageStreamRateController* rateController = controller;
+	g_mutex_unlock(mutex);
+	if (rateController)
+	{
+		rateController->onFrameSent(frame.bytes * frame.copies, (monotonicUsecs() - frame.submitted) / 1e6);
+	}
+}
+
+void*
+ImageStreamPipeline::sendLoop(void* data)
+{
+	ImageStreamPipeline* self = static_cast<ImageStreamPipeline*>(data);
+	Frame frame;
+
+	g_mutex_lock(self->mutex);
+	while (self->running)
+	{
+		if (!self->hasFrame)
+		{
+			g_cond_wait(self->frameCond, self->mutex);
+			continue;
+		}
+		std::swap(self->frame, frame);
+		self->hasFrame = false;
+		double rate = self->linkRate;
+		g_mutex_unlock(self->mutex);
+
+		// Frames encoded from now on only send what changed since this one
+		if (!frame.tiles.empty())
+		{
+			self->tileEncoder.commit(frame.image, frame.tiles);
+		}
+
+		// Without a link rate spread the frame over 1/1.2 of its interval
+		if (rate <= 0.0 && frame.interval > 0.0f)
+		{
+			rate = 1.2 * frame.bytes * frame.copies / frame.interval;
+		}
+		self->bucket.setRate(rate);
+		self->send(frame);
+
+		g_mutex_lock(self->mutex);
+	}
+	g_mutex_unlock(self->mutex);
+	return NULL;
+}
+
+}
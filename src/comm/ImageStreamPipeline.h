@@ -0,0 +1,209 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Encoding and paced transmission of images over MAVLink.
+*
+*   Three stages, each handing over to the next through a single slot:
+*   the caller submits the latest raw frame, an encoder thread turns it
+*   into a DATA_TRANSMISSION_HANDSHAKE followed by ENCAPSULATED_DATA
+*   packets, parity packets included if FEC is enabled, and a sender
+*   thread publishes these as fast as a token bucket at the link rate
+*   allows. A frame still waiting in a slot is replaced by a
+*   newer one, so a slow link sends fewer but always recent frames. A
+*   frame the sender has started on is always sent completely. In tile
+*   mode only the tiles that changed since the last frame sent are
+*   encoded, see ImageStreamTiles.h.
+*
+*/
+
+#ifndef IMAGESTREAMPIPELINE_H
+#define IMAGESTREAMPIPELINE_H
+
+#include <stdint.h>
+#include <vector>
+#include <glib.h>
+#include <opencv2/core/core.hpp>
+
+#include "mavconn.h"
+#include "ImageStreamFEC.h"
+#include "ImageStreamTiles.h"
+
+namespace px
+{
+
+class ImageStreamRateController;
+
+/**
+ * @brief Byte rate limiter, allows bursts of up to one batch
+ */
+class TokenBucket
+{
+public:
+	/**
+	 * @param rate bytes per second, 0 for no limit
+	 * @param burst bytes that may be sent at once after an idle period
+	 */
+	TokenBucket(double rate = 0.0, double burst = 0.0);
+
+	void setRate(double rate);
+	double getRate(void) const { return rate; }
+
+	/**
+	 * Take bytes from the bucket if it holds enough.
+	 *
+	 * @return 0 if the bytes were taken, otherwise the microseconds until
+	 *         the bucket will hold enough
+	 */
+	uint64_t take(size_t bytes);
+
+private:
+	void refill(void);
+
+	double rate;
+	double burst;
+	double tokens;
+	uint64_t last;	///< microseconds, CLOCK_MONOTONIC
+};
+
+/**
+ * @brief Encoder settings of a submitted frame
+ */
+struct ImageStreamSettings
+{
+	ImageStreamSettings() :
+		jpegQuality(60), width(0), height(0), copies(1), scale(1.0f), interval(1.0f),
+		tileSize(0), tileThreshold(3.0f), tileRefresh(30) {}
+
+	int jpegQuality;	///< 1-100
+	uint16_t width;		///< announced in the handshake, before scaling
+	uint16_t height;	///< announced in the handshake, before scaling
+	int copies;			///< times every packet is sent
+	ImageStreamFEC fec;	///< parity packets added to every frame
+	float scale;		///< the image is resized by this factor before encoding
+	float interval;		///< seconds between frames, paces the sender if no link rate is set
+	int tileSize;		///< 0 sends whole frames, otherwise only the tiles that changed
+	float tileThreshold;	///< mean difference per byte of a changed tile
+	int tileRefresh;	///< frames until every tile was sent once, 0 for never
+};
+
+/**
+ * @brief Counters of an ImageStreamPipeline
+ */
+struct ImageStreamStats
+{
+	uint64_t submitted;		///< raw frames handed to the encoder
+	uint64_t encoded;		///< frames encoded
+	uint64_t sent;			///< frames sent completely
+	uint64_t superseded;	///< frames replaced by a newer one before being sent
+	uint64_t bytes;			///< bytes sent, MAVLink framing included
+};
+
+class ImageStreamPipeline
+{
+public:
+	/**
+	 * @param lcm instance the packets are published on
+	 * @param linkRate bytes per second the sender may use, 0 to spread
+	 *        every frame over its interval instead
+	 */
+	ImageStreamPipeline(lcm_t* lcm, int sysid, int compid, double linkRate = 0.0, bool verbose = false);
+	~ImageStreamPipeline();
+
+	bool start(void);
+	void stop(void);
+
+	/**
+	 * Whether a frame submitted now would be due, i.e. at least interval
+	 * seconds passed since the last accepted one.
+	 */
+	bool isDue(float interval) const;
+
+	/**
+	 * Hand over a frame to the encoder, replacing one it has not started
+	 * on yet. Only takes a reference, so the caller must not write to img
+	 * afterwards.
+	 */
+	void submit(const cv::Mat& img, const ImageStreamSettings& settings);
+
+	void setLinkRate(double rate);
+
+	/** @brief Report encoded and sent frames to controller, NULL to stop */
+	void setRateController(ImageStreamRateController* controller);
+
+	ImageStreamStats getStats(void) const;
+
+protected:
+	/** @brief An encoded frame, ready to be sent */
+	struct Frame
+	{
+		std::vector<mavlink_message_t> packets;	///< handshake first
+		size_t bytes;							///< on the wire, per copy
+		int copies;
+		float interval;
+		uint64_t submitted;						///< microseconds, CLOCK_MONOTONIC
+		cv::Mat image;							///< tile frames only, the image encoded
+		std::vector<uint16_t> tiles;			///< tile frames only, the tiles sent
+	};
+
+	static void* encodeLoop(void* data);
+	static void* sendLoop(void* data);
+
+	void encode(const cv::Mat& img, const ImageStreamSettings& settings, Frame& frame);
+	void send(const Frame& frame);
+
+	lcm_t* lcm;
+	int sysid;
+	int compid;
+	double linkRate;
+	bool verbose;
+	volatile bool running;
+
+	GMutex* mutex;			///< Protects the slots, the counters and linkRate
+	GCond* rawCond;			///< Signalled when a raw frame is submitted
+	GCond* frameCond;		///< Signalled when a frame is encoded
+	GThread* encodeThread;
+	GThread* sendThread;
+
+	bool hasRaw;
+	cv::Mat raw;
+	ImageStreamSettings rawSettings;
+	uint64_t rawSubmitted;	///< microseconds, CLOCK_MONOTONIC
+	bool hasFrame;
+	Frame frame;
+
+	uint64_t lastAccepted;	///< microseconds, CLOCK_MONOTONIC
+	ImageStreamStats stats;
+	TokenBucket bucket;		///< Only used by the sender thread
+	ImageStreamTileEncoder tileEncoder;
+	ImageStreamRateController* controller;
+
+private:
+	ImageStreamPipeline(const ImageStreamPipeline&);
+	ImageStreamPipeline& operator=(const ImageStreamPipeline&);
+};
+
+}
+
+#endif
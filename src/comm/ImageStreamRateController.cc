@@ -0,0 +1,145 @@
+#include "ImageStreamRateController.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#define QUALITY_FLOOR		40		///< lowest quality before the resolution is reduced
+#define QUALITY_MIN			15		///< lowest quality at the smallest scale
+#define TXBUF_CONGESTED		40		///< % free in the radio buffer below which the rate is lowered
+#define TXBUF_IDLE			80		///< % free in the radio buffer above which the rate is raised
+
+namespace px
+{
+
+static const float kScales[] = { 1.0f, 0.75f, 0.5f, 0.25f };
+static const int kScaleCount = sizeof(kScales) / sizeof(kScales[0]);
+
+ImageStreamRateController::ImageStreamRateController(double targetRate, float maxLatency, bool verbose)
+ : targetRate(targetRate)
+ , maxLatency(maxLatency)
+ , verbose(verbose)
+ , rate(targetRate)
+ , bytesPerPixel(0.0)
+{
+	if (!g_thread_supported())
+	{
+		g_thread_init(NULL);
+	}
+	mutex = g_mutex_new();
+}
+
+ImageStreamRateController::~ImageStreamRateController()
+{
+	g_mutex_free(mutex);
+}
+
+double
+ImageStreamRateController::qualityCurve(int quality)
+{
+	// JPEG size grows about 3x from quality 50 to 90
+	return exp(0.03 * quality);
+}
+
+double
+ImageStreamRateController::getRate(void) const
+{
+	g_mutex_lock(mutex);
+	double r = rate;
+	g_mutex_unlock(mutex);
+	return r;
+}
+
+void
+ImageStreamRateController::adjust(ImageStreamSettings& settings, int width, int height, float fixedScale)
+{
+	g_mutex_lock(mutex);
+	double linkRate = rate;
+	double k = bytesPerPixel;
+	g_mutex_unlock(mutex);
+
+	int maxQuality = (settings.jpegQuality < 1 || settings.jpegQuality > 100) ? 60 : settings.jpegQuality;
+	float interval = (settings.interval > 0.0f) ? settings.interval : 1.0f;
+	settings.scale = (fixedScale > 0.0f) ? fixedScale : 1.0f;
+	if (k <= 0.0 || linkRate <= 0.0)
+	{
+		// Nothing to predict from before the first frame
+		return;
+	}
+
+	double budget = linkRate * std::min(interval, maxLatency);
+	// Only the quality and the interval are left to choose at a fixed scale
+	const float* scales = (fixedScale > 0.0f) ? &fixedScale : kScales;
+	int scaleCount = (fixedScale > 0.0f) ? 1 : kScaleCount;
+	int quality = QUALITY_MIN;
+	float scale = scales[scaleCount - 1];
+	for (int i = 0; i < scaleCount; ++i)
+	{
+		double pixels = (double)width * height * scales[i] * scales[i];
+		int q = (int)floor(log(budget / (k * pixels)) / 0.03);
+		if (q >= QUALITY_FLOOR || (i == scaleCount - 1 && q >= QUALITY_MIN))
+		{
+			quality = std::min(q, maxQuality);
+			scale = scales[i];
+			break;
+		}
+	}
+
+	// Even the smallest frame does not fit, send less often
+	double predicted = k * qualityCurve(quality) * width * height * scale * scale;
+	if (predicted > budget)
+	{
+		interval = std::max(interval, (float)(predicted / linkRate));
+	}
+
+	if (verbose && (quality != settings.jpegQuality || interval != settings.interval || scale != settings.scale))
+	{
+		printf("# INFO: %.0f bytes/s: quality %d, scale %.2f, every %.2f s, %.0f bytes predicted\n",
+			   linkRate, quality, scale, interval, predicted);
+	}
+	settings.jpegQuality = quality;
+	settings.scale = scale;
+	settings.interval = interval;
+}
+
+void
+ImageStreamRateController::onFrameEncoded(size_t bytes, int quality, int pixels)
+{
+	if (pixels <= 0)
+	{
+		return;
+	}
+	double sample = bytes / (pixels * qualityCurve(quality));
+
+	g_mutex_lock(mutex);
+	bytesPerPixel = (bytesPerPixel > 0.0) ? 0.7 * bytesPerPixel + 0.3 * sample : sample;
+	g_mutex_unlock(mutex);
+}
+
+void
+ImageStreamRateController::onFrameSent(size_t bytes, double seconds)
+{
+	g_mutex_lock(mutex);
+	if (seconds > 1.2 * maxLatency)
+	{
+		rate = std::max(0.05 * targetRate, 0.9 * rate);
+	}
+	g_mutex_unlock(mutex);
+}
+
+void
+ImageStreamRateController::onRadioStatus(const mavlink_radio_status_t& status)
+{
+	g_mutex_lock(mutex);
+	if (status.txbuf < TXBUF_CONGESTED)
+	{
+		rate = std::max(0.05 * targetRate, 0.8 * rate);
+	}
+	else if (status.txbuf > TXBUF_IDLE)
+	{
+		rate = std::min(targetRate, rate + 0.05 * targetRate);
+	}
+	g_mutex_unlock(mutex);
+}
+
+}
@@ -0,0 +1,107 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Adapts image stream quality, resolution and frame rate to the link.
+*
+*   The controller keeps an estimate of the byte rate the link carries,
+*   starting at the target rate. RADIO_STATUS messages of a SiK type
+*   radio lower it multiplicatively when the transmit buffer of the radio
+*   fills up, or when the measured send time of frames exceeds the
+*   latency target, and raise it additively towards the target while the
+*   buffer stays empty.
+*
+*   Losses on the downlink are not estimated. The rxerrors counter of
+*   RADIO_STATUS counts packets the local radio failed to receive, i.e.
+*   uplink losses, and nothing reports the downlink back. Lost image
+*   packets only show up as far as they cause congestion, so links that
+*   lose packets need FEC, see ImageStreamFEC.h.
+*
+*   Each frame gets a budget of rate * min(interval, latency) bytes. The
+*   size of the next frame is predicted from the recent frames, as bytes
+*   per pixel scaled by a fixed curve over the JPEG quality, and the
+*   highest quality and resolution predicted to fit are chosen. Below the
+*   lowest quality at the smallest scale the frame interval is stretched.
+*
+*/
+
+#ifndef IMAGESTREAMRATECONTROLLER_H
+#define IMAGESTREAMRATECONTROLLER_H
+
+#include <stdint.h>
+#include <glib.h>
+
+#include <pixhawk/mavlink.h>
+
+#include "ImageStreamPipeline.h"
+
+namespace px
+{
+
+class ImageStreamRateController
+{
+public:
+	/**
+	 * @param targetRate bytes per second the stream may use at most
+	 * @param maxLatency seconds a frame may take on the link
+	 */
+	ImageStreamRateController(double targetRate, float maxLatency, bool verbose = false);
+	~ImageStreamRateController();
+
+	/**
+	 * Choose quality, scale and interval for the next frame. The quality
+	 * and interval requested are taken as the best quality and the
+	 * shortest interval wanted.
+	 *
+	 * @param fixedScale if positive, the scale the frame has to be sent
+	 *        at, e.g. 1 for tiles; only quality and interval are chosen
+	 */
+	void adjust(ImageStreamSettings& settings, int width, int height, float fixedScale = 0.0f);
+
+	/** @return the current estimate of the link rate, bytes per second */
+	double getRate(void) const;
+
+	/** @brief A frame was encoded, from the encoder thread */
+	void onFrameEncoded(size_t bytes, int quality, int pixels);
+
+	/** @brief A frame was sent, seconds between its submission and its last packet */
+	void onFrameSent(size_t bytes, double seconds);
+
+	void onRadioStatus(const mavlink_radio_status_t& status);
+
+protected:
+	static double qualityCurve(int quality);
+
+	double targetRate;
+	float maxLatency;
+	bool verbose;
+
+	GMutex* mutex;
+	double rate;			///< current estimate of the link rate
+	double bytesPerPixel;	///< at qualityCurve() == 1, averaged
+};
+
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "ImageStreamReassembler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define REASSEMBLER_MAX_KEPT	4096	///< packets kept for a frame whose handshake was lost
+
+namespace px
+{
+
+ImageStreamReassembler::ImageStreamReassembler()
+ : size(0)
+ , active(false)
+ , missing(0)
+ , arrived(0)
+ , known(false)
+ , sequenced(false)
+ , lastSeqnr(0)
+ , restarted(false)
+{
+	memset(&handshake, 0, sizeof(handshake));
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool
+ImageStreamReassembler::handleMessage(const mavlink_message_t* msg, std::vector<uint8_t>& jpg)
+{
+	if (msg->msgid == MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE)
+	{
+		mavlink_data_transmission_handshake_t hs;
+		mavlink_msg_data_transmission_handshake_decode(msg, &hs);
+		if (ImageStreamFEC::isRepeat(hs))
+		{
+			return repeat(hs, jpg);
+		}
+		begin(hs);
+		return false;
+	}
+	if (msg->msgid == MAVLINK_MSG_ID_ENCAPSULATED_DATA)
+	{
+		mavlink_encapsulated_data_t packet;
+		mavlink_msg_encapsulated_data_decode(msg, &packet);
+
+		// A copy or the next frame begins
+		if (sequenced && packet.seqnr <= lastSeqnr)
+		{
+			restarted = true;
+			keptSeqnrs.clear();
+			kept.clear();
+		}
+		sequenced = true;
+		lastSeqnr = packet.seqnr;
+		if (keptSeqnrs.size() < REASSEMBLER_MAX_KEPT)
+		{
+			keptSeqnrs.push_back(packet.seqnr);
+			kept.insert(kept.end(), packet.data, packet.data + IMAGESTREAM_PACKET_PAYLOAD);
+		}
+		return addPacket(packet.seqnr, packet.data, jpg);
+	}
+	return false;
+}
+
+bool
+ImageStreamReassembler::repeat(mavlink_data_transmission_handshake_t hs, std::vector<uint8_t>& jpg)
+{
+	hs.type &= ~IMAGESTREAM_HANDSHAKE_REPEAT;
+	if (known && !restarted && memcmp(&hs, &handshake, sizeof(hs)) == 0)
+	{
+		keptSeqnrs.clear();
+		kept.clear();
+		return false;
+	}
+
+	// The first handshake was lost, start the frame with the packets since
+	std::vector<uint16_t> seqnrs;
+	std::vector<uint8_t> packets;
+	seqnrs.swap(keptSeqnrs);
+	packets.swap(kept);
+	begin(hs);
+	++stats.late;
+
+	bool done = false;
+	for (size_t i = 0; i < seqnrs.size(); ++i)
+	{
+		done = addPacket(seqnrs[i], &packets[i * IMAGESTREAM_PACKET_PAYLOAD], jpg) || done;
+	}
+	sequenced = !seqnrs.empty();
+	lastSeqnr = sequenced ? seqnrs.back() : 0;
+
+	// keeps the buffers for the next frame
+	seqnrs.clear();
+	packets.clear();
+	seqnrs.swap(keptSeqnrs);
+	packets.swap(kept);
+	return done;
+}
+
+void
+ImageStreamReassembler::begin(const mavlink_data_transmission_handshake_t& hs)
+{
+	if (active)
+	{
+		++stats.incomplete;
+	}
+	++stats.frames;
+
+	handshake = hs;
+	known = true;
+	sequenced = false;
+	restarted = false;
+	keptSeqnrs.clear();
+	kept.clear();
+	active = (ImageStreamFEC::isJPEG(hs) || ImageStreamFEC::isTiles(hs)) && hs.packets > 0;
+	if (!active)
+	{
+		return;
+	}
+
+	fec = ImageStreamFEC::fromHandshake(hs, &size);
+	const uint16_t parityPackets = fec.getParityPackets(hs.packets);
+	data.assign((size_t)hs.packets * IMAGESTREAM_PACKET_PAYLOAD, 0);
+	parity.assign((size_t)parityPackets * IMAGESTREAM_PACKET_PAYLOAD, 0);
+	received.assign(hs.packets + parityPackets, false);
+	missing = hs.packets;
+	arrived = 0;
+}
+
+bool
+ImageStreamReassembler::addPacket(uint16_t seqnr, const uint8_t* packet, std::vector<uint8_t>& jpg)
+{
+	if (!active || seqnr >= received.size() || received[seqnr])
+	{
+		return false;
+	}
+
+	received[seqnr] = true;
+	++arrived;
+	if (seqnr < handshake.packets)
+	{
+		memcpy(&data[(size_t)seqnr * IMAGESTREAM_PACKET_PAYLOAD], packet, IMAGESTREAM_PACKET_PAYLOAD);
+		--missing;
+	}
+	else
+	{
+		memcpy(&parity[(size_t)(seqnr - handshake.packets) * IMAGESTREAM_PACKET_PAYLOAD], packet, IMAGESTREAM_PACKET_PAYLOAD);
+	}
+
+	if (missing == 0)
+	{
+		return complete(jpg);
+	}
+	// Rebuilding needs at least as many packets as there is data
+	if (arrived >= handshake.packets && fec.isDecodable(handshake.packets, received))
+	{
+		int rebuilt = fec.decode(&data[0], handshake.packets, received, parity.empty() ? NULL : &parity[0]);
+		if (rebuilt > 0)
+		{
+			++stats.recovered;
+			stats.rebuiltPackets += rebuilt;
+			return complete(jpg);
+		}
+	}
+	return false;
+}
+
+bool
+ImageStreamReassembler::complete(std::vector<uint8_t>& jpg)
+{
+	jpg.assign(data.begin(), data.begin() + std::min((size_t)size, data.size()));
+	active = false;
+	++stats.completed;
+	return true;
+}
+
+}
@@ -0,0 +1,114 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Receiver side of the image stream.
+*
+*   Collects the ENCAPSULATED_DATA packets following a
+*   DATA_TRANSMISSION_HANDSHAKE and returns the JPEG image as soon as it
+*   is complete, rebuilding lost packets from parity packets if the
+*   handshake announces FEC, see ImageStreamFEC.h. Packets of further
+*   copies of a frame are ignored once it is complete.
+*
+*   The packets since the last handshake, or since the sequence numbers
+*   last started over, are kept until the repeated handshake of an FEC
+*   frame arrives. If it announces a frame other than the current one,
+*   the first handshake was lost and the frame is started from them.
+*   Copies of a frame carry no handshake, so a repeat after the sequence
+*   numbers started over always belongs to the next frame. Tile frames are
+*   returned the same way, getHandshake() tells them apart and
+*   ImageStreamTileDecoder applies them.
+*
+*/
+
+#ifndef IMAGESTREAMREASSEMBLER_H
+#define IMAGESTREAMREASSEMBLER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "ImageStreamFEC.h"
+
+namespace px
+{
+
+class ImageStreamReassembler
+{
+public:
+	struct Stats
+	{
+		uint64_t frames;			///< handshakes received
+		uint64_t completed;			///< frames returned
+		uint64_t recovered;			///< of these, frames that needed parity packets
+		uint64_t rebuiltPackets;	///< data packets rebuilt from parity packets
+		uint64_t incomplete;		///< frames replaced by the next handshake before they were complete
+		uint64_t late;				///< of the frames, those started by the repeated handshake
+	};
+
+	ImageStreamReassembler();
+
+	/**
+	 * Feed a message from the image stream, other messages are ignored.
+	 *
+	 * @param jpg the image, if this message completed one
+	 * @return true if jpg was set
+	 */
+	bool handleMessage(const mavlink_message_t* msg, std::vector<uint8_t>& jpg);
+
+	/** @brief Start a new frame, as on a handshake */
+	void begin(const mavlink_data_transmission_handshake_t& handshake);
+
+	/** @brief Add a data or parity packet of the current frame */
+	bool addPacket(uint16_t seqnr, const uint8_t* data, std::vector<uint8_t>& jpg);
+
+	/** @return the handshake of the current frame */
+	const mavlink_data_transmission_handshake_t& getHandshake(void) const { return handshake; }
+
+	const Stats& getStats(void) const { return stats; }
+
+protected:
+	bool complete(std::vector<uint8_t>& jpg);
+	bool repeat(mavlink_data_transmission_handshake_t hs, std::vector<uint8_t>& jpg);
+
+	mavlink_data_transmission_handshake_t handshake;
+	ImageStreamFEC fec;
+	uint32_t size;				///< JPEG bytes of the current frame
+	bool active;				///< a frame is being collected
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> parity;
+	std::vector<bool> received;
+	uint32_t missing;			///< data packets not received yet
+	uint32_t arrived;			///< data and parity packets received
+	bool known;					///< handshake holds a frame, complete or not
+	bool sequenced;				///< lastSeqnr is set
+	uint16_t lastSeqnr;
+	bool restarted;				///< sequence numbers started over since the handshake
+	std::vector<uint16_t> keptSeqnrs;	///< packets for a frame whose handshake was lost
+	std::vector<uint8_t> kept;
+	Stats stats;
+};
+
+}
+
+#endif
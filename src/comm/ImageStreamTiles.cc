@@ -0,0 +1,335 @@
+#include "ImageStreamTiles.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <opencv2/highgui/highgui.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace px
+{
+
+static int
+roundTileSize(int tileSize)
+{
+	return std::max(16, std::min(256, (tileSize + 8) / 16 * 16));
+}
+
+/** @return cells per row of the mosaic of n tiles, it is about square */
+static int
+mosaicColumns(int n)
+{
+	return std::max(1, (int)ceil(sqrt((double)n)));
+}
+
+static void
+putUint16(std::vector<uint8_t>& out, size_t offset, uint16_t value)
+{
+	out[offset] = value & 0xff;
+	out[offset + 1] = value >> 8;
+}
+
+static uint16_t
+getUint16(const std::vector<uint8_t>& in, size_t offset)
+{
+	return in[offset] | (in[offset + 1] << 8);
+}
+
+ImageStreamTileEncoder::ImageStreamTileEncoder(int tileSize, float threshold, int refreshFrames)
+ : tileSize(roundTileSize(tileSize))
+ , threshold(threshold)
+ , refreshFrames(refreshFrames)
+ , columns(0)
+ , rows(0)
+ , cursor(0)
+{
+	if (!g_thread_supported())
+	{
+		g_thread_init(NULL);
+	}
+	mutex = g_mutex_new();
+	memset(&stats, 0, sizeof(stats));
+}
+
+ImageStreamTileEncoder::~ImageStreamTileEncoder()
+{
+	g_mutex_free(mutex);
+}
+
+void
+ImageStreamTileEncoder::setup(int tileSize, float threshold, int refreshFrames)
+{
+	g_mutex_lock(mutex);
+	if (roundTileSize(tileSize) != this->tileSize)
+	{
+		this->tileSize = roundTileSize(tileSize);
+		reference = cv::Mat();
+	}
+	this->threshold = threshold;
+	this->refreshFrames = refreshFrames;
+	g_mutex_unlock(mutex);
+}
+
+ImageStreamTileEncoder::Stats
+ImageStreamTileEncoder::getStats(void) const
+{
+	g_mutex_lock(mutex);
+	Stats s = stats;
+	g_mutex_unlock(mutex);
+	return s;
+}
+
+uint32_t
+ImageStreamTileEncoder::sumOfAbsDiff(const uint8_t* a, const uint8_t* b, size_t length)
+{
+	uint32_t sum = 0;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		// one sum per 8 bytes, in the low word of each 64 bit half
+		acc = _mm_add_epi32(acc, _mm_sad_epu8(x, y));
+	}
+	sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	uint32x4_t acc = vdupq_n_u32(0);
+	for (; i + 16 <= length; i += 16)
+	{
+		uint8x16_t x = vld1q_u8(a + i);
+		uint8x16_t y = vld1q_u8(b + i);
+		uint16x8_t d = vabdl_u8(vget_low_u8(x), vget_low_u8(y));
+		d = vabal_u8(d, vget_high_u8(x), vget_high_u8(y));
+		acc = vpadalq_u16(acc, d);
+	}
+	uint64x2_t pairs = vpaddlq_u32(acc);
+	sum = (uint32_t)(vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+#endif
+
+	for (; i < length; ++i)
+	{
+		sum += abs((int)a[i] - (int)b[i]);
+	}
+	return sum;
+}
+
+cv::Rect
+ImageStreamTileEncoder::tileRect(int index) const
+{
+	int x = (index % columns) * tileSize;
+	int y = (index / columns) * tileSize;
+	return cv::Rect(x, y, std::min(tileSize, reference.cols - x), std::min(tileSize, reference.rows - y));
+}
+
+bool
+ImageStreamTileEncoder::hasChanged(const cv::Mat& img, int index) const
+{
+	const cv::Rect r = tileRect(index);
+	const size_t offset = (size_t)r.x * img.channels();
+	const size_t length = (size_t)r.width * img.channels();
+	const uint64_t limit = (uint64_t)(threshold * length * r.height);
+
+	uint64_t sum = 0;
+	for (int y = r.y; y < r.y + r.height; ++y)
+	{
+		sum += sumOfAbsDiff(img.ptr(y) + offset, reference.ptr(y) + offset, length);
+		// a tile is rarely changed only in its last rows, stop early
+		if (sum > limit) return true;
+	}
+	return false;
+}
+
+int
+ImageStreamTileEncoder::encode(const cv::Mat& img, int quality, std::vector<uint8_t>& payload, std::vector<uint16_t>& tiles)
+{
+	tiles.clear();
+	payload.clear();
+	if (img.empty() || img.depth() != CV_8U || (img.channels() != 1 && img.channels() != 3))
+	{
+		return 0;
+	}
+
+	g_mutex_lock(mutex);
+	if (reference.rows != img.rows || reference.cols != img.cols || reference.type() != img.type())
+	{
+		reference.create(img.rows, img.cols, img.type());
+		columns = (img.cols + tileSize - 1) / tileSize;
+		rows = (img.rows + tileSize - 1) / tileSize;
+		valid.assign(columns * rows, false);
+		cursor = 0;
+	}
+	const int count = columns * rows;
+
+	std::vector<bool> chosen(count, false);
+	for (int t = 0; t < count; ++t)
+	{
+		if (!valid[t] || hasChanged(img, t))
+		{
+			chosen[t] = true;
+			tiles.push_back(t);
+			++stats.changed;
+		}
+	}
+	// Refresh in turn, so that a lost frame is repaired after refreshFrames
+	const int refresh = (refreshFrames > 0) ? (count + refreshFrames - 1) / refreshFrames : 0;
+	for (int i = 0; i < refresh; ++i)
+	{
+		if (!chosen[cursor])
+		{
+			chosen[cursor] = true;
+			tiles.push_back(cursor);
+			++stats.refreshed;
+		}
+		cursor = (cursor + 1) % count;
+	}
+	++stats.frames;
+	stats.tiles += count;
+	const int columnsNow = columns;
+	const int tileSizeNow = tileSize;
+	g_mutex_unlock(mutex);
+
+	std::sort(tiles.begin(), tiles.end());
+
+	// The cells of the mosaic are filled row by row
+	const int n = (int)tiles.size();
+	const int cellColumns = mosaicColumns(n);
+	const int cellRows = (n + cellColumns - 1) / cellColumns;
+	std::vector<uint8_t> jpg;
+	if (n > 0)
+	{
+		cv::Mat mosaic(cellRows * tileSizeNow, cellColumns * tileSizeNow, img.type());
+		mosaic = cv::Scalar(0);
+		for (int i = 0; i < n; ++i)
+		{
+			int x = (tiles[i] % columnsNow) * tileSizeNow;
+			int y = (tiles[i] / columnsNow) * tileSizeNow;
+			cv::Rect r(x, y, std::min(tileSizeNow, img.cols - x), std::min(tileSizeNow, img.rows - y));
+			cv::Mat cell = mosaic(cv::Rect((i % cellColumns) * tileSizeNow, (i / cellColumns) * tileSizeNow, r.width, r.height));
+			img(r).copyTo(cell);
+		}
+
+		std::vector<int> p(2);
+		p[0] = CV_IMWRITE_JPEG_QUALITY;
+		p[1] = quality;
+		cv::imencode(".jpg", mosaic, jpg, p);
+	}
+
+	const size_t header = IMAGESTREAM_TILES_HEADER + 2 * (size_t)n;
+	payload.resize(header + jpg.size());
+	payload[0] = IMAGESTREAM_TILES_VERSION;
+	payload[1] = img.channels();
+	putUint16(payload, 2, tileSizeNow);
+	putUint16(payload, 4, n);
+	for (int i = 0; i < n; ++i)
+	{
+		putUint16(payload, IMAGESTREAM_TILES_HEADER + 2 * i, tiles[i]);
+	}
+	if (!jpg.empty())
+	{
+		memcpy(&payload[header], &jpg[0], jpg.size());
+	}
+	return cellRows * cellColumns * tileSizeNow * tileSizeNow;
+}
+
+void
+ImageStreamTileEncoder::commit(const cv::Mat& img, const std::vector<uint16_t>& tiles)
+{
+	g_mutex_lock(mutex);
+	// The reference started over since img was encoded
+	if (img.rows != reference.rows || img.cols != reference.cols || img.type() != reference.type())
+	{
+		g_mutex_unlock(mutex);
+		return;
+	}
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		if (tiles[i] >= valid.size()) continue;
+		cv::Rect r = tileRect(tiles[i]);
+		cv::Mat dst = reference(r);
+		img(r).copyTo(dst);
+		valid[tiles[i]] = true;
+	}
+	g_mutex_unlock(mutex);
+}
+
+ImageStreamTileDecoder::ImageStreamTileDecoder()
+ : tileSize(0)
+ , missing(0)
+{
+
+}
+
+bool
+ImageStreamTileDecoder::apply(const std::vector<uint8_t>& payload, int width, int height)
+{
+	if (payload.size() < IMAGESTREAM_TILES_HEADER || payload[0] != IMAGESTREAM_TILES_VERSION)
+	{
+		return false;
+	}
+	const int channels = payload[1];
+	const int size = getUint16(payload, 2);
+	const int n = getUint16(payload, 4);
+	const size_t header = IMAGESTREAM_TILES_HEADER + 2 * (size_t)n;
+	if ((channels != 1 && channels != 3) || size < 16 || size % 16 != 0 ||
+		width <= 0 || height <= 0 || payload.size() < header)
+	{
+		return false;
+	}
+	const int columns = (width + size - 1) / size;
+	const int count = columns * ((height + size - 1) / size);
+	for (int i = 0; i < n; ++i)
+	{
+		if (getUint16(payload, IMAGESTREAM_TILES_HEADER + 2 * i) >= count) return false;
+	}
+
+	cv::Mat mosaic;
+	if (n > 0)
+	{
+		if (payload.size() == header) return false;
+		cv::Mat jpg(1, (int)(payload.size() - header), CV_8UC1, const_cast<uint8_t*>(&payload[header]));
+		mosaic = cv::imdecode(jpg, (channels == 1) ? CV_LOAD_IMAGE_GRAYSCALE : CV_LOAD_IMAGE_COLOR);
+		const int cellRows = (n + mosaicColumns(n) - 1) / mosaicColumns(n);
+		if (mosaic.empty() || mosaic.channels() != channels ||
+			mosaic.cols < mosaicColumns(n) * size || mosaic.rows < cellRows * size)
+		{
+			return false;
+		}
+	}
+
+	if (image.cols != width || image.rows != height || image.channels() != channels || tileSize != size)
+	{
+		image.create(height, width, CV_8UC(channels));
+		image = cv::Scalar(0);
+		tileSize = size;
+		received.assign(count, false);
+		missing = count;
+	}
+
+	const int cellColumns = mosaicColumns(n);
+	for (int i = 0; i < n; ++i)
+	{
+		const int t = getUint16(payload, IMAGESTREAM_TILES_HEADER + 2 * i);
+		const int x = (t % columns) * size;
+		const int y = (t / columns) * size;
+		cv::Rect r(x, y, std::min(size, width - x), std::min(size, height - y));
+		cv::Mat dst = image(r);
+		mosaic(cv::Rect((i % cellColumns) * size, (i / cellColumns) * size, r.width, r.height)).copyTo(dst);
+		if (!received[t])
+		{
+			received[t] = true;
+			--missing;
+		}
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,173 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Image stream frames that only carry the tiles which changed.
+*
+*   The image is split into square tiles. A tile is sent if its sum of
+*   absolute differences to the reference, the last version of it that
+*   was handed to the sender, exceeds a threshold per byte, and a few tiles
+*   are sent regardless in turn so that a receiver which lost a frame
+*   catches up within a bounded number of frames. The tiles sent are
+*   laid out side by side in one mosaic image and encoded as a single
+*   JPEG, which saves the JPEG headers of the individual tiles; tile
+*   sizes are multiples of 16, so no JPEG block straddles two tiles.
+*
+*   A tile frame is announced by a handshake of type IMAGESTREAM_TYPE_TILES
+*   with the size of the whole image, and its data, sent as the JPEG of
+*   a normal frame, is:
+*
+*     uint8  version, IMAGESTREAM_TILES_VERSION
+*     uint8  channels, 1 or 3
+*     uint16 tile size in pixels
+*     uint16 number of tiles n
+*     uint16 n tile indices, row major over the image
+*     the mosaic JPEG, the tiles in the order of their indices, row by row
+*
+*   all little endian. Tiles at the right and bottom border are cut to
+*   the image and occupy the top left of their mosaic cell.
+*
+*/
+
+#ifndef IMAGESTREAMTILES_H
+#define IMAGESTREAMTILES_H
+
+#include <stdint.h>
+#include <vector>
+#include <glib.h>
+#include <opencv2/core/core.hpp>
+
+#define IMAGESTREAM_TILES_VERSION	1
+#define IMAGESTREAM_TILES_HEADER	6	///< bytes before the tile indices
+
+namespace px
+{
+
+/**
+ * @brief Sender side, chooses and encodes the tiles of each frame
+ *
+ * encode() runs on the encoder thread and commit() on the sender thread
+ * when it takes a frame, before sending it. A frame that is replaced
+ * before the sender takes it leaves the reference untouched, so its
+ * tiles go out with the next frame, and a frame encoded while another
+ * is still on the link does not send the tiles of that one again.
+ */
+class ImageStreamTileEncoder
+{
+public:
+	struct Stats
+	{
+		uint64_t frames;		///< frames encoded
+		uint64_t tiles;			///< tiles of these frames
+		uint64_t changed;		///< tiles sent because they changed
+		uint64_t refreshed;		///< tiles sent because it was their turn
+	};
+
+	/**
+	 * @param tileSize pixels, rounded to a multiple of 16
+	 * @param threshold mean absolute difference per byte above which a tile changed
+	 * @param refreshFrames frames after which every tile was sent at least once
+	 */
+	ImageStreamTileEncoder(int tileSize = 64, float threshold = 3.0f, int refreshFrames = 30);
+	~ImageStreamTileEncoder();
+
+	/** @brief Change the parameters, forgets the reference if the tile size changes */
+	void setup(int tileSize, float threshold, int refreshFrames);
+
+	/**
+	 * Encode the tiles of img that differ from the reference, and those
+	 * due for a refresh. An image of another size or type than the
+	 * reference starts over with all tiles.
+	 *
+	 * @param img 8 bit, 1 or 3 channels
+	 * @param payload the tile frame
+	 * @param tiles indices of the tiles in payload, to be passed to commit()
+	 * @return pixels of the mosaic encoded
+	 */
+	int encode(const cv::Mat& img, int quality, std::vector<uint8_t>& payload, std::vector<uint16_t>& tiles);
+
+	/** @brief The tiles of img are being sent, they become the reference */
+	void commit(const cv::Mat& img, const std::vector<uint16_t>& tiles);
+
+	int getTileSize(void) const { return tileSize; }
+	Stats getStats(void) const;
+
+	/** @return sum of |a[i] - b[i]|, with SSE2 or NEON where available */
+	static uint32_t sumOfAbsDiff(const uint8_t* a, const uint8_t* b, size_t length);
+
+protected:
+	cv::Rect tileRect(int index) const;
+	bool hasChanged(const cv::Mat& img, int index) const;
+
+	int tileSize;
+	float threshold;
+	int refreshFrames;
+
+	GMutex* mutex;				///< Protects the reference, valid and the counters
+	cv::Mat reference;			///< the tiles as last sent
+	std::vector<bool> valid;	///< tiles of the reference that were sent at all
+	int columns;
+	int rows;
+	int cursor;					///< next tile to refresh
+	Stats stats;
+
+private:
+	ImageStreamTileEncoder(const ImageStreamTileEncoder&);
+	ImageStreamTileEncoder& operator=(const ImageStreamTileEncoder&);
+};
+
+/**
+ * @brief Receiver side, keeps the image the tile frames are applied to
+ */
+class ImageStreamTileDecoder
+{
+public:
+	ImageStreamTileDecoder();
+
+	/**
+	 * Apply a tile frame as returned by ImageStreamReassembler. A frame of
+	 * another image size starts a new, black image.
+	 *
+	 * @param width of the image, from the handshake
+	 * @param height of the image, from the handshake
+	 * @return false if the frame is malformed, the image is unchanged then
+	 */
+	bool apply(const std::vector<uint8_t>& payload, int width, int height);
+
+	/** @return the image, tiles that did not arrive yet are black */
+	const cv::Mat& getImage(void) const { return image; }
+
+	/** @return whether every tile arrived at least once */
+	bool isComplete(void) const { return missing == 0; }
+
+protected:
+	cv::Mat image;
+	int tileSize;
+	std::vector<bool> received;
+	size_t missing;
+};
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Decodes all MAVLink frames in a buffer at once.
+*
+*/
+
+#include "MAVLinkScanner.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace px
+{
+
+/*
+ * CRC-16/MCRF4XX, reflected polynomial 0x8408
+ */
+
+/**
+ * Slicing-by-4 tables. Built by the constructor of a function local
+ * static, which the compiler guards, so concurrent first callers never
+ * see them half filled.
+ */
+struct CrcTable
+{
+	uint16_t t[4][256];
+
+	CrcTable()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint16_t c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? (c >> 1) ^ 0x8408 : (c >> 1);
+			}
+			t[0][i] = c;
+		}
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			for (int k = 1; k < 4; ++k)
+			{
+				uint16_t c = t[k - 1][i];
+				t[k][i] = (c >> 8) ^ t[0][c & 0xFF];
+			}
+		}
+	}
+};
+
+/**
+ * Slicing-by-4, about four times fewer dependent steps than the bitwise
+ * crc_accumulate() of the MAVLink headers.
+ */
+uint16_t
+mavlinkCrc(uint16_t crc, const uint8_t* data, size_t length)
+{
+	static const CrcTable table;
+	const uint16_t (*crcTable)[256] = table.t;
+
+	while (length >= 4)
+	{
+		uint16_t x = crc ^ (data[0] | (data[1] << 8));
+		crc = crcTable[3][x & 0xFF] ^
+			  crcTable[2][x >> 8] ^
+			  crcTable[1][data[2]] ^
+			  crcTable[0][data[3]];
+		data += 4;
+		length -= 4;
+	}
+	while (length--)
+	{
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *data++) & 0xFF];
+	}
+	return crc;
+}
+
+#if MAVLINK_CRC_EXTRA
+static const uint8_t messageCrcs[256] = MAVLINK_MESSAGE_CRCS;
+#endif
+#ifdef MAVLINK_CHECK_MESSAGE_LENGTH
+static const uint8_t messageLengths[256] = MAVLINK_MESSAGE_LENGTHS;
+#endif
+
+MAVLinkScanner::MAVLinkScanner()
+ : carryLength(0)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void
+MAVLinkScanner::reset(void)
+{
+	carryLength = 0;
+}
+
+const MAVLinkScanner::Stats&
+MAVLinkScanner::getStats(void) const
+{
+	return stats;
+}
+
+/**
+ * Checks length and checksum of a complete frame.
+ */
+bool
+MAVLinkScanner::checkFrame(const uint8_t* frame) const
+{
+	uint8_t len = frame[1];
+
+#ifdef MAVLINK_CHECK_MESSAGE_LENGTH
+	if (len != messageLengths[frame[5]])
+	{
+		return false;
+	}
+#endif
+
+	uint16_t crc = mavlinkCrc(0xFFFF, frame + 1, MAVLINK_CORE_HEADER_LEN + len);
+#if MAVLINK_CRC_EXTRA
+	crc = mavlinkCrc(crc, &messageCrcs[frame[5]], 1);
+#endif
+	const uint8_t* ck = frame + MAVLINK_NUM_HEADER_BYTES + len;
+	return ck[0] == (crc & 0xFF) && ck[1] == (crc >> 8);
+}
+
+/**
+ * Decodes the frames starting before startLimit.
+ *
+ * @return offset of the first byte not consumed. Bytes from there to the
+ *         end of the buffer are the start of an incomplete frame if the
+ *         offset is below startLimit.
+ */
+size_t
+MAVLinkScanner::scanFrames(const uint8_t* data, size_t length, size_t startLimit,
+						   std::vector<mavlink_message_t>& messages)
+{
+	size_t pos = 0;
+	while (pos < startLimit)
+	{
+		// Frames are mostly back to back, only search after garbage
+		if (data[pos] != MAVLINK_STX)
+		{
+			const uint8_t* stx = static_cast<const uint8_t*>(
+				memchr(data + pos, MAVLINK_STX, startLimit - pos));
+			size_t next = (stx != NULL) ? stx - data : startLimit;
+			stats.skippedBytes += next - pos;
+			pos = next;
+			if (stx == NULL)
+			{
+				break;
+			}
+		}
+
+		if (length - pos < 2 ||
+			length - pos < static_cast<size_t>(data[pos + 1]) + MAVLINK_NUM_NON_PAYLOAD_BYTES)
+		{
+			// incomplete frame
+			break;
+		}
+
+		const uint8_t* frame = data + pos;
+		uint8_t len = frame[1];
+		if (!checkFrame(frame))
+		{
+			// Not a frame, the start byte was part of something else
+			++stats.badFrames;
+			++stats.skippedBytes;
+			++pos;
+			continue;
+		}
+
+		messages.resize(messages.size() + 1);
+		mavlink_message_t& msg = messages.back();
+		msg.magic = frame[0];
+		msg.len = len;
+		msg.seq = frame[2];
+		msg.sysid = frame[3];
+		msg.compid = frame[4];
+		msg.msgid = frame[5];
+		// mavlink_parse_char() also keeps the checksum bytes after the payload
+		memcpy(_MAV_PAYLOAD_NON_CONST(&msg), frame + MAVLINK_NUM_HEADER_BYTES,
+			   len + MAVLINK_NUM_CHECKSUM_BYTES);
+		msg.checksum = frame[MAVLINK_NUM_HEADER_BYTES + len] |
+					   (frame[MAVLINK_NUM_HEADER_BYTES + len + 1] << 8);
+		++stats.frames;
+
+		pos += len + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+	}
+	return pos;
+}
+
+size_t
+MAVLinkScanner::scan(const uint8_t* data, size_t length,
+					 std::vector<mavlink_message_t>& messages)
+{
+	messages.clear();
+
+	size_t pos = 0;
+	if (carryLength > 0)
+	{
+		// Complete the carried frame with the head of this buffer. Only
+		// frames starting in the carried bytes are decoded here, the
+		// others are found in this buffer itself below.
+		size_t head = std::min(length, static_cast<size_t>(MAVLINK_MAX_PACKET_LEN));
+		memcpy(carry + carryLength, data, head);
+		size_t staged = carryLength + head;
+		size_t end = scanFrames(carry, staged, carryLength, messages);
+		if (end < carryLength)
+		{
+			// still incomplete, the whole buffer was staged
+			memmove(carry, carry + end, staged - end);
+			carryLength = staged - end;
+			return messages.size();
+		}
+		pos = end - carryLength;
+		carryLength = 0;
+	}
+
+	if (pos < length)
+	{
+		size_t end = pos + scanFrames(data + pos, length - pos, length - pos, messages);
+		if (end < length)
+		{
+			// less than one frame, see the length check in scanFrames()
+			carryLength = length - end;
+			memcpy(carry, data + end, carryLength);
+		}
+	}
+	return messages.size();
+}
+
+}
@@ -0,0 +1,97 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Decodes all MAVLink frames in a buffer at once.
+*
+*   A replacement for feeding a byte stream through mavlink_parse_char()
+*   one byte at a time. Start bytes are located with memchr(), which is
+*   vectorized in glibc, and a frame is checked as a whole once its
+*   length is known. Up to one partial frame is carried over to the next
+*   buffer, so streams may be cut anywhere.
+*
+*/
+
+#ifndef MAVLINKSCANNER_H
+#define MAVLINKSCANNER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <pixhawk/mavlink.h>
+
+namespace px
+{
+
+class MAVLinkScanner
+{
+public:
+	struct Stats
+	{
+		uint64_t frames;		///< frames decoded
+		uint64_t badFrames;		///< frames with a wrong checksum or length
+		uint64_t skippedBytes;	///< bytes outside of any valid frame
+	};
+
+	MAVLinkScanner();
+
+	/**
+	 * Decode all frames that end in the given buffer.
+	 *
+	 * @param data bytes received from the stream
+	 * @param length number of bytes
+	 * @param messages is replaced with the decoded frames; its capacity
+	 *        is kept, so reusing the vector avoids allocations
+	 * @return number of decoded frames
+	 */
+	size_t scan(const uint8_t* data, size_t length,
+				std::vector<mavlink_message_t>& messages);
+
+	/**
+	 * Drop the carried over partial frame, e.g. after reopening a port.
+	 */
+	void reset(void);
+
+	const Stats& getStats(void) const;
+
+private:
+	size_t scanFrames(const uint8_t* data, size_t length, size_t startLimit,
+					  std::vector<mavlink_message_t>& messages);
+	bool checkFrame(const uint8_t* frame) const;
+
+	Stats stats;
+
+	uint8_t carry[2 * MAVLINK_MAX_PACKET_LEN];	///< partial frame, then room for the next buffer's head
+	size_t carryLength;
+};
+
+/**
+ * CRC-16/MCRF4XX as used by MAVLink, computed with a table instead of
+ * the bitwise crc_accumulate().
+ */
+uint16_t mavlinkCrc(uint16_t crc, const uint8_t* data, size_t length);
+
+}
+
+#endif
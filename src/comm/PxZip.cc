@@ -1,6 +1,9 @@
 #include "PxZip.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <turbojpeg.h>
 #include <zlib.h>
@@ -26,122 +29,158 @@ PxZip::PxZip()
 	handleCompress = tjInitCompress();
 	handleDecompress = tjInitDecompress();
 
-	chunkBuffer = new unsigned char[kChunkSize];
+	// Initialised once, every call only resets them
+	deflateStream = new z_stream;
+	memset(deflateStream, 0, sizeof(z_stream));
+	deflateInit(deflateStream, Z_BEST_SPEED);
+
+	inflateStream = new z_stream;
+	memset(inflateStream, 0, sizeof(z_stream));
+	inflateInit(inflateStream);
 }
 
 PxZip::~PxZip()
 {
 	delete [] jpegBuffer;
-	delete [] chunkBuffer;
 
 	tjDestroy(handleCompress);
 	tjDestroy(handleDecompress);
+
+	deflateEnd(deflateStream);
+	inflateEnd(inflateStream);
+	delete deflateStream;
+	delete inflateStream;
 }
 
-void
-PxZip::compressData(unsigned char* inData, size_t inDataSize,
-					std::vector<unsigned char>& outData)
+size_t
+PxZip::compressDataBound(size_t inDataSize)
 {
-	std::vector<unsigned char> buffer;
-
-	z_stream strm;
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.next_in = inData;
-	strm.avail_in = inDataSize;
-	strm.next_out = chunkBuffer;
-	strm.avail_out = kChunkSize;
-	
-	deflateInit(&strm, Z_BEST_SPEED);
-
-	int flush, ret;
+	return deflateBound(deflateStream, inDataSize);
+}
 
-	do
+size_t
+PxZip::compressData(const unsigned char* inData, size_t inDataSize,
+					unsigned char* outData, size_t outCapacity)
+{
+	deflateReset(deflateStream);
+	deflateStream->next_in = const_cast<unsigned char*>(inData);
+	deflateStream->avail_in = inDataSize;
+	deflateStream->next_out = outData;
+	deflateStream->avail_out = outCapacity;
+
+	// With deflateBound() bytes of output one call always finishes
+	int ret = deflate(deflateStream, Z_FINISH);
+	assert(ret != Z_STREAM_ERROR);
+	if (ret != Z_STREAM_END)
 	{
-		flush = (strm.avail_in == 0) ? Z_FINISH : Z_NO_FLUSH;
-
-		do
-		{
-			strm.next_out = chunkBuffer;
-			strm.avail_out = kChunkSize;
-
-			ret = deflate(&strm, flush);
-			assert(ret != Z_STREAM_ERROR);
-
-			buffer.insert(buffer.end(), chunkBuffer,
-						  chunkBuffer + kChunkSize - strm.avail_out);
-		}
-		while (strm.avail_out == 0);
+		return 0;
 	}
-	while (flush != Z_FINISH);
+	return outCapacity - deflateStream->avail_out;
+}
 
-	assert(ret == Z_STREAM_END);
+size_t
+PxZip::decompressData(const unsigned char* inData, size_t inDataSize,
+					  unsigned char* outData, size_t outCapacity)
+{
+	inflateReset(inflateStream);
+	inflateStream->next_in = const_cast<unsigned char*>(inData);
+	inflateStream->avail_in = inDataSize;
+	inflateStream->next_out = outData;
+	inflateStream->avail_out = outCapacity;
+
+	int ret = inflate(inflateStream, Z_FINISH);
+	assert(ret != Z_STREAM_ERROR);
+	if (ret != Z_STREAM_END)
+	{
+		return 0;
+	}
+	return outCapacity - inflateStream->avail_out;
+}
 
-	deflateEnd(&strm);
+void
+PxZip::compressData(unsigned char* inData, size_t inDataSize,
+					std::vector<unsigned char>& outData)
+{
+	size_t bound = compressDataBound(inDataSize);
+	if (deflateBuffer.size() < bound)
+	{
+		deflateBuffer.resize(bound);
+	}
 
-	outData.swap(buffer);
-}			
+	size_t size = compressData(inData, inDataSize, &deflateBuffer[0], deflateBuffer.size());
+	outData.assign(deflateBuffer.begin(), deflateBuffer.begin() + size);
+}
 
-void
+bool
 PxZip::decompressData(unsigned char* inData, size_t inDataSize,
 					  std::vector<unsigned char>& outData)
 {
-	std::vector<unsigned char> buffer;
-
-	z_stream strm;
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.next_in = inData;
-	strm.avail_in = inDataSize;
-	strm.next_out = chunkBuffer;
-	strm.avail_out = kChunkSize;
-	
-	inflateInit(&strm);
+	// Decompress into the whole capacity of outData, growing it if needed
+	outData.resize(std::max(outData.capacity(), kChunkSize));
+
+	inflateReset(inflateStream);
+	inflateStream->next_in = inData;
+	inflateStream->avail_in = inDataSize;
 
+	size_t size = 0;
 	int ret;
 
 	do
 	{
-		if (strm.avail_in == 0)
+		if (size == outData.size())
 		{
-			break;
+			outData.resize(outData.size() * 2);
 		}
+		inflateStream->next_out = &outData[size];
+		inflateStream->avail_out = outData.size() - size;
 
-		do
-		{
-			strm.next_out = chunkBuffer;
-			strm.avail_out = kChunkSize;
-
-			ret = inflate(&strm, Z_NO_FLUSH);
-			assert(ret != Z_STREAM_ERROR);
+		ret = inflate(inflateStream, Z_NO_FLUSH);
+		assert(ret != Z_STREAM_ERROR);
 
-			buffer.insert(buffer.end(), chunkBuffer,
-						  chunkBuffer + kChunkSize - strm.avail_out);
-		}
-		while (strm.avail_out == 0);
+		size = outData.size() - inflateStream->avail_out;
 	}
-	while (ret != Z_STREAM_END);
+	while (ret == Z_OK && (inflateStream->avail_in > 0 || inflateStream->avail_out == 0));
 
-	inflateEnd(&strm);
+	if (ret != Z_STREAM_END)
+	{
+		fprintf(stderr, "# WARNING: Decompressing %lu bytes failed: %s\n", (unsigned long)inDataSize,
+				inflateStream->msg ? inflateStream->msg : "truncated data");
+	}
+	outData.resize(size);
+	return ret == Z_STREAM_END;
+}
 
-	outData.swap(buffer);
+size_t
+PxZip::compressImageBound(int width, int height) const
+{
+	return TJBUFSIZE(width, height);
 }
 
 void
-PxZip::compressImage(const cv::Mat& inData, std::vector<unsigned char>& outData)
+PxZip::reserveJpegBuffer(size_t size)
 {
-	assert(inData.channels() == 1 || inData.channels() == 3);
-	assert(inData.type() == CV_8U);
-
-	unsigned long maxsize = TJBUFSIZE(inData.cols, inData.rows);
-	if (maxsize > jpegBufferSize)
+	if (size > jpegBufferSize)
 	{
 		delete [] jpegBuffer;
-		jpegBufferSize = maxsize;
+		jpegBufferSize = size;
 		jpegBuffer = new unsigned char[jpegBufferSize];
 	}
+}
+
+size_t
+PxZip::compressImage(const cv::Mat& inData, unsigned char* outData, size_t outCapacity)
+{
+	assert(inData.channels() == 1 || inData.channels() == 3);
+	assert(inData.depth() == CV_8U);
+
+	// tjCompress() does not check the size of its output buffer
+	unsigned long maxsize = compressImageBound(inData.cols, inData.rows);
+	unsigned char* buffer = outData;
+	if (outCapacity < maxsize)
+	{
+		reserveJpegBuffer(maxsize);
+		buffer = jpegBuffer;
+	}
 
 	int flags, jpegsubsamp;
 	if (inData.channels() == 1)
@@ -156,21 +195,48 @@ PxZip::compressImage(const cv::Mat& inData, std::vector<unsigned char>& outData)
 	}
 
 	unsigned long jpegSize = 0;
-	tjCompress(handleCompress,
-			   inData.data, inData.cols, inData.step[0], inData.rows,
-			   inData.elemSize(), jpegBuffer, &jpegSize, jpegsubsamp, 50, flags);
+	if (tjCompress(handleCompress,
+				   inData.data, inData.cols, inData.step[0], inData.rows,
+				   inData.elemSize(), buffer, &jpegSize, jpegsubsamp, 50, flags) != 0)
+	{
+		fprintf(stderr, "# WARNING: JPEG compression failed: %s\n", tjGetErrorStr());
+		return 0;
+	}
 
-	outData = std::vector<unsigned char>(jpegBuffer, jpegBuffer + jpegSize);
+	if (buffer != outData)
+	{
+		if (jpegSize > outCapacity)
+		{
+			return 0;
+		}
+		memcpy(outData, buffer, jpegSize);
+	}
+	return jpegSize;
 }
 
 void
-PxZip::decompressImage(unsigned char* inData, size_t inDataSize,
+PxZip::compressImage(const cv::Mat& inData, std::vector<unsigned char>& outData)
+{
+	reserveJpegBuffer(compressImageBound(inData.cols, inData.rows));
+
+	size_t jpegSize = compressImage(inData, jpegBuffer, jpegBufferSize);
+	outData.assign(jpegBuffer, jpegBuffer + jpegSize);
+}
+
+bool
+PxZip::decompressImage(const unsigned char* inData, size_t inDataSize,
 					   cv::Mat& outData)
 {
+	unsigned char* jpeg = const_cast<unsigned char*>(inData);
+
 	// get image attributes
 	int width, height, jpegsubsamp;
-	tjDecompressHeader2(handleDecompress, inData, inDataSize,
-						&width, &height, &jpegsubsamp);
+	if (tjDecompressHeader2(handleDecompress, jpeg, inDataSize,
+							&width, &height, &jpegsubsamp) != 0)
+	{
+		fprintf(stderr, "# WARNING: JPEG header invalid: %s\n", tjGetErrorStr());
+		return false;
+	}
 
 	int type, flags;
 	if (jpegsubsamp == TJ_GRAYSCALE)
@@ -183,9 +249,10 @@ PxZip::decompressImage(unsigned char* inData, size_t inDataSize,
 		type = CV_8UC3;
 		flags = TJ_BGR;
 	}
-	outData = cv::Mat(height, width, type);
+	// No allocation if outData has this size and type already
+	outData.create(height, width, type);
 
-	tjDecompress(handleDecompress, inData, inDataSize,
-				 outData.data, outData.cols, outData.step[0], outData.rows,
-				 outData.elemSize(), flags);
+	return tjDecompress(handleDecompress, jpeg, inDataSize,
+						outData.data, outData.cols, outData.step[0], outData.rows,
+						outData.elemSize(), flags) == 0;
 }
@@ -5,30 +5,87 @@
 #include <vector>
 
 typedef void* tjhandle;
+struct z_stream_s;
 
+/**
+ * Compression context. The zlib streams, the turbojpeg handles and the
+ * output buffers live as long as the context and are reused by every
+ * call, so once the buffers grew to the largest frame nothing is
+ * allocated any more. A context must only be used by one thread at a
+ * time, give every thread its own.
+ */
 class PxZip
 {
 public:
+	/** @brief A context shared by the whole process, for single threaded users */
 	static PxZip* instance(void);
 
 	PxZip();
 	~PxZip();
 
 	// use zlib to compress/decompress generic data
+
+	/** @return the most bytes compressData() writes for inDataSize bytes */
+	size_t compressDataBound(size_t inDataSize);
+
+	/**
+	 * Compress into caller memory, at least compressDataBound() bytes
+	 * always suffice.
+	 *
+	 * @return bytes written, 0 if outCapacity is too small
+	 */
+	size_t compressData(const unsigned char* inData, size_t inDataSize,
+						unsigned char* outData, size_t outCapacity);
+
+	/**
+	 * Decompress into caller memory.
+	 *
+	 * @return bytes written, 0 if the data is corrupt or outCapacity too small
+	 */
+	size_t decompressData(const unsigned char* inData, size_t inDataSize,
+						  unsigned char* outData, size_t outCapacity);
+
+	// outData is overwritten, its capacity is kept
 	void compressData(unsigned char* inData, size_t inDataSize,
 					  std::vector<unsigned char>& outData);
 
-	void decompressData(unsigned char* inData, size_t inDataSize,
+	/** @return false if the data is corrupt or truncated, outData holds what was decoded */
+	bool decompressData(unsigned char* inData, size_t inDataSize,
 						std::vector<unsigned char>& outData);
 
 	// use libjpeg-turbo to compress/decompress image data
+
+	/** @return the most bytes compressImage() writes for an image of this size */
+	size_t compressImageBound(int width, int height) const;
+
+	/**
+	 * Compress into caller memory. With less than compressImageBound()
+	 * bytes the image is compressed into the buffer of the context first
+	 * and copied.
+	 *
+	 * @return bytes written, 0 on error or if outCapacity is too small
+	 */
+	size_t compressImage(const cv::Mat& inData,
+						 unsigned char* outData, size_t outCapacity);
+
 	void compressImage(const cv::Mat& inData,
 					   std::vector<unsigned char>& outData);
 
-	void decompressImage(unsigned char* inData, size_t inDataSize,
+	/**
+	 * The pixels of outData are reused if it has the size and type of
+	 * the image already, so it must not share them with anyone else.
+	 *
+	 * @return false if the data is no JPEG image
+	 */
+	bool decompressImage(const unsigned char* inData, size_t inDataSize,
 						 cv::Mat& outData);
 
 private:
+	PxZip(const PxZip&);
+	PxZip& operator=(const PxZip&);
+
+	void reserveJpegBuffer(size_t size);
+
 	static PxZip* mInstance;
 
 	unsigned long jpegBufferSize;
@@ -37,8 +94,11 @@ private:
 	tjhandle handleCompress;
 	tjhandle handleDecompress;
 
-	const size_t kChunkSize;
-	unsigned char* chunkBuffer;
+	z_stream_s* deflateStream;
+	z_stream_s* inflateStream;
+
+	const size_t kChunkSize;					///< growth step of decompressed vectors
+	std::vector<unsigned char> deflateBuffer;	///< grown to deflateBound() of the largest input
 };
 
 #endif
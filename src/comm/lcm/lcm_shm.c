@@ -0,0 +1,783 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief shm:// transport for LCM between processes on the same host
+*
+*   LCM has no way to register transport providers, so this file provides
+*   the LCM C API itself: lcm_create() with an shm:// URL returns a
+*   handle served from a shared memory ring, every other URL and every
+*   call on such a handle is passed on to liblcm. This only works if
+*   mavconn_lcm comes before liblcm in the symbol lookup order, so targets
+*   link mavconn_lcm alone and get liblcm as its dependency; listing lcm
+*   directly may put it first. Processes that never ask for shm:// behave
+*   exactly as before. A process where liblcm wins reports it at load time
+*   and exits if LCM_DEFAULT_URL asks for shm://.
+*
+*     shm://[name][?size=bytes]
+*
+*   All handles created with the same name share the segment
+*   /dev/shm/lcm-<name> ("default" if empty). The ring size is rounded up
+*   to a power of two, 4 MB by default; a message may use a quarter of it.
+*   lcm_create(NULL) uses LCM_DEFAULT_URL as liblcm does.
+*
+*   Any process may publish (multiple producers reserve space with a CAS
+*   on the head) and every handle reads every message (multiple consumers
+*   with a private cursor each). A record is committed by writing its ring
+*   position into its header last, readers copy it out and then check that
+*   no producer has lapped them meanwhile. Readers that fall behind by more
+*   than the ring lose the overwritten messages, like a UDP socket buffer
+*   overflowing.
+*
+*   Each handle runs a thread that sleeps on a futex in the segment and
+*   writes one byte to a pipe per message for a subscribed channel, so
+*   lcm_get_fileno() can be used with select() as with udpm://. Unlike
+*   udpm://, messages stay in the ring until lcm_handle() copies them; the
+*   subscription queue capacity has no effect.
+*
+*/
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+
+#include <lcm/lcm.h>
+
+#define LCM_SHM_MAGIC 0x4c434d53484d3031LL              ///< "LCMSHM01"
+#define LCM_SHM_DEFAULT_SIZE (4 * 1024 * 1024)
+#define LCM_SHM_MIN_SIZE (64 * 1024)
+#define LCM_SHM_MAX_INSTANCES 32
+#define LCM_SHM_ALIGN 32                               ///< record alignment, equals the record header size
+#define LCM_SHM_MAX_CHANNEL 255
+/** Time a reader waits for a reserved record before it assumes its producer died */
+#define LCM_SHM_STALL_USEC 1000000
+
+typedef struct {
+    int64_t magic;
+    int64_t capacity;           ///< ring bytes, power of two
+    int64_t head;               ///< next free ring position, only grows
+    uint32_t futex;             ///< bumped after each commit
+    uint32_t waiters;           ///< readers sleeping on futex
+    uint8_t reserved[32];
+} lcm_shm_header_t;
+
+typedef struct {
+    int64_t stamp;              ///< ring position + 1 once committed
+    int64_t utime;
+    uint32_t size;              ///< whole record, aligned
+    uint32_t data_size;
+    uint8_t channel_len;        ///< 0 for padding at the end of the ring
+    uint8_t reserved[7];
+} lcm_shm_record_t;
+
+typedef struct _lcm_shm_subscription_t lcm_shm_subscription_t;
+struct _lcm_shm_subscription_t {
+    regex_t regex;
+    lcm_msg_handler_t handler;
+    void *userdata;
+    int removed;
+    lcm_shm_subscription_t *next;
+};
+
+typedef struct {
+    lcm_shm_header_t *header;
+    uint8_t *ring;
+    int64_t mask;
+    size_t map_size;
+
+    pthread_mutex_t lock;       ///< recursive, guards subscriptions and the handle cursor
+    lcm_shm_subscription_t *subscriptions;
+    int dispatching;            ///< unsubscribed entries stay listed while set
+
+    int64_t handle_cursor;
+    int64_t handle_stalled_since;   ///< time the record at handle_cursor was first found uncommitted
+    uint8_t *copy;              ///< message copied out of the ring for the handlers
+    size_t copy_size;
+
+    int64_t notify_cursor;
+    int64_t notify_resync;      ///< where the notify thread went on after a stalled publisher
+    int notify_pipe[2];
+    pthread_t notify_thread;
+    int notify_started;
+    volatile int quit;
+} lcm_shm_t;
+
+typedef enum { RECORD_OK, RECORD_NOT_READY, RECORD_LOST } record_status_t;
+
+static lcm_shm_t *instances[LCM_SHM_MAX_INSTANCES];
+static int instance_count;
+static pthread_mutex_t instances_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * liblcm
+ */
+
+static void *real_symbol(const char *name)
+{
+    void *f = dlsym(RTLD_NEXT, name);
+    if (!f) {
+        fprintf(stderr, "# ERROR: lcm_shm: %s not found in liblcm, link mavconn_lcm before lcm\n", name);
+        abort();
+    }
+    return f;
+}
+
+#define REAL(name) \
+    static __typeof__(&name) real_##name; \
+    if (!real_##name) real_##name = (__typeof__(&name)) real_symbol(#name)
+
+/* The lcm_create() the process resolves has to be this one, not liblcm's */
+static int shim_active(void)
+{
+    Dl_info self, found;
+    void *f = dlsym(RTLD_DEFAULT, "lcm_create");
+    if (!f || !dladdr((void*) shim_active, &self) || !dladdr(f, &found)) return 0;
+    return self.dli_fbase == found.dli_fbase;
+}
+
+__attribute__((constructor))
+static void check_shim(void)
+{
+    if (shim_active()) return;
+    const char *url = getenv("LCM_DEFAULT_URL");
+    if (url && strncmp(url, "shm://", 6) == 0) {
+        fprintf(stderr, "# ERROR: lcm_shm: liblcm is linked before mavconn_lcm, cannot serve LCM_DEFAULT_URL=%s\n", url);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "# WARNING: lcm_shm: liblcm is linked before mavconn_lcm, shm:// URLs will fail; link mavconn_lcm instead of lcm\n");
+}
+
+static lcm_shm_t *find_instance(lcm_t *lcm)
+{
+    int i;
+    if (__atomic_load_n(&instance_count, __ATOMIC_ACQUIRE) == 0) return NULL;
+    for (i = 0; i < LCM_SHM_MAX_INSTANCES; i++) {
+        if ((lcm_t*) __atomic_load_n(&instances[i], __ATOMIC_ACQUIRE) == lcm) return instances[i];
+    }
+    return NULL;
+}
+
+/*
+ * Ring
+ */
+
+static int64_t now_usec(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void futex_wait(uint32_t *word, uint32_t value, int usec)
+{
+    struct timespec rel;
+    rel.tv_sec = usec / 1000000;
+    rel.tv_nsec = (usec % 1000000) * 1000;
+    syscall(SYS_futex, word, FUTEX_WAIT, value, (usec >= 0) ? &rel : NULL, NULL, 0);
+}
+
+static lcm_shm_record_t *record_at(lcm_shm_t *s, int64_t pos)
+{
+    return (lcm_shm_record_t*) (s->ring + (pos & s->mask));
+}
+
+/**
+ * Copies the record at pos into the copy buffer.
+ *
+ * @param size set to the ring bytes of the record when RECORD_OK
+ */
+static record_status_t read_record(lcm_shm_t *s, int64_t pos, uint32_t *size)
+{
+    lcm_shm_record_t *r = record_at(s, pos);
+    int64_t head = __atomic_load_n(&s->header->head, __ATOMIC_ACQUIRE);
+
+    if (head - pos > s->header->capacity) return RECORD_LOST;
+    if (head <= pos || __atomic_load_n(&r->stamp, __ATOMIC_ACQUIRE) != pos + 1) return RECORD_NOT_READY;
+
+    *size = r->size;
+    if (*size < sizeof(lcm_shm_record_t) || *size % LCM_SHM_ALIGN || *size > (uint32_t) s->header->capacity) return RECORD_LOST;
+    if (s->copy_size < *size) {
+        uint8_t *copy = (uint8_t*) realloc(s->copy, *size);
+        if (!copy) return RECORD_LOST;
+        s->copy = copy;
+        s->copy_size = *size;
+    }
+    memcpy(s->copy, r, *size);
+
+    // the copy is valid if no producer reserved our bytes meanwhile
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->header->head, __ATOMIC_ACQUIRE) - pos > s->header->capacity) return RECORD_LOST;
+    return RECORD_OK;
+}
+
+static int channel_matches(lcm_shm_t *s, const lcm_shm_record_t *r, char *channel)
+{
+    lcm_shm_subscription_t *sub;
+
+    if (r->channel_len == 0) return 0;
+    memcpy(channel, r + 1, r->channel_len);
+    channel[r->channel_len] = '\0';
+    for (sub = s->subscriptions; sub; sub = sub->next) {
+        if (!sub->removed && regexec(&sub->regex, channel, 0, NULL, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+static void *notify_thread(void *arg)
+{
+    lcm_shm_t *s = (lcm_shm_t*) arg;
+    lcm_shm_header_t *h = s->header;
+    int64_t stalled_since = 0;
+
+    while (!s->quit) {
+        __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t seq = __atomic_load_n(&h->futex, __ATOMIC_SEQ_CST);
+        int64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+        if (s->notify_cursor == head) {
+            futex_wait(&h->futex, seq, 100000);
+            __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+
+        lcm_shm_record_t *r = record_at(s, s->notify_cursor);
+        if (head - s->notify_cursor > h->capacity) {
+            // lcm_handle() reports the loss
+            s->notify_cursor = head;
+            continue;
+        }
+        if (__atomic_load_n(&r->stamp, __ATOMIC_ACQUIRE) != s->notify_cursor + 1) {
+            // reserved but not committed yet
+            if (!stalled_since) stalled_since = now_usec();
+            if (now_usec() - stalled_since > LCM_SHM_STALL_USEC) {
+                fprintf(stderr, "# WARNING: lcm_shm: a publisher stopped in the middle of a message, skipping %lld bytes\n",
+                        (long long) (head - s->notify_cursor));
+                s->notify_cursor = head;
+                // shm_handle() skips to the same position
+                __atomic_store_n(&s->notify_resync, head, __ATOMIC_RELEASE);
+                stalled_since = 0;
+            } else {
+                futex_wait(&h->futex, seq, 1000);
+            }
+            continue;
+        }
+        stalled_since = 0;
+
+        char channel[LCM_SHM_MAX_CHANNEL + 1];
+        uint32_t size = r->size;
+        pthread_mutex_lock(&s->lock);
+        int matches = channel_matches(s, r, channel);
+        pthread_mutex_unlock(&s->lock);
+        if (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) - s->notify_cursor > h->capacity ||
+            size < sizeof(lcm_shm_record_t) || size % LCM_SHM_ALIGN) {
+            // overwritten while we looked at it
+            s->notify_cursor = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        s->notify_cursor += size;
+
+        if (matches) {
+            char c = 0;
+            while (write(s->notify_pipe[1], &c, 1) < 0 && errno == EINTR);
+        }
+    }
+    return NULL;
+}
+
+static int parse_url(const char *url, char *name, size_t name_len, int64_t *capacity)
+{
+    const char *network = url + strlen("shm://");
+    const char *options = strchr(network, '?');
+    size_t len = options ? (size_t) (options - network) : strlen(network);
+
+    if (len == 0) {
+        network = "default";
+        len = strlen(network);
+    }
+    if (len + strlen("/lcm-") >= name_len || memchr(network, '/', len)) {
+        fprintf(stderr, "# ERROR: lcm_shm: invalid segment name in %s\n", url);
+        return -1;
+    }
+    snprintf(name, name_len, "/lcm-%.*s", (int) len, network);
+
+    *capacity = 0;
+    while (options && *options) {
+        options++;
+        if (strncmp(options, "size=", 5) == 0) {
+            *capacity = strtoll(options + 5, NULL, 10);
+        } else {
+            fprintf(stderr, "# WARNING: lcm_shm: ignoring option %.*s\n", (int) strcspn(options, "&"), options);
+        }
+        options = strchr(options, '&');
+    }
+
+    if (*capacity > 0) {
+        int64_t size = LCM_SHM_MIN_SIZE;
+        while (size < *capacity) size <<= 1;
+        *capacity = size;
+    }
+    return 0;
+}
+
+static lcm_shm_t *shm_create(const char *url)
+{
+    char name[NAME_MAX];
+    int64_t capacity;
+    struct stat st;
+
+    if (parse_url(url, name, sizeof(name), &capacity) < 0) return NULL;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "# ERROR: lcm_shm: Unable to open %s (ERRNO #%d).\n", name, errno);
+        return NULL;
+    }
+
+    // the first process to get the lock initializes the segment
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) < 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        if (capacity == 0) capacity = LCM_SHM_DEFAULT_SIZE;
+        if (ftruncate(fd, sizeof(lcm_shm_header_t) + capacity) < 0) {
+            fprintf(stderr, "# ERROR: lcm_shm: Unable to size %s (ERRNO #%d).\n", name, errno);
+            flock(fd, LOCK_UN);
+            close(fd);
+            return NULL;
+        }
+        st.st_size = sizeof(lcm_shm_header_t) + capacity;
+    }
+
+    void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "# ERROR: lcm_shm: Unable to map %s (ERRNO #%d).\n", name, errno);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+    lcm_shm_header_t *h = (lcm_shm_header_t*) mem;
+    if (h->magic != LCM_SHM_MAGIC) {
+        h->capacity = st.st_size - sizeof(lcm_shm_header_t);
+        h->head = 0;
+        __atomic_store_n(&h->magic, LCM_SHM_MAGIC, __ATOMIC_RELEASE);
+    } else if (capacity != 0 && h->capacity != capacity) {
+        fprintf(stderr, "# WARNING: lcm_shm: %s exists with %lld bytes, ignoring size=%lld\n",
+                name, (long long) h->capacity, (long long) capacity);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if ((h->capacity & (h->capacity - 1)) != 0 ||
+        (int64_t) (st.st_size - sizeof(lcm_shm_header_t)) < h->capacity) {
+        fprintf(stderr, "# ERROR: lcm_shm: %s is not an LCM ring, remove it\n", name);
+        munmap(mem, st.st_size);
+        return NULL;
+    }
+
+    lcm_shm_t *s = (lcm_shm_t*) calloc(1, sizeof(lcm_shm_t));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    s->header = h;
+    s->ring = (uint8_t*) mem + sizeof(lcm_shm_header_t);
+    s->mask = h->capacity - 1;
+    s->map_size = st.st_size;
+    // new handles only see messages published from now on
+    s->handle_cursor = s->notify_cursor = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+    if (pipe(s->notify_pipe) < 0) {
+        munmap(mem, st.st_size);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void shm_destroy(lcm_shm_t *s)
+{
+    if (s->notify_started) {
+        s->quit = 1;
+        // the thread sleeps at most 100 ms on the futex
+        pthread_join(s->notify_thread, NULL);
+    }
+    while (s->subscriptions) {
+        lcm_shm_subscription_t *sub = s->subscriptions;
+        s->subscriptions = sub->next;
+        regfree(&sub->regex);
+        free(sub);
+    }
+    close(s->notify_pipe[0]);
+    close(s->notify_pipe[1]);
+    munmap(s->header, s->map_size);
+    pthread_mutex_destroy(&s->lock);
+    free(s->copy);
+    free(s);
+}
+
+static int shm_publish(lcm_shm_t *s, const char *channel, const void *data, unsigned int datalen)
+{
+    lcm_shm_header_t *h = s->header;
+    size_t channel_len = strlen(channel);
+    int64_t size = (sizeof(lcm_shm_record_t) + channel_len + datalen + LCM_SHM_ALIGN - 1) & ~(int64_t) (LCM_SHM_ALIGN - 1);
+    int64_t pos, pad, next;
+
+    if (channel_len > LCM_SHM_MAX_CHANNEL || size > h->capacity / 4) {
+        fprintf(stderr, "# ERROR: lcm_shm: message on %s too large (%u bytes)\n", channel, datalen);
+        return -1;
+    }
+
+    // reserve, with padding when the record would wrap around the end
+    pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+    do {
+        pad = h->capacity - (pos & s->mask);
+        if (pad >= size) pad = 0;
+        next = pos + pad + size;
+    } while (!__atomic_compare_exchange_n(&h->head, &pos, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (pad) {
+        lcm_shm_record_t *r = record_at(s, pos);
+        r->size = pad;
+        r->channel_len = 0;
+        r->data_size = 0;
+        __atomic_store_n(&r->stamp, pos + 1, __ATOMIC_RELEASE);
+        pos += pad;
+    }
+
+    lcm_shm_record_t *r = record_at(s, pos);
+    r->utime = now_usec();
+    r->size = size;
+    r->channel_len = channel_len;
+    r->data_size = datalen;
+    memcpy(r + 1, channel, channel_len);
+    memcpy((uint8_t*) (r + 1) + channel_len, data, datalen);
+    __atomic_store_n(&r->stamp, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&h->futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &h->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    return 0;
+}
+
+static int shm_handle(lcm_shm_t *s)
+{
+    char c;
+    ssize_t status;
+
+    // one byte per message that matched a subscription
+    while ((status = read(s->notify_pipe[0], &c, 1)) < 0 && errno == EINTR);
+    if (status != 1) return -1;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        uint32_t size;
+        record_status_t rs = read_record(s, s->handle_cursor, &size);
+        if (rs == RECORD_LOST) {
+            int64_t head = __atomic_load_n(&s->header->head, __ATOMIC_ACQUIRE);
+            fprintf(stderr, "# WARNING: lcm_shm: reader fell behind, lost %lld bytes of messages\n",
+                    (long long) (head - s->handle_cursor));
+            s->handle_cursor = head;
+            break;
+        }
+        if (rs == RECORD_NOT_READY) {
+            // only after a loss or a stalled publisher, the notifications are ahead
+            int64_t head = __atomic_load_n(&s->header->head, __ATOMIC_ACQUIRE);
+            int64_t resync = __atomic_load_n(&s->notify_resync, __ATOMIC_ACQUIRE);
+            if (head <= s->handle_cursor) break;
+            if (!s->handle_stalled_since) s->handle_stalled_since = now_usec();
+            if (resync <= s->handle_cursor && now_usec() - s->handle_stalled_since <= LCM_SHM_STALL_USEC) break;
+
+            // the publisher of this record died after reserving it, go on
+            // where the notify thread did, or at the head if it did not yet
+            int64_t next = (resync > s->handle_cursor) ? resync : head;
+            fprintf(stderr, "# WARNING: lcm_shm: a publisher stopped in the middle of a message, lost %lld bytes of messages\n",
+                    (long long) (next - s->handle_cursor));
+            s->handle_cursor = next;
+            s->handle_stalled_since = 0;
+            continue;
+        }
+        s->handle_cursor += size;
+        s->handle_stalled_since = 0;
+
+        const lcm_shm_record_t *r = (const lcm_shm_record_t*) s->copy;
+        char channel[LCM_SHM_MAX_CHANNEL + 1];
+        if (!channel_matches(s, r, channel)) continue;
+
+        lcm_recv_buf_t rbuf;
+        rbuf.data = (uint8_t*) (r + 1) + r->channel_len;
+        rbuf.data_size = r->data_size;
+        rbuf.recv_utime = r->utime;
+        rbuf.lcm = (lcm_t*) s;
+
+        // handlers may (un)subscribe, removed subscriptions are freed below
+        s->dispatching++;
+        lcm_shm_subscription_t *sub;
+        for (sub = s->subscriptions; sub; sub = sub->next) {
+            if (!sub->removed && regexec(&sub->regex, channel, 0, NULL, 0) == 0) {
+                sub->handler(&rbuf, channel, sub->userdata);
+            }
+        }
+        s->dispatching--;
+        break;
+    }
+    if (!s->dispatching) {
+        lcm_shm_subscription_t **link = &s->subscriptions;
+        while (*link) {
+            lcm_shm_subscription_t *sub = *link;
+            if (!sub->removed) {
+                link = &sub->next;
+                continue;
+            }
+            *link = sub->next;
+            regfree(&sub->regex);
+            free(sub);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int shm_handle_timeout(lcm_shm_t *s, int timeout_millis)
+{
+    struct pollfd pfd;
+    int status;
+
+    pfd.fd = s->notify_pipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    // a negative timeout blocks like lcm_handle()
+    while ((status = poll(&pfd, 1, timeout_millis)) < 0 && errno == EINTR);
+    if (status <= 0) return status;
+    return (shm_handle(s) == 0) ? 1 : -1;
+}
+
+static lcm_subscription_t *shm_subscribe(lcm_shm_t *s, const char *channel,
+                                         lcm_msg_handler_t handler, void *userdata)
+{
+    lcm_shm_subscription_t *sub = (lcm_shm_subscription_t*) calloc(1, sizeof(lcm_shm_subscription_t));
+    size_t len = strlen(channel) + 5;
+    char *pattern = (char*) malloc(len);
+
+    // LCM channel patterns match the whole channel name
+    snprintf(pattern, len, "^(%s)$", channel);
+    int status = regcomp(&sub->regex, pattern, REG_EXTENDED | REG_NOSUB);
+    free(pattern);
+    if (status != 0) {
+        fprintf(stderr, "# ERROR: lcm_shm: invalid channel pattern %s\n", channel);
+        free(sub);
+        return NULL;
+    }
+    sub->handler = handler;
+    sub->userdata = userdata;
+
+    pthread_mutex_lock(&s->lock);
+    sub->next = s->subscriptions;
+    s->subscriptions = sub;
+    if (!s->notify_started) {
+        if (pthread_create(&s->notify_thread, NULL, notify_thread, s) != 0) {
+            fprintf(stderr, "# ERROR: lcm_shm: Unable to start the receive thread\n");
+        } else {
+            s->notify_started = 1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return (lcm_subscription_t*) sub;
+}
+
+static int shm_unsubscribe(lcm_shm_t *s, lcm_subscription_t *handle)
+{
+    lcm_shm_subscription_t **link;
+    int status = -1;
+
+    pthread_mutex_lock(&s->lock);
+    for (link = &s->subscriptions; *link; link = &(*link)->next) {
+        lcm_shm_subscription_t *sub = *link;
+        if ((lcm_subscription_t*) sub != handle || sub->removed) continue;
+
+        if (s->dispatching) {
+            // a handler unsubscribed, shm_handle() is still iterating the list
+            sub->removed = 1;
+        } else {
+            *link = sub->next;
+            regfree(&sub->regex);
+            free(sub);
+        }
+        status = 0;
+        break;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return status;
+}
+
+/*
+ * LCM API
+ */
+
+lcm_t *lcm_create(const char *url)
+{
+    REAL(lcm_create);
+    const char *shm_url = url;
+
+    if (!shm_url || !*shm_url) shm_url = getenv("LCM_DEFAULT_URL");
+    if (!shm_url || strncmp(shm_url, "shm://", 6) != 0) return real_lcm_create(url);
+
+    lcm_shm_t *s = shm_create(shm_url);
+    if (!s) return NULL;
+
+    pthread_mutex_lock(&instances_lock);
+    int i;
+    for (i = 0; i < LCM_SHM_MAX_INSTANCES; i++) {
+        if (!instances[i]) {
+            __atomic_store_n(&instances[i], s, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&instance_count, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&instances_lock);
+    if (i == LCM_SHM_MAX_INSTANCES) {
+        fprintf(stderr, "# ERROR: lcm_shm: more than %d handles\n", LCM_SHM_MAX_INSTANCES);
+        shm_destroy(s);
+        return NULL;
+    }
+    return (lcm_t*) s;
+}
+
+void lcm_destroy(lcm_t *lcm)
+{
+    REAL(lcm_destroy);
+    lcm_shm_t *s = find_instance(lcm);
+    if (!s) {
+        real_lcm_destroy(lcm);
+        return;
+    }
+
+    pthread_mutex_lock(&instances_lock);
+    int i;
+    for (i = 0; i < LCM_SHM_MAX_INSTANCES; i++) {
+        if (instances[i] == s) {
+            __atomic_store_n(&instances[i], NULL, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&instance_count, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&instances_lock);
+    shm_destroy(s);
+}
+
+int lcm_get_fileno(lcm_t *lcm)
+{
+    REAL(lcm_get_fileno);
+    lcm_shm_t *s = find_instance(lcm);
+    return s ? s->notify_pipe[0] : real_lcm_get_fileno(lcm);
+}
+
+int lcm_publish(lcm_t *lcm, const char *channel, const void *data, unsigned int datalen)
+{
+    REAL(lcm_publish);
+    lcm_shm_t *s = find_instance(lcm);
+    return s ? shm_publish(s, channel, data, datalen) : real_lcm_publish(lcm, channel, data, datalen);
+}
+
+int lcm_handle(lcm_t *lcm)
+{
+    REAL(lcm_handle);
+    lcm_shm_t *s = find_instance(lcm);
+    return s ? shm_handle(s) : real_lcm_handle(lcm);
+}
+
+/*
+ * Not declared by liblcm before 1.0, so the real symbol is only looked up
+ * once a handle of another provider needs it.
+ */
+int lcm_handle_timeout(lcm_t *lcm, int timeout_millis)
+{
+    static int (*real_lcm_handle_timeout)(lcm_t*, int);
+    lcm_shm_t *s = find_instance(lcm);
+    if (s) return shm_handle_timeout(s, timeout_millis);
+    if (!real_lcm_handle_timeout) {
+        real_lcm_handle_timeout = (int (*)(lcm_t*, int)) real_symbol("lcm_handle_timeout");
+    }
+    return real_lcm_handle_timeout(lcm, timeout_millis);
+}
+
+lcm_subscription_t *lcm_subscribe(lcm_t *lcm, const char *channel,
+                                  lcm_msg_handler_t handler, void *userdata)
+{
+    REAL(lcm_subscribe);
+    lcm_shm_t *s = find_instance(lcm);
+    return s ? shm_subscribe(s, channel, handler, userdata) : real_lcm_subscribe(lcm, channel, handler, userdata);
+}
+
+int lcm_unsubscribe(lcm_t *lcm, lcm_subscription_t *handle)
+{
+    REAL(lcm_unsubscribe);
+    lcm_shm_t *s = find_instance(lcm);
+    return s ? shm_unsubscribe(s, handle) : real_lcm_unsubscribe(lcm, handle);
+}
+
+int lcm_subscription_set_queue_capacity(lcm_subscription_t *handle, int num_messages)
+{
+    REAL(lcm_subscription_set_queue_capacity);
+    int i;
+
+    if (__atomic_load_n(&instance_count, __ATOMIC_ACQUIRE) > 0) {
+        pthread_mutex_lock(&instances_lock);
+        for (i = 0; i < LCM_SHM_MAX_INSTANCES; i++) {
+            lcm_shm_t *s = instances[i];
+            lcm_shm_subscription_t *sub;
+            if (!s) continue;
+            pthread_mutex_lock(&s->lock);
+            for (sub = s->subscriptions; sub && (lcm_subscription_t*) sub != handle; sub = sub->next);
+            pthread_mutex_unlock(&s->lock);
+            if (sub) {
+                // the ring is the queue
+                pthread_mutex_unlock(&instances_lock);
+                return 0;
+            }
+        }
+        pthread_mutex_unlock(&instances_lock);
+    }
+    return real_lcm_subscription_set_queue_capacity(handle, num_messages);
+}
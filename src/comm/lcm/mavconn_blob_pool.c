@@ -0,0 +1,451 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Shared memory pool for large extended MAVLink payloads
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mavconn_blob_pool.h"
+#include "mavconn_config.h"
+
+#define BLOB_POOL_MAGIC 0x4d564231      /* "MVB1" */
+#define BLOB_HEADER_SIZE 64
+#define BLOB_MAX_MAPPED 16
+/** Readers wait this many yields for a writer to finish a slot */
+#define BLOB_PIN_SPINS 1000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint32_t alive;             ///< cleared by the owner before it unlinks the pool
+} pool_header_t;
+
+typedef struct {
+    uint32_t generation;        ///< odd while the owner writes the slot
+    uint32_t readers;           ///< pins
+    uint64_t pin_time;          ///< CLOCK_MONOTONIC of the last pin, in microseconds
+    uint32_t length;
+} slot_header_t;
+
+typedef struct {
+    uint32_t pool_id;
+    uint8_t *base;
+    size_t size;
+    uint32_t slot_size;         ///< geometry checked when the pool was mapped, the
+    uint32_t slot_count;        ///< header is writable by other processes
+    uint32_t pins;              ///< payloads pinned in this mapping, it is only unmapped without
+    int retired;                ///< the owner exited, unmapped at the last unpin
+} mapping_t;
+
+/** Pool of this process */
+static pthread_mutex_t own_lock = PTHREAD_MUTEX_INITIALIZER;
+static mapping_t own;
+static uint32_t own_next;
+
+/** Pools of other processes */
+static pthread_mutex_t mapped_lock = PTHREAD_MUTEX_INITIALIZER;
+static mapping_t mapped[BLOB_MAX_MAPPED];
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t slot_stride(uint32_t slot_size)
+{
+    return BLOB_HEADER_SIZE + slot_size;
+}
+
+static size_t pool_size(uint32_t slot_size, uint32_t slot_count)
+{
+    return BLOB_HEADER_SIZE + slot_count * slot_stride(slot_size);
+}
+
+static slot_header_t *slot_at(uint8_t *base, uint32_t slot_size, uint32_t i)
+{
+    return (slot_header_t*) (base + BLOB_HEADER_SIZE + i * slot_stride(slot_size));
+}
+
+static void pool_name(char *buf, size_t len, uint32_t pool_id)
+{
+    snprintf(buf, len, "/mavconn-blob-%u", pool_id);
+}
+
+static void destroy_own_pool(void)
+{
+    char name[32];
+
+    pthread_mutex_lock(&own_lock);
+    if (own.base && own.pool_id == (uint32_t) getpid()) {
+        __atomic_store_n(&((pool_header_t*) own.base)->alive, 0, __ATOMIC_RELEASE);
+        pool_name(name, sizeof(name), own.pool_id);
+        shm_unlink(name);
+    }
+    pthread_mutex_unlock(&own_lock);
+}
+
+/** Called with own_lock held */
+static uint64_t pin_timeout(void)
+{
+    static const mavconn_config_t *cached = NULL;
+    static uint64_t timeout = MAVCONN_BLOB_PIN_TIMEOUT_US;
+    const mavconn_config_t *config = mavconn_config_get();
+
+    if (config != cached) {
+        int value = mavconn_config_int(config, "blobtimeout", 0);
+        timeout = (value > 0) ? (uint64_t) value * 1000000 : MAVCONN_BLOB_PIN_TIMEOUT_US;
+        cached = config;
+    }
+    return timeout;
+}
+
+/** Called with own_lock held */
+static int create_own_pool(void)
+{
+    static int registered = 0;
+    char name[32];
+    size_t size = pool_size(MAVCONN_BLOB_SLOT_SIZE, MAVCONN_BLOB_SLOTS);
+    pool_header_t *header;
+    uint32_t pool_id = (uint32_t) getpid();
+    uint8_t *base;
+    int fd;
+
+    // a forked child must not write into the pool of its parent
+    if (own.base) munmap(own.base, own.size);
+    own.base = NULL;
+
+    pool_name(name, sizeof(name), pool_id);
+    // left behind by an earlier process with the same pid
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0) {
+        fprintf(stderr, "# ERROR: Could not create blob pool %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    // readers of the same group have to pin slots, whatever the umask
+    fchmod(fd, 0660);
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "# ERROR: Could not size blob pool %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    base = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "# ERROR: Could not map blob pool %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return -1;
+    }
+
+    header = (pool_header_t*) base;
+    header->slot_size = MAVCONN_BLOB_SLOT_SIZE;
+    header->slot_count = MAVCONN_BLOB_SLOTS;
+    header->alive = 1;
+    __atomic_store_n(&header->magic, BLOB_POOL_MAGIC, __ATOMIC_RELEASE);
+
+    own.pool_id = pool_id;
+    own.base = base;
+    own.size = size;
+    own.slot_size = MAVCONN_BLOB_SLOT_SIZE;
+    own.slot_count = MAVCONN_BLOB_SLOTS;
+    own_next = 0;
+    if (!registered) {
+        atexit(destroy_own_pool);
+        registered = 1;
+    }
+    return 0;
+}
+
+int mavconn_blob_put(const void *data, uint32_t length, mavconn_blob_handle_t *handle)
+{
+    uint64_t now = now_us();
+    uint64_t timeout;
+    uint32_t tries;
+
+    if (length > MAVCONN_BLOB_SLOT_SIZE) return -1;
+
+    pthread_mutex_lock(&own_lock);
+    if ((!own.base || own.pool_id != (uint32_t) getpid()) && create_own_pool() < 0) {
+        pthread_mutex_unlock(&own_lock);
+        return -1;
+    }
+    timeout = pin_timeout();
+
+    for (tries = 0; tries < MAVCONN_BLOB_SLOTS; tries++) {
+        uint32_t i = own_next;
+        slot_header_t *slot = slot_at(own.base, MAVCONN_BLOB_SLOT_SIZE, i);
+        uint32_t generation;
+        uint32_t readers;
+
+        own_next = (own_next + 1) % MAVCONN_BLOB_SLOTS;
+
+        readers = __atomic_load_n(&slot->readers, __ATOMIC_SEQ_CST);
+        if (readers > 0) {
+            // readers store pin_time before they count themselves, so it
+            // is at least as new as the newest pin counted here
+            if (now - __atomic_load_n(&slot->pin_time, __ATOMIC_SEQ_CST) < timeout) continue;
+            // the reader died with the slot pinned; a new pin since changed
+            // the count and keeps the slot
+            if (!__atomic_compare_exchange_n(&slot->readers, &readers, 0, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) continue;
+        }
+
+        // mark the slot as being written, then check for a reader that
+        // pinned it in the meantime; the reader checks in the opposite order
+        generation = slot->generation;
+        __atomic_store_n(&slot->generation, generation + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->readers, __ATOMIC_SEQ_CST) > 0) {
+            __atomic_store_n(&slot->generation, generation, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        memcpy((uint8_t*) slot + BLOB_HEADER_SIZE, data, length);
+        slot->length = length;
+        __atomic_store_n(&slot->generation, generation + 2, __ATOMIC_RELEASE);
+
+        handle->pool_id = own.pool_id;
+        handle->generation = generation + 2;
+        handle->offset = (uint8_t*) slot + BLOB_HEADER_SIZE - own.base;
+        handle->length = length;
+        pthread_mutex_unlock(&own_lock);
+        return 0;
+    }
+
+    pthread_mutex_unlock(&own_lock);
+    return -1;
+}
+
+/** Called with mapped_lock held, unmaps m unless a payload in it is pinned */
+static void release_mapping(mapping_t *m)
+{
+    if (m->pins > 0) {
+        m->retired = 1;
+        return;
+    }
+    munmap(m->base, m->size);
+    m->base = NULL;
+}
+
+/** Called with mapped_lock held */
+static mapping_t *map_pool(uint32_t pool_id)
+{
+    char name[32];
+    struct stat st;
+    pool_header_t *header;
+    mapping_t *m = NULL;
+    uint8_t *base;
+    uint32_t slot_size, slot_count;
+    int fd, i;
+
+    for (i = 0; i < BLOB_MAX_MAPPED; i++) {
+        if (mapped[i].base && !mapped[i].retired && mapped[i].pool_id == pool_id) {
+            header = (pool_header_t*) mapped[i].base;
+            if (__atomic_load_n(&header->alive, __ATOMIC_ACQUIRE)) return &mapped[i];
+            // the owner exited, its pid may be reused by a new owner
+            release_mapping(&mapped[i]);
+        }
+    }
+
+    pool_name(name, sizeof(name), pool_id);
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < BLOB_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    base = (uint8_t*) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    header = (pool_header_t*) base;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != BLOB_POOL_MAGIC) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    slot_size = __atomic_load_n(&header->slot_size, __ATOMIC_RELAXED);
+    slot_count = __atomic_load_n(&header->slot_count, __ATOMIC_RELAXED);
+    // divided, so that a bogus header cannot overflow the product
+    if (slot_count > ((size_t) st.st_size - BLOB_HEADER_SIZE) / slot_stride(slot_size)) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    // take a free entry, or evict the oldest one without pins
+    for (i = 0; i < BLOB_MAX_MAPPED && !m; i++) {
+        if (!mapped[i].base) m = &mapped[i];
+    }
+    if (!m) {
+        for (i = 0; i < BLOB_MAX_MAPPED && mapped[i].pins > 0; i++);
+        if (i == BLOB_MAX_MAPPED) {
+            munmap(base, st.st_size);
+            return NULL;
+        }
+        munmap(mapped[i].base, mapped[i].size);
+        memmove(&mapped[i], &mapped[i + 1], (BLOB_MAX_MAPPED - 1 - i) * sizeof(mapping_t));
+        m = &mapped[BLOB_MAX_MAPPED - 1];
+    }
+    m->pool_id = pool_id;
+    m->base = base;
+    m->size = st.st_size;
+    m->slot_size = slot_size;
+    m->slot_count = slot_count;
+    m->pins = 0;
+    m->retired = 0;
+    return m;
+}
+
+/** Checks the handle against the pool layout, returns the slot or NULL */
+static slot_header_t *find_slot(const mapping_t *m, const mavconn_blob_handle_t *handle)
+{
+    size_t stride = slot_stride(m->slot_size);
+    uint64_t first = 2 * BLOB_HEADER_SIZE;
+
+    if (handle->offset < first || (handle->offset - first) % stride != 0) return NULL;
+    if ((handle->offset - first) / stride >= m->slot_count) return NULL;
+    if (handle->length > m->slot_size) return NULL;
+    return (slot_header_t*) (m->base + handle->offset - BLOB_HEADER_SIZE);
+}
+
+const void *mavconn_blob_pin(const mavconn_blob_handle_t *handle)
+{
+    mapping_t *m;
+    slot_header_t *slot;
+    uint8_t *base;
+    uint32_t generation;
+    int spins = 0;
+
+    pthread_mutex_lock(&mapped_lock);
+    if (handle->pool_id == own.pool_id && own.base) {
+        // published and received by the same process
+        m = &own;
+    } else {
+        m = map_pool(handle->pool_id);
+    }
+    slot = m ? find_slot(m, handle) : NULL;
+    base = m ? m->base : NULL;
+    // keeps the mapping until mavconn_blob_unpin()
+    if (slot && m != &own) m->pins++;
+    pthread_mutex_unlock(&mapped_lock);
+    if (!slot) return NULL;
+
+    __atomic_store_n(&slot->pin_time, now_us(), __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&slot->readers, 1, __ATOMIC_SEQ_CST);
+    generation = __atomic_load_n(&slot->generation, __ATOMIC_SEQ_CST);
+    while ((generation & 1) && spins++ < BLOB_PIN_SPINS) {
+        sched_yield();
+        generation = __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE);
+    }
+    if (generation != handle->generation || slot->length != handle->length) {
+        mavconn_blob_unpin(base + handle->offset);
+        return NULL;
+    }
+    return base + handle->offset;
+}
+
+/** Called with mapped_lock held, returns the mapping holding p or NULL */
+static mapping_t *find_mapping(const uint8_t *p)
+{
+    int i;
+
+    if (own.base && p >= own.base && p < own.base + own.size) return &own;
+    for (i = 0; i < BLOB_MAX_MAPPED; i++) {
+        if (mapped[i].base && p >= mapped[i].base && p < mapped[i].base + mapped[i].size) return &mapped[i];
+    }
+    return NULL;
+}
+
+void mavconn_blob_unpin(const void *payload)
+{
+    const uint8_t *p = (const uint8_t*) payload;
+    mapping_t *m;
+    slot_header_t *slot;
+    uint32_t readers;
+
+    pthread_mutex_lock(&mapped_lock);
+    m = find_mapping(p);
+    if (!m) {
+        pthread_mutex_unlock(&mapped_lock);
+        return;
+    }
+    slot = (slot_header_t*) (p - BLOB_HEADER_SIZE);
+
+    // the owner may have reset the pin after a timeout
+    readers = __atomic_load_n(&slot->readers, __ATOMIC_RELAXED);
+    while (readers > 0 &&
+           !__atomic_compare_exchange_n(&slot->readers, &readers, readers - 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (m != &own && --m->pins == 0 && m->retired) {
+        munmap(m->base, m->size);
+        m->base = NULL;
+    }
+    pthread_mutex_unlock(&mapped_lock);
+}
+
+static void encode_uint32(uint8_t *b, uint32_t v)
+{
+    b[0] = (uint8_t) (v >> 24);
+    b[1] = (uint8_t) (v >> 16);
+    b[2] = (uint8_t) (v >> 8);
+    b[3] = (uint8_t) v;
+}
+
+static uint32_t decode_uint32(const uint8_t *b)
+{
+    return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3];
+}
+
+void mavconn_blob_handle_encode(uint8_t *buf, const mavconn_blob_handle_t *handle)
+{
+    encode_uint32(buf, handle->pool_id);
+    encode_uint32(buf + 4, handle->generation);
+    encode_uint32(buf + 8, (uint32_t) (handle->offset >> 32));
+    encode_uint32(buf + 12, (uint32_t) handle->offset);
+    encode_uint32(buf + 16, handle->length);
+}
+
+void mavconn_blob_handle_decode(const uint8_t *buf, mavconn_blob_handle_t *handle)
+{
+    handle->pool_id = decode_uint32(buf);
+    handle->generation = decode_uint32(buf + 4);
+    handle->offset = ((uint64_t) decode_uint32(buf + 8) << 32) | decode_uint32(buf + 12);
+    handle->length = decode_uint32(buf + 16);
+}
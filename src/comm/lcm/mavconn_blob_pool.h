@@ -0,0 +1,97 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Shared memory pool for large extended MAVLink payloads
+*
+*   Every publishing process owns one pool, the POSIX shared memory
+*   object /mavconn-blob-<pid>, made of MAVCONN_BLOB_SLOTS slots of
+*   MAVCONN_BLOB_SLOT_SIZE bytes. A payload is copied into a slot once
+*   and only its handle is published on LCM; receivers on the same host
+*   map the pool and read the payload in place. Pinning writes to the
+*   pool, so it is only shared with processes of the owner's group.
+*
+*   Each slot carries a generation, odd while the slot is being written.
+*   Readers pin a slot while they use it and the owner skips pinned slots,
+*   so a payload is never overwritten under a reader. A pin older than
+*   "blobtimeout <seconds>" in mavconn.conf, MAVCONN_BLOB_PIN_TIMEOUT_US
+*   by default, is considered left behind by a crashed reader and ignored,
+*   so it has to be longer than any handler takes.
+*
+*/
+
+#ifndef _mavconn_blob_pool_h
+#define _mavconn_blob_pool_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAVCONN_BLOB_SLOT_SIZE 65536
+#define MAVCONN_BLOB_SLOTS 32
+#define MAVCONN_BLOB_PIN_TIMEOUT_US 30000000
+
+/** Size of an encoded handle */
+#define MAVCONN_BLOB_HANDLE_SIZE 20
+
+typedef struct {
+    uint32_t pool_id;       ///< pid of the owner
+    uint32_t generation;    ///< generation of the slot when it was written
+    uint64_t offset;        ///< offset of the payload in the pool
+    uint32_t length;        ///< payload length in bytes
+} mavconn_blob_handle_t;
+
+/**
+ * Copies data into the pool of this process, creating it on first use.
+ *
+ * @return 0 on success, -1 if the payload does not fit into a slot, every
+ *         slot is pinned or the pool could not be created
+ */
+int mavconn_blob_put(const void *data, uint32_t length, mavconn_blob_handle_t *handle);
+
+/**
+ * Pins the payload of a handle. The pool stays mapped while any of its
+ * payloads is pinned, even if its owner exits.
+ *
+ * @return the payload, valid until mavconn_blob_unpin(), or NULL if the
+ *         pool is gone, the slot was reused since or the pools of too many
+ *         processes are pinned
+ */
+const void *mavconn_blob_pin(const mavconn_blob_handle_t *handle);
+
+/** Releases a payload returned by mavconn_blob_pin() */
+void mavconn_blob_unpin(const void *payload);
+
+/** Writes handle as MAVCONN_BLOB_HANDLE_SIZE big endian bytes */
+void mavconn_blob_handle_encode(uint8_t *buf, const mavconn_blob_handle_t *handle);
+void mavconn_blob_handle_decode(const uint8_t *buf, mavconn_blob_handle_t *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,351 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Host configuration, /etc/mavconn/mavconn.conf
+*
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "mavconn_config.h"
+
+#define CONFIG_MAGIC 0x4d56434631LL     /* "MVCF1" */
+#define CONFIG_MAX_ENTRIES 64
+#define CONFIG_KEY_LEN 32
+#define CONFIG_VALUE_LEN 96
+#define CONFIG_SNAPSHOT_DIR "/dev/shm"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+typedef struct {
+    char key[CONFIG_KEY_LEN];
+    char value[CONFIG_VALUE_LEN];
+    int32_t int_value;
+    int32_t is_int;
+} config_entry_t;
+
+/** Mapped as it is, so it only holds fixed size fields */
+struct _mavconn_config_t {
+    int64_t magic;
+    // identifies the version of the file the snapshot was made from
+    int64_t source_ino;
+    int64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    int32_t source_present;
+    int32_t count;
+    config_entry_t entries[CONFIG_MAX_ENTRIES];
+};
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static const mavconn_config_t *current;
+static char config_path[PATH_MAX];
+static char snapshot_path[PATH_MAX];
+
+static void stamp(mavconn_config_t *c, const struct stat *st)
+{
+    c->source_present = (st != NULL);
+    c->source_ino = st ? (int64_t) st->st_ino : 0;
+    c->source_size = st ? (int64_t) st->st_size : 0;
+    c->source_mtime_sec = st ? (int64_t) st->st_mtim.tv_sec : 0;
+    c->source_mtime_nsec = st ? (int64_t) st->st_mtim.tv_nsec : 0;
+}
+
+static int same_stamp(const mavconn_config_t *a, const mavconn_config_t *b)
+{
+    return a->source_present == b->source_present && a->source_ino == b->source_ino &&
+           a->source_size == b->source_size && a->source_mtime_sec == b->source_mtime_sec &&
+           a->source_mtime_nsec == b->source_mtime_nsec;
+}
+
+static void parse(mavconn_config_t *c, FILE *f)
+{
+    char line[256];
+
+    while (fgets(line, sizeof(line), f)) {
+        char *key = line, *value, *end;
+        config_entry_t *e;
+        long v;
+        int i, ch;
+
+        if (!strchr(line, '\n') && !feof(f)) {
+            fprintf(stderr, "# WARNING: Line too long in %s, ignoring %.*s\n",
+                    config_path, CONFIG_KEY_LEN, line);
+            while ((ch = fgetc(f)) != EOF && ch != '\n');
+            continue;
+        }
+        while (isspace((unsigned char) *key)) key++;
+        if (*key == '\0' || *key == '#') continue;
+        value = key;
+        while (*value && !isspace((unsigned char) *value)) value++;
+        if (*value) *value++ = '\0';
+        while (isspace((unsigned char) *value)) value++;
+        end = value + strlen(value);
+        while (end > value && isspace((unsigned char) end[-1])) *--end = '\0';
+        // truncating would merge keys with the same prefix
+        if (strlen(key) >= CONFIG_KEY_LEN || (size_t) (end - value) >= CONFIG_VALUE_LEN) {
+            fprintf(stderr, "# WARNING: Key or value too long in %s, ignoring %.*s\n",
+                    config_path, CONFIG_KEY_LEN, key);
+            continue;
+        }
+
+        // a later line overrides an earlier one
+        for (i = 0; i < c->count && strcmp(c->entries[i].key, key) != 0; i++);
+        if (i == c->count) {
+            if (c->count == CONFIG_MAX_ENTRIES) {
+                fprintf(stderr, "# WARNING: More than %d keys in %s, ignoring %s\n",
+                        CONFIG_MAX_ENTRIES, config_path, key);
+                continue;
+            }
+            c->count++;
+        }
+        e = &c->entries[i];
+        memcpy(e->key, key, strlen(key) + 1);
+        memcpy(e->value, value, end - value + 1);
+        errno = 0;
+        v = strtol(value, &end, 10);
+        e->is_int = (end != value && *end == '\0' && errno == 0 && v >= INT32_MIN && v <= INT32_MAX);
+        e->int_value = e->is_int ? (int32_t) v : 0;
+    }
+}
+
+/**
+ * Maps the shared snapshot if it was made from the file described by want.
+ * The path is known to everyone, so only a snapshot of this user or root
+ * that no one else can write is trusted.
+ */
+static const mavconn_config_t *map_snapshot(const mavconn_config_t *want)
+{
+    struct stat st;
+    mavconn_config_t *c;
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != (off_t) sizeof(mavconn_config_t) ||
+        (st.st_uid != geteuid() && st.st_uid != 0) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        close(fd);
+        return NULL;
+    }
+    c = (mavconn_config_t*) mmap(NULL, sizeof(mavconn_config_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (c == MAP_FAILED) return NULL;
+    if (c->magic != CONFIG_MAGIC || !same_stamp(c, want) ||
+        c->count < 0 || c->count > CONFIG_MAX_ENTRIES) {
+        munmap(c, sizeof(mavconn_config_t));
+        return NULL;
+    }
+    return c;
+}
+
+/** Writes the snapshot for other processes and maps it, falls back to a private copy */
+static const mavconn_config_t *publish_snapshot(mavconn_config_t *c)
+{
+    char tmp[sizeof(snapshot_path) + 8];
+    const mavconn_config_t *mapped;
+    int fd;
+
+    // a predictable name in a shared directory could be a planted symlink
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", snapshot_path);
+    fd = mkstemp(tmp);
+    if (fd >= 0) {
+        if (fchmod(fd, 0644) == 0 && write(fd, c, sizeof(*c)) == (ssize_t) sizeof(*c) &&
+            rename(tmp, snapshot_path) == 0) {
+            mapped = (const mavconn_config_t*) mmap(NULL, sizeof(*c), PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapped != MAP_FAILED) {
+                free(c);
+                return mapped;
+            }
+        } else {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    // no /dev/shm, or not writable for this user
+    return c;
+}
+
+static const mavconn_config_t *load(void)
+{
+    mavconn_config_t *c = (mavconn_config_t*) calloc(1, sizeof(mavconn_config_t));
+    const mavconn_config_t *shared;
+    struct stat st;
+    FILE *f;
+
+    if (!c) return NULL;
+    c->magic = CONFIG_MAGIC;
+
+    f = fopen(config_path, "r");
+    if (f && fstat(fileno(f), &st) == 0) {
+        stamp(c, &st);
+    } else {
+        stamp(c, NULL);
+    }
+
+    shared = map_snapshot(c);
+    if (shared) {
+        if (f) fclose(f);
+        free(c);
+        return shared;
+    }
+
+    if (f) {
+        parse(c, f);
+        fclose(f);
+    }
+    return publish_snapshot(c);
+}
+
+#ifdef __linux__
+/** Whether the file still is the one the current snapshot was made from */
+static int unchanged(void)
+{
+    mavconn_config_t now;
+    struct stat st;
+
+    stamp(&now, stat(config_path, &st) == 0 ? &st : NULL);
+    return same_stamp(&now, __atomic_load_n(&current, __ATOMIC_ACQUIRE));
+}
+
+static void *watch(void *arg)
+{
+    char dir[PATH_MAX];
+    const char *name;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    char *slash;
+    int fd;
+
+    snprintf(dir, sizeof(dir), "%s", config_path);
+    slash = strrchr(dir, '/');
+    if (slash == dir) slash[1] = '\0';
+    else if (slash) *slash = '\0';
+    else snprintf(dir, sizeof(dir), ".");
+    name = strrchr(config_path, '/') ? strrchr(config_path, '/') + 1 : config_path;
+
+    fd = inotify_init();
+    // watch the directory, editors replace the file instead of writing it
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                    IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        ssize_t i;
+        int changed = 0;
+
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < len; ) {
+            const struct inotify_event *ev = (const struct inotify_event*) (buf + i);
+            if (ev->len > 0 && strcmp(ev->name, name) == 0) changed = 1;
+            i += sizeof(struct inotify_event) + ev->len;
+        }
+        if (changed && !unchanged()) {
+            const mavconn_config_t *c = load();
+            // the old snapshot stays mapped, readers may still use it
+            if (c) __atomic_store_n(&current, c, __ATOMIC_RELEASE);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+#endif
+
+static void init(void)
+{
+    const char *path = getenv("MAVCONN_CONFIG");
+    unsigned hash = 5381;
+    const char *p;
+    static mavconn_config_t empty;
+
+    snprintf(config_path, sizeof(config_path), "%s", (path && *path) ? path : MAVCONN_CONFIG_FILE);
+    // one snapshot per configuration file
+    for (p = config_path; *p; p++) hash = hash * 33 + (unsigned char) *p;
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/mavconn-config-%08x", CONFIG_SNAPSHOT_DIR, hash);
+
+    current = load();
+    if (!current) {
+        empty.magic = CONFIG_MAGIC;
+        current = &empty;
+    }
+
+#ifdef __linux__
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, watch, NULL) != 0)
+            fprintf(stderr, "# WARNING: Could not watch %s for changes\n", config_path);
+        pthread_attr_destroy(&attr);
+    }
+#endif
+}
+
+const mavconn_config_t *mavconn_config_get(void)
+{
+    pthread_once(&config_once, init);
+    return __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+}
+
+static const config_entry_t *find(const mavconn_config_t *config, const char *key)
+{
+    int i;
+    for (i = 0; i < config->count; i++) {
+        if (strcmp(config->entries[i].key, key) == 0) return &config->entries[i];
+    }
+    return NULL;
+}
+
+int mavconn_config_int(const mavconn_config_t *config, const char *key, int default_value)
+{
+    const config_entry_t *e = find(config, key);
+    return (e && e->is_int) ? e->int_value : default_value;
+}
+
+const char *mavconn_config_string(const mavconn_config_t *config, const char *key, const char *default_value)
+{
+    const config_entry_t *e = find(config, key);
+    return e ? e->value : default_value;
+}
@@ -0,0 +1,72 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Host configuration, /etc/mavconn/mavconn.conf
+*
+*   The file holds one "key value" pair per line, lines starting with #
+*   are comments. Keys longer than 31 and values longer than 95
+*   characters are ignored with a warning. The file is parsed into an
+*   immutable snapshot, which is written to /dev/shm and mapped read-only,
+*   so the processes of a host parse it only once between changes.
+*   MAVCONN_CONFIG overrides the path of the file.
+*
+*   On Linux a thread watches the file with inotify and replaces the
+*   current snapshot when it changes. Snapshots are never unmapped, so a
+*   pointer returned by mavconn_config_get() stays valid; comparing it
+*   with an earlier one tells whether anything changed.
+*
+*/
+
+#ifndef _mavconn_config_h
+#define _mavconn_config_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAVCONN_CONFIG_FILE "/etc/mavconn/mavconn.conf"
+
+typedef struct _mavconn_config_t mavconn_config_t;
+
+/**
+ * @return the current snapshot, never NULL. Only the first call reads
+ *         files, later calls are an atomic load.
+ */
+const mavconn_config_t *mavconn_config_get(void);
+
+/** @return the value of key if it is an integer, default_value otherwise */
+int mavconn_config_int(const mavconn_config_t *config, const char *key, int default_value);
+
+/** @return the value of key, default_value if it is not set */
+const char *mavconn_config_string(const mavconn_config_t *config, const char *key, const char *default_value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Partitioned LCM channel layout for MAVLink messages
+*
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <pixhawk/mavlink.h>
+#include "mavconn_mavlink_channels.h"
+
+static const char *class_names[MAVCONN_CHANNEL_CLASS_COUNT] = {
+    "TELEM", "CMD", "PARAM", "MISSION", "IMAGE"
+};
+
+/** "MAVLINK/255/MISSION" */
+#define CHANNEL_NAME_MAX 20
+
+static uint8_t classes[256];
+static char names[256][MAVCONN_CHANNEL_CLASS_COUNT][CHANNEL_NAME_MAX];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+#define ROUTE(id, cls) classes[id] = cls
+
+static void init_tables(void)
+{
+    int sysid, cls;
+
+    // everything not listed is MAVCONN_CHANNEL_TELEM
+    // heartbeats are liveness, they travel with the commands
+#ifdef MAVLINK_MSG_ID_HEARTBEAT
+    ROUTE(MAVLINK_MSG_ID_HEARTBEAT, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_PING
+    ROUTE(MAVLINK_MSG_ID_PING, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_SET_MODE
+    ROUTE(MAVLINK_MSG_ID_SET_MODE, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_COMMAND
+    ROUTE(MAVLINK_MSG_ID_COMMAND, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_COMMAND_LONG
+    ROUTE(MAVLINK_MSG_ID_COMMAND_LONG, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_COMMAND_ACK
+    ROUTE(MAVLINK_MSG_ID_COMMAND_ACK, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_REQUEST_DATA_STREAM
+    ROUTE(MAVLINK_MSG_ID_REQUEST_DATA_STREAM, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_SET_GPS_GLOBAL_ORIGIN
+    ROUTE(MAVLINK_MSG_ID_SET_GPS_GLOBAL_ORIGIN, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_SET_POSITION_CONTROL_OFFSET
+    ROUTE(MAVLINK_MSG_ID_SET_POSITION_CONTROL_OFFSET, MAVCONN_CHANNEL_CMD);
+#endif
+#ifdef MAVLINK_MSG_ID_WATCHDOG_COMMAND
+    ROUTE(MAVLINK_MSG_ID_WATCHDOG_COMMAND, MAVCONN_CHANNEL_CMD);
+#endif
+
+#ifdef MAVLINK_MSG_ID_PARAM_REQUEST_READ
+    ROUTE(MAVLINK_MSG_ID_PARAM_REQUEST_READ, MAVCONN_CHANNEL_PARAM);
+#endif
+#ifdef MAVLINK_MSG_ID_PARAM_REQUEST_LIST
+    ROUTE(MAVLINK_MSG_ID_PARAM_REQUEST_LIST, MAVCONN_CHANNEL_PARAM);
+#endif
+#ifdef MAVLINK_MSG_ID_PARAM_VALUE
+    ROUTE(MAVLINK_MSG_ID_PARAM_VALUE, MAVCONN_CHANNEL_PARAM);
+#endif
+#ifdef MAVLINK_MSG_ID_PARAM_SET
+    ROUTE(MAVLINK_MSG_ID_PARAM_SET, MAVCONN_CHANNEL_PARAM);
+#endif
+
+#ifdef MAVLINK_MSG_ID_MISSION_ITEM
+    ROUTE(MAVLINK_MSG_ID_MISSION_ITEM, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_REQUEST
+    ROUTE(MAVLINK_MSG_ID_MISSION_REQUEST, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_SET_CURRENT
+    ROUTE(MAVLINK_MSG_ID_MISSION_SET_CURRENT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_CURRENT
+    ROUTE(MAVLINK_MSG_ID_MISSION_CURRENT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_REQUEST_LIST
+    ROUTE(MAVLINK_MSG_ID_MISSION_REQUEST_LIST, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_COUNT
+    ROUTE(MAVLINK_MSG_ID_MISSION_COUNT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_CLEAR_ALL
+    ROUTE(MAVLINK_MSG_ID_MISSION_CLEAR_ALL, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_ITEM_REACHED
+    ROUTE(MAVLINK_MSG_ID_MISSION_ITEM_REACHED, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_MISSION_ACK
+    ROUTE(MAVLINK_MSG_ID_MISSION_ACK, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_REQUEST
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_REQUEST, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_SET_CURRENT
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_SET_CURRENT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_CURRENT
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_CURRENT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_REQUEST_LIST
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_REQUEST_LIST, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_COUNT
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_COUNT, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_CLEAR_ALL
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_CLEAR_ALL, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_REACHED
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_REACHED, MAVCONN_CHANNEL_MISSION);
+#endif
+#ifdef MAVLINK_MSG_ID_WAYPOINT_ACK
+    ROUTE(MAVLINK_MSG_ID_WAYPOINT_ACK, MAVCONN_CHANNEL_MISSION);
+#endif
+
+#ifdef MAVLINK_MSG_ID_IMAGE_AVAILABLE
+    ROUTE(MAVLINK_MSG_ID_IMAGE_AVAILABLE, MAVCONN_CHANNEL_IMAGE);
+#endif
+#ifdef MAVLINK_MSG_ID_IMAGE_TRIGGERED
+    ROUTE(MAVLINK_MSG_ID_IMAGE_TRIGGERED, MAVCONN_CHANNEL_IMAGE);
+#endif
+#ifdef MAVLINK_MSG_ID_IMAGE_TRIGGER_CONTROL
+    ROUTE(MAVLINK_MSG_ID_IMAGE_TRIGGER_CONTROL, MAVCONN_CHANNEL_IMAGE);
+#endif
+#ifdef MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE
+    ROUTE(MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE, MAVCONN_CHANNEL_IMAGE);
+#endif
+#ifdef MAVLINK_MSG_ID_ENCAPSULATED_DATA
+    ROUTE(MAVLINK_MSG_ID_ENCAPSULATED_DATA, MAVCONN_CHANNEL_IMAGE);
+#endif
+
+    for (sysid = 0; sysid < 256; sysid++) {
+        for (cls = 0; cls < MAVCONN_CHANNEL_CLASS_COUNT; cls++) {
+            snprintf(names[sysid][cls], CHANNEL_NAME_MAX, "MAVLINK/%d/%s", sysid, class_names[cls]);
+        }
+    }
+}
+
+mavconn_channel_class_t mavconn_channel_class(uint8_t msgid)
+{
+    pthread_once(&tables_once, init_tables);
+    return (mavconn_channel_class_t) classes[msgid];
+}
+
+const char *mavconn_channel_name(uint8_t sysid, mavconn_channel_class_t cls)
+{
+    pthread_once(&tables_once, init_tables);
+    return names[sysid][cls];
+}
+
+static int append_classes(char *buf, size_t len, size_t *pos, const char *system, unsigned mask)
+{
+    int cls, n;
+    const char *sep = "";
+
+    n = snprintf(buf + *pos, len - *pos, "%sMAVLINK/%s/(", (*pos > 0) ? "|" : "", system);
+    if (n < 0 || (size_t) n >= len - *pos) return -1;
+    *pos += n;
+    for (cls = 0; cls < MAVCONN_CHANNEL_CLASS_COUNT; cls++) {
+        if (!(mask & MAVCONN_CHANNEL_MASK(cls))) continue;
+        n = snprintf(buf + *pos, len - *pos, "%s%s", sep, class_names[cls]);
+        if (n < 0 || (size_t) n >= len - *pos) return -1;
+        *pos += n;
+        sep = "|";
+    }
+    n = snprintf(buf + *pos, len - *pos, ")");
+    if (n < 0 || (size_t) n >= len - *pos) return -1;
+    *pos += n;
+    return 0;
+}
+
+int mavconn_channel_pattern(char *buf, size_t len, unsigned classes, uint8_t sysid, unsigned own_classes)
+{
+    char system[4];
+    size_t pos = 0;
+
+    if (len == 0) return -1;
+    buf[0] = '\0';
+    classes &= MAVCONN_CHANNEL_ALL;
+    // own classes already received from every system need no extra term
+    own_classes &= MAVCONN_CHANNEL_ALL & ~classes;
+
+    if (classes && append_classes(buf, len, &pos, "[0-9]+", classes) < 0) return -1;
+    snprintf(system, sizeof(system), "%d", sysid);
+    if (own_classes && append_classes(buf, len, &pos, system, own_classes) < 0) return -1;
+    return pos;
+}
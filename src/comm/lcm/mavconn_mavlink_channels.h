@@ -0,0 +1,98 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+
+/**
+* @file
+*   @brief Partitioned LCM channel layout for MAVLink messages
+*
+*   By default every MAVLink message is published on MAVLINK_MAIN and
+*   every subscriber filters in its handler. The partitioned layout
+*   publishes each message on a channel named after its sending system
+*   and its message class instead:
+*
+*     MAVLINK/<sysid>/TELEM      state and sensor data, the default class
+*     MAVLINK/<sysid>/CMD        commands, modes, stream requests, pings,
+*                                heartbeats
+*     MAVLINK/<sysid>/PARAM      the parameter protocol
+*     MAVLINK/<sysid>/MISSION    the mission (waypoint) protocol
+*     MAVLINK/<sysid>/IMAGE      image transfers and camera triggers
+*
+*   Subscribers pick their channels with an LCM channel regex, see
+*   mavconn_channel_pattern(). The message class of each msgid is taken
+*   from a table, unknown messages are telemetry. Announcements of images
+*   in shared memory stay on their own MAVLINK_IMAGES channel.
+*
+*/
+
+#ifndef _mavconn_mavlink_channels_h
+#define _mavconn_mavlink_channels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    MAVCONN_CHANNEL_TELEM,
+    MAVCONN_CHANNEL_CMD,
+    MAVCONN_CHANNEL_PARAM,
+    MAVCONN_CHANNEL_MISSION,
+    MAVCONN_CHANNEL_IMAGE,
+    MAVCONN_CHANNEL_CLASS_COUNT
+} mavconn_channel_class_t;
+
+#define MAVCONN_CHANNEL_MASK(c) (1u << (c))
+#define MAVCONN_CHANNEL_ALL ((1u << MAVCONN_CHANNEL_CLASS_COUNT) - 1)
+
+/** Which channels messages are published on */
+typedef enum {
+    MAVCONN_CHANNELS_LEGACY = 0,        ///< MAVLINK_MAIN only
+    MAVCONN_CHANNELS_MIRROR = 1,        ///< partitioned channels and MAVLINK_MAIN for old subscribers
+    MAVCONN_CHANNELS_PARTITIONED = 2    ///< partitioned channels only
+} mavconn_channel_layout_t;
+
+mavconn_channel_class_t mavconn_channel_class(uint8_t msgid);
+
+/**
+ * @return "MAVLINK/<sysid>/<class>", a static string
+ */
+const char *mavconn_channel_name(uint8_t sysid, mavconn_channel_class_t cls);
+
+/**
+ * Writes the LCM channel regex for the given classes.
+ *
+ * @param classes classes received from every system, MAVCONN_CHANNEL_MASK() bits
+ * @param sysid system for own_classes
+ * @param own_classes classes received only from sysid
+ * @return length of the pattern, -1 if it did not fit into buf
+ */
+int mavconn_channel_pattern(char *buf, size_t len, unsigned classes, uint8_t sysid, unsigned own_classes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
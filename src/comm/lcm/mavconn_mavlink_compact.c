@@ -0,0 +1,318 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Compact LCM encoding of mavconn_mavlink_msg_container_t
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mavconn_mavlink_compact.h"
+
+/** Largest container that is encoded on the stack when publishing */
+#define COMPACT_STACK_BUFFER 512
+
+static void encode_int64(uint8_t *b, int64_t v)
+{
+    int i;
+    for (i = 7; i >= 0; i--) {
+        b[i] = (uint8_t) v;
+        v >>= 8;
+    }
+}
+
+static int64_t decode_int64(const uint8_t *b)
+{
+    int64_t v = 0;
+    int i;
+    for (i = 0; i < 8; i++)
+        v = (v << 8) | b[i];
+    return v;
+}
+
+int mavconn_mavlink_compact_encoded_size(const mavconn_mavlink_msg_container_t *p)
+{
+    return MAVCONN_MAVLINK_COMPACT_OVERHEAD + (uint8_t) p->msg.len + p->extended_payload_len;
+}
+
+/**
+ * Encodes everything after the fingerprint, which is also the layout of a
+ * record in a batch.
+ */
+static int encode_record(uint8_t *b, int maxlen, int8_t link_network_source, int8_t link_component_id,
+                         const mavconn_mavlink_message_t *msg, const int8_t *extended_payload, int32_t ext)
+{
+    const uint8_t *payload = (const uint8_t*) msg->payload64;
+    uint8_t len = (uint8_t) msg->len;
+    int size = MAVCONN_MAVLINK_COMPACT_OVERHEAD - 8 + len + ext;
+
+    if (maxlen < size || ext < 0) return -1;
+
+    *b++ = (uint8_t) link_network_source;
+    *b++ = (uint8_t) link_component_id;
+    *b++ = (uint8_t) msg->magic;
+    *b++ = len;
+    *b++ = (uint8_t) msg->seq;
+    *b++ = (uint8_t) msg->sysid;
+    *b++ = (uint8_t) msg->compid;
+    *b++ = (uint8_t) msg->msgid;
+    memcpy(b, payload, len);
+    b += len;
+    *b++ = (uint8_t) (msg->checksum & 0xFF);
+    *b++ = (uint8_t) ((uint16_t) msg->checksum >> 8);
+    *b++ = (uint8_t) (ext >> 24);
+    *b++ = (uint8_t) (ext >> 16);
+    *b++ = (uint8_t) (ext >> 8);
+    *b++ = (uint8_t) ext;
+    if (ext > 0) memcpy(b, extended_payload, ext);
+
+    return size;
+}
+
+static int decode_record(const uint8_t *b, int maxlen, mavconn_mavlink_msg_container_t *p)
+{
+    uint8_t *payload = (uint8_t*) p->msg.payload64;
+    const int overhead = MAVCONN_MAVLINK_COMPACT_OVERHEAD - 8;
+    uint8_t len;
+    int32_t ext;
+
+    if (maxlen < overhead) return -1;
+
+    len = b[3];
+    if (maxlen < overhead + len) return -1;
+
+    p->link_network_source = (int8_t) *b++;
+    p->link_component_id = (int8_t) *b++;
+    p->msg.magic = (int8_t) *b++;
+    p->msg.len = (int8_t) *b++;
+    p->msg.seq = (int8_t) *b++;
+    p->msg.sysid = (int8_t) *b++;
+    p->msg.compid = (int8_t) *b++;
+    p->msg.msgid = (int8_t) *b++;
+    // the checksum also follows the payload, as after mavlink_parse_char()
+    memcpy(payload, b, len + 2);
+    p->msg.checksum = (int16_t) (b[len] | (b[len + 1] << 8));
+    b += len + 2;
+
+    ext = (int32_t) (((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+    b += 4;
+    if (ext < 0 || maxlen - overhead - len < ext) return -1;
+    p->extended_payload_len = ext;
+    p->extended_payload = (int8_t*) b;
+
+    return overhead + len + ext;
+}
+
+int mavconn_mavlink_compact_encode(void *buf, int offset, int maxlen, const mavconn_mavlink_msg_container_t *p)
+{
+    uint8_t *b = (uint8_t*) buf + offset;
+    int size;
+
+    if (maxlen < 8) return -1;
+    size = encode_record(b + 8, maxlen - 8, p->link_network_source, p->link_component_id,
+                         &p->msg, p->extended_payload, p->extended_payload_len);
+    if (size < 0) return -1;
+    encode_int64(b, MAVCONN_MAVLINK_COMPACT_FINGERPRINT);
+
+    return 8 + size;
+}
+
+int mavconn_mavlink_compact_decode(const void *buf, int offset, int maxlen, mavconn_mavlink_msg_container_t *p)
+{
+    const uint8_t *b = (const uint8_t*) buf + offset;
+    int size;
+
+    if (maxlen < MAVCONN_MAVLINK_COMPACT_OVERHEAD) return -1;
+    if (decode_int64(b) != MAVCONN_MAVLINK_COMPACT_FINGERPRINT) return -1;
+
+    size = decode_record(b + 8, maxlen - 8, p);
+    return (size < 0) ? -1 : 8 + size;
+}
+
+int mavconn_mavlink_compact_publish(lcm_t *lc, const char *channel, const mavconn_mavlink_msg_container_t *p)
+{
+    uint8_t stack_buf[COMPACT_STACK_BUFFER];
+    int max_data_size = mavconn_mavlink_compact_encoded_size(p);
+    uint8_t *buf = stack_buf;
+    if (max_data_size > COMPACT_STACK_BUFFER) {
+        // extended messages
+        buf = (uint8_t*) malloc(max_data_size);
+        if (!buf) return -1;
+    }
+    int data_size = mavconn_mavlink_compact_encode(buf, 0, max_data_size, p);
+    int status = (data_size < 0) ? data_size : lcm_publish(lc, channel, buf, data_size);
+    if (buf != stack_buf) free(buf);
+    return status;
+}
+
+int mavconn_mavlink_compact_publish_batch(lcm_t *lc, const char *channel, int8_t link_network_source,
+                                          const mavconn_mavlink_message_t *msgs, int count)
+{
+    // one buffer per thread, publishers need neither locks nor malloc
+    static __thread uint8_t buf[MAVCONN_MAVLINK_COMPACT_BATCH_MAX];
+    // batches beyond an LCM short message would be fragmented, and losing
+    // one fragment loses all of their messages
+    int limit = MAVCONN_MAVLINK_COMPACT_BATCH_MAX - (int) strlen(channel);
+    int size = 8;
+    int i;
+
+    encode_int64(buf, MAVCONN_MAVLINK_COMPACT_BATCH_FINGERPRINT);
+    for (i = 0; i < count; i++) {
+        int record = encode_record(buf + size, limit - size, link_network_source, 0, &msgs[i], NULL, 0);
+        if (record < 0) {
+            // full, a MAVLink frame always fits into an empty batch
+            int status = lcm_publish(lc, channel, buf, size);
+            if (status != 0) return status;
+            size = 8;
+            record = encode_record(buf + size, limit - size, link_network_source, 0, &msgs[i], NULL, 0);
+        }
+        size += record;
+    }
+    if (size > 8) return lcm_publish(lc, channel, buf, size);
+    return 0;
+}
+
+int mavconn_mavlink_compact_publish_blob(lcm_t *lc, const char *channel, const mavconn_mavlink_msg_container_t *p,
+                                         const mavconn_blob_handle_t *blob)
+{
+    uint8_t buf[COMPACT_STACK_BUFFER];
+    int size = encode_record(buf + 8, sizeof(buf) - 8, p->link_network_source, p->link_component_id,
+                             &p->msg, NULL, 0);
+    if (size < 0) return -1;
+    encode_int64(buf, MAVCONN_MAVLINK_COMPACT_BLOB_FINGERPRINT);
+    mavconn_blob_handle_encode(buf + 8 + size, blob);
+    return lcm_publish(lc, channel, buf, 8 + size + MAVCONN_BLOB_HANDLE_SIZE);
+}
+
+struct _mavconn_mavlink_compact_subscription_t {
+    mavconn_mavlink_msg_container_t_handler_t user_handler;
+    void *userdata;
+    lcm_subscription_t *lc_h;
+};
+
+static
+void mavconn_mavlink_compact_handler_stub(const lcm_recv_buf_t *rbuf,
+                            const char *channel, void *userdata)
+{
+    mavconn_mavlink_compact_subscription_t *h = (mavconn_mavlink_compact_subscription_t*) userdata;
+    mavconn_mavlink_msg_container_t p;
+    memset(&p, 0, sizeof(mavconn_mavlink_msg_container_t));
+
+    if (mavconn_mavlink_compact_decode(rbuf->data, 0, rbuf->data_size, &p) >= 0) {
+        h->user_handler(rbuf, channel, &p, h->userdata);
+        return;
+    }
+
+    if (rbuf->data_size >= 8 &&
+        decode_int64((const uint8_t*) rbuf->data) == MAVCONN_MAVLINK_COMPACT_BATCH_FINGERPRINT) {
+        const uint8_t *b = (const uint8_t*) rbuf->data;
+        int offset = 8;
+        while (offset < (int) rbuf->data_size) {
+            int size = decode_record(b + offset, rbuf->data_size - offset, &p);
+            if (size < 0) {
+                fprintf(stderr, "error decoding mavconn_mavlink_msg_container_t batch, dropped %d bytes\n",
+                        (int) rbuf->data_size - offset);
+                return;
+            }
+            h->user_handler(rbuf, channel, &p, h->userdata);
+            offset += size;
+        }
+        return;
+    }
+
+    if (rbuf->data_size >= 8 &&
+        decode_int64((const uint8_t*) rbuf->data) == MAVCONN_MAVLINK_COMPACT_BLOB_FINGERPRINT) {
+        const uint8_t *b = (const uint8_t*) rbuf->data;
+        mavconn_blob_handle_t blob;
+        const void *payload;
+        int size = decode_record(b + 8, rbuf->data_size - 8, &p);
+        if (size < 0 || (int) rbuf->data_size - 8 - size < MAVCONN_BLOB_HANDLE_SIZE) {
+            fprintf(stderr, "error decoding mavconn_mavlink_msg_container_t blob\n");
+            return;
+        }
+        mavconn_blob_handle_decode(b + 8 + size, &blob);
+        p.extended_payload = (int8_t*) mavconn_blob_pin(&blob);
+        if (!p.extended_payload) {
+            // the slot was reused before this receiver got to it
+            static unsigned gone = 0;
+            gone++;
+            if ((gone & (gone - 1)) == 0)
+                fprintf(stderr, "# WARNING: extended payload of message %u from %u:%u is gone, %u dropped so far\n",
+                        (uint8_t) p.msg.msgid, (uint8_t) p.msg.sysid, (uint8_t) p.msg.compid, gone);
+            return;
+        }
+        payload = p.extended_payload;
+        p.extended_payload_len = blob.length;
+        h->user_handler(rbuf, channel, &p, h->userdata);
+        mavconn_blob_unpin(payload);
+        return;
+    }
+
+    // publishers still using the generated encoding
+    int status = mavconn_mavlink_msg_container_t_decode(rbuf->data, 0, rbuf->data_size, &p);
+    if (status < 0) {
+        fprintf(stderr, "error %d decoding mavconn_mavlink_msg_container_t!!!\n", status);
+        return;
+    }
+    h->user_handler(rbuf, channel, &p, h->userdata);
+    mavconn_mavlink_msg_container_t_decode_cleanup(&p);
+}
+
+mavconn_mavlink_compact_subscription_t* mavconn_mavlink_compact_subscribe(lcm_t *lcm,
+                    const char *channel,
+                    mavconn_mavlink_msg_container_t_handler_t f, void *userdata)
+{
+    mavconn_mavlink_compact_subscription_t *n = (mavconn_mavlink_compact_subscription_t*)
+                       malloc(sizeof(mavconn_mavlink_compact_subscription_t));
+    n->user_handler = f;
+    n->userdata = userdata;
+    n->lc_h = lcm_subscribe(lcm, channel,
+                                 mavconn_mavlink_compact_handler_stub, n);
+    if (n->lc_h == NULL) {
+        fprintf(stderr, "couldn't reg mavconn_mavlink_msg_container_t LCM handler!\n");
+        free(n);
+        return NULL;
+    }
+    return n;
+}
+
+int mavconn_mavlink_compact_subscription_set_queue_capacity(mavconn_mavlink_compact_subscription_t* subs,
+                              int num_messages)
+{
+    return lcm_subscription_set_queue_capacity(subs->lc_h, num_messages);
+}
+
+int mavconn_mavlink_compact_unsubscribe(lcm_t *lcm, mavconn_mavlink_compact_subscription_t* hid)
+{
+    int status = lcm_unsubscribe(lcm, hid->lc_h);
+    if (0 != status) {
+        fprintf(stderr,
+           "couldn't unsubscribe mavconn_mavlink_msg_container_t handler %p!\n", hid);
+        return -1;
+    }
+    free(hid);
+    return 0;
+}
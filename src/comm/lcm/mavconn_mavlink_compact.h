@@ -0,0 +1,148 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Compact LCM encoding of mavconn_mavlink_msg_container_t
+*
+*   The generated encoding of mavconn_mavlink_msg_container_t always
+*   carries all 33 payload words of the MAVLink message, about 300 bytes
+*   even for a 9 byte HEARTBEAT. The compact encoding carries the MAVLink
+*   frame as it is sent on a link instead:
+*
+*     int64_t  fingerprint       MAVCONN_MAVLINK_COMPACT_FINGERPRINT
+*     int8_t   link_network_source
+*     int8_t   link_component_id
+*     uint8_t  magic, len, seq, sysid, compid, msgid
+*     uint8_t  payload[len]
+*     uint8_t  ck_a, ck_b
+*     int32_t  extended_payload_len
+*     int8_t   extended_payload[extended_payload_len]
+*
+*   Integers are big endian as in all LCM types. This is not an lcm-gen
+*   type because the payload length is an unsigned byte inside the
+*   header, and because decoding writes the frame straight into the
+*   mavlink_message_t of a container, so handlers keep using
+*   getMAVLinkMsgPtr() on it.
+*
+*   Several messages for the same channel may be published at once as a
+*   batch, MAVCONN_MAVLINK_COMPACT_BATCH_FINGERPRINT followed by the above
+*   records without their fingerprint, up to the end of the LCM message.
+*
+*   Large extended payloads may instead be placed in the shared memory
+*   blob pool of the publisher (see mavconn_blob_pool.h). Such a message is
+*   MAVCONN_MAVLINK_COMPACT_BLOB_FINGERPRINT, a record with an empty
+*   extended payload and the MAVCONN_BLOB_HANDLE_SIZE byte handle. The
+*   subscription pins the blob and hands it to the handler in place as
+*   extended_payload; handlers that keep it must copy it.
+*
+*   Subscriptions made here accept the compact encoding, batches, blobs and
+*   the generated encoding, so publishers can be switched one by one. The
+*   publishers in mavconn.h only switch with "compact 1" in mavconn.conf.
+*
+*/
+
+#ifndef _mavconn_mavlink_compact_h
+#define _mavconn_mavlink_compact_h
+
+#include <stdint.h>
+#include <lcm/lcm.h>
+
+#include "mavconn_mavlink_msg_container_t.h"
+#include "mavconn_blob_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAVCONN_MAVLINK_COMPACT_FINGERPRINT 0x4d41564c4b434f31LL
+
+/** Encoded size without extended payload: fingerprint, link fields, header, checksum, extended length */
+#define MAVCONN_MAVLINK_COMPACT_OVERHEAD (8 + 2 + 6 + 2 + 4)
+
+#define MAVCONN_MAVLINK_COMPACT_BATCH_FINGERPRINT 0x4d41564c4b424131LL
+
+#define MAVCONN_MAVLINK_COMPACT_BLOB_FINGERPRINT 0x4d41564c4b424c31LL
+
+/**
+ * lcm_udpm sends a message in a single datagram, without fragmenting it,
+ * if it is shorter than this together with its 8 byte header and the
+ * NUL terminated channel name.
+ */
+#define MAVCONN_MAVLINK_COMPACT_LCM_SHORT_MAX 1435
+
+/**
+ * Largest batch published at once on a channel with an empty name,
+ * longer batches are split. The length of the channel name is taken off
+ * as well, so that every batch is a single LCM datagram.
+ */
+#define MAVCONN_MAVLINK_COMPACT_BATCH_MAX (MAVCONN_MAVLINK_COMPACT_LCM_SHORT_MAX - 8 - 2)
+
+int  mavconn_mavlink_compact_encode(void *buf, int offset, int maxlen, const mavconn_mavlink_msg_container_t *p);
+
+/**
+ * Decodes into an existing container. Only the first len + 2 payload bytes
+ * of p->msg are written. p->extended_payload points into buf, it must not
+ * be freed and is only valid as long as buf is.
+ *
+ * @return number of bytes decoded, -1 if buf holds no compact container
+ */
+int  mavconn_mavlink_compact_decode(const void *buf, int offset, int maxlen, mavconn_mavlink_msg_container_t *p);
+int  mavconn_mavlink_compact_encoded_size(const mavconn_mavlink_msg_container_t *p);
+
+int  mavconn_mavlink_compact_publish(lcm_t *lcm, const char *channel, const mavconn_mavlink_msg_container_t *p);
+
+/**
+ * Publishes count messages without extended payload in as few LCM messages
+ * as possible. Encodes into a buffer of the calling thread, so this is safe
+ * to call from any thread and does not allocate.
+ *
+ * @return 0 on success, the status of the failed lcm_publish() otherwise
+ */
+int  mavconn_mavlink_compact_publish_batch(lcm_t *lcm, const char *channel, int8_t link_network_source,
+		const mavconn_mavlink_message_t *msgs, int count);
+
+/**
+ * Publishes p with a handle to blob instead of its extended payload.
+ * Only receivers on this host can resolve the handle.
+ */
+int  mavconn_mavlink_compact_publish_blob(lcm_t *lcm, const char *channel, const mavconn_mavlink_msg_container_t *p,
+                                          const mavconn_blob_handle_t *blob);
+
+typedef struct _mavconn_mavlink_compact_subscription_t mavconn_mavlink_compact_subscription_t;
+
+/**
+ * Subscribes to containers in compact or generated encoding. The handler
+ * is the same as for mavconn_mavlink_msg_container_t_subscribe().
+ */
+mavconn_mavlink_compact_subscription_t* mavconn_mavlink_compact_subscribe(lcm_t *lcm, const char *channel,
+		mavconn_mavlink_msg_container_t_handler_t f, void *userdata);
+int  mavconn_mavlink_compact_unsubscribe(lcm_t *lcm, mavconn_mavlink_compact_subscription_t* hid);
+int  mavconn_mavlink_compact_subscription_set_queue_capacity(mavconn_mavlink_compact_subscription_t* subs,
+		int num_messages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -66,10 +66,69 @@ void signalHandler(int signal)
 	}
 }
 
+/**
+ * @brief Compress an image straight into the preallocated buffer of a DDS sequence
+ */
+bool
+compressImage(PxZip& zip, const cv::Mat& img, DDS_CharSeq& seq)
+{
+	unsigned char* pBuffer = reinterpret_cast<unsigned char*>(seq.get_contiguous_buffer());
+	size_t size = pBuffer ? zip.compressImage(img, pBuffer, seq.maximum()) : 0;
+	seq.length(size);
+	if (size == 0)
+	{
+		fprintf(stderr, "# WARNING: %dx%d image does not fit into a DDS message.\n", img.cols, img.rows);
+	}
+	return size > 0;
+}
+
+/**
+ * @brief Compress the raw data of an image straight into a DDS sequence
+ */
+bool
+compressData(PxZip& zip, const cv::Mat& img, DDS_CharSeq& seq)
+{
+	unsigned char* pBuffer = reinterpret_cast<unsigned char*>(seq.get_contiguous_buffer());
+	size_t size = pBuffer ? zip.compressData(img.data, img.step[0] * img.rows, pBuffer, seq.maximum()) : 0;
+	seq.length(size);
+	if (size == 0)
+	{
+		fprintf(stderr, "# WARNING: %dx%d image does not fit into a DDS message.\n", img.cols, img.rows);
+	}
+	return size > 0;
+}
+
+/**
+ * @brief Decompress the raw data of an image from a DDS sequence
+ *
+ * @return false if the data is corrupt or shorter than rows * step bytes,
+ *         or a row does not fit into step; the message has to be dropped
+ */
+bool
+decompressData(PxZip& zip, DDS_CharSeq& seq, int rows, int cols, int type, int step,
+			   std::vector<uint8_t>& buffer)
+{
+	unsigned char* pBuffer = reinterpret_cast<unsigned char*>(seq.get_contiguous_buffer());
+	if (!pBuffer || !zip.decompressData(pBuffer, seq.length(), buffer))
+	{
+		return false;
+	}
+	if (rows <= 0 || cols <= 0 || step < (int64_t)cols * CV_ELEM_SIZE(type) || buffer.size() < (size_t)rows * step)
+	{
+		fprintf(stderr, "# WARNING: %lu bytes of image data from DDS, expected %d rows of %d bytes.\n",
+				(unsigned long)buffer.size(), rows, step);
+		return false;
+	}
+	return true;
+}
+
 void
 imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 				const mavconn_mavlink_msg_container_t* container, void* user)
 {
+	// Only called from the LCM thread
+	static PxZip zip;
+
 	const mavlink_message_t* msg = getMAVLinkMsgPtr(container);
 	for (size_t i = 0; i < imageClientVec.size(); ++i)
 	{
@@ -83,8 +142,6 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 		bool publishImage = false;
 		PxSHM::CameraType cameraType;
 
-		std::vector<uchar> buffer;
-
 		// read mono image data
 		cv::Mat img;
 		if (client.readMonoImage(msg, img))
@@ -94,9 +151,6 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 			dds_image_msg.step1 = img.step[0];
 			dds_image_msg.type1 = img.type();
 
-			PxZip::instance()->compressImage(img, buffer);
-			dds_image_msg.imageData1.from_array(reinterpret_cast<DDS_Char*>(&buffer[0]), buffer.size());
-
 			dds_image_msg.step2 = 0;
 			dds_image_msg.type2 = 0;
 			dds_image_msg.imageData2.length(0);
@@ -110,7 +164,7 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 				cameraType = PxSHM::CAMERA_MONO_24;
 			}
 
-			publishImage = true;
+			publishImage = compressImage(zip, img, dds_image_msg.imageData1);
 		}
 
 		cv::Mat imgLeft, imgRight;
@@ -121,17 +175,9 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 			dds_image_msg.step1 = imgLeft.step[0];
 			dds_image_msg.type1 = imgLeft.type();
 
-			PxZip::instance()->compressImage(imgLeft, buffer);
-			DDS_Char* pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-			dds_image_msg.imageData1.from_array(pBuffer, buffer.size());
-
 			dds_image_msg.step2 = imgRight.step[0];
 			dds_image_msg.type2 = imgRight.type();
 
-			PxZip::instance()->compressImage(imgRight, buffer);
-			pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-			dds_image_msg.imageData2.from_array(pBuffer, buffer.size());
-
 			if (imgLeft.channels() == 1)
 			{
 				cameraType = PxSHM::CAMERA_STEREO_8;
@@ -141,7 +187,8 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 				cameraType = PxSHM::CAMERA_STEREO_24;
 			}
 
-			publishImage = true;
+			publishImage = compressImage(zip, imgLeft, dds_image_msg.imageData1) &&
+						   compressImage(zip, imgRight, dds_image_msg.imageData2);
 		}
 
 		// read Kinect data
@@ -153,24 +200,13 @@ imageLCMHandler(const lcm_recv_buf_t* rbuf, const char* channel,
 			dds_image_msg.step1 = imgBayer.step[0];
 			dds_image_msg.type1 = imgBayer.type();
 
-			PxZip::instance()->compressData(imgBayer.data,
-											imgBayer.step[0] * imgBayer.rows,
-											buffer);
-			DDS_Char* pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-			dds_image_msg.imageData1.from_array(pBuffer, buffer.size());
-
 			dds_image_msg.step2 = imgDepth.step[0];
 			dds_image_msg.type2 = imgDepth.type();
 
-			PxZip::instance()->compressData(imgDepth.data,
-											imgDepth.step[0] * imgDepth.rows,
-											buffer);
-			pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-			dds_image_msg.imageData2.from_array(pBuffer, buffer.size());
-
 			cameraType = PxSHM::CAMERA_KINECT;
 
-			publishImage = true;
+			publishImage = compressData(zip, imgBayer, dds_image_msg.imageData1) &&
+						   compressData(zip, imgDepth, dds_image_msg.imageData2);
 		}
 
 		if (publishImage)
@@ -256,7 +292,8 @@ rgbdLCMHandler(void)
 	clientVec.at(0).init(true, PxSHM::CAMERA_FORWARD_RGBD);
 	clientVec.at(1).init(true, PxSHM::CAMERA_DOWNWARD_RGBD);
 
-	std::vector<uchar> buffer;
+	// This thread compresses with its own context
+	PxZip zip;
 
 	while (!quit)
 	{
@@ -314,16 +351,14 @@ rgbdLCMHandler(void)
 				dds_rgbd_image_msg.step1 = imgColor.step[0];
 				dds_rgbd_image_msg.type1 = imgColor.type();
 
-				PxZip::instance()->compressImage(imgColor, buffer);
-				DDS_Char* pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-				dds_rgbd_image_msg.imageData1.from_array(pBuffer, buffer.size());
-
 				dds_rgbd_image_msg.step2 = imgDepth.step[0];
 				dds_rgbd_image_msg.type2 = imgDepth.type();
 
-				PxZip::instance()->compressData(imgDepth.data, imgDepth.step[0] * imgDepth.rows, buffer);
-				pBuffer = reinterpret_cast<DDS_Char*>(&buffer[0]);
-				dds_rgbd_image_msg.imageData2.from_array(pBuffer, buffer.size());
+				if (!compressImage(zip, imgColor, dds_rgbd_image_msg.imageData1) ||
+					!compressData(zip, imgDepth, dds_rgbd_image_msg.imageData2))
+				{
+					continue;
+				}
 
 				// publish image to DDS
 				px::RGBDImageTopic::instance()->publish(&dds_rgbd_image_msg);
@@ -345,6 +380,11 @@ imageDDSHandler(void* msg)
 {
 	dds_image_message_t* dds_msg = reinterpret_cast<dds_image_message_t*>(msg);
 
+	// Reused for every message, the servers copy the images into shared memory
+	static PxZip zip;
+	static cv::Mat imgLeft, imgRight;
+	static std::vector<uint8_t> buffer1, buffer2;
+
 	int serverIdx = -1;
 	for (size_t i = 0; i < imageServerVec.size(); ++i)
 	{
@@ -367,11 +407,11 @@ imageDDSHandler(void* msg)
 	if (dds_msg->camera_type == PxSHM::CAMERA_MONO_8 ||
 		dds_msg->camera_type == PxSHM::CAMERA_MONO_24)
 	{
-		cv::Mat img;
 		uint8_t* pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData1.get_contiguous_buffer());
-		PxZip::instance()->decompressImage(pBuffer,
-										   dds_msg->imageData1.length(),
-										   img);
+		if (!zip.decompressImage(pBuffer, dds_msg->imageData1.length(), imgLeft))
+		{
+			return;
+		}
 
 		mavlink_image_triggered_t itrg;
 		itrg.roll = dds_msg->roll;
@@ -385,21 +425,18 @@ imageDDSHandler(void* msg)
 		itrg.ground_y = dds_msg->ground_y;
 		itrg.ground_z = dds_msg->ground_z;
 
-		server.writeMonoImage(img, dds_msg->cam_id1, dds_msg->timestamp, itrg, dds_msg->exposure);
+		server.writeMonoImage(imgLeft, dds_msg->cam_id1, dds_msg->timestamp, itrg, dds_msg->exposure);
 	}
 	else if (dds_msg->camera_type == PxSHM::CAMERA_STEREO_8 ||
 			 dds_msg->camera_type == PxSHM::CAMERA_STEREO_24)
 	{
-		cv::Mat imgLeft;
-		uint8_t* pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData1.get_contiguous_buffer());
-		PxZip::instance()->decompressImage(pBuffer,
-										   dds_msg->imageData1.length(),
-										   imgLeft);
-		cv::Mat imgRight;
-		pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData2.get_contiguous_buffer());
-		PxZip::instance()->decompressImage(pBuffer,
-										   dds_msg->imageData2.length(),
-										   imgRight);
+		uint8_t* pBuffer1 = reinterpret_cast<uint8_t*>(dds_msg->imageData1.get_contiguous_buffer());
+		uint8_t* pBuffer2 = reinterpret_cast<uint8_t*>(dds_msg->imageData2.get_contiguous_buffer());
+		if (!zip.decompressImage(pBuffer1, dds_msg->imageData1.length(), imgLeft) ||
+			!zip.decompressImage(pBuffer2, dds_msg->imageData2.length(), imgRight))
+		{
+			return;
+		}
 
 		mavlink_image_triggered_t itrg;
 		itrg.roll = dds_msg->roll;
@@ -418,19 +455,13 @@ imageDDSHandler(void* msg)
 	}
 	else if (dds_msg->camera_type == PxSHM::CAMERA_KINECT)
 	{
-		std::vector<uint8_t> buffer1;
-		uint8_t* pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData1.get_contiguous_buffer());
-		PxZip::instance()->decompressData(pBuffer,
-										  dds_msg->imageData1.length(),
-										  buffer1);
+		if (!decompressData(zip, dds_msg->imageData1, dds_msg->rows, dds_msg->cols, dds_msg->type1, dds_msg->step1, buffer1) ||
+			!decompressData(zip, dds_msg->imageData2, dds_msg->rows, dds_msg->cols, dds_msg->type2, dds_msg->step2, buffer2))
+		{
+			return;
+		}
 		cv::Mat imgBayer(dds_msg->rows, dds_msg->cols, dds_msg->type1,
 						 &(buffer1[0]), dds_msg->step1);
-
-		std::vector<uint8_t> buffer2;
-		pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData2.get_contiguous_buffer());
-		PxZip::instance()->decompressData(pBuffer,
-										  dds_msg->imageData2.length(),
-										  buffer2);
 		cv::Mat imgDepth(dds_msg->rows, dds_msg->cols, dds_msg->type2,
 						 &(buffer2[0]), dds_msg->step2);
 
@@ -452,6 +483,11 @@ rgbdDDSHandler(void* msg)
 {
 	dds_rgbd_image_message_t* dds_msg = reinterpret_cast<dds_rgbd_image_message_t*>(msg);
 
+	// Reused for every message, the server copies the images into shared memory
+	static PxZip zip;
+	static cv::Mat imgColor;
+	static std::vector<uint8_t> buffer;
+
 	int serverIdx = -1;
 	for (size_t i = 0; i < rgbdServerVec.size(); ++i)
 	{
@@ -473,17 +509,16 @@ rgbdDDSHandler(void* msg)
 	// write image(s) to shared memory
 	assert(dds_msg->camera_type == PxSHM::CAMERA_RGBD);
 
-	cv::Mat imgColor;
 	uint8_t* pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData1.get_contiguous_buffer());
-	PxZip::instance()->decompressImage(pBuffer,
-									   dds_msg->imageData1.length(),
-									   imgColor);
-		
-	std::vector<uint8_t> buffer;
-	pBuffer = reinterpret_cast<uint8_t*>(dds_msg->imageData2.get_contiguous_buffer());
-	PxZip::instance()->decompressData(pBuffer,
-									  dds_msg->imageData2.length(),
-									  buffer);
+	if (!zip.decompressImage(pBuffer, dds_msg->imageData1.length(), imgColor))
+	{
+		return;
+	}
+
+	if (!decompressData(zip, dds_msg->imageData2, dds_msg->rows, dds_msg->cols, dds_msg->type2, dds_msg->step2, buffer))
+	{
+		return;
+	}
 	cv::Mat imgDepth(dds_msg->rows, dds_msg->cols, dds_msg->type2,
 					 &(buffer[0]), dds_msg->step2);
 
@@ -627,10 +662,10 @@ main(int argc, char** argv)
 	px::Middleware mw;
 	mw.init(argc, argv);
 
-	mavconn_mavlink_msg_container_t_subscription_t* imageLCMSub = 0;
-	mavconn_mavlink_msg_container_t_subscription_t* mavlinkLCMSub = 0;
+	mavconn_mavlink_compact_subscription_t* imageLCMSub = 0;
+	mavconn_mavlink_compact_subscription_t* mavlinkLCMSub = 0;
 
-	mavlinkLCMSub = mavconn_mavlink_msg_container_t_subscribe(lcm, "MAVLINK", &mavlinkLCMHandler, 0);
+	mavlinkLCMSub = subscribeMAVLinkMessages(lcm, MAVCONN_CHANNEL_ALL, 0, &mavlinkLCMHandler, 0);
 	px::MavlinkTopic::instance()->advertise();
 
 	px::Handler handler = px::Handler(sigc::bind(sigc::ptr_fun(mavlinkDDSHandler), lcm));
@@ -655,7 +690,7 @@ main(int argc, char** argv)
 		dds_rgbd_image_message_t_initialize(&dds_rgbd_image_msg);
 
 		// subscribe to LCM messages
-		imageLCMSub = mavconn_mavlink_msg_container_t_subscribe(lcm, "IMAGES", &imageLCMHandler, 0);
+		imageLCMSub = mavconn_mavlink_compact_subscribe(lcm, "IMAGES", &imageLCMHandler, 0);
 
 		// advertise DDS topics
 		px::ImageTopic::instance()->advertise();
@@ -706,7 +741,7 @@ main(int argc, char** argv)
 
 	if (lcm2dds)
 	{
-		mavconn_mavlink_msg_container_t_unsubscribe(lcm, mavlinkLCMSub);
+		mavconn_mavlink_compact_unsubscribe(lcm, mavlinkLCMSub);
 
 		dds_image_message_t_finalize(&dds_image_msg);
 		dds_rgbd_image_message_t_finalize(&dds_rgbd_image_msg);
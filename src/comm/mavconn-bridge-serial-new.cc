@@ -43,6 +43,7 @@ This file is part of the MAVCONN project
 #include <string.h>
 #include <inttypes.h>
 #include <fstream>
+#include <sstream>
 // BOOST includes
 #include <boost/program_options.hpp>
 // Serial includes
@@ -52,14 +53,18 @@ This file is part of the MAVCONN project
 #include <fcntl.h>   /* File control definitions */
 #include <errno.h>   /* Error number definitions */
 #include <termios.h> /* POSIX terminal control definitions */
+#include <poll.h>
 #ifdef __linux
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/serial.h>
 #endif
 
 // Latency Benchmarking
 #include <sys/time.h>
 #include <time.h>
 #include "mavconn.h"
+#include "MAVLinkScanner.h"
 #include <glib.h>
 
 namespace config = boost::program_options;
@@ -68,13 +73,13 @@ using namespace std;
 
 struct timeval tv;		  ///< System time
 
-int baud;                 ///< The serial baud rate
+int baud;                 ///< The default serial baud rate
 
 // Settings
 int systemid = getSystemID();             ///< The unique system id of this MAV, 0-127. Has to be consistent across the system
 int compid = PX_COMP_ID_MAVLINK_BRIDGE_SERIAL;
 int serial_compid = 0;
-string port;              ///< The serial port name, e.g. /dev/ttyUSB0
+bool lowLatency;          ///< Put the UART drivers into low latency mode
 bool silent;              ///< Wether console output should be enabled
 bool verbose;             ///< Enable verbose output
 bool emitHeartbeat;       ///< Generate a heartbeat with this process
@@ -95,10 +100,664 @@ lcm_t* lcm;               ///< Reference to LCM bus
 #define B921600 921600
 #endif
 
+std::string routeFile;    ///< Route table file, see config/mavconn-bridge-serial-routes.cfg
+
+/**
+ * Which messages a route section applies to
+ */
+enum RouteSource
+{
+	ROUTE_ANY,					///< all messages
+	ROUTE_OWN_SYSTEM,			///< messages sent by this system
+	ROUTE_NOT_SERIAL,			///< messages not sent by the component on the serial port
+	ROUTE_SOURCE_COUNT
+};
+
+/**
+ * Messages forwarded in one direction. Deciding about a message is a bit
+ * test per source class plus one rate cap lookup.
+ */
+struct RouteTable
+{
+	uint32_t allow[ROUTE_SOURCE_COUNT][8];	///< bitsets of forwarded message IDs
+	uint32_t interval[256];					///< minimum time between two messages of an ID in microseconds, 0 for no cap
+	uint64_t next[256];						///< earliest time the next message of an ID may pass
+	uint64_t capped;						///< messages dropped by rate caps
+};
+
+static RouteTable lcmToSerial;	///< Messages from LCM written to the serial port
+static RouteTable serialToLcm;	///< Messages from the serial port published on LCM
+static uint32_t priorityMessages[8];	///< Message IDs written to the serial port ahead of telemetry
+
+/**
+ * A section of the route file, see config/mavconn-bridge-serial-routes.cfg
+ */
+struct RouteSection
+{
+	const char* name;
+	RouteTable* table;
+	RouteSource source;
+	bool active;
+	uint32_t allow[8];			///< message IDs listed in the section
+	float rate[256];			///< rate cap of each listed message in Hz, 0 for no cap
+};
+
+static RouteSection routeSections[] =
+{
+	{ "imu", &lcmToSerial, ROUTE_NOT_SERIAL },
+	{ "pc2serial", &lcmToSerial, ROUTE_OWN_SYSTEM },
+	{ "pcrelay", &lcmToSerial, ROUTE_OWN_SYSTEM },
+	{ "imgrelay", &lcmToSerial, ROUTE_OWN_SYSTEM },
+	{ "serial2lcm", &serialToLcm, ROUTE_ANY },
+	{ "priority", NULL, ROUTE_ANY },
+};
+
+#define ROUTE_MESSAGE(name) { #name, MAVLINK_MSG_ID_##name }
+
+/**
+ * Message names that may be used in the route file instead of IDs
+ */
+static const struct
+{
+	const char* name;
+	int id;
+} routeMessages[] =
+{
+	ROUTE_MESSAGE(HEARTBEAT),
+	ROUTE_MESSAGE(SYS_STATUS),
+	ROUTE_MESSAGE(SYSTEM_TIME),
+	ROUTE_MESSAGE(PING),
+	ROUTE_MESSAGE(SET_MODE),
+	ROUTE_MESSAGE(PARAM_REQUEST_READ),
+	ROUTE_MESSAGE(PARAM_REQUEST_LIST),
+	ROUTE_MESSAGE(PARAM_VALUE),
+	ROUTE_MESSAGE(PARAM_SET),
+	ROUTE_MESSAGE(GPS_STATUS),
+	ROUTE_MESSAGE(ATTITUDE),
+	ROUTE_MESSAGE(LOCAL_POSITION_NED),
+	ROUTE_MESSAGE(GLOBAL_POSITION_INT),
+	ROUTE_MESSAGE(MISSION_ITEM),
+	ROUTE_MESSAGE(MISSION_REQUEST),
+	ROUTE_MESSAGE(MISSION_SET_CURRENT),
+	ROUTE_MESSAGE(MISSION_CURRENT),
+	ROUTE_MESSAGE(MISSION_REQUEST_LIST),
+	ROUTE_MESSAGE(MISSION_COUNT),
+	ROUTE_MESSAGE(MISSION_CLEAR_ALL),
+	ROUTE_MESSAGE(MISSION_ITEM_REACHED),
+	ROUTE_MESSAGE(MISSION_ACK),
+	ROUTE_MESSAGE(SET_GPS_GLOBAL_ORIGIN),
+	ROUTE_MESSAGE(GPS_GLOBAL_ORIGIN),
+	ROUTE_MESSAGE(REQUEST_DATA_STREAM),
+	ROUTE_MESSAGE(COMMAND_LONG),
+	ROUTE_MESSAGE(COMMAND_ACK),
+	ROUTE_MESSAGE(ATTITUDE_TARGET),
+	ROUTE_MESSAGE(POSITION_TARGET_LOCAL_NED),
+	ROUTE_MESSAGE(POSITION_TARGET_GLOBAL_INT),
+	ROUTE_MESSAGE(OPTICAL_FLOW),
+	ROUTE_MESSAGE(GLOBAL_VISION_POSITION_ESTIMATE),
+	ROUTE_MESSAGE(VISION_POSITION_ESTIMATE),
+	ROUTE_MESSAGE(VICON_POSITION_ESTIMATE),
+	ROUTE_MESSAGE(IMAGE_TRIGGER_CONTROL),
+	ROUTE_MESSAGE(SET_POSITION_CONTROL_OFFSET),
+	ROUTE_MESSAGE(POSITION_CONTROL_SETPOINT),
+	ROUTE_MESSAGE(ATTITUDE_CONTROL),
+	ROUTE_MESSAGE(DATA_TRANSMISSION_HANDSHAKE),
+	ROUTE_MESSAGE(ENCAPSULATED_DATA),
+	ROUTE_MESSAGE(STATUSTEXT),
+	ROUTE_MESSAGE(DEBUG),
+	ROUTE_MESSAGE(DEBUG_VECT),
+};
+
+/**
+ * @brief Look up a message name or a numeric message ID
+ *
+ * @return the message ID or -1 if unknown
+ */
+static int route_message_id(const std::string& name)
+{
+	if (name.find_first_not_of("0123456789") == std::string::npos)
+	{
+		int id = atoi(name.c_str());
+		return (id <= 255) ? id : -1;
+	}
+	for (size_t i = 0; i < sizeof(routeMessages) / sizeof(routeMessages[0]); ++i)
+	{
+		if (name == routeMessages[i].name)
+		{
+			return routeMessages[i].id;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Load the route file and build the route tables of the active sections
+ *
+ * @return false if the file could not be read or is malformed
+ */
+static bool load_routes(const std::string& filename)
+{
+	std::ifstream file(filename.c_str());
+	if (!file.is_open())
+	{
+		fprintf(stderr, "# ERROR: Could not open route file %s\n", filename.c_str());
+		return false;
+	}
+
+	const int sectionCount = sizeof(routeSections) / sizeof(routeSections[0]);
+	RouteSection* section = NULL;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		++lineNumber;
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream tokens(line);
+		std::string entry;
+		if (!(tokens >> entry))
+		{
+			continue;
+		}
+
+		if (entry[0] == '[')
+		{
+			section = NULL;
+			for (int i = 0; i < sectionCount; ++i)
+			{
+				if (entry == std::string("[") + routeSections[i].name + "]")
+				{
+					section = &routeSections[i];
+				}
+			}
+			if (section == NULL)
+			{
+				fprintf(stderr, "# ERROR: %s:%d: Unknown section %s\n", filename.c_str(), lineNumber, entry.c_str());
+				return false;
+			}
+			continue;
+		}
+		if (section == NULL)
+		{
+			fprintf(stderr, "# ERROR: %s:%d: Entry outside of a section\n", filename.c_str(), lineNumber);
+			return false;
+		}
+
+		bool remove = (entry[0] == '-');
+		if (remove)
+		{
+			entry.erase(0, 1);
+		}
+
+		float rate = 0;
+		if (!(tokens >> rate))
+		{
+			rate = 0;
+		}
+
+		int first = 0;
+		int last = 255;
+		if (entry != "all")
+		{
+			first = last = route_message_id(entry);
+		}
+		if (first < 0 || rate < 0)
+		{
+			fprintf(stderr, "# ERROR: %s:%d: Invalid entry %s\n", filename.c_str(), lineNumber, line.c_str());
+			return false;
+		}
+
+		for (int id = first; id <= last; ++id)
+		{
+			if (remove)
+			{
+				section->allow[id >> 5] &= ~(1U << (id & 31));
+			}
+			else
+			{
+				section->allow[id >> 5] |= 1U << (id & 31);
+				section->rate[id] = rate;
+			}
+		}
+	}
+
+	// Merge the active sections, the highest rate cap of a message wins
+	float maxRate[2][256];
+	RouteTable* tables[2] = { &lcmToSerial, &serialToLcm };
+	for (int t = 0; t < 2; ++t)
+	{
+		memset(tables[t], 0, sizeof(RouteTable));
+		for (int id = 0; id < 256; ++id)
+		{
+			maxRate[t][id] = -1;
+		}
+	}
+	for (int i = 0; i < sectionCount; ++i)
+	{
+		const RouteSection* s = &routeSections[i];
+		if (s->table == NULL)
+		{
+			// Messages that are written to the serial port ahead of telemetry
+			memcpy(priorityMessages, s->allow, sizeof(priorityMessages));
+			continue;
+		}
+		if (!s->active)
+		{
+			continue;
+		}
+		int t = (s->table == &lcmToSerial) ? 0 : 1;
+		for (int id = 0; id < 256; ++id)
+		{
+			if (s->allow[id >> 5] & (1U << (id & 31)))
+			{
+				s->table->allow[s->source][id >> 5] |= 1U << (id & 31);
+				float rate = (s->rate[id] > 0) ? s->rate[id] : 1e9f;
+				if (rate > maxRate[t][id])
+				{
+					maxRate[t][id] = rate;
+				}
+			}
+		}
+	}
+	for (int t = 0; t < 2; ++t)
+	{
+		for (int id = 0; id < 256; ++id)
+		{
+			if (maxRate[t][id] > 0 && maxRate[t][id] < 1e9f)
+			{
+				tables[t]->interval[id] = 1000000 / maxRate[t][id];
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Decide if a message is forwarded
+ *
+ * @param table route table of the direction the message travels
+ * @param now current time in microseconds
+ */
+static bool route(RouteTable* table, const mavlink_message_t* msg, uint64_t now)
+{
+	uint8_t id = msg->msgid;
+	uint32_t bit = 1U << (id & 31);
+	bool ownSystem = (msg->sysid == systemid);
+	bool fromSerial = (ownSystem && msg->compid == serial_compid);
+
+	if (!((table->allow[ROUTE_ANY][id >> 5] & bit) ||
+		  (ownSystem && (table->allow[ROUTE_OWN_SYSTEM][id >> 5] & bit)) ||
+		  (!fromSerial && (table->allow[ROUTE_NOT_SERIAL][id >> 5] & bit))))
+	{
+		return false;
+	}
+
+	uint32_t interval = table->interval[id];
+	if (interval > 0)
+	{
+		if (now < table->next[id])
+		{
+			++table->capped;
+			return false;
+		}
+		// Keep the average rate at the cap even if messages arrive with jitter
+		table->next[id] = (now - table->next[id] < interval) ? table->next[id] + interval : now + interval;
+	}
+	return true;
+}
+
+static int txQueueSize;   ///< Bytes of bulk messages queued for the serial port
+
+/**
+ * Serialized messages waiting for the serial port. The queue only ever
+ * holds complete frames, so the oldest one can be dropped by reading its
+ * length from the header.
+ */
+struct SerialQueue
+{
+	uint8_t* data;
+	size_t length;
+	size_t capacity;
+	uint64_t dropped;		///< messages dropped because the queue was full
+};
+
+/**
+ * A serial port served by the bridge. Every port has its own MAVLink
+ * scanner and its own transmit queues.
+ */
+struct SerialPort
+{
+	string name;			///< The serial port name, e.g. /dev/ttyUSB0
+	int baud;				///< The serial baud rate
+	int fd;
+	px::MAVLinkScanner scanner;
+	std::vector<mavlink_message_t> messages;	///< frames of the last read
+	uint64_t lastBadFrames;
+	uint32_t sources[2048];	///< bitset of sysid << 8 | compid received on this port
+	SerialQueue txPriority;	///< commands, heartbeats and protocol messages
+	SerialQueue txBulk;		///< telemetry
+	size_t chunkLimit;		///< bytes written at once, about 20 ms on the wire
+
+	// Only used by the writer thread
+	uint8_t* txChunk;		///< frames taken from the queues, chunkLimit bytes
+	size_t txLength;		///< bytes in txChunk
+	size_t txWritten;		///< bytes of txChunk the driver took so far
+	bool txBlocked;			///< the driver is full, waiting until the port is writable
+};
+
+static std::vector<SerialPort*> ports;
+static GMutex* txMutex;		///< protects the transmit queues of all ports
+static GCond* txCond;
+#ifdef __linux
+static int txEpoll;			///< ports the writer waits to become writable
+#endif
+
+/**
+ * @brief Remember that a system and component is on a port
+ */
+static inline void serial_source_add(SerialPort* p, int source)
+{
+	uint32_t bit = 1U << (source & 31);
+	if (!(__atomic_load_n(&p->sources[source >> 5], __ATOMIC_RELAXED) & bit))
+	{
+		__atomic_fetch_or(&p->sources[source >> 5], bit, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * @return whether messages of this system and component were received on a port
+ */
+static inline bool serial_source_seen(const SerialPort* p, int source)
+{
+	return __atomic_load_n(&p->sources[source >> 5], __ATOMIC_RELAXED) & (1U << (source & 31));
+}
+
+static void serial_queue_init(SerialQueue* q, size_t capacity)
+{
+	q->capacity = (capacity > MAVLINK_MAX_PACKET_LEN) ? capacity : MAVLINK_MAX_PACKET_LEN;
+	q->data = new uint8_t[q->capacity];
+	q->length = 0;
+	q->dropped = 0;
+}
+
+static inline size_t serial_frame_length(const uint8_t* frame)
+{
+	return frame[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+}
+
+/**
+ * @brief Queue a message for the serial writer thread
+ *
+ * Never blocks on the serial port. If the queue is full, its oldest
+ * messages are dropped, as fresh telemetry is worth more than old.
+ * Must be called with txMutex held.
+ */
+static void serial_enqueue(SerialPort* p, const uint8_t* frame, size_t length, bool priority)
+{
+	SerialQueue* q = priority ? &p->txPriority : &p->txBulk;
+
+	while (q->length + length > q->capacity && q->length > 0)
+	{
+		size_t first = serial_frame_length(q->data);
+		memmove(q->data, q->data + first, q->length - first);
+		q->length -= first;
+		++q->dropped;
+	}
+	memcpy(q->data + q->length, frame, length);
+	q->length += length;
+}
+
+/**
+ * @brief Queue a message for all serial ports except those it came from
+ *
+ * A port is skipped if a message of the same system and component was
+ * ever received on it, so nothing is echoed back to any of the devices
+ * behind a port, e.g. an autopilot and a radio sharing one link.
+ */
+static void serial_send(const mavlink_message_t* msg)
+{
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	size_t messageLength = mavlink_msg_to_send_buffer(buffer, msg);
+	bool priority = (priorityMessages[msg->msgid >> 5] & (1U << (msg->msgid & 31)));
+	int source = (msg->sysid << 8) | msg->compid;
+
+	g_mutex_lock(txMutex);
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		if (!serial_source_seen(ports[i], source))
+		{
+			serial_enqueue(ports[i], buffer, messageLength, priority);
+		}
+	}
+	g_cond_signal(txCond);
+	g_mutex_unlock(txMutex);
+}
+
+/**
+ * @brief Move whole frames from the front of a queue into a buffer
+ *
+ * @return number of bytes moved
+ */
+static size_t serial_take(SerialQueue* q, uint8_t* buffer, size_t room)
+{
+	size_t n = 0;
+	while (n < q->length && n + serial_frame_length(q->data + n) <= room)
+	{
+		n += serial_frame_length(q->data + n);
+	}
+	memcpy(buffer, q->data, n);
+	memmove(q->data, q->data + n, q->length - n);
+	q->length -= n;
+	return n;
+}
+
+/**
+ * @brief Time until the driver of a port can take the next chunk
+ *
+ * @return 0 if the port can be written now, otherwise microseconds to wait
+ */
+static uint64_t serial_backlog(const SerialPort* p)
+{
+#ifdef TIOCOUTQ
+	int pending;
+	if (ioctl(p->fd, TIOCOUTQ, &pending) == 0 && pending > (int) p->chunkLimit)
+	{
+		return (pending - p->chunkLimit) * 10000000ULL / p->baud;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * @brief Wake the writer once the driver of a port has room again
+ */
+static void serial_wait_writable(SerialPort* p)
+{
+	p->txBlocked = true;
+#ifdef __linux
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT | EPOLLONESHOT;
+	ev.data.ptr = p;
+	if (epoll_ctl(txEpoll, EPOLL_CTL_MOD, p->fd, &ev) < 0)
+	{
+		// Try again after the next timeout
+		p->txBlocked = false;
+	}
+#endif
+}
+
+/**
+ * @brief Wait until a blocked port is writable or the timeout passed
+ *
+ * @param timeout milliseconds, 0 to only check
+ */
+static void serial_poll_writable(int timeout)
+{
+#ifdef __linux
+	std::vector<struct epoll_event> events(ports.size());
+	int n = epoll_wait(txEpoll, &events[0], events.size(), timeout);
+	for (int i = 0; i < n; ++i)
+	{
+		static_cast<SerialPort*>(events[i].data.ptr)->txBlocked = false;
+	}
+#else
+	std::vector<struct pollfd> fds;
+	std::vector<SerialPort*> blocked;
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		if (ports[i]->txBlocked)
+		{
+			struct pollfd pfd = { ports[i]->fd, POLLOUT, 0 };
+			fds.push_back(pfd);
+			blocked.push_back(ports[i]);
+		}
+	}
+	if (fds.empty() || poll(&fds[0], fds.size(), timeout) <= 0)
+	{
+		return;
+	}
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+		if (fds[i].revents) blocked[i]->txBlocked = false;
+	}
+#endif
+}
+
+/**
+* @brief Serial writer thread
+*
+* Writes the queued messages of all ports, priority messages first, with
+* one write() per batch of messages. Each batch is limited to about 20 ms
+* on the wire, and a port only gets its next batch once the driver has
+* sent most of the previous one, so priority messages never wait behind a
+* long backlog of telemetry in the UART driver. A port whose driver is
+* full keeps the rest of its batch and is skipped until epoll reports it
+* writable, so one slow port does not hold up the others.
+*/
+void* serial_write(void* ptr)
+{
+#ifdef __linux
+	txEpoll = epoll_create(ports.size());
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		// Disarmed until a write returns EAGAIN
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLONESHOT;
+		ev.data.ptr = ports[i];
+		if (epoll_ctl(txEpoll, EPOLL_CTL_ADD, ports[i]->fd, &ev) < 0)
+		{
+			fprintf(stderr, "ERROR: Could not watch port %s: %s\n", ports[i]->name.c_str(), strerror(errno));
+		}
+	}
+#endif
+
+	while (1)
+	{
+		bool busy = false;		// a port can take more right away
+		bool blocked = false;	// a port waits to become writable
+		uint64_t wait = 0;
+
+		for (size_t i = 0; i < ports.size(); ++i)
+		{
+			SerialPort* p = ports[i];
+
+			if (p->txBlocked)
+			{
+				blocked = true;
+				continue;
+			}
+
+			if (p->txWritten == p->txLength)
+			{
+				g_mutex_lock(txMutex);
+				bool queued = (p->txPriority.length > 0 || p->txBulk.length > 0);
+				g_mutex_unlock(txMutex);
+				if (!queued)
+				{
+					continue;
+				}
+
+				uint64_t backlog = serial_backlog(p);
+				if (backlog > 0)
+				{
+					wait = (wait == 0) ? backlog : std::min(wait, backlog);
+					continue;
+				}
+
+				g_mutex_lock(txMutex);
+				p->txLength = serial_take(&p->txPriority, p->txChunk, p->chunkLimit);
+				p->txLength += serial_take(&p->txBulk, p->txChunk + p->txLength, p->chunkLimit - p->txLength);
+				busy |= (p->txPriority.length > 0 || p->txBulk.length > 0);
+				g_mutex_unlock(txMutex);
+				p->txWritten = 0;
+
+				if (debug) printf("Writing %zu bytes to %s\n", p->txLength, p->name.c_str());
+			}
+
+			while (p->txWritten < p->txLength)
+			{
+				ssize_t ret = write(p->fd, p->txChunk + p->txWritten, p->txLength - p->txWritten);
+				if (ret < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					if (errno == EAGAIN)
+					{
+						// The port is non-blocking for the reader, go on with the others
+						serial_wait_writable(p);
+						blocked = true;
+						break;
+					}
+					if (!silent) fprintf(stderr, "ERROR: Could not write to port %s: %s\n", p->name.c_str(), strerror(errno));
+					p->txWritten = p->txLength;
+					break;
+				}
+				p->txWritten += ret;
+			}
+		}
+
+		if (busy)
+		{
+			if (blocked) serial_poll_writable(0);
+			continue;
+		}
+		if (blocked)
+		{
+			// Wake up for the backlog of the other ports, and at least every
+			// batch to notice newly queued messages
+			uint64_t timeout = (wait > 0) ? std::min<uint64_t>(wait, 20000) : 20000;
+			serial_poll_writable((timeout + 999) / 1000);
+			continue;
+		}
+		if (wait > 0)
+		{
+			usleep(wait);
+			continue;
+		}
+
+		g_mutex_lock(txMutex);
+		bool empty = true;
+		for (size_t i = 0; i < ports.size(); ++i)
+		{
+			empty &= (ports[i]->txPriority.length == 0 && ports[i]->txBulk.length == 0);
+		}
+		if (empty)
+		{
+			g_cond_wait(txCond, txMutex);
+		}
+		g_mutex_unlock(txMutex);
+	}
+	return NULL;
+}
+
 /**
 * @brief Handle a MAVLINK message received from LCM
 *
-* The message is forwarded to the serial port.
+* The message is forwarded to the serial ports.
 *
 * @param rbuf LCM receive buffer
 * @param channel LCM channel
@@ -110,139 +769,29 @@ static void mavlink_handler (const lcm_recv_buf_t *rbuf, const char * channel,
 {
 	const mavlink_message_t* msg = getMAVLinkMsgPtr(container);
 
-	int fd = *(static_cast<int*>(user));
-	if (fd == -1)
+	if (route(&lcmToSerial, msg, getSystemTimeUsecs()))
 	{
-		std::cerr << "Unable to send message over serial port. Port " << port << " not ready!" << std::endl;
+		if (verbose || debug)
+			std::cout << std::dec
+					<< "Received and forwarded LCM message with id "
+					<< static_cast<unsigned int> (msg->msgid)
+					<< " from system " << static_cast<int> (msg->sysid)
+					<< std::endl;
+
+		// Send message over serial ports
+		serial_send(msg);
 	}
-	else
-	{
-		//If msg not from system or not from IMU
-		if (!pc2serial && (msg->sysid != systemid || msg->compid != serial_compid))
-		{
-			// Filter out debug messages
-			//
-			//if (msg->msgid != MAVLINK_MSG_ID_DEBUG && msg->msgid != MAVLINK_MSG_ID_STATUSTEXT && msg->msgid != MAVLINK_MSG_ID_SYSTEM_TIME && msg->msgid != MAVLINK_MSG_ID_DEBUG_VECT)
-
-                        // IMU<->COMPUTER FILTER, filters out messages from LCM
-
-			// Only send messages which are in positiv list. This list contains all messages handled by IMU
-			if (       msg->msgid == MAVLINK_MSG_ID_SET_MODE
-					|| msg->msgid == MAVLINK_MSG_ID_HEARTBEAT
-					|| msg->msgid == MAVLINK_MSG_ID_COMMAND_LONG
-					|| msg->msgid == MAVLINK_MSG_ID_SYSTEM_TIME
-					|| msg->msgid == MAVLINK_MSG_ID_REQUEST_DATA_STREAM
-					|| msg->msgid == MAVLINK_MSG_ID_PARAM_REQUEST_LIST
-					|| msg->msgid == MAVLINK_MSG_ID_PARAM_REQUEST_READ
-					|| msg->msgid == MAVLINK_MSG_ID_PARAM_SET
-					|| msg->msgid == MAVLINK_MSG_ID_PARAM_VALUE
-					|| msg->msgid == MAVLINK_MSG_ID_IMAGE_TRIGGER_CONTROL
-					|| msg->msgid == MAVLINK_MSG_ID_VISION_POSITION_ESTIMATE
-                    || msg->msgid == MAVLINK_MSG_ID_GLOBAL_VISION_POSITION_ESTIMATE
-					|| msg->msgid == MAVLINK_MSG_ID_VICON_POSITION_ESTIMATE
-					|| msg->msgid == MAVLINK_MSG_ID_PING
-					|| msg->msgid == MAVLINK_MSG_ID_STATUSTEXT
-					|| msg->msgid == MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED
-					|| msg->msgid == MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT
-                    || msg->msgid == MAVLINK_MSG_ID_SET_POSITION_CONTROL_OFFSET
-                    || msg->msgid == MAVLINK_MSG_ID_OPTICAL_FLOW) {
-				if (verbose || debug)
-					std::cout << std::dec
-							<< "Received and forwarded LCM message with id "
-							<< static_cast<unsigned int> (msg->msgid)
-							<< " from system " << static_cast<int> (msg->sysid)
-							<< std::endl;
-
-				// Send message over serial port
-				uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-				int messageLength = mavlink_msg_to_send_buffer(buffer, msg);
-				if (debug) printf("Writing %d bytes\n", messageLength);
-				int written = write(fd, (char*)buffer, messageLength);
-				/* wait until all data has been written */
-				tcdrain(fd);
-				if (messageLength != written) fprintf(stderr, "ERROR: Wrote %d bytes but should have written %d\n", written, messageLength);
-			}
-		}
-
-		if (pc2serial && msg->sysid == systemid && (
-			   msg->msgid == MAVLINK_MSG_ID_MISSION_ITEM
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_ACK
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_CLEAR_ALL
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_COUNT
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_CURRENT
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_ITEM_REACHED
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_REQUEST
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_REQUEST_LIST
-			|| msg->msgid == MAVLINK_MSG_ID_MISSION_SET_CURRENT
-			|| msg->msgid == MAVLINK_MSG_ID_SET_GPS_GLOBAL_ORIGIN
-			|| msg->msgid == MAVLINK_MSG_ID_GPS_GLOBAL_ORIGIN
-			|| msg->msgid == MAVLINK_MSG_ID_HEARTBEAT
-			|| msg->msgid == MAVLINK_MSG_ID_PARAM_VALUE
-			|| msg->msgid == MAVLINK_MSG_ID_STATUSTEXT
-			|| msg->msgid == MAVLINK_MSG_ID_COMMAND_ACK
-			|| msg->msgid == MAVLINK_MSG_ID_SYS_STATUS
-			|| msg->msgid == MAVLINK_MSG_ID_SYSTEM_TIME
-			|| msg->msgid == MAVLINK_MSG_ID_POSITION_CONTROL_SETPOINT
-			|| msg->msgid == MAVLINK_MSG_ID_ATTITUDE_TARGET
-			|| msg->msgid == MAVLINK_MSG_ID_ATTITUDE_CONTROL
-			|| msg->msgid == MAVLINK_MSG_ID_DEBUG
-			|| msg->msgid == MAVLINK_MSG_ID_DEBUG_VECT
-			|| msg->msgid == MAVLINK_MSG_ID_GPS_STATUS
-			|| msg->msgid == MAVLINK_MSG_ID_GLOBAL_POSITION_INT
-			|| msg->msgid == MAVLINK_MSG_ID_LOCAL_POSITION_NED
-			|| msg->msgid == MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED
-			|| msg->msgid == MAVLINK_MSG_ID_ATTITUDE))
-		{
-			if (verbose || debug)
-					std::cout << std::dec
-							<< "Received and forwarded LCM message with id "
-							<< static_cast<unsigned int> (msg->msgid)
-							<< " from system " << static_cast<int> (msg->sysid)
-							<< std::endl;
-
-				// Send message over serial port
-				uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-				int messageLength = mavlink_msg_to_send_buffer(buffer, msg);
-				if (debug) printf("Writing %d bytes\n", messageLength);
-				int written = write(fd, (char*)buffer, messageLength);
-				/* wait until all data has been written */
-				tcdrain(fd);
-				if (messageLength != written) fprintf(stderr, "ERROR: Wrote %d bytes but should have written %d\n", written, messageLength);
-		}
-
-        if (pcrelay && msg->sysid == systemid &&
-           ((msg->msgid != MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE
-        && msg->msgid != MAVLINK_MSG_ID_ENCAPSULATED_DATA) || imgrelay))
-        {
-			if (verbose || debug)
-					std::cout << std::dec
-							<< "Received and forwarded LCM message with id "
-							<< static_cast<unsigned int> (msg->msgid)
-							<< " from system " << static_cast<int> (msg->sysid)
-							<< std::endl;
-
-				// Send message over serial port
-				uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-				int messageLength = mavlink_msg_to_send_buffer(buffer, msg);
-				if (debug) printf("Writing %d bytes\n", messageLength);
-				int written = write(fd, (char*)buffer, messageLength);
-				/* wait until all data has been written */
-				tcdrain(fd);
-				if (messageLength != written) fprintf(stderr, "ERROR: Wrote %d bytes but should have written %d\n", written, messageLength);
 
-        }
-
-		if (msg->msgid == MAVLINK_MSG_ID_PING)
+	if (msg->msgid == MAVLINK_MSG_ID_PING)
+	{
+		mavlink_ping_t ping;
+		mavlink_msg_ping_decode(msg, &ping);
+		uint64_t r_timestamp = getSystemTimeUsecs();
+		if (ping.target_system == 0 && ping.target_component == 0)
 		{
-			mavlink_ping_t ping;
-			mavlink_msg_ping_decode(msg, &ping);
-			uint64_t r_timestamp = getSystemTimeUsecs();
-			if (ping.target_system == 0 && ping.target_component == 0)
-			{
-				mavlink_message_t r_msg;
-				mavlink_msg_ping_pack(systemid, compid, &r_msg, ping.seq, msg->sysid, msg->compid, r_timestamp);
-				sendMAVLinkMessage(lcm, &r_msg);
-			}
+			mavlink_message_t r_msg;
+			mavlink_msg_ping_pack(systemid, compid, &r_msg, ping.seq, msg->sysid, msg->compid, r_timestamp);
+			sendMAVLinkMessage(lcm, &r_msg);
 		}
 	}
 }
@@ -281,13 +830,14 @@ int open_port(std::string port)
 	}
 	else
 	{
-		fcntl(fd, F_SETFL, 0);
+		// Non-blocking, the reader thread waits for data with epoll
+		fcntl(fd, F_SETFL, O_NONBLOCK);
 	}
 
 	return (fd);
 }
 
-bool setup_port(int fd, int baud, int data_bits, int stop_bits, bool parity, bool hardware_control)
+bool setup_port(const string& port, int fd, int baud, int data_bits, int stop_bits, bool parity, bool hardware_control)
 {
 	//struct termios options;
 
@@ -336,11 +886,11 @@ bool setup_port(int fd, int baud, int data_bits, int stop_bits, bool parity, boo
 	config.c_cflag |= CS8;
 	config.c_cflag |= CLOCAL;
 	//
-	// One input byte is enough to return from read()
-	// Inter-character timer off
+	// read() returns whatever is buffered, the reader thread
+	// waits for data with epoll instead of the inter-character timer
 	//
-	config.c_cc[VMIN]  = 1;
-	config.c_cc[VTIME] = 10; // was 0
+	config.c_cc[VMIN]  = 0;
+	config.c_cc[VTIME] = 0;
 
 	// Get the current options for the port
 	//tcgetattr(fd, &options);
@@ -458,6 +1008,20 @@ bool setup_port(int fd, int baud, int data_bits, int stop_bits, bool parity, boo
 		fprintf(stderr, "\nERROR: could not set configuration of port %s\n", port.c_str());
 		return false;
 	}
+
+#ifdef ASYNC_LOW_LATENCY
+	// Hand received bytes to the reader right away instead of
+	// after the driver's flip buffer timer, at the cost of more wakeups
+	struct serial_struct serial;
+	if (lowLatency && ioctl(fd, TIOCGSERIAL, &serial) == 0)
+	{
+		serial.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(fd, TIOCSSERIAL, &serial) < 0)
+		{
+			fprintf(stderr, "\nWARNING: could not set low latency mode of port %s\n", port.c_str());
+		}
+	}
+#endif
 	return true;
 }
 
@@ -467,61 +1031,38 @@ void close_port(int fd)
 }
 
 /**
-* @brief Serial function
+* @brief Handle the bytes read from a serial port
 *
-* This function blocks waiting for serial data in it's own thread
-* and forwards the data once received.
+* Parses all complete messages in the buffer and forwards them to LCM.
 */
-void* serial_wait(void* serial_ptr)
-				{
-	int fd = *((int*) serial_ptr);
+static void serial_receive(SerialPort* p, const uint8_t* buf, ssize_t length)
+{
+	p->scanner.scan(buf, length, p->messages);
 
-	mavlink_status_t lastStatus;
-	lastStatus.packet_rx_drop_count = 0;
+	uint64_t badFrames = p->scanner.getStats().badFrames;
+	if (badFrames != p->lastBadFrames)
+	{
+		if (verbose || debug) printf("ERROR: DROPPED %llu PACKETS ON %s\n", (unsigned long long) (badFrames - p->lastBadFrames), p->name.c_str());
+		p->lastBadFrames = badFrames;
+	}
 
-	// Blocking wait for new data
-	while (1)
+	for (size_t i = 0; i < p->messages.size(); ++i)
 	{
-		//if (debug) printf("Checking for new data on serial port\n");
-		// Block until data is available, read only one byte to be able to continue immediately
-		//char buf[MAVLINK_MAX_PACKET_LEN];
-		uint8_t cp;
-		mavlink_message_t message;
-		mavlink_status_t status;
-		uint8_t msgReceived = false;
+		const mavlink_message_t& message = p->messages[i];
 
-		if (read(fd, &cp, 1) > 0)
-		{
-			// Check if a message could be decoded, return the message in case yes
-			msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
-			if (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count)
-			{
-				if (verbose || debug) printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
-				if (debug)
-				{
-					unsigned char v=cp;
-					fprintf(stderr,"%02x ", v);
-				}
-			}
-			lastStatus = status;
-		}
-		else
-		{
-			if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", port.c_str());
-		}
+		// Remember who is on this port to not echo its messages back
+		serial_source_add(p, (message.sysid << 8) | message.compid);
 
 		// If a message could be decoded, handle it
-		if(msgReceived)
+		if (route(&serialToLcm, &message, getSystemTimeUsecs()))
 		{
-			if (verbose || debug) std::cout << std::dec << "Received and forwarded serial port message with id " << static_cast<unsigned int>(message.msgid) << " from system " << static_cast<int>(message.sysid) << std::endl;
-
-			// Do not send images over serial port
+			if (verbose || debug) std::cout << std::dec << "Received and forwarded serial port message with id " << static_cast<unsigned int>(message.msgid) << " from system " << static_cast<int>(message.sysid) << " on " << p->name << std::endl;
 
 			// DEBUG output
 			if (debug)
 			{
 				fprintf(stderr,"Forwarding SERIAL -> LCM: ");
-				unsigned int i;
+				unsigned int j;
 				uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
 				unsigned int messageLength = mavlink_msg_to_send_buffer(buffer, &message);
 				if (messageLength > MAVLINK_MAX_PACKET_LEN)
@@ -530,9 +1071,9 @@ void* serial_wait(void* serial_ptr)
 				}
 				else
 				{
-					for (i=0; i<messageLength; i++)
+					for (j=0; j<messageLength; j++)
 					{
-						unsigned char v=buffer[i];
+						unsigned char v=buffer[j];
 						fprintf(stderr,"%02x ", v);
 					}
 					fprintf(stderr,"\n");
@@ -552,6 +1093,92 @@ void* serial_wait(void* serial_ptr)
 			}
 		}
 	}
+}
+
+/**
+* @brief Serial function
+*
+* This function waits for serial data on all ports in its own thread and
+* forwards the data once received. Every wakeup drains whatever the driver
+* has buffered with reads of up to 4 KB, instead of one read() per byte.
+*/
+void* serial_wait(void* ptr)
+				{
+	uint8_t buf[4096];
+
+#ifdef __linux
+	int epfd = epoll_create(ports.size());
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = ports[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ports[i]->fd, &ev) < 0)
+		{
+			fprintf(stderr, "ERROR: Could not watch port %s: %s\n", ports[i]->name.c_str(), strerror(errno));
+		}
+	}
+	std::vector<struct epoll_event> events(ports.size());
+#else
+	std::vector<struct pollfd> fds(ports.size());
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		fds[i].fd = ports[i]->fd;
+		fds[i].events = POLLIN;
+	}
+#endif
+
+	// Blocking wait for new data
+	while (1)
+	{
+		std::vector<SerialPort*> ready;
+		std::vector<bool> hangup;
+#ifdef __linux
+		int n = epoll_wait(epfd, &events[0], events.size(), -1);
+		for (int i = 0; i < n; ++i)
+		{
+			ready.push_back(static_cast<SerialPort*>(events[i].data.ptr));
+			hangup.push_back((events[i].events & (EPOLLHUP | EPOLLERR)) != 0);
+		}
+#else
+		int n = poll(&fds[0], fds.size(), -1);
+		for (size_t i = 0; n > 0 && i < fds.size(); ++i)
+		{
+			if (fds[i].revents)
+			{
+				ready.push_back(ports[i]);
+				hangup.push_back((fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0);
+			}
+		}
+#endif
+		if (n < 0 && errno != EINTR)
+		{
+			if (!silent) fprintf(stderr, "ERROR: Could not wait for serial data: %s\n", strerror(errno));
+			usleep(100000);
+		}
+
+		for (size_t i = 0; i < ready.size(); ++i)
+		{
+			SerialPort* p = ready[i];
+			ssize_t length;
+			while ((length = read(p->fd, buf, sizeof(buf))) > 0)
+			{
+				serial_receive(p, buf, length);
+				if (length < (ssize_t) sizeof(buf))
+				{
+					break;
+				}
+			}
+			// with VMIN = VTIME = 0 an empty read returns 0, the port is
+			// drained; a lost device is reported as a hangup instead
+			if (hangup[i] || (length < 0 && errno != EAGAIN && errno != EINTR))
+			{
+				if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", p->name.c_str());
+				usleep(100000);
+			}
+		}
+	}
 	return NULL;
 				}
 
@@ -563,19 +1190,24 @@ int main(int argc, char* argv[])
 
 	// Handling Program options
 
+	std::vector<string> portNames;
+
 	config::options_description desc("Allowed options");
 	desc.add_options()
 		("help", "produce help message")
 		("sysid,a", config::value<int>(&systemid)->default_value(systemid), "ID of this system, 1-127")
 		("compid,c", config::value<int>(&serial_compid)->default_value(MAV_COMP_ID_IMU), "ID of the component connected to the serial port (if non-zero, messages from this compid wont be forwarded back to the serial port)")
-		("port,p", config::value<string>(&port)->default_value("/dev/ttyUSB0"), "serial port, e.g. /dev/ttyUSB0")
-		("baud,b", config::value<int>(&baud)->default_value(115200), "serial baud rate, e.g. 115200")
+		("port,p", config::value< std::vector<string> >(&portNames)->composing(), "serial port, e.g. /dev/ttyUSB0 or /dev/ttyUSB1:57600 (may be repeated). Default: /dev/ttyUSB0")
+		("baud,b", config::value<int>(&baud)->default_value(115200), "serial baud rate of ports without one, e.g. 115200")
+		("low-latency", config::bool_switch(&lowLatency)->default_value(false), "Put the UART drivers into low latency mode")
 		("silent,s", config::bool_switch(&silent)->default_value(false), "surpress outputs")
 		("verbose,v", config::bool_switch(&verbose)->default_value(false), "verbose output")
 		("debug,d", config::bool_switch(&debug)->default_value(false), "Emit debug information")
 		("pc2serial", config::bool_switch(&pc2serial)->default_value(false), "Send more status information from PC over serial (for second XBee mode)")
         ("pcrelay", config::bool_switch(&pcrelay)->default_value(false), "Relay all messages, except for image data, over serial. Useful for onboard PC to serial radio.")
         ("imgrelay", config::bool_switch(&imgrelay)->default_value(false), "Relay image data over serial. Will be removed in a future version (automatic switching instead)")
+		("txqueue", config::value<int>(&txQueueSize)->default_value(4096), "Bytes of telemetry queued for the serial port before the oldest messages are dropped")
+		("routes", config::value<string>(&routeFile)->default_value("config/mavconn-bridge-serial-routes.cfg"), "Route file with the forwarded messages and their rate caps")
 		;
 	config::variables_map vm;
 	config::store(config::parse_command_line(argc, argv, desc), vm);
@@ -587,35 +1219,80 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
-	// SETUP SERIAL PORT
-
-	if (!silent) printf("SERIAL MAVLINK INTERFACE STARTED\n");
-
-	// Exit if opening port failed
-	// Open the serial port.
-	if (!silent) printf("Trying to connect to %s.. ", port.c_str());
-	int fd = open_port(port);
-	if (fd == -1)
+	// Load the route table, the command line selects the sections
+	for (size_t i = 0; i < sizeof(routeSections) / sizeof(routeSections[0]); ++i)
 	{
-		if (!silent) printf("failure, could not open port.\n");
-		exit(EXIT_FAILURE);
+		RouteSection* section = &routeSections[i];
+		string name = section->name;
+		section->active = (name == "imu" && !pc2serial) ||
+						  (name == "pc2serial" && pc2serial) ||
+						  (name == "pcrelay" && pcrelay) ||
+						  (name == "imgrelay" && pcrelay && imgrelay) ||
+						  (name == "serial2lcm");
 	}
-	else
+	if (!load_routes(routeFile))
 	{
-		if (!silent) printf("success.\n");
+		exit(EXIT_FAILURE);
 	}
-	if (!silent) printf("Trying to configure %s.. ", port.c_str());
-	bool setup = setup_port(fd, baud, 8, 1, false, false);
-	if (!setup)
+
+	// SETUP SERIAL PORT
+
+	if (!silent) printf("SERIAL MAVLINK INTERFACE STARTED\n");
+
+	if (portNames.empty())
 	{
-		if (!silent) printf("failure, could not configure port.\n");
-		exit(EXIT_FAILURE);
+		portNames.push_back("/dev/ttyUSB0");
 	}
-	else
+	for (size_t i = 0; i < portNames.size(); ++i)
 	{
-		if (!silent) printf("success.\n");
+		SerialPort* p = new SerialPort;
+		p->name = portNames[i];
+		p->baud = baud;
+		size_t colon = p->name.rfind(':');
+		if (colon != string::npos)
+		{
+			p->baud = atoi(p->name.c_str() + colon + 1);
+			p->name.erase(colon);
+		}
+		memset(p->sources, 0, sizeof(p->sources));
+		p->lastBadFrames = 0;
+
+		// Exit if opening port failed
+		// Open the serial port.
+		if (!silent) printf("Trying to connect to %s.. ", p->name.c_str());
+		p->fd = open_port(p->name);
+		if (p->fd == -1)
+		{
+			if (!silent) printf("failure, could not open port.\n");
+			exit(EXIT_FAILURE);
+		}
+		else
+		{
+			if (!silent) printf("success.\n");
+		}
+		if (!silent) printf("Trying to configure %s.. ", p->name.c_str());
+		bool setup = setup_port(p->name, p->fd, p->baud, 8, 1, false, false);
+		if (!setup)
+		{
+			if (!silent) printf("failure, could not configure port.\n");
+			exit(EXIT_FAILURE);
+		}
+		else
+		{
+			if (!silent) printf("success.\n");
+		}
+
+		// Queues of the serial writer, priority messages are small and rare
+		serial_queue_init(&p->txPriority, 1024);
+		serial_queue_init(&p->txBulk, txQueueSize);
+		// 10 bits per byte on the wire, write 20 ms worth at once
+		p->chunkLimit = std::max(p->baud / 10 / 50, MAVLINK_MAX_PACKET_LEN);
+		p->txChunk = new uint8_t[p->chunkLimit];
+		p->txLength = 0;
+		p->txWritten = 0;
+		p->txBlocked = false;
+		ports.push_back(p);
 	}
-	int* fd_ptr = &fd;
 
 	// SETUP LCM
 	lcm = lcm_create ("udpm://");
@@ -632,6 +1309,7 @@ int main(int argc, char* argv[])
 	// Thread
 	GThread* lcm_thread;
 	GThread* serial_thread;
+	GThread* writer_thread;
 	GError* err;
 
 	if( !g_thread_supported() )
@@ -640,8 +1318,17 @@ int main(int argc, char* argv[])
 		// Only initialize g thread if not already done
 	}
 
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, (void*)fd_ptr);
+	txMutex = g_mutex_new();
+	txCond = g_cond_new();
+
+	if( (writer_thread = g_thread_create((GThreadFunc)serial_write, NULL, TRUE, &err)) == NULL)
+	{
+		printf("Failed to create serial writer thread: %s!!\n", err->message );
+		g_error_free ( err ) ;
+	}
+
+	mavconn_mavlink_compact_subscription_t * comm_sub =
+			subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_ALL, 0, &mavlink_handler, NULL);
 	if (!silent) printf("Subscribed to %s LCM channel.\n", "MAVLINK");
 
 	// Run indefinitely while the LCM and serial threads handle the data
@@ -654,27 +1341,15 @@ int main(int argc, char* argv[])
 	}
 
 
-	if( (serial_thread = g_thread_create((GThreadFunc)serial_wait, (void *)fd_ptr, TRUE, &err)) == NULL)
+	if( (serial_thread = g_thread_create((GThreadFunc)serial_wait, NULL, TRUE, &err)) == NULL)
 	{
 		printf("Failed to create serial handling thread: %s!!\n", err->message );
 		g_error_free ( err ) ;
 	}
 
-	int noErrors = 0;
-	if (fd == -1 || fd == 0)
-	{
-		if (!silent) fprintf(stderr, "First attempt failed, waiting for port..\n");
-	}
-	else
-	{
-		if (!silent) fprintf(stderr, "\nConnected to %s with %d baud, 8 data bits, no parity, 1 stop bit (8N1)\n", port.c_str(), baud);
-	}
-
-	// FIXME ADD MORE CONNECTION ATTEMPTS
-
-	if(fd == -1 || fd == 0)
+	for (size_t i = 0; i < ports.size(); ++i)
 	{
-		exit(noErrors);
+		if (!silent) fprintf(stderr, "\nConnected to %s with %d baud, 8 data bits, no parity, 1 stop bit (8N1)\n", ports[i]->name.c_str(), ports[i]->baud);
 	}
 
 	// Ready to roll
@@ -682,9 +1357,8 @@ int main(int argc, char* argv[])
 
 	// Write timestamp to serial port from time to time (every 2 seconds)
 	uint64_t lastTime = 0;
-	// Static buffers
-	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
 	mavlink_message_t msg;
+	std::vector<uint64_t> lastDropped(ports.size(), 0);
 	while(1)
 	{
 			gettimeofday(&tv, NULL);
@@ -695,25 +1369,36 @@ int main(int argc, char* argv[])
 				// SEND OUT TIME MESSAGE
 				// send message as close to time aquisition as possible
 				mavlink_msg_system_time_pack(systemid, compid, &msg, currTime, 0);
-				// Send message over serial port
-				int messageLength = mavlink_msg_to_send_buffer(buffer, &msg);
-				int written = write(fd, (char*)buffer, messageLength);
+				// Send message over serial ports
+				serial_send(&msg);
 				lastTime = currTime;
-				if (written != messageLength)
+
+				for (size_t i = 0; i < ports.size(); ++i)
 				{
-					fprintf(stderr, "\nERROR: Unable to send system time over serial port.\n");
+					g_mutex_lock(txMutex);
+					uint64_t dropped = ports[i]->txPriority.dropped + ports[i]->txBulk.dropped;
+					g_mutex_unlock(txMutex);
+					if (dropped != lastDropped[i] && !silent)
+					{
+						fprintf(stderr, "# WARNING: Serial port %s too slow, dropped %llu queued messages\n", ports[i]->name.c_str(), (unsigned long long) (dropped - lastDropped[i]));
+					}
+					lastDropped[i] = dropped;
 				}
 			}
 		usleep(100000);
 	}
 
 	// Disconnect from LCM
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
 	lcm_destroy (lcm);
-	close_port(fd);
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		close_port(ports[i]->fd);
+	}
 
 	g_thread_join(lcm_thread);
 	g_thread_join(serial_thread);
+	g_thread_join(writer_thread);
 	exit(0);
 }
 
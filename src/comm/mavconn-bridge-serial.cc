@@ -60,6 +60,7 @@ This file is part of the MAVCONN project
 #include <sys/time.h>
 #include <time.h>
 #include "mavconn.h"
+#include "MAVLinkScanner.h"
 #include <glib.h>
 
 namespace config = boost::program_options;
@@ -446,49 +447,42 @@ void close_port(int fd)
 * @brief Serial function
 *
 * This function blocks waiting for serial data in it's own thread
-* and forwards the data once received.
+* and forwards the data once received. Each read takes everything the
+* driver has buffered, up to 4 KB, and all frames in it are decoded at
+* once.
 */
 void* serial_wait(void* serial_ptr)
 				{
 	int fd = *((int*) serial_ptr);
 
-	mavlink_status_t lastStatus;
-	lastStatus.packet_rx_drop_count = 0;
+	px::MAVLinkScanner scanner;
+	std::vector<mavlink_message_t> messages;
+	uint64_t lastBadFrames = 0;
+	uint8_t buf[4096];
 
 	// Blocking wait for new data
 	while (1)
 	{
-		//if (debug) printf("Checking for new data on serial port\n");
-		// Block until data is available, read only one byte to be able to continue immediately
-		//char buf[MAVLINK_MAX_PACKET_LEN];
-		uint8_t cp;
-		mavlink_message_t message;
-		mavlink_status_t status;
-		uint8_t msgReceived = false;
-
-		if (read(fd, &cp, 1) > 0)
+		// Blocks until at least one byte is available (VMIN = 1)
+		ssize_t length = read(fd, buf, sizeof(buf));
+		if (length <= 0)
 		{
-			// Check if a message could be decoded, return the message in case yes
-			msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
-			if (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count)
-			{
-				if (verbose || debug) printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
-				if (debug)
-				{
-					unsigned char v=cp;
-					fprintf(stderr,"%02x ", v);
-				}
-			}
-			lastStatus = status;
+			if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", port.c_str());
+			continue;
 		}
-		else
+
+		scanner.scan(buf, length, messages);
+		uint64_t badFrames = scanner.getStats().badFrames;
+		if (badFrames != lastBadFrames)
 		{
-			if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", port.c_str());
+			if (verbose || debug) printf("ERROR: DROPPED %llu PACKETS\n", (unsigned long long) (badFrames - lastBadFrames));
+			lastBadFrames = badFrames;
 		}
 
-		// If a message could be decoded, handle it
-		if(msgReceived)
+		for (size_t m = 0; m < messages.size(); ++m)
 		{
+			const mavlink_message_t& message = messages[m];
+
 			if (verbose || debug) std::cout << std::dec << "Received and forwarded serial port message with id " << static_cast<unsigned int>(message.msgid) << " from system " << static_cast<int>(message.sysid) << std::endl;
 
 			// Do not send images over serial port
@@ -614,8 +608,8 @@ int main(int argc, char* argv[])
 		// Only initialize g thread if not already done
 	}
 
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, (void*)fd_ptr);
+	mavconn_mavlink_compact_subscription_t * comm_sub =
+			subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_ALL, 0, &mavlink_handler, (void*)fd_ptr);
 	if (!silent) printf("Subscribed to %s LCM channel.\n", "MAVLINK");
 
 	// Run indefinitely while the LCM and serial threads handle the data
@@ -682,7 +676,7 @@ int main(int argc, char* argv[])
 	}
 
 	// Disconnect from LCM
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
 	lcm_destroy (lcm);
 	close_port(fd);
 
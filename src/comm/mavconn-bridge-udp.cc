@@ -45,6 +45,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <sys/uio.h>
 #if (defined __QNX__) | (defined __QNXNTO__)
 /* QNX specific headers */
 #include <unix.h>
@@ -55,6 +58,7 @@
 #endif
 #include <glib.h>
 #include "mavconn.h"
+#include "MAVLinkScanner.h"
 
 // Settings
 int systemid = getSystemID();
@@ -72,7 +76,6 @@ bool dataOnly; ///< send only data, without video stream
 bool debug; ///< debug mode
 
 int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-struct sockaddr_in gcAddr;
 struct sockaddr_in locAddr;
 struct sockaddr_in fromAddr;
 int messageBurstSize = 20; ///< Number of image messages to send in a row - controls how much bandwidth the image consumes
@@ -84,6 +87,483 @@ struct timeval tv;
 
 lcm_t* lcm;
 
+// Batching
+bool batch; ///< queue outgoing messages and send them in batches from a sender thread
+int mtu = 1400; ///< maximum size of a datagram carrying several messages
+int flushDeadline = 2000; ///< maximum time a message may wait for a datagram to fill up, in microseconds
+
+#define UDP_SEND_MAX_DATAGRAMS 32	///< datagrams handed to the kernel in one sendmmsg call
+#define UDP_SEND_MAX_FRAMES 256		///< messages handed to the kernel in one sendmmsg call
+#define UDP_RECV_MAX_DATAGRAMS 16	///< datagrams fetched from the kernel in one recvmmsg call
+#define UDP_MAX_DATAGRAM_LEN 65536
+
+/**
+ * Outgoing messages in batch mode. The ring has exactly one producer, the
+ * LCM thread, and one consumer, the sender thread, so head and tail are
+ * plain counters that are only ever written by their owner. Each record
+ * is a 32 bit length followed by the wire bytes of the message, padded to
+ * 4 bytes. A record that would cross the end of the ring is preceded by a
+ * wrap marker instead. The sender hands records to the kernel straight
+ * from the ring and only then releases them.
+ */
+#define UDP_RING_SIZE (1 << 20)
+#define UDP_RING_WRAP 0xFFFFFFFF
+
+static uint8_t ring[UDP_RING_SIZE];
+static uint32_t ringHead = 0; ///< end of the last queued record, written by the LCM thread
+static uint32_t ringTail = 0; ///< start of the oldest unsent record, written by the sender thread
+static uint32_t ringDropped = 0; ///< messages dropped because the ring was full
+static int senderSleeping = 0; ///< set while the sender thread waits for new records
+static int senderWakeup[2]; ///< pipe used to wake up the sender thread
+static uint32_t sendCursor = 0; ///< end of the records packed by the sender thread
+
+/**
+ * @brief Queue a message for the sender thread
+ *
+ * The message is given in two parts so that extended messages do not
+ * have to be assembled in a temporary buffer first.
+ *
+ * @return false if the ring is full and the message was dropped
+ */
+static bool batch_enqueue(const uint8_t* data, uint32_t length, const uint8_t* ext, uint32_t extLength)
+{
+	uint32_t total = length + extLength;
+	uint32_t need = (4 + total + 3) & ~3U;
+	uint32_t head = ringHead;
+	uint32_t tail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+	uint32_t offset = head % UDP_RING_SIZE;
+	uint32_t pad = (offset + need > UDP_RING_SIZE) ? UDP_RING_SIZE - offset : 0;
+
+	if (need + pad > UDP_RING_SIZE - (head - tail))
+	{
+		__atomic_add_fetch(&ringDropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	if (pad > 0)
+	{
+		uint32_t marker = UDP_RING_WRAP;
+		memcpy(ring + offset, &marker, 4);
+		head += pad;
+		offset = 0;
+	}
+
+	memcpy(ring + offset, &total, 4);
+	memcpy(ring + offset + 4, data, length);
+	if (extLength > 0)
+	{
+		memcpy(ring + offset + 4 + length, ext, extLength);
+	}
+	__atomic_store_n(&ringHead, head + need, __ATOMIC_RELEASE);
+
+	// Pairs with the fence in batch_wait(): either the sender sees the
+	// new head or we see it sleeping and wake it up
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&senderSleeping, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&senderSleeping, 0, __ATOMIC_RELAXED))
+	{
+		char c = 0;
+		if (write(senderWakeup[1], &c, 1) < 0 && errno != EAGAIN)
+		{
+			perror("Could not wake up UDP sender");
+		}
+	}
+	return true;
+}
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Endpoints
+#define UDP_MAX_ENDPOINTS 16
+
+static gchar** endpointSpecs = NULL; ///< static endpoints, HOST:PORT[,OPTIONS]
+static gchar* learnedOptions = NULL; ///< options of endpoints learned from received datagrams
+int endpointExpiry = 10; ///< seconds after which a silent learned endpoint is dropped
+
+/**
+ * A ground station or logger that messages are forwarded to, either
+ * given on the command line or learned from received datagrams, see
+ * endpoint_learn().
+ *
+ * All fields are protected by endpointMutex. The routing fields are
+ * written by the UDP receive thread, the counters and the batch state by
+ * the thread that sends, which is the LCM thread or the sender thread in
+ * batch mode.
+ */
+struct Endpoint
+{
+	bool active;
+	bool learned;
+	struct sockaddr_in addr;
+	int sysid;				///< system ID seen from this endpoint, -1 until known
+	int compid;				///< component ID seen from this endpoint, -1 until known
+	uint64_t lastSeen;		///< time of the last datagram from this endpoint, in microseconds
+	uint32_t allow[8];		///< bitset of message IDs forwarded to this endpoint
+	double rate;			///< maximum messages per second, 0 for unlimited
+	double tokens;			///< token bucket of the rate limit, holds up to one second
+	uint64_t lastRefill;
+	uint64_t forwarded;		///< messages forwarded
+	uint64_t filtered;		///< messages dropped by the message ID filter
+	uint64_t limited;		///< messages dropped by the rate limit
+
+	// Batch mode
+	struct iovec iov[UDP_SEND_MAX_FRAMES];
+	int counts[UDP_SEND_MAX_DATAGRAMS + 1];	///< messages per datagram, the last one is being filled
+	int frames;				///< messages in iov
+	int datagrams;			///< complete datagrams
+	uint32_t openBytes;		///< size of the datagram being filled
+	uint32_t openStart;		///< ring position of its first message
+	uint64_t openSince;		///< time its first message was packed
+};
+
+static Endpoint endpoints[UDP_MAX_ENDPOINTS];
+static Endpoint learnedTemplate; ///< filter and rate limit of learned endpoints
+static GMutex* endpointMutex;
+
+static const char* endpoint_name(const Endpoint* ep)
+{
+	static char name[32];
+	snprintf(name, sizeof(name), "%s:%u", inet_ntoa(ep->addr.sin_addr), ntohs(ep->addr.sin_port));
+	return name;
+}
+
+/**
+ * @brief Set or clear message IDs in a bitset
+ *
+ * @param list message IDs and ranges separated by slashes, e.g. 0/30-33
+ * @return false if the list is malformed
+ */
+static bool parse_msgids(const char* list, uint32_t* set, bool value)
+{
+	while (*list != '\0')
+	{
+		char* end;
+		long first = strtol(list, &end, 10);
+		long last = first;
+		if (end == list)
+		{
+			return false;
+		}
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list)
+			{
+				return false;
+			}
+		}
+		if (first < 0 || last > 255 || first > last)
+		{
+			return false;
+		}
+		for (long id = first; id <= last; ++id)
+		{
+			if (value)
+			{
+				set[id >> 5] |= 1U << (id & 31);
+			}
+			else
+			{
+				set[id >> 5] &= ~(1U << (id & 31));
+			}
+		}
+		if (*end == '/')
+		{
+			++end;
+		}
+		else if (*end != '\0')
+		{
+			return false;
+		}
+		list = end;
+	}
+	return true;
+}
+
+/**
+ * @brief Apply endpoint options
+ *
+ * @param options comma separated list of rate=MSGS_PER_SECOND,
+ *                allow=MSGIDS and deny=MSGIDS. allow replaces the default
+ *                of forwarding everything, deny removes IDs afterwards.
+ * @return false if the options are malformed
+ */
+static bool endpoint_configure(Endpoint* ep, const char* options)
+{
+	memset(ep->allow, 0xFF, sizeof(ep->allow));
+	ep->rate = 0;
+
+	gchar** items = g_strsplit(options, ",", 0);
+	bool ok = true;
+	bool allowed = false;
+	for (int i = 0; ok && items[i] != NULL; ++i)
+	{
+		const char* item = items[i];
+		if (*item == '\0')
+		{
+			continue;
+		}
+		else if (strncmp(item, "rate=", 5) == 0)
+		{
+			ep->rate = atof(item + 5);
+			ok = (ep->rate >= 0);
+		}
+		else if (strncmp(item, "allow=", 6) == 0)
+		{
+			if (!allowed)
+			{
+				memset(ep->allow, 0, sizeof(ep->allow));
+				allowed = true;
+			}
+			ok = parse_msgids(item + 6, ep->allow, true);
+		}
+		else if (strncmp(item, "deny=", 5) == 0)
+		{
+			ok = parse_msgids(item + 5, ep->allow, false);
+		}
+		else
+		{
+			ok = false;
+		}
+	}
+	g_strfreev(items);
+
+	ep->tokens = ep->rate;
+	return ok;
+}
+
+/**
+ * @brief Resolve a host name and port into a socket address
+ *
+ * @return false if the host is unknown
+ */
+static bool resolve(const char* hostname, const char* service, struct sockaddr_in* addr)
+{
+	// Get internet address for hostname
+	struct hostent *hp = gethostbyname(hostname);
+
+	if (hp == NULL)
+	{
+		fprintf(stderr,"Unknown remote host address: %s, please check spelling.\n", hostname);
+		return false;
+	}
+
+	printf("Using IP address: %s for host %s\n", inet_ntoa( *( struct in_addr*)( hp -> h_addr)), hp->h_name);
+
+	// If more than one address exists
+	if (hp->h_addr_list[1] != NULL)
+	{
+		printf("Additional (unused) addresses of this host (%s) are:\n", hp->h_name);
+		int i=1;
+		while (hp->h_addr_list[i] != NULL)
+		{
+			printf( "\t%s \n", inet_ntoa( *( struct in_addr*)( hp -> h_addr_list[i])));
+			i++;
+		}
+	}
+
+	// Set host and port
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = hp->h_addrtype;
+	addr->sin_addr.s_addr = ((struct in_addr *)(hp->h_addr))->s_addr;
+	addr->sin_port = htons(atoi(service));
+	return true;
+}
+
+/**
+ * @brief Add a static endpoint
+ *
+ * @param spec HOST:PORT[,OPTIONS], see endpoint_configure() for the options
+ * @return false if the endpoint could not be added
+ */
+static bool endpoint_add(const char* spec)
+{
+	Endpoint* ep = NULL;
+	for (int i = 0; i < UDP_MAX_ENDPOINTS && ep == NULL; ++i)
+	{
+		if (!endpoints[i].active)
+		{
+			ep = &endpoints[i];
+		}
+	}
+	if (ep == NULL)
+	{
+		fprintf(stderr, "# ERROR: More than %d endpoints\n", UDP_MAX_ENDPOINTS);
+		return false;
+	}
+
+	printf("Connecting to host %s\n", spec);
+
+	gchar** parts = g_strsplit(spec, ",", 2);
+	gchar* colon = strrchr(parts[0], ':');
+	bool ok = (colon != NULL);
+	if (ok)
+	{
+		*colon = '\0';
+		ok = resolve(parts[0], colon + 1, &ep->addr) &&
+			 endpoint_configure(ep, (parts[1] != NULL) ? parts[1] : "");
+	}
+	if (!ok)
+	{
+		fprintf(stderr, "# ERROR: Invalid endpoint %s, expected HOST:PORT[,rate=N][,allow=IDS][,deny=IDS]\n", spec);
+	}
+	g_strfreev(parts);
+
+	ep->sysid = -1;
+	ep->compid = -1;
+	ep->active = ok;
+	return ok;
+}
+
+/**
+ * @brief Record a datagram received from an address
+ *
+ * @param sysid system ID of the messages in the datagram, -1 if none was complete
+ * @param compid component ID of the messages in the datagram
+ */
+static void endpoint_learn(const struct sockaddr_in* from, int sysid, int compid, uint64_t now)
+{
+	Endpoint* byAddr = NULL;
+	Endpoint* byId = NULL;
+	Endpoint* unused = NULL;
+
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		Endpoint* ep = &endpoints[i];
+		if (!ep->active)
+		{
+			if (unused == NULL) unused = ep;
+		}
+		else if (ep->addr.sin_addr.s_addr == from->sin_addr.s_addr && ep->addr.sin_port == from->sin_port)
+		{
+			byAddr = ep;
+		}
+		else if (sysid >= 0 && ep->sysid == sysid && ep->compid == compid)
+		{
+			byId = ep;
+		}
+	}
+
+	Endpoint* ep = byAddr;
+	if (ep == NULL && byId != NULL && byId->learned)
+	{
+		// Same ground station, new address
+		ep = byId;
+		ep->addr = *from;
+		if (!silent) printf("Endpoint SYS %d/COMP %d moved to %s\n", sysid, compid, endpoint_name(ep));
+	}
+	else if (ep == NULL)
+	{
+		if (unused == NULL)
+		{
+			return;
+		}
+		ep = unused;
+		*ep = learnedTemplate;
+		ep->active = true;
+		ep->learned = true;
+		ep->addr = *from;
+		ep->sysid = -1;
+		ep->compid = -1;
+		ep->tokens = ep->rate;
+		if (!silent) printf("Learned endpoint %s\n", endpoint_name(ep));
+	}
+
+	if (sysid >= 0 && (ep->sysid != sysid || ep->compid != compid))
+	{
+		ep->sysid = sysid;
+		ep->compid = compid;
+		if (!silent) printf("Endpoint %s is SYS %d/COMP %d\n", endpoint_name(ep), sysid, compid);
+	}
+	ep->lastSeen = now;
+}
+
+/**
+ * @brief Drop learned endpoints that have been silent for too long
+ */
+static void endpoint_expire(uint64_t now)
+{
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		Endpoint* ep = &endpoints[i];
+		if (ep->active && ep->learned && now - ep->lastSeen > (uint64_t) endpointExpiry * 1000000)
+		{
+			if (!silent) printf("Endpoint %s expired\n", endpoint_name(ep));
+			ep->active = false;
+			ep->frames = 0;
+			ep->datagrams = 0;
+			ep->counts[0] = 0;
+			ep->openBytes = 0;
+		}
+	}
+}
+
+/**
+ * @brief Check the message ID filter and the rate limit of an endpoint
+ *
+ * Messages are not sent back to the component they came from.
+ *
+ * @return true if the message should be forwarded to the endpoint
+ */
+static bool endpoint_accepts(Endpoint* ep, uint8_t sysid, uint8_t compid, uint8_t msgid, uint64_t now)
+{
+	if (ep->sysid == sysid && ep->compid == compid)
+	{
+		return false;
+	}
+	if (!(ep->allow[msgid >> 5] & (1U << (msgid & 31))))
+	{
+		++ep->filtered;
+		return false;
+	}
+	if (ep->rate > 0)
+	{
+		ep->tokens += (now - ep->lastRefill) * 1e-6 * ep->rate;
+		ep->lastRefill = now;
+		if (ep->tokens > ep->rate)
+		{
+			ep->tokens = ep->rate;
+		}
+		if (ep->tokens < 1)
+		{
+			++ep->limited;
+			return false;
+		}
+		ep->tokens -= 1;
+	}
+	++ep->forwarded;
+	return true;
+}
+
+/**
+ * @brief Print the endpoint table with its counters
+ */
+static void endpoint_print(void)
+{
+	g_mutex_lock(endpointMutex);
+	printf("%-22s %-7s %-9s %12s %10s %10s\n", "ENDPOINT", "TYPE", "SYS/COMP", "FORWARDED", "FILTERED", "LIMITED");
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		const Endpoint* ep = &endpoints[i];
+		if (ep->active)
+		{
+			char ids[16] = "-";
+			if (ep->sysid >= 0) snprintf(ids, sizeof(ids), "%d/%d", ep->sysid, ep->compid);
+			printf("%-22s %-7s %-9s %12llu %10llu %10llu\n", endpoint_name(ep),
+					ep->learned ? "learned" : "static", ids,
+					(unsigned long long) ep->forwarded, (unsigned long long) ep->filtered,
+					(unsigned long long) ep->limited);
+		}
+	}
+	g_mutex_unlock(endpointMutex);
+}
 
 /**
  * @brief Handle a MAVLINK message over LCM
@@ -100,10 +580,10 @@ static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,
 
 	// Send message over UDP
 	int link = *(static_cast<int*>(user));
-	int bytes_sent = 0;
 
 	static uint8_t buf[MAVLINK_MAX_PACKET_LEN];
 	uint32_t messageLength = mavlink_msg_to_send_buffer(buf, msg);
+	const uint8_t* packet = buf;
 	int bytesToSend = 0;
 	
 	if (msg->msgid != MAVLINK_MSG_ID_EXTENDED_MESSAGE)
@@ -119,11 +599,13 @@ static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,
 			fprintf(stderr, "\n");
 		}
 
-		// Send over UDP
-		bytes_sent = sendto(link, buf, messageLength, 0, (struct sockaddr*) &gcAddr,
-				sizeof(struct sockaddr_in));
+		if (batch)
+		{
+			batch_enqueue(buf, messageLength, NULL, 0);
+			return;
+		}
+
 		bytesToSend = messageLength;
-		//	extern int errno;
 	}
 	else if (transmitExtended)
 	{
@@ -131,11 +613,6 @@ static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,
 
 		uint32_t extendedMessageLength = messageLength + container->extended_payload_len;
 
-		// copy core message data
-		memcpy(extended_buf, buf, messageLength);
-		// copy extended message data
-		memcpy(extended_buf + messageLength, container->extended_payload, container->extended_payload_len);
-
 		if (verbose)
 		{
 			printf("(SYS: %d/COMP: %d/LCM->UDP) Received message with ID %u from LCM with %d payload bytes and %u total length\n",
@@ -147,9 +624,18 @@ static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,
 			fprintf(stderr, "\n");
 		}
 
-		// Send over UDP
-		bytes_sent = sendto(link, extended_buf, extendedMessageLength, 0, (struct sockaddr*) &gcAddr,
-				sizeof(struct sockaddr_in));
+		if (batch)
+		{
+			batch_enqueue(buf, messageLength, (const uint8_t*) container->extended_payload, container->extended_payload_len);
+			return;
+		}
+
+		// copy core message data
+		memcpy(extended_buf, buf, messageLength);
+		// copy extended message data
+		memcpy(extended_buf + messageLength, container->extended_payload, container->extended_payload_len);
+
+		packet = extended_buf;
 		bytesToSend = extendedMessageLength;
 	}
 	else
@@ -157,32 +643,57 @@ static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,
 		return;
 	}
 
-	if (bytes_sent != bytesToSend)
-	{
-		// Error handling
-		perror("Could not send over UDP socket");
-		fprintf(stderr, "Target address and host: %s:%s\n", host->str, port->str);
+	// Pick the receivers under the lock, but do not hold it while sendto()
+	// blocks, the UDP receive thread needs it for every datagram
+	struct sockaddr_in targets[UDP_MAX_ENDPOINTS];
+	int targetCount = 0;
 
-		// Try to increase buffer size
-		if (bytesToSend > MAVLINK_MAX_PACKET_LEN)
+	uint64_t now = now_us();
+	g_mutex_lock(endpointMutex);
+	endpoint_expire(now);
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		Endpoint* ep = &endpoints[i];
+		if (ep->active && endpoint_accepts(ep, msg->sysid, msg->compid, msg->msgid, now))
 		{
+			targets[targetCount++] = ep->addr;
+		}
+	}
+	g_mutex_unlock(endpointMutex);
 
-			int tmp = bytesToSend;
-			int ret = setsockopt(link, SOL_SOCKET, SO_SNDBUF, &tmp, sizeof(tmp));
+	for (int i = 0; i < targetCount; ++i)
+	{
+		// Send over UDP
+		int bytes_sent = sendto(link, packet, bytesToSend, 0, (struct sockaddr*) &targets[i],
+				sizeof(struct sockaddr_in));
 
-			if(ret < 0) {
-			    printf("Could not change buffer size! Giving up.\n");
-			    return;
-			}
-			else
+		if (bytes_sent != bytesToSend)
+		{
+			// Error handling
+			perror("Could not send over UDP socket");
+			fprintf(stderr, "Target address and host: %s:%u\n", inet_ntoa(targets[i].sin_addr), ntohs(targets[i].sin_port));
+
+			// Try to increase buffer size
+			if (bytesToSend > MAVLINK_MAX_PACKET_LEN)
 			{
-				printf("Increased UDP protocol buffer size to allow next large packet to pass.\n");
+
+				int tmp = bytesToSend;
+				int ret = setsockopt(link, SOL_SOCKET, SO_SNDBUF, &tmp, sizeof(tmp));
+
+				if(ret < 0) {
+				    printf("Could not change buffer size! Giving up.\n");
+				    break;
+				}
+				else
+				{
+					printf("Increased UDP protocol buffer size to allow next large packet to pass.\n");
+				}
 			}
 		}
-	}
-	else
-	{
-		if (debug) fprintf(stderr, "SENT %d BYTES OVER UDP TO %s:%s", bytes_sent, host->str, port->str);
+		else
+		{
+			if (debug) fprintf(stderr, "SENT %d BYTES OVER UDP TO %s:%u", bytes_sent, inet_ntoa(targets[i].sin_addr), ntohs(targets[i].sin_port));
+		}
 	}
 }
 
@@ -197,31 +708,325 @@ void* lcm_wait(void* lcm_ptr)
 	return NULL;
 		}
 
+/**
+ * @brief Wait until new records are queued or the timeout expires
+ *
+ * @param timeout_us timeout in microseconds, negative to wait forever
+ */
+static void batch_wait(int64_t timeout_us)
+{
+	__atomic_store_n(&senderSleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ringHead, __ATOMIC_RELAXED) == sendCursor)
+	{
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(senderWakeup[0], &fds);
+		struct timeval timeout;
+		timeout.tv_sec = timeout_us / 1000000;
+		timeout.tv_usec = timeout_us % 1000000;
+		select(senderWakeup[0] + 1, &fds, NULL, NULL, (timeout_us < 0) ? NULL : &timeout);
+	}
+	__atomic_store_n(&senderSleeping, 0, __ATOMIC_RELAXED);
+
+	// Drain wakeups, the pipe is non-blocking
+	char drain[64];
+	while (read(senderWakeup[0], drain, sizeof(drain)) > 0);
+}
+
+/**
+ * @brief Get the next queued record that has not been packed yet
+ *
+ * @param length set to the message length
+ * @return pointer to the message in the ring or NULL if the ring is empty
+ */
+static const uint8_t* batch_next(uint32_t* length)
+{
+	uint32_t head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+	while (sendCursor != head)
+	{
+		uint32_t offset = sendCursor % UDP_RING_SIZE;
+		uint32_t total;
+		memcpy(&total, ring + offset, 4);
+		if (total == UDP_RING_WRAP)
+		{
+			sendCursor += UDP_RING_SIZE - offset;
+			continue;
+		}
+		sendCursor += (4 + total + 3) & ~3U;
+		*length = total;
+		return ring + offset + 4;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Append a message to the datagram an endpoint is filling
+ *
+ * @param position ring position of the message record
+ * @return true if the endpoint cannot take more messages before a flush
+ */
+static bool batch_pack(Endpoint* ep, const uint8_t* frame, uint32_t length, uint32_t position, uint64_t now)
+{
+	// Close the open datagram if this message does not fit anymore
+	if (ep->counts[ep->datagrams] > 0 && ep->openBytes + length > (uint32_t) mtu)
+	{
+		ep->counts[++ep->datagrams] = 0;
+		ep->openBytes = 0;
+	}
+	if (ep->counts[ep->datagrams] == 0)
+	{
+		ep->openStart = position;
+		ep->openSince = now;
+	}
+	ep->iov[ep->frames].iov_base = (void*) frame;
+	ep->iov[ep->frames].iov_len = length;
+	++ep->frames;
+	++ep->counts[ep->datagrams];
+	ep->openBytes += length;
+
+	if (ep->openBytes >= (uint32_t) mtu)
+	{
+		ep->counts[++ep->datagrams] = 0;
+		ep->openBytes = 0;
+	}
+	return ep->datagrams == UDP_SEND_MAX_DATAGRAMS || ep->frames == UDP_SEND_MAX_FRAMES;
+}
+
+/**
+ * @brief Send the complete datagrams of all endpoints
+ *
+ * Datagrams that are still being filled are closed and sent as well once
+ * their oldest message is flushDeadline old. Ring records that are no
+ * longer referenced by any endpoint are released.
+ *
+ * @return time until the next deadline in microseconds, -1 if no datagram is pending
+ */
+static int64_t batch_flush(uint64_t now)
+{
+	static struct mmsghdr msgs[UDP_MAX_ENDPOINTS * UDP_SEND_MAX_DATAGRAMS];
+	int count = 0;
+
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		Endpoint* ep = &endpoints[i];
+		if (!ep->active)
+		{
+			continue;
+		}
+
+		bool expired = (now - ep->openSince >= (uint64_t) flushDeadline);
+		if (ep->counts[ep->datagrams] > 0 && (expired || ep->frames == UDP_SEND_MAX_FRAMES))
+		{
+			ep->counts[++ep->datagrams] = 0;
+			ep->openBytes = 0;
+		}
+
+		for (int d = 0, frame = 0; d < ep->datagrams; frame += ep->counts[d], ++d)
+		{
+			memset(&msgs[count], 0, sizeof(msgs[count]));
+			msgs[count].msg_hdr.msg_name = &ep->addr;
+			msgs[count].msg_hdr.msg_namelen = sizeof(ep->addr);
+			msgs[count].msg_hdr.msg_iov = ep->iov + frame;
+			msgs[count].msg_hdr.msg_iovlen = ep->counts[d];
+			++count;
+		}
+	}
+
+#ifdef __linux__
+	int sent = 0;
+	while (sent < count)
+	{
+		int ret = sendmmsg(sock, msgs + sent, count - sent, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("Could not send over UDP socket");
+			fprintf(stderr, "%d datagrams dropped\n", count - sent);
+			break;
+		}
+		sent += ret;
+	}
+#else
+	for (int i = 0; i < count; ++i)
+	{
+		if (sendmsg(sock, &msgs[i].msg_hdr, 0) < 0)
+		{
+			perror("Could not send over UDP socket");
+		}
+	}
+#endif
+	if (debug && count > 0) fprintf(stderr, "SENT %d DATAGRAMS OVER UDP\n", count);
+
+	// Keep the open datagrams, release everything before the oldest one
+	endpoint_expire(now);
+	uint32_t tail = sendCursor;
+	int64_t timeout = -1;
+	for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+	{
+		Endpoint* ep = &endpoints[i];
+		int open = ep->counts[ep->datagrams];
+		if (!ep->active)
+		{
+			continue;
+		}
+		if (ep->datagrams > 0)
+		{
+			memmove(ep->iov, ep->iov + ep->frames - open, open * sizeof(struct iovec));
+			ep->frames = open;
+			ep->counts[0] = open;
+			ep->datagrams = 0;
+		}
+		if (open > 0)
+		{
+			if ((int32_t) (ep->openStart - tail) < 0)
+			{
+				tail = ep->openStart;
+			}
+			int64_t remaining = (int64_t) (ep->openSince + flushDeadline - now);
+			if (timeout < 0 || remaining < timeout)
+			{
+				timeout = remaining;
+			}
+		}
+	}
+	__atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+	return timeout;
+}
+
+/**
+ * @brief Sender thread of the batch mode
+ *
+ * Packs queued messages into one datagram per endpoint of at most mtu
+ * bytes. A message larger than the mtu gets a datagram of its own.
+ * Complete datagrams of all endpoints are sent together as soon as the
+ * ring runs empty, datagrams still being filled are held back until they
+ * are full or their oldest message is flushDeadline old.
+ */
+void* udp_send(void* ptr)
+{
+	uint32_t lastDropped = 0;
+
+	while (1)
+	{
+		uint32_t position = sendCursor;
+		uint32_t length;
+		const uint8_t* frame = batch_next(&length);
+		uint64_t now = now_us();
+		bool full = false;
+		int64_t timeout = -1;
+
+		g_mutex_lock(endpointMutex);
+		if (frame != NULL)
+		{
+			// Header: STX, LEN, SEQ, SYSID, COMPID, MSGID
+			for (int i = 0; i < UDP_MAX_ENDPOINTS; ++i)
+			{
+				Endpoint* ep = &endpoints[i];
+				if (ep->active && endpoint_accepts(ep, frame[3], frame[4], frame[5], now))
+				{
+					full |= batch_pack(ep, frame, length, position, now);
+				}
+			}
+		}
+		if (frame == NULL || full)
+		{
+			timeout = batch_flush(now);
+		}
+		g_mutex_unlock(endpointMutex);
+
+		uint32_t dropped = __atomic_load_n(&ringDropped, __ATOMIC_RELAXED);
+		if (dropped != lastDropped)
+		{
+			fprintf(stderr, "# WARNING: UDP send queue full, %u messages dropped\n", dropped - lastDropped);
+			lastDropped = dropped;
+		}
+
+		if (frame == NULL)
+		{
+			batch_wait(timeout);
+		}
+	}
+	return NULL;
+}
+
 void* udp_wait(void* lcm_ptr)
 		{
 	lcm_t* lcm = (lcm_t*) lcm_ptr;
 	// Blocking wait for new data
 	// READ PENDING BYTES ON UDP LINK
-	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+	// A datagram may carry several messages if the peer batches as well
+	static uint8_t buf[UDP_RECV_MAX_DATAGRAMS][UDP_MAX_DATAGRAM_LEN];
+	struct sockaddr_in from[UDP_RECV_MAX_DATAGRAMS];
+	int lengths[UDP_RECV_MAX_DATAGRAMS];
+	px::MAVLinkScanner scanner;
+	std::vector<mavlink_message_t> messages;
+
+#ifdef __linux__
+	struct iovec iov[UDP_RECV_MAX_DATAGRAMS];
+	struct mmsghdr msgs[UDP_RECV_MAX_DATAGRAMS];
+	for (int i = 0; i < UDP_RECV_MAX_DATAGRAMS; ++i)
+	{
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = UDP_MAX_DATAGRAM_LEN;
+	}
+#endif
+
 	while (1)
 	{
-		int recsize = recvfrom(sock, (void *) buf, MAVLINK_MAX_PACKET_LEN, 0,
-				(struct sockaddr *) &gcAddr, &fromlen);
-		if (recsize < 1)
+#ifdef __linux__
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < UDP_RECV_MAX_DATAGRAMS; ++i)
+		{
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		// Block for the first datagram, then take whatever else is queued
+		int received = recvmmsg(sock, msgs, UDP_RECV_MAX_DATAGRAMS, MSG_WAITFORONE, NULL);
+		for (int i = 0; i < received; ++i)
+		{
+			lengths[i] = msgs[i].msg_len;
+		}
+#else
+		socklen_t fromlen = sizeof(from[0]);
+		int received = 1;
+		lengths[0] = recvfrom(sock, (void *) buf[0], UDP_MAX_DATAGRAM_LEN, 0,
+				(struct sockaddr *) &from[0], &fromlen);
+#endif
+		if (received < 1 || lengths[0] < 1)
 		{
 			// An error occured
+			continue;
 		}
 
 		// Something received - print out all bytes and parse packet
-		mavlink_message_t msg;
-		mavlink_status_t status;
+		int sysids[UDP_RECV_MAX_DATAGRAMS];
+		int compids[UDP_RECV_MAX_DATAGRAMS];
 
-		for (int i = 0; i < recsize; ++i)
+		for (int d = 0; d < received; ++d)
 		{
-			unsigned char tmpchar = buf[i];
-			if (debug) printf("%02x ", tmpchar);
-			if (mavlink_parse_char(MAVLINK_COMM_0, buf[i], &msg, &status))
+			int recsize = lengths[d];
+			sysids[d] = -1;
+			compids[d] = -1;
+			if (debug)
+			{
+				for (int i = 0; i < recsize; ++i)
+				{
+					printf("%02x ", buf[d][i]);
+				}
+			}
+
+			// Frames never span datagrams, which may come from different senders
+			scanner.reset();
+			scanner.scan(buf[d], recsize, messages);
+			for (size_t i = 0; i < messages.size(); ++i)
 			{
+				const mavlink_message_t& msg = messages[i];
 				if (verbose)
 				{
 					// Packet received
@@ -229,9 +1034,19 @@ void* udp_wait(void* lcm_ptr)
 							msg.sysid, msg.compid, msg.msgid, msg.len, recsize);
 				}
 				sendMAVLinkMessage(lcm, &msg);
+				sysids[d] = msg.sysid;
+				compids[d] = msg.compid;
 			}
 		}
 
+		// Update the routing table with the senders
+		uint64_t now = now_us();
+		g_mutex_lock(endpointMutex);
+		for (int d = 0; d < received; ++d)
+		{
+			endpoint_learn(&from[d], sysids[d], compids[d], now);
+		}
+		g_mutex_unlock(endpointMutex);
 	}
 	return NULL;
 		}
@@ -249,6 +1064,12 @@ int main(int argc, char* argv[])
 			{ "silent", 's', 0, G_OPTION_ARG_NONE, &silent, "Be silent", NULL },
 			{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Be verbose", NULL },
 			{ "debug", 'd', 0, G_OPTION_ARG_NONE, &debug, "Debug mode, changes behaviour", NULL },
+			{ "batch", 'b', 0, G_OPTION_ARG_NONE, &batch, "Queue outgoing messages and send several per datagram", NULL },
+			{ "mtu", 'm', 0, G_OPTION_ARG_INT, &mtu, "Maximum datagram size in batch mode", "1400" },
+			{ "flush-us", 'f', 0, G_OPTION_ARG_INT, &flushDeadline, "Maximum time a message is held back in batch mode, in microseconds", "2000" },
+			{ "endpoint", 'E', 0, G_OPTION_ARG_STRING_ARRAY, &endpointSpecs, "Forward to HOST:PORT[,rate=N][,allow=IDS][,deny=IDS], IDS like 0/30-33 (repeatable, replaces --host/--port)", NULL },
+			{ "learned", 'l', 0, G_OPTION_ARG_STRING, &learnedOptions, "Options of endpoints learned from incoming datagrams, e.g. rate=50,deny=100-120", NULL },
+			{ "expiry", 'x', 0, G_OPTION_ARG_INT, &endpointExpiry, "Seconds after which a silent learned endpoint is dropped", "10" },
 			{ NULL }
 	};
 
@@ -264,10 +1085,19 @@ int main(int argc, char* argv[])
 		exit (1);
 	}
 
+	if (mtu < MAVLINK_MAX_PACKET_LEN || mtu > UDP_MAX_DATAGRAM_LEN)
+	{
+		fprintf(stderr, "# WARNING: MTU %d out of range, using %d\n", mtu, MAVLINK_MAX_PACKET_LEN);
+		mtu = MAVLINK_MAX_PACKET_LEN;
+	}
+	if (flushDeadline < 0)
+	{
+		flushDeadline = 0;
+	}
+
 	// Handling program options done
 
 	// Print the basic configuration
-	printf("Connecting to host %s:%s\n", host->str, port->str);
 
 	//		sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	//		struct sockaddr_in gcAddr;
@@ -297,50 +1127,46 @@ int main(int argc, char* argv[])
 	//	exit(EXIT_FAILURE);
 	//    }
 
-	// Get internet address for hostname
-	struct hostent *hp = gethostbyname(host->str);
-
-	if (hp == NULL)
+	// Set up the routing table
+	endpointMutex = g_mutex_new();
+	if (!endpoint_configure(&learnedTemplate, (learnedOptions != NULL) ? learnedOptions : ""))
 	{
-		fprintf(stderr,"Unknown remote host address: %s, please check spelling.\n", host->str);
+		fprintf(stderr, "# ERROR: Invalid options for learned endpoints: %s\n", learnedOptions);
 		exit(EXIT_FAILURE);
 	}
+	if (endpointSpecs == NULL || endpointSpecs[0] == NULL)
+	{
+		gchar* spec = g_strdup_printf("%s:%s", host->str, port->str);
+		if (!endpoint_add(spec))
+		{
+			exit(EXIT_FAILURE);
+		}
+		g_free(spec);
+	}
 	else
 	{
-		printf("Using IP address: %s for host %s\n", inet_ntoa( *( struct in_addr*)( hp -> h_addr)), hp->h_name);
-
-		// If more than one address exists
-		if (hp->h_addr_list[1] != NULL)
+		for (int i = 0; endpointSpecs[i] != NULL; ++i)
 		{
-			printf("Additional (unused) addresses of this host (%s) are:\n", hp->h_name);
-			int i=1;
-			while (hp->h_addr_list[i] != NULL)
+			if (!endpoint_add(endpointSpecs[i]))
 			{
-				printf( "\t%s \n", inet_ntoa( *( struct in_addr*)( hp -> h_addr_list[i])));
-				i++;
+				exit(EXIT_FAILURE);
 			}
 		}
 	}
 
-
-	// Set host and port
-	memset(&gcAddr, 0, sizeof(gcAddr));
-	gcAddr.sin_family = hp->h_addrtype;
-	gcAddr.sin_addr.s_addr = ((struct in_addr *)(hp->h_addr))->s_addr;//inet_addr("127.0.0.1");//inet_addr(host.c_str());
-	gcAddr.sin_port = htons(atoi(port->str));
-
 	lcm = lcm_create ("udpm://");
 	if (!lcm)
 	{
 		return 1;
 	}
 
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, &sock);
+	mavconn_mavlink_compact_subscription_t * comm_sub =
+			subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_ALL, 0, &mavlink_handler, &sock);
 
 	// Initialize LCM receiver thread
 	GThread* lcm_thread;
 	GThread* udp_thread;
+	GThread* send_thread = NULL;
 	GError* err;
 
 	if( !g_thread_supported() )
@@ -361,18 +1187,39 @@ int main(int argc, char* argv[])
 		g_error_free ( err ) ;
 	}
 
+	if (batch)
+	{
+		if (pipe(senderWakeup) < 0 ||
+			fcntl(senderWakeup[0], F_SETFL, O_NONBLOCK) < 0 ||
+			fcntl(senderWakeup[1], F_SETFL, O_NONBLOCK) < 0)
+		{
+			perror("Could not create wakeup pipe for UDP sender");
+			exit(EXIT_FAILURE);
+		}
+
+		if( (send_thread = g_thread_create((GThreadFunc)udp_send, NULL, TRUE, &err)) == NULL)
+		{
+			printf("Thread creation failed: %s!!\n", err->message );
+			g_error_free ( err ) ;
+		}
+
+		printf("Batching messages into datagrams of up to %d bytes, flushed after %d us\n", mtu, flushDeadline);
+	}
+
 	printf("\nPX MAVLINK BRIDGE UDP STARTED ON MAV %d (COMPONENT ID:%d) - RUNNING..\n\n", systemid, componentid);
 
 	while (1)
 	{
 		sleep(1); // Sleep one second
+		if (verbose) endpoint_print();
 	}
-	mavconn_mavlink_msg_container_t_unsubscribe(lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe(lcm, comm_sub);
 	lcm_destroy (lcm);
 	close(sock);
 
 	g_thread_join(lcm_thread);
 	g_thread_join(udp_thread);
+	if (send_thread) g_thread_join(send_thread);
 	exit(0);
 }
 
@@ -0,0 +1,207 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Image stream delivery over a simulated lossy link
+*
+*   Sends random images through ImageStreamFEC and ImageStreamReassembler
+*   with whole frame copies, XOR parity and Reed-Solomon, dropping packets
+*   on the way, and compares the share of frames that arrive intact with
+*   the bytes it took. Losses follow a two state model: --burst 1 drops
+*   packets independently, larger values give bursts of that mean length
+*   at the same average loss.
+*
+*   Exits with 1 if a frame that could have been rebuilt, a handshake and
+*   enough packets of every group arrived, was not delivered intact.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "ImageStreamFEC.h"
+#include "ImageStreamReassembler.h"
+
+namespace config = boost::program_options;
+
+/** @brief Two state loss model, the bad state drops every packet */
+class LossyLink
+{
+public:
+	LossyLink(double loss, double burst)
+	 : bad(false)
+	{
+		leaveBad = 1.0 / std::max(burst, 1.0);
+		enterBad = (loss < 1.0) ? loss * leaveBad / (1.0 - loss) : 1.0;
+	}
+
+	bool drop(void)
+	{
+		double r = rand() / (RAND_MAX + 1.0);
+		bad = bad ? (r >= leaveBad) : (r < enterBad);
+		return bad;
+	}
+
+private:
+	bool bad;
+	double enterBad;
+	double leaveBad;
+};
+
+struct Result
+{
+	int delivered;
+	int rebuilt;
+	int late;			///< frames started by the repeated handshake
+	int failed;			///< frames that could have been rebuilt but were not
+	uint64_t bytes;
+};
+
+static Result run(const px::ImageStreamFEC& fec, int copies, int frames, int size,
+				  double loss, double burst, unsigned seed)
+{
+	Result result = { 0, 0, 0, 0, 0 };
+	px::ImageStreamReassembler reassembler;
+	LossyLink link(loss, burst);
+	std::vector<mavlink_message_t> packets;
+	std::vector<uint8_t> jpg;
+	std::vector<uint8_t> received;
+
+	srand(seed);
+	for (int n = 0; n < frames; ++n)
+	{
+		std::vector<uint8_t> image(size);
+		for (int i = 0; i < size; ++i) image[i] = rand();
+		jpg = image;
+
+		mavlink_data_transmission_handshake_t handshake;
+		memset(&handshake, 0, sizeof(handshake));
+		handshake.jpg_quality = 60;
+		fec.pack(42, 30, jpg, handshake, packets);
+
+		bool delivered = false;
+		bool announced = false;
+		std::vector<bool> arrived(handshake.packets + fec.getParityPackets(handshake.packets), false);
+		// The handshakes are only sent with the first copy, as by the streamer
+		for (int k = 0; k < copies; ++k)
+		{
+			for (size_t i = 0; i < packets.size(); ++i)
+			{
+				const bool isHandshake = packets[i].msgid == MAVLINK_MSG_ID_DATA_TRANSMISSION_HANDSHAKE;
+				if (k > 0 && isHandshake) continue;
+				result.bytes += MAVLINK_NUM_NON_PAYLOAD_BYTES + packets[i].len;
+				if (link.drop()) continue;
+				if (isHandshake) announced = true;
+				else arrived[mavlink_msg_encapsulated_data_get_seqnr(&packets[i])] = true;
+				if (reassembler.handleMessage(&packets[i], received))
+				{
+					delivered = (received == image);
+				}
+			}
+		}
+		if (delivered) ++result.delivered;
+		else if (announced && fec.isDecodable(handshake.packets, arrived)) ++result.failed;
+	}
+	result.rebuilt = reassembler.getStats().recovered;
+	result.late = reassembler.getStats().late;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	int frames;
+	int size;
+	double loss;
+	double burst;
+	float overhead;
+	int group;
+	unsigned seed;
+
+	config::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("frames,n", config::value<int>(&frames)->default_value(1000), "Number of images sent")
+		("size,s", config::value<int>(&size)->default_value(15000), "JPEG bytes per image")
+		("loss,l", config::value<double>(&loss)->default_value(0.02), "Average share of packets lost")
+		("burst,b", config::value<double>(&burst)->default_value(1.0), "Mean length of a loss burst in packets")
+		("overhead,o", config::value<float>(&overhead)->default_value(0.25f), "Parity packets per data packet")
+		("group,g", config::value<int>(&group)->default_value(16), "Data packets per Reed-Solomon group")
+		("seed", config::value<unsigned>(&seed)->default_value(1), "Random seed, the same for every scheme")
+		;
+	config::variables_map vm;
+	config::store(config::parse_command_line(argc, argv, desc), vm);
+	config::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+	if (frames < 1 || size < 1 || size >= (1 << 24) || loss < 0.0 || loss >= 1.0)
+	{
+		fprintf(stderr, "# ERROR: --frames and --size must be positive, --loss in [0, 1)\n");
+		return 1;
+	}
+
+	px::ImageStreamFEC none;
+	px::ImageStreamFEC xorFec = px::ImageStreamFEC::fromOverhead(px::IMAGESTREAM_FEC_XOR, overhead);
+	px::ImageStreamFEC rsFec = px::ImageStreamFEC::fromOverhead(px::IMAGESTREAM_FEC_RS, overhead, group);
+
+	struct
+	{
+		const char* name;
+		const px::ImageStreamFEC* fec;
+		int copies;
+	} schemes[] = {
+		{ "plain", &none, 1 },
+		{ "2 copies", &none, 2 },
+		{ "3 copies", &none, 3 },
+		{ "xor", &xorFec, 1 },
+		{ "reed-solomon", &rsFec, 1 },
+	};
+
+	printf("%d images of %d bytes, %.1f%% loss, bursts of %.1f packets\n", frames, size, loss * 100.0, burst);
+	printf("xor: 1 parity per %d packets, reed-solomon: %d parity per %d packets\n",
+		   xorFec.getDataPerGroup(), rsFec.getParityPerGroup(), rsFec.getDataPerGroup());
+	printf("  %-14s %10s %10s %10s %10s\n", "SCHEME", "DELIVERED", "REBUILT", "LATE", "BYTES");
+
+	int failed = 0;
+	Result plain = run(none, 1, frames, size, loss, burst, seed);
+	for (size_t i = 0; i < sizeof(schemes) / sizeof(schemes[0]); ++i)
+	{
+		Result r = run(*schemes[i].fec, schemes[i].copies, frames, size, loss, burst, seed);
+		printf("  %-14s %9.1f%% %10d %10d %9.2fx\n", schemes[i].name, 100.0 * r.delivered / frames,
+			   r.rebuilt, r.late, (double)r.bytes / plain.bytes);
+		if (r.failed > 0)
+		{
+			fprintf(stderr, "# ERROR: %s lost %d frames that could have been rebuilt\n", schemes[i].name, r.failed);
+			failed += r.failed;
+		}
+	}
+	return (failed > 0) ? 1 : 0;
+}
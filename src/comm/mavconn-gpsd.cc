@@ -175,7 +175,7 @@ int main(int argc, char* argv[])
 //		// Only initialize g thread if not already done
 //	}
 
-//	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
+//	mavconn_mavlink_compact_subscription_t * comm_sub =
 //			mavlink_message_t_subscribe (lcm, "MAVLINK", &mavlink_handler, (void*)fd_ptr);
 //	if (!silent) printf("Subscribed to %s LCM channel.\n", "MAVLINK");
 
@@ -283,8 +283,8 @@ int main(int argc, char* argv[])
         clientVec.at(1).init(true, px::SHM::CAMERA_FORWARD_LEFT, px::SHM::CAMERA_FORWARD_RIGHT);
         clientVec.at(2).init(true, px::SHM::CAMERA_DOWNWARD_LEFT);
         clientVec.at(3).init(true, px::SHM::CAMERA_DOWNWARD_LEFT, px::SHM::CAMERA_DOWNWARD_RIGHT);
-	mavconn_mavlink_msg_container_t_subscription_t * img_sub  = mavconn_mavlink_msg_container_t_subscribe (lcmImage, "IMAGES", &image_handler, &clientVec);
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcmMavlink, "MAVLINK", &mavlink_handler, lcmMavlink);
+	mavconn_mavlink_compact_subscription_t * img_sub  = mavconn_mavlink_compact_subscribe (lcmImage, "IMAGES", &image_handler, &clientVec);
+	mavconn_mavlink_compact_subscription_t * comm_sub = subscribeMAVLinkMessages (lcmMavlink, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_IMAGE), 0, &mavlink_handler, lcmMavlink);
 
 	cout << "MAVLINK client ready, waiting for data..." << endl;
 
@@ -324,8 +324,8 @@ int main(int argc, char* argv[])
 
 	cout << "Everything done successfully - Exiting" << endl;
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmImage, img_sub);
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmMavlink, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmImage, img_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmMavlink, comm_sub);
 	lcm_destroy (lcmImage);
 	lcm_destroy (lcmMavlink);
 
@@ -50,13 +50,11 @@ This file is part of the MAVCONN project
 // #include <sys/time.h>
 #include <time.h>
 
-//Timing
-#include <thread>
-#include <chrono>
-
 //#include "PxSharedMemClient.h"
 #include "interface/shared_mem/SHMImageClient.h"
 #include "mavconn.h"
+#include "ImageStreamPipeline.h"
+#include "ImageStreamRateController.h"
 
 
 namespace config = boost::program_options;
@@ -69,107 +67,51 @@ bool silent, verbose, debug;
 
 using namespace std;
 
-#define PACKET_PAYLOAD		253
 bool captureImage = false;
 float imgdT=1; //Frames per second
 int redundantFrames=1;    //How many times we send each image packet
+double linkRate;          //Bytes per second for image packets, 0 to spread each frame over imgdT
+px::ImageStreamFEC fec;   //Parity packets added to each frame
+px::ImageStreamRateController* rateController; //Adapts quality and rate to the link, NULL if disabled
+int tileSize;             //Send only the tiles that changed, 0 sends whole images
+float tileThreshold;      //Mean difference per byte of a changed tile
+int tileRefresh;          //Images until every tile was sent once
 uint16_t CameraResW = 640;
 uint16_t CameraResH = 480;
 
-int myimgcounter = 1;
-
 lcm_t* lcmImage;
 lcm_t* lcmMavlink;
-mavlink_message_t tmp;
-mavlink_data_transmission_handshake_t req, ack;
+mavlink_data_transmission_handshake_t req;
+px::ImageStreamPipeline* pipeline;
 
 bool quit = false;
 
 
 /**
- * @brief Read camera vertical resolution from config file
+ * @brief Camera horizontal resolution from the config snapshot
  */
-static inline int getCameraResW(void)   //Modeled after GetSystemID
+static inline int getCameraResW(void)
 {
-	static bool isCached = false;
 	// Return 640 on error or no config file present
-	static int CCameraResW = 640;
-
-	if (!isCached)
-	{
-		// Read config file
-		std::string line;
-		std::ifstream configFile("/etc/mavconn/mavconn.conf");
-		if (configFile.is_open())
-		{
-			while (configFile.good())
-			{
-				std::string key;
-				int value;
-				configFile >> key;
-				configFile >> value;
-
-				key = trimString(key);
-
-				if (key == "cameraresw" && value > 0)
-				{
-					CCameraResW = value;
-                    isCached = true;
-                    //std::cout<<"Reading SysID from mavconn.conf successful, sysID "<<systemId<<"\n";
-				}
-			}
-		}
-
-	}/*else{
-        std::cout<<"Reading cached SysID "<<systemId<<"\n";
-    }*/
-
-	return CCameraResW;
+	int value = mavconn_config_int(mavconn_config_get(), "cameraresw", 640);
+	return (value > 0) ? value : 640;
 }
 /**
- * @brief Read camera vertical resolution from config file
+ * @brief Camera vertical resolution from the config snapshot
  */
-static inline int getCameraResH(void)   //Modeled after GetSystemID
+static inline int getCameraResH(void)
 {
-	static bool isCached = false;
 	// Return 480 on error or no config file present
-	static int CCameraResH = 480;
-
-	if (!isCached)
-	{
-		// Read config file
-		std::string line;
-		std::ifstream configFile("/etc/mavconn/mavconn.conf");
-		if (configFile.is_open())
-		{
-			while (configFile.good())
-			{
-				std::string key;
-				int value;
-				configFile >> key;
-				configFile >> value;
-
-				key = trimString(key);
-
-				if (key == "cameraresh" && value > 0)
-				{
-					CCameraResH = value;
-                    isCached = true;
-                    //std::cout<<"Reading SysID from mavconn.conf successful, sysID "<<systemId<<"\n";
-				}
-			}
-		}
-
-	}/*else{
-        std::cout<<"Reading cached SysID "<<systemId<<"\n";
-    }*/
-
-	return CCameraResH;
+	int value = mavconn_config_int(mavconn_config_get(), "cameraresh", 480);
+	return (value > 0) ? value : 480;
 } 
 
 
 /**
  * @brief Handle incoming MAVLink packets containing images
+ *
+ * Only copies the image out of shared memory and hands it to the
+ * pipeline, encoding and sending happen on its threads.
  */
 static void image_handler (const lcm_recv_buf_t *rbuf, const char * channel, const mavconn_mavlink_msg_container_t* container, void * user)
 {
@@ -178,22 +120,17 @@ static void image_handler (const lcm_recv_buf_t *rbuf, const char * channel, con
 	// Pointer to shared memory data
 	std::vector<px::SHMImageClient>* clientVec = reinterpret_cast< std::vector<px::SHMImageClient>* >(user);
 
-	// Temporary memory for raw camera image
-	cv::Mat img;
-	cv::Mat img2;	// img2 not used.
-
 	// TODO resize IMG according to the resolution requested in the CMD_DO_CONTROL_VIDEO message, which also affects the camera controller.
 
 	for(size_t i = 0; i < clientVec->size(); ++i){
 		px::SHMImageClient& client = clientVec->at(i);
-                if ((client.getCameraConfig() & px::SHMImageClient::getCameraNo(msg)) != px::SHMImageClient::getCameraNo(msg))
-                         continue;
+		if ((client.getCameraConfig() & px::SHMImageClient::getCameraNo(msg)) != px::SHMImageClient::getCameraNo(msg))
+			continue;
 
-	// Check if there are images
-	uint64_t camId = client.getCameraID(msg);
+		// Temporary memory for raw camera image, handed over to the pipeline
+		cv::Mat img;
+		cv::Mat img2;	// img2 not used.
 
-	if (camId >= 0)
-	{
 		// Copy one image from shared buffer
 		if (!client.readStereoImage(msg, img, img2))
 		{
@@ -202,113 +139,30 @@ static void image_handler (const lcm_recv_buf_t *rbuf, const char * channel, con
 				continue;
 			}
 		}
-        
-        // Timing works as follows. We have a static time tic and a non-static time toc. We update toc every time we open this function.
-        // If toc-tic>ImgFrequency, we set tic=toc and we execute the encoding and sending below. Otherwise, we skip it.
-
-        static std::chrono::high_resolution_clock::time_point tic;
-        std::chrono::high_resolution_clock::time_point toc = std::chrono::high_resolution_clock::now();
-
-        std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(toc - tic);
 
-        //Only execute the stuff below every now and then: from here
-
-        //Override captureImage
-        //captureImage=true;
-
-        if (captureImage && (time_span.count() > (imgdT))){
-
-		//captureImage = false;
-
-		// Check for valid jpg_quality in request and adjust if necessary
-		if (req.jpg_quality < 1 || req.jpg_quality > 100)
+		px::ImageStreamSettings settings;
+		settings.jpegQuality = req.jpg_quality;
+		settings.width = CameraResW;
+		settings.height = CameraResH;
+		settings.copies = redundantFrames;
+		settings.fec = fec;
+		settings.interval = imgdT;
+		settings.tileSize = tileSize;
+		settings.tileThreshold = tileThreshold;
+		settings.tileRefresh = tileRefresh;
+		if (rateController)
 		{
-			req.jpg_quality = 60;
+			// Another scale would send every tile again
+			rateController->adjust(settings, img.cols, img.rows, (tileSize > 0) ? 1.0f : 0.0f);
+			pipeline->setLinkRate(rateController->getRate());
 		}
 
-		// Encode image as JPEG
-		vector<uint8_t> jpg; ///< container for JPEG image data
-		vector<int> p (4); ///< params for cv::imencode. Sets the JPEG quality.
-		p[0] = CV_IMWRITE_JPEG_QUALITY;
-		p[1] = req.jpg_quality;
-		p[2] = 4; //CV_IMWRITE_JPEG_RST_INTERVAL
-		p[3] = 7500;
-        // If we want to resize the image here, see http://docs.opencv.org/modules/imgproc/doc/geometric_transformations.html
-		cv::imencode(".jpg", img, jpg, p);
-
-		/*
-		// HACK to see if the problem is with JPEG encoding
-		char fileNameB[128];
-		char fileNameJ[128];
-		sprintf(fileNameB, "IMG%08d.bmp", myimgcounter);
-		sprintf(fileNameJ, "IMG%08d.jpg", myimgcounter++);
-		cv::imwrite((std::string("RawImages/") + fileNameB).c_str(), img);
-		
-		cv::imwrite((std::string("JpgImages/") + fileNameJ).c_str(), img,p);
-		
-		ofstream outputFile ((std::string("JpgImages2/") + fileNameJ).c_str());
-		for (vector<uint8_t>::iterator jpgit = jpg.begin(); jpgit!= jpg.end(); jpgit++){
-			outputFile << *jpgit;
+		// Only every interval, a frame still waiting in the pipeline is replaced
+		if (captureImage && pipeline->isDue(settings.interval))
+		{
+			pipeline->submit(img, settings);
 		}
-		
-		// END HACK
-		*/
-		
-		// Prepare and send acknowledgment packet
-		ack.type = static_cast<uint8_t>( DATA_TYPE_JPEG_IMAGE );
-		ack.size = static_cast<uint32_t>( jpg.size() );
-		ack.packets = static_cast<uint16_t>( ack.size/PACKET_PAYLOAD );
-		if (ack.size % PACKET_PAYLOAD) { ++ack.packets; } // one more packet with the rest of data
-		ack.payload = static_cast<uint8_t>( PACKET_PAYLOAD );
-		ack.jpg_quality = req.jpg_quality;
-		ack.width = CameraResW;
-		ack.height = CameraResH;
-
-		mavlink_msg_data_transmission_handshake_encode(sysid, compid, &tmp, &ack);
-		sendMAVLinkMessage(lcmMavlink, &tmp);
-
-		// Send image data (split up into smaller chunks first, then sent over MAVLink)
-		uint8_t data[PACKET_PAYLOAD];
-		uint32_t byteIndex = 0;
-		if (verbose) printf("there are %02d packets waiting to be sent (%05d bytes). start sending...\n", ack.packets, ack.size);
-
-        for (uint16_t k = 0; k < redundantFrames; ++k)
-        { 
-		    for (uint16_t i = 0; i < ack.packets; ++i)
-		    {
-				// TODO remove, this is the world's possible way of simulating packet loss
-				//if ((i % 79) != 37)
-				//{
-			// Copy PACKET_PAYLOAD bytes of image data to send buffer
-			    for (uint8_t j = 0; j < PACKET_PAYLOAD; ++j)
-			    {
-				    if (byteIndex < ack.size)
-				    {
-					    data[j] = (uint8_t)jpg[byteIndex];
-				    }
-				    // fill packet data with padding bits
-				    else
-				    {
-				    	data[j] = 0;
-				    }
-				    ++byteIndex;
-			    }
-			    // Send ENCAPSULATED_IMAGE packet
-			    mavlink_msg_encapsulated_data_pack(sysid, compid, &tmp, i, data);
-           
-			    sendMAVLinkMessage(lcmMavlink, &tmp);
-			    if (verbose) printf("sent packet %02d/%02d (copy %d), wait %d micros\n", i+1,ack.packets,k,(int) (1000000*imgdT/(1.2*ack.packets) +0.5));
-                //We try and slow down package sending, to avoid overloading the net. Note that this may be an especially bad idea, since it is unclear whether we'll keep checking other incoming messages
-                std::this_thread::sleep_for (std::chrono::microseconds( (int) (1000000*imgdT/(1.2*ack.packets*redundantFrames) +0.5) ) );
-				//}// TODO remove this too
-		    }
-        }
-        tic = std::chrono::high_resolution_clock::now();
-        //Only execute the stuff below every now and then: to here
-        }
 	}
-	}
-    //std::this_thread::sleep_for(std::chrono::seconds(1));
 }
 
 /**
@@ -360,6 +214,13 @@ static void mavlink_handler (const lcm_recv_buf_t *rbuf, const char * channel, c
         }
 	}
 	
+	if (msg->msgid == MAVLINK_MSG_ID_RADIO_STATUS && rateController)
+	{
+		mavlink_radio_status_t status;
+		mavlink_msg_radio_status_decode(msg, &status);
+		rateController->onRadioStatus(status);
+	}
+
 	if (msg->msgid == MAVLINK_MSG_ID_PARAM_SET)
 	{
 		std::string strHeight ("RESH");
@@ -430,6 +291,12 @@ void* lcm_image_wait(void* lcm_ptr)
  */
 int main(int argc, char* argv[])
 {
+	std::string fecScheme;
+	float fecOverhead;
+	int fecGroup;
+	bool adaptive;
+	float maxLatency;
+
 	// ----- Handling Program options
 	config::options_description desc("Allowed options");
 	desc.add_options()
@@ -440,6 +307,15 @@ int main(int argc, char* argv[])
 		("silent,s", config::bool_switch(&silent)->default_value(false), "suppress outputs")
 		("verbose,v", config::bool_switch(&verbose)->default_value(false), "verbose output")
 		("debug,d", config::bool_switch(&debug)->default_value(false), "Emit debug information")
+		("rate,r", config::value<double>(&linkRate)->default_value(0.0), "Bytes per second for image packets, 0 to spread each image over its interval")
+		("fec", config::value<std::string>(&fecScheme)->default_value("none"), "Parity packets added to each image: none, xor or rs")
+		("fec-overhead", config::value<float>(&fecOverhead)->default_value(0.25f), "Parity packets per data packet")
+		("fec-group", config::value<int>(&fecGroup)->default_value(16), "Data packets per parity group for rs, 1-32")
+		("adaptive", config::bool_switch(&adaptive)->default_value(false), "Adapt quality, resolution and frame rate to --rate and RADIO_STATUS")
+		("max-latency", config::value<float>(&maxLatency)->default_value(1.0f), "Seconds an image may take on the link with --adaptive")
+		("tile-size", config::value<int>(&tileSize)->default_value(0), "Send only the square tiles of this size that changed, multiple of 16, 0 sends whole images")
+		("tile-threshold", config::value<float>(&tileThreshold)->default_value(3.0f), "Mean difference per byte above which a tile changed")
+		("tile-refresh", config::value<int>(&tileRefresh)->default_value(30), "Images after which every tile was sent once, 0 for never")
 		;
 	config::variables_map vm;
 	config::store(config::parse_command_line(argc, argv, desc), vm);
@@ -450,6 +326,30 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	if (fecScheme == "xor")
+	{
+		fec = px::ImageStreamFEC::fromOverhead(px::IMAGESTREAM_FEC_XOR, fecOverhead);
+	}
+	else if (fecScheme == "rs")
+	{
+		fec = px::ImageStreamFEC::fromOverhead(px::IMAGESTREAM_FEC_RS, fecOverhead, fecGroup);
+	}
+	else if (fecScheme != "none")
+	{
+		fprintf(stderr, "# ERROR: Unknown FEC scheme %s\n", fecScheme.c_str());
+		return 1;
+	}
+	if (verbose && fec.getScheme() != px::IMAGESTREAM_FEC_NONE)
+	{
+		printf("# INFO: %d parity packets per %d data packets\n", fec.getParityPerGroup(), fec.getDataPerGroup());
+	}
+
+	if (tileSize < 0 || tileSize > 256 || tileRefresh < 0)
+	{
+		fprintf(stderr, "# ERROR: --tile-size has to be in [0, 256], --tile-refresh positive\n");
+		return 1;
+	}
+
 	// ----- Setting up communication and data for images
 	// Creating LCM network provider
 	lcmImage = lcm_create ("udpm://");
@@ -457,6 +357,21 @@ int main(int argc, char* argv[])
 	if (!lcmImage || !lcmMavlink)
 		exit(EXIT_FAILURE);
 
+	if (adaptive)
+	{
+		if (linkRate <= 0.0 || maxLatency <= 0.0f)
+		{
+			fprintf(stderr, "# ERROR: --adaptive needs a --rate and a positive --max-latency\n");
+			return 1;
+		}
+		rateController = new px::ImageStreamRateController(linkRate, maxLatency, verbose);
+	}
+
+	pipeline = new px::ImageStreamPipeline(lcmMavlink, sysid, compid, linkRate, verbose);
+	pipeline->setRateController(rateController);
+	if (!pipeline->start())
+		exit(EXIT_FAILURE);
+
 	std::vector<px::SHMImageClient> clientVec;
 	clientVec.resize(4);
 
@@ -464,8 +379,11 @@ int main(int argc, char* argv[])
         clientVec.at(1).init(true, px::SHM::CAMERA_FORWARD_LEFT, px::SHM::CAMERA_FORWARD_RIGHT);
         clientVec.at(2).init(true, px::SHM::CAMERA_DOWNWARD_LEFT);
         clientVec.at(3).init(true, px::SHM::CAMERA_DOWNWARD_LEFT, px::SHM::CAMERA_DOWNWARD_RIGHT);
-	mavconn_mavlink_msg_container_t_subscription_t * img_sub  = mavconn_mavlink_msg_container_t_subscribe (lcmImage, "IMAGES", &image_handler, &clientVec);
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcmMavlink, "MAVLINK", &mavlink_handler, lcmMavlink);
+	mavconn_mavlink_compact_subscription_t * img_sub  = mavconn_mavlink_compact_subscribe (lcmImage, "IMAGES", &image_handler, &clientVec);
+	// RADIO_STATUS is telemetry, only needed by the rate controller
+	unsigned commClasses = MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_IMAGE);
+	if (rateController) commClasses |= MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM);
+	mavconn_mavlink_compact_subscription_t * comm_sub = subscribeMAVLinkMessages (lcmMavlink, commClasses, 0, &mavlink_handler, lcmMavlink);
 
 	cout << "MAVLINK client ready, waiting for data..." << endl;
 
@@ -503,11 +421,21 @@ int main(int argc, char* argv[])
 	cout << "Stopping thread for image capture..." << endl;
 	g_thread_join(lcm_mavlinkThread);
     g_thread_join(lcm_imageThread);
+	pipeline->stop();
+
+	if (verbose)
+	{
+		px::ImageStreamStats stats = pipeline->getStats();
+		printf("# INFO: %llu frames sent, %llu superseded, %llu bytes\n", (unsigned long long)stats.sent,
+			   (unsigned long long)stats.superseded, (unsigned long long)stats.bytes);
+	}
+	delete pipeline;
+	delete rateController;
 
 	cout << "Everything done successfully - Exiting" << endl;
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmImage, img_sub);
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmMavlink, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmImage, img_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmMavlink, comm_sub);
 	lcm_destroy (lcmImage);
 	lcm_destroy (lcmMavlink);
 
@@ -193,8 +193,8 @@ int main(int argc, char* argv[])
 		// Only initialize g thread if not already done
 	}
 
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, (void*)lcm);
+	mavconn_mavlink_compact_subscription_t * comm_sub =
+			subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD), 0, &mavlink_handler, (void*)lcm);
 	if (!silent) printf("Subscribed to %s LCM channel.\n", MAVLINK_MAIN);
 
 	if( (lcm_thread = g_thread_create((GThreadFunc)lcm_wait, (void *)lcm, TRUE, &err)) == NULL)
@@ -231,7 +231,7 @@ int main(int argc, char* argv[])
 	}
 
 	// Disconnect from LCM
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
 	lcm_destroy (lcm);
 
 	g_thread_join(lcm_thread);
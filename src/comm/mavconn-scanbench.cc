@@ -0,0 +1,207 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Compares MAVLinkScanner with mavlink_parse_char on a recorded stream
+*
+*   The stream is either a raw capture of a link, e.g. made with
+*   "cat /dev/ttyUSB0 > capture.raw", or a MAVLink log as written for
+*   mavconn-replay. It is fed to both parsers in chunks of the given size,
+*   which should match the read size of the bridge of interest.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <sys/time.h>
+#include <boost/program_options.hpp>
+
+#include <pixhawk/mavlink.h>
+
+#include "MAVLinkScanner.h"
+
+namespace config = boost::program_options;
+
+static uint64_t now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Extracts the frames of a MAVLink log as one byte stream.
+ */
+static bool read_log(const std::string& filename, std::vector<uint8_t>& stream)
+{
+	std::ifstream log(filename.c_str(), std::ios::binary | std::ios::in);
+	if (!log)
+	{
+		return false;
+	}
+
+	// timestamp, then the frame padded to the maximum packet length
+	uint8_t record[sizeof(uint64_t) + MAVLINK_MAX_PACKET_LEN];
+	while (log.read(reinterpret_cast<char*>(record), sizeof(record)))
+	{
+		const uint8_t* frame = record + sizeof(uint64_t);
+		stream.insert(stream.end(), frame, frame + frame[1] + MAVLINK_NUM_NON_PAYLOAD_BYTES);
+
+		if (frame[5] == MAVLINK_MSG_ID_EXTENDED_MESSAGE)
+		{
+			// the extended payload follows the record
+			uint32_t extendedLength;
+			memcpy(&extendedLength, frame + MAVLINK_NUM_HEADER_BYTES + 3, 4);
+			log.seekg(extendedLength, std::ios::cur);
+		}
+	}
+	return true;
+}
+
+static bool read_raw(const std::string& filename, std::vector<uint8_t>& stream)
+{
+	std::ifstream raw(filename.c_str(), std::ios::binary | std::ios::in);
+	if (!raw)
+	{
+		return false;
+	}
+	stream.assign(std::istreambuf_iterator<char>(raw), std::istreambuf_iterator<char>());
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> logFiles;
+	std::vector<std::string> rawFiles;
+	int chunk;
+	int repeat;
+
+	config::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("log,l", config::value< std::vector<std::string> >(&logFiles)->composing(), "MAVLink log file (*.mavlink), may be repeated")
+		("raw,r", config::value< std::vector<std::string> >(&rawFiles)->composing(), "Raw capture of a link, may be repeated")
+		("chunk,c", config::value<int>(&chunk)->default_value(4096), "Bytes handed to the parsers at once")
+		("repeat,n", config::value<int>(&repeat)->default_value(10), "Number of passes over the stream")
+		;
+	config::variables_map vm;
+	config::store(config::parse_command_line(argc, argv, desc), vm);
+	config::notify(vm);
+
+	if (vm.count("help") || (logFiles.empty() && rawFiles.empty()))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+	if (chunk < 1 || repeat < 1)
+	{
+		fprintf(stderr, "# ERROR: --chunk and --repeat must be positive\n");
+		return 1;
+	}
+
+	std::vector<uint8_t> stream;
+	for (size_t i = 0; i < logFiles.size(); ++i)
+	{
+		if (!read_log(logFiles.at(i), stream))
+		{
+			fprintf(stderr, "# ERROR: Could not open log file %s\n", logFiles.at(i).c_str());
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < rawFiles.size(); ++i)
+	{
+		if (!read_raw(rawFiles.at(i), stream))
+		{
+			fprintf(stderr, "# ERROR: Could not open capture %s\n", rawFiles.at(i).c_str());
+			return 1;
+		}
+	}
+	if (stream.empty())
+	{
+		fprintf(stderr, "# ERROR: The stream is empty\n");
+		return 1;
+	}
+
+	// mavlink_parse_char, one call per byte
+	uint64_t parsedFrames = 0;
+	uint64_t parseTime = 0;
+	for (int n = 0; n < repeat; ++n)
+	{
+		mavlink_message_t msg;
+		mavlink_status_t status;
+		uint64_t start = now_us();
+		for (size_t offset = 0; offset < stream.size(); offset += chunk)
+		{
+			size_t end = std::min(stream.size(), offset + chunk);
+			for (size_t i = offset; i < end; ++i)
+			{
+				if (mavlink_parse_char(MAVLINK_COMM_0, stream[i], &msg, &status))
+				{
+					++parsedFrames;
+				}
+			}
+		}
+		parseTime += now_us() - start;
+	}
+
+	// MAVLinkScanner, one call per chunk
+	px::MAVLinkScanner scanner;
+	std::vector<mavlink_message_t> messages;
+	uint64_t scanTime = 0;
+	for (int n = 0; n < repeat; ++n)
+	{
+		uint64_t start = now_us();
+		for (size_t offset = 0; offset < stream.size(); offset += chunk)
+		{
+			size_t length = std::min(stream.size() - offset, static_cast<size_t>(chunk));
+			scanner.scan(&stream[offset], length, messages);
+		}
+		scanTime += now_us() - start;
+	}
+	const px::MAVLinkScanner::Stats& stats = scanner.getStats();
+
+	double megabytes = stream.size() * (double) repeat / 1e6;
+	printf("stream: %zu bytes, %d passes in chunks of %d bytes\n", stream.size(), repeat, chunk);
+	printf("  %-18s %10s %10s %12s\n", "PARSER", "FRAMES", "MB/s", "FRAMES/s");
+	printf("  %-18s %10llu %10.1f %12.0f\n", "mavlink_parse_char",
+		   (unsigned long long) (parsedFrames / repeat),
+		   megabytes / (parseTime / 1e6), parsedFrames / (parseTime / 1e6));
+	printf("  %-18s %10llu %10.1f %12.0f\n", "MAVLinkScanner",
+		   (unsigned long long) (stats.frames / repeat),
+		   megabytes / (scanTime / 1e6), stats.frames / (scanTime / 1e6));
+	printf("scanner: %llu bad frames, %llu skipped bytes per pass, speedup %.1fx\n",
+		   (unsigned long long) (stats.badFrames / repeat),
+		   (unsigned long long) (stats.skippedBytes / repeat),
+		   (double) parseTime / scanTime);
+
+	if (stats.frames != parsedFrames)
+	{
+		fprintf(stderr, "# WARNING: The parsers decoded a different number of frames\n");
+	}
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Link bytes of tile frames against whole images
+*
+*   Streams a synthetic near static scene, a textured background with
+*   sensor noise and one moving square, once as whole JPEG images and
+*   once as tile frames through ImageStreamFEC and ImageStreamReassembler,
+*   and compares the bytes on the link. --drop loses whole frames on the
+*   way, the error of the image kept by the receiver shows how fast the
+*   refresh repairs it.
+*
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "ImageStreamFEC.h"
+#include "ImageStreamReassembler.h"
+#include "ImageStreamTiles.h"
+
+namespace config = boost::program_options;
+
+static void drawScene(cv::Mat& img, int frame, int noise, int object, int speed)
+{
+	const int x0 = (frame * speed) % std::max(1, img.cols - object);
+	const int y0 = img.rows / 3;
+	for (int y = 0; y < img.rows; ++y)
+	{
+		uint8_t* row = img.ptr(y);
+		for (int x = 0; x < img.cols; ++x)
+		{
+			int v = 128 + (int)(60.0 * sin(x * 0.05) * cos(y * 0.07)) + ((x / 40 + y / 40) % 2) * 30;
+			if (x >= x0 && x < x0 + object && y >= y0 && y < y0 + object) v = 240;
+			if (noise > 0) v += rand() % (2 * noise + 1) - noise;
+			row[x] = std::max(0, std::min(255, v));
+		}
+	}
+}
+
+static uint64_t wireBytes(const std::vector<mavlink_message_t>& packets)
+{
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		bytes += MAVLINK_NUM_NON_PAYLOAD_BYTES + packets[i].len;
+	}
+	return bytes;
+}
+
+int main(int argc, char* argv[])
+{
+	int frames;
+	int width;
+	int height;
+	int noise;
+	int object;
+	int speed;
+	int quality;
+	int tileSize;
+	float threshold;
+	int refresh;
+	double drop;
+
+	config::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("frames,n", config::value<int>(&frames)->default_value(300), "Number of images sent")
+		("width", config::value<int>(&width)->default_value(640), "Image width")
+		("height", config::value<int>(&height)->default_value(480), "Image height")
+		("noise", config::value<int>(&noise)->default_value(2), "Sensor noise, +- gray values")
+		("object", config::value<int>(&object)->default_value(48), "Size of the moving square")
+		("speed", config::value<int>(&speed)->default_value(4), "Pixels the square moves per image")
+		("quality,q", config::value<int>(&quality)->default_value(60), "JPEG quality")
+		("tile-size", config::value<int>(&tileSize)->default_value(64), "Tile size, multiple of 16")
+		("tile-threshold", config::value<float>(&threshold)->default_value(3.0f), "Mean difference per byte of a changed tile")
+		("tile-refresh", config::value<int>(&refresh)->default_value(30), "Images after which every tile was sent once")
+		("drop", config::value<double>(&drop)->default_value(0.0), "Share of tile frames lost")
+		;
+	config::variables_map vm;
+	config::store(config::parse_command_line(argc, argv, desc), vm);
+	config::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+	if (frames < 1 || width < 16 || height < 16 || quality < 1 || quality > 100)
+	{
+		fprintf(stderr, "# ERROR: --frames has to be positive, the image at least 16x16, --quality in [1, 100]\n");
+		return 1;
+	}
+
+	px::ImageStreamFEC fec;
+	px::ImageStreamTileEncoder encoder(tileSize, threshold, refresh);
+	px::ImageStreamTileDecoder decoder;
+	px::ImageStreamReassembler reassembler;
+	std::vector<int> p(2);
+	p[0] = CV_IMWRITE_JPEG_QUALITY;
+	p[1] = quality;
+
+	uint64_t wholeBytes = 0;
+	uint64_t tileBytes = 0;
+	uint64_t applied = 0;
+	uint64_t shown = 0;
+	double error = 0.0;
+	std::vector<mavlink_message_t> packets;
+	std::vector<uint8_t> jpg;
+	std::vector<uint8_t> received;
+	std::vector<uint16_t> tiles;
+
+	srand(1);
+	for (int n = 0; n < frames; ++n)
+	{
+		cv::Mat img(height, width, CV_8UC1);
+		drawScene(img, n, noise, object, speed);
+
+		mavlink_data_transmission_handshake_t handshake;
+		memset(&handshake, 0, sizeof(handshake));
+		handshake.width = width;
+		handshake.height = height;
+		handshake.jpg_quality = quality;
+
+		cv::imencode(".jpg", img, jpg, p);
+		fec.pack(42, 30, jpg, handshake, packets);
+		wholeBytes += wireBytes(packets);
+
+		encoder.encode(img, quality, jpg, tiles);
+		fec.pack(42, 30, jpg, handshake, packets, IMAGESTREAM_TYPE_TILES);
+		tileBytes += wireBytes(packets);
+		// Sent is all the sender knows, whether it arrived or not
+		encoder.commit(img, tiles);
+
+		const bool lost = rand() < drop * RAND_MAX;
+		for (size_t i = 0; i < packets.size() && !lost; ++i)
+		{
+			if (reassembler.handleMessage(&packets[i], received) &&
+				px::ImageStreamFEC::isTiles(reassembler.getHandshake()) &&
+				decoder.apply(received, reassembler.getHandshake().width, reassembler.getHandshake().height))
+			{
+				++applied;
+			}
+		}
+
+		// What the receiver shows, stale tiles of lost frames included
+		if (decoder.isComplete())
+		{
+			const cv::Mat& out = decoder.getImage();
+			uint64_t sum = 0;
+			for (int y = 0; y < height; ++y)
+			{
+				sum += px::ImageStreamTileEncoder::sumOfAbsDiff(img.ptr(y), out.ptr(y), width);
+			}
+			error += (double)sum / ((double)width * height);
+			++shown;
+		}
+	}
+
+	px::ImageStreamTileEncoder::Stats stats = encoder.getStats();
+	printf("%d images of %dx%d, %d px tiles, %.1f%% of the tile frames lost\n", frames, width, height,
+		   encoder.getTileSize(), drop * 100.0);
+	printf("  whole images:  %10llu bytes\n", (unsigned long long)wholeBytes);
+	printf("  tile frames:   %10llu bytes, %.2fx less\n", (unsigned long long)tileBytes,
+		   tileBytes ? (double)wholeBytes / tileBytes : 0.0);
+	printf("  tiles sent:    %.1f%% changed, %.1f%% refreshed\n",
+		   100.0 * stats.changed / stats.tiles, 100.0 * stats.refreshed / stats.tiles);
+	printf("  received:      %llu frames, mean error %.2f gray values\n", (unsigned long long)applied,
+		   shown ? error / shown : 0.0);
+	return 0;
+}
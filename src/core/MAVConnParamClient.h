@@ -19,6 +19,7 @@
 
 #include "mavconn.h"
 #include "ParamClientCallbacks.h"
+#include "MAVLinkDispatcher.h"
 
 using namespace std::tr1;
 
@@ -69,45 +70,13 @@ public:
 		switch (msg->msgid)
 		{
 		case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
-		{
-			// Start sending parameters
-			if (verbose) printf("MAVConnParamClient: Requested parameters, sending them now..\n");
-
-			uint16_t i = 0;
-			PxParameterMap::const_iterator iter = params.begin();
-			while(iter != params.end())
-			{
-				mavlink_message_t response;
-				mavlink_msg_param_value_pack(systemid, componentid, &response, (*iter).first.c_str(), (*iter).second, MAVLINK_TYPE_FLOAT, params.size(), i);
-				sendMAVLinkMessage(lcm, &response);
-				if (verbose) std::cout << "Sending param " << (*iter).first  << ':' << (*iter).second << std::endl;
-				++iter;
-				i++;
-			}
-		}
-		break;
+			handleParamRequestList(msg);
+			break;
 		case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
 		{
-			// Send one parameter
-			if (verbose) printf("MAVConnParamClient: Send requested parameter now..\n");
 			mavlink_param_request_read_t read;
 			mavlink_msg_param_request_read_decode(msg, &read);
-			mavlink_message_t response;
-
-			uint16_t i = 0;
-			PxParameterMap::const_iterator iter = params.begin();
-			while(iter != params.end())
-			{
-				if (i == read.param_index)
-				{
-					mavlink_message_t response;
-					mavlink_msg_param_value_pack(systemid, componentid, &response, (*iter).first.c_str(), (*iter).second, MAVLINK_TYPE_FLOAT, params.size(), i);
-					sendMAVLinkMessage(lcm, &response);
-					if (verbose) std::cout << "Sending param " << (*iter).first  << ':' << (*iter).second << std::endl;
-				}
-				i++;
-				++iter;
-			}
+			handleParamRequestRead(msg, &read);
 		}
 		break;
 		case MAVLINK_MSG_ID_PARAM_SET:
@@ -120,29 +89,7 @@ public:
 					== (uint8_t) systemid && (uint8_t) set.target_component
 					== componentid)
 			{
-				const char* key = (char*) set.param_id;
-				std::string paramName(key);
-
-				if (params.count(paramName) > 0)
-				{
-					params.erase(paramName);
-					params.insert(std::make_pair(paramName, set.param_value));
-				}
-
-				uint16_t i = 0;
-				for (PxCallbackList::iterator iter = callbacks.begin(); iter != callbacks.end(); ++iter)
-				{
-					(**iter)(paramName, set.param_value);
-					i++;
-				}
-				i--;
-				if (paramCallbacks.count(paramName) > 0)
-					(*paramCallbacks[paramName])(paramName, set.param_value);
-
-				// Report back new value
-				mavlink_message_t response;
-				mavlink_msg_param_value_pack(systemid, componentid, &response, set.param_id, set.param_value, MAVLINK_TYPE_FLOAT, params.size(), i);
-				sendMAVLinkMessage(lcm, &response);
+				handleParamSet(msg, &set);
 			}
 		}
 		break;
@@ -150,26 +97,119 @@ public:
 		{
 			mavlink_command_long_t action;
 			mavlink_msg_command_long_decode(msg, &action);
-			switch (action.command)
+			handleCommand(msg, &action);
+		}
+		break;
+		}
+	}
+
+	/**
+	 * @brief Register the parameter protocol handlers with a dispatcher
+	 *
+	 * Replaces calling handleMAVLinkPacket() for every message: only the
+	 * parameter messages and commands reach the client, and PARAM_SET is
+	 * filtered on its target before it is decoded.
+	 */
+	void registerHandlers(px::MAVLinkDispatcher& dispatcher)
+	{
+		dispatcher.add(MAVLINK_MSG_ID_PARAM_REQUEST_LIST, &MAVConnParamClient::handleParamRequestList, this, "param_request_list");
+		dispatcher.add(MAVLINK_MSG_ID_PARAM_REQUEST_READ, &mavlink_msg_param_request_read_decode,
+				&MAVConnParamClient::handleParamRequestRead, this, "param_request_read");
+		dispatcher.add(MAVLINK_MSG_ID_PARAM_SET, &mavlink_msg_param_set_decode,
+				&MAVConnParamClient::handleParamSet, this, "param_set",
+				px::MAVLinkFilter()
+				.toSystem(&mavlink_msg_param_set_get_target_system, systemid, false)
+				.toComponent(&mavlink_msg_param_set_get_target_component, componentid, false));
+		dispatcher.add(MAVLINK_MSG_ID_COMMAND_LONG, &mavlink_msg_command_long_decode,
+				&MAVConnParamClient::handleCommand, this, "param_storage");
+	}
+
+	void handleParamRequestList(const mavlink_message_t* msg)
+	{
+		// Start sending parameters
+		if (verbose) printf("MAVConnParamClient: Requested parameters, sending them now..\n");
+
+		std::vector<mavlink_message_t> responses(params.size());
+		uint16_t i = 0;
+		PxParameterMap::const_iterator iter = params.begin();
+		while(iter != params.end())
+		{
+			mavlink_msg_param_value_pack(systemid, componentid, &responses[i], (*iter).first.c_str(), (*iter).second, MAVLINK_TYPE_FLOAT, params.size(), i);
+			if (verbose) std::cout << "Sending param " << (*iter).first  << ':' << (*iter).second << std::endl;
+			++iter;
+			i++;
+		}
+		sendMAVLinkMessages(lcm, responses);
+	}
+
+	void handleParamRequestRead(const mavlink_message_t* msg, const mavlink_param_request_read_t* read)
+	{
+		// Send one parameter
+		if (verbose) printf("MAVConnParamClient: Send requested parameter now..\n");
+
+		uint16_t i = 0;
+		PxParameterMap::const_iterator iter = params.begin();
+		while(iter != params.end())
+		{
+			if (i == read->param_index)
 			{
-			case MAV_CMD_PREFLIGHT_STORAGE:
+				mavlink_message_t response;
+				mavlink_msg_param_value_pack(systemid, componentid, &response, (*iter).first.c_str(), (*iter).second, MAVLINK_TYPE_FLOAT, params.size(), i);
+				sendMAVLinkMessage(lcm, &response);
+				if (verbose) std::cout << "Sending param " << (*iter).first  << ':' << (*iter).second << std::endl;
+			}
+			i++;
+			++iter;
+		}
+	}
+
+	/** @brief Apply a PARAM_SET addressed to this component */
+	void handleParamSet(const mavlink_message_t* msg, const mavlink_param_set_t* set)
+	{
+		const char* key = (char*) set->param_id;
+		std::string paramName(key);
+
+		if (params.count(paramName) > 0)
+		{
+			params.erase(paramName);
+			params.insert(std::make_pair(paramName, set->param_value));
+		}
+
+		uint16_t i = 0;
+		for (PxCallbackList::iterator iter = callbacks.begin(); iter != callbacks.end(); ++iter)
+		{
+			(**iter)(paramName, set->param_value);
+			i++;
+		}
+		i--;
+		if (paramCallbacks.count(paramName) > 0)
+			(*paramCallbacks[paramName])(paramName, set->param_value);
+
+		// Report back new value
+		mavlink_message_t response;
+		mavlink_msg_param_value_pack(systemid, componentid, &response, set->param_id, set->param_value, MAVLINK_TYPE_FLOAT, params.size(), i);
+		sendMAVLinkMessage(lcm, &response);
+	}
+
+	void handleCommand(const mavlink_message_t* msg, const mavlink_command_long_t* action)
+	{
+		switch (action->command)
+		{
+		case MAV_CMD_PREFLIGHT_STORAGE:
+		{
+			if (action->param1 == 0)
 			{
-				if (action.param1 == 0)
-				{
-					readParamsFromFile(configFileName);
-					if (verbose) printf("Reading parameters from file %s", configFileName.c_str());
-					break;
-				}
-				else if (action.param1 == 1)
-				{
-					if (verbose) printf("Writing parameters from file %s", configFileName.c_str());
-					writeParamsToFile(configFileName);
-					break;
-				}
+				readParamsFromFile(configFileName);
+				if (verbose) printf("Reading parameters from file %s", configFileName.c_str());
+				break;
 			}
+			else if (action->param1 == 1)
+			{
+				if (verbose) printf("Writing parameters from file %s", configFileName.c_str());
+				writeParamsToFile(configFileName);
+				break;
 			}
 		}
-		break;
 		}
 	}
 
@@ -0,0 +1,507 @@
+/*=====================================================================
+
+MAVCONN Micro Air Vehicle Flying Robotics Toolkit
+Please see our website at <http://MAVCONN.ethz.ch>
+
+(c) 2009 MAVCONN PROJECT
+
+This file is part of the MAVCONN project
+
+    MAVCONN is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MAVCONN is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MAVCONN. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+ * @file
+ *   @brief Table-driven MAVLink message dispatcher
+ *
+ *   Handlers are registered per message ID together with a filter on the
+ *   sender and target fields. Filters are evaluated on the raw message, so
+ *   messages nobody wants are never decoded. Typed handlers receive the
+ *   decoded struct; every (message ID, decode function) pair is decoded at
+ *   most once per message, no matter how many handlers share it.
+ *
+ *   Each handler counts its calls and the time spent in it, see
+ *   MAVLinkDispatcher::printStats().
+ *
+ *   Registration has to be finished before dispatching starts. Several
+ *   threads may dispatch concurrently (see MAVLinkLanes) as long as each
+ *   message ID is always dispatched from the same thread.
+ *
+ */
+
+#ifndef _MAVLINKDISPATCHER_H_
+#define _MAVLINKDISPATCHER_H_
+
+#include <inttypes.h>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "mavconn.h"
+
+namespace px
+{
+
+/**
+ * @brief Filter on the header and target fields of a message
+ *
+ * Target fields are read with the generated mavlink_msg_*_get_target_*()
+ * accessors, which only touch one payload byte.
+ */
+class MAVLinkFilter
+{
+public:
+	typedef uint8_t (*FieldGetter)(const mavlink_message_t* msg);
+
+	MAVLinkFilter() :
+		sysid(-1),
+		compid(-1),
+		targetSystemGetter(0),
+		targetSystem(-1),
+		targetSystemBroadcast(true),
+		targetComponentGetter(0),
+		targetComponent(-1),
+		targetComponentBroadcast(true)
+	{
+	}
+
+	/** @brief Only accept messages sent by system @p id */
+	MAVLinkFilter& fromSystem(int id)
+	{
+		sysid = id;
+		return *this;
+	}
+
+	/** @brief Only accept messages sent by component @p id */
+	MAVLinkFilter& fromComponent(int id)
+	{
+		compid = id;
+		return *this;
+	}
+
+	/** @brief Only accept messages addressed to system @p id (or to 0 if @p broadcast is set) */
+	MAVLinkFilter& toSystem(FieldGetter getter, int id, bool broadcast = true)
+	{
+		targetSystemGetter = getter;
+		targetSystem = id;
+		targetSystemBroadcast = broadcast;
+		return *this;
+	}
+
+	/** @brief Only accept messages addressed to component @p id (or to 0 if @p broadcast is set) */
+	MAVLinkFilter& toComponent(FieldGetter getter, int id, bool broadcast = true)
+	{
+		targetComponentGetter = getter;
+		targetComponent = id;
+		targetComponentBroadcast = broadcast;
+		return *this;
+	}
+
+	inline bool matches(const mavlink_message_t* msg) const
+	{
+		if (sysid >= 0 && msg->sysid != sysid) return false;
+		if (compid >= 0 && msg->compid != compid) return false;
+		if (targetSystemGetter &&
+				!matchTarget((*targetSystemGetter)(msg), targetSystem, targetSystemBroadcast)) return false;
+		if (targetComponentGetter &&
+				!matchTarget((*targetComponentGetter)(msg), targetComponent, targetComponentBroadcast)) return false;
+		return true;
+	}
+
+protected:
+	static inline bool matchTarget(uint8_t value, int id, bool broadcast)
+	{
+		return value == (uint8_t)id || (broadcast && value == 0);
+	}
+
+	int sysid;								///< Sender system ID, -1 for any
+	int compid;								///< Sender component ID, -1 for any
+	FieldGetter targetSystemGetter;			///< Accessor for the target system field, 0 for none
+	int targetSystem;						///< Required target system
+	bool targetSystemBroadcast;				///< Also accept target system 0
+	FieldGetter targetComponentGetter;		///< Accessor for the target component field, 0 for none
+	int targetComponent;					///< Required target component
+	bool targetComponentBroadcast;			///< Also accept target component 0
+};
+
+/**
+ * @brief Decoded payload shared by all typed handlers of one message ID
+ */
+class MAVLinkDecoder
+{
+public:
+	MAVLinkDecoder() : stamp(0), decodes(0) {}
+	virtual ~MAVLinkDecoder() {}
+
+	/** @brief Decode @p msg unless it was already decoded for dispatch round @p round */
+	inline const void* get(const mavlink_message_t* msg, uint64_t round)
+	{
+		if (stamp != round)
+		{
+			decode(msg);
+			stamp = round;
+			++decodes;
+		}
+		return data();
+	}
+
+	inline uint64_t getDecodes() const { return decodes; }
+
+protected:
+	virtual void decode(const mavlink_message_t* msg) = 0;
+	virtual const void* data() const = 0;
+
+	uint64_t stamp;		///< Dispatch round the buffer was last decoded for
+	uint64_t decodes;	///< Number of decodes done
+};
+
+template <typename T>
+class MAVLinkDecoderType : public MAVLinkDecoder
+{
+public:
+	typedef void (*DecodeFunction)(const mavlink_message_t*, T*);
+
+	MAVLinkDecoderType(DecodeFunction function) : function_(function) {}
+
+	inline DecodeFunction function() const { return function_; }
+
+protected:
+	void decode(const mavlink_message_t* msg) { (*function_)(msg, &value_); }
+	const void* data() const { return &value_; }
+
+private:
+	DecodeFunction function_;
+	T value_;
+};
+
+/**
+ * @brief Base class of all dispatcher handlers
+ */
+class MAVLinkHandler
+{
+public:
+	MAVLinkHandler(const std::string& name, const MAVLinkFilter& filter, void* userData = 0) :
+		name(name),
+		filter(filter),
+		userData_(userData),
+		calls(0),
+		filtered(0),
+		usecs(0)
+	{
+	}
+	virtual ~MAVLinkHandler() {}
+
+	virtual void operator()(const mavlink_message_t* msg, uint64_t round) = 0;
+
+	std::string name;		///< Name shown in the statistics
+	MAVLinkFilter filter;	///< Pre-decode filter
+	void* userData_;
+	uint64_t calls;			///< Number of calls
+	uint64_t filtered;		///< Number of messages rejected by the filter
+	uint64_t usecs;			///< Time spent in the handler, in microseconds
+};
+
+class MAVLinkHandlerRaw : public MAVLinkHandler
+{
+public:
+	MAVLinkHandlerRaw(void (*callback) (const mavlink_message_t*, void*), void* userData, const std::string& name, const MAVLinkFilter& filter) :
+		MAVLinkHandler(name, filter, userData), callback_(callback) {}
+
+	inline void operator()(const mavlink_message_t* msg, uint64_t)
+		{ (*this->callback_)(msg, this->userData_); }
+
+private:
+	void (*callback_) (const mavlink_message_t*, void*);
+};
+
+template <class C>
+class MAVLinkHandlerClassRaw : public MAVLinkHandler
+{
+public:
+	MAVLinkHandlerClassRaw(void (C::*callback) (const mavlink_message_t*), C* object, const std::string& name, const MAVLinkFilter& filter) :
+		MAVLinkHandler(name, filter, object), callback_(callback) {}
+
+	inline void operator()(const mavlink_message_t* msg, uint64_t)
+		{ (((C*)this->userData_)->*this->callback_)(msg); }
+
+private:
+	void (C::*callback_) (const mavlink_message_t*);
+};
+
+template <typename T>
+class MAVLinkHandlerDecoded : public MAVLinkHandler
+{
+public:
+	MAVLinkHandlerDecoded(MAVLinkDecoder* decoder, void (*callback) (const mavlink_message_t*, const T*, void*), void* userData, const std::string& name, const MAVLinkFilter& filter) :
+		MAVLinkHandler(name, filter, userData), decoder_(decoder), callback_(callback) {}
+
+	inline void operator()(const mavlink_message_t* msg, uint64_t round)
+		{ (*this->callback_)(msg, static_cast<const T*>(decoder_->get(msg, round)), this->userData_); }
+
+private:
+	MAVLinkDecoder* decoder_;
+	void (*callback_) (const mavlink_message_t*, const T*, void*);
+};
+
+template <class C, typename T>
+class MAVLinkHandlerClassDecoded : public MAVLinkHandler
+{
+public:
+	MAVLinkHandlerClassDecoded(MAVLinkDecoder* decoder, void (C::*callback) (const mavlink_message_t*, const T*), C* object, const std::string& name, const MAVLinkFilter& filter) :
+		MAVLinkHandler(name, filter, object), decoder_(decoder), callback_(callback) {}
+
+	inline void operator()(const mavlink_message_t* msg, uint64_t round)
+		{ (((C*)this->userData_)->*this->callback_)(msg, static_cast<const T*>(decoder_->get(msg, round))); }
+
+private:
+	MAVLinkDecoder* decoder_;
+	void (C::*callback_) (const mavlink_message_t*, const T*);
+};
+
+/**
+ * @brief Snapshot of the counters of one handler
+ */
+struct MAVLinkHandlerStats
+{
+	std::string name;	///< Handler name
+	uint8_t msgid;		///< Message ID the handler is registered for
+	uint64_t calls;		///< Number of calls
+	uint64_t filtered;	///< Number of messages rejected by the filter
+	uint64_t usecs;		///< Time spent in the handler, in microseconds
+};
+
+/**
+ * @brief Dispatches MAVLink messages to handlers registered per message ID
+ *
+ * Usage:
+ * @code
+ * px::MAVLinkDispatcher dispatcher;
+ * dispatcher.add(MAVLINK_MSG_ID_COMMAND_LONG, &mavlink_msg_command_long_decode, &handle_command, &context, "command",
+ *                px::MAVLinkFilter().toSystem(&mavlink_msg_command_long_get_target_system, getSystemID(), false));
+ * subscribeMAVLinkMessages(lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD), 0, &px::MAVLinkDispatcher::lcmHandler, &dispatcher);
+ * @endcode
+ */
+class MAVLinkDispatcher
+{
+public:
+	MAVLinkDispatcher() : messages(0), unhandled(0) {}
+
+	~MAVLinkDispatcher()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			for (size_t j = 0; j < table[i].handlers.size(); ++j)
+				delete table[i].handlers[j];
+			for (size_t j = 0; j < table[i].decoders.size(); ++j)
+				delete table[i].decoders[j];
+		}
+	}
+
+	/** @brief Register a handler that gets the raw message */
+	void add(uint8_t msgid, void (*callback) (const mavlink_message_t*, void*), void* userData,
+			const std::string& name, const MAVLinkFilter& filter = MAVLinkFilter())
+	{
+		table[msgid].handlers.push_back(new MAVLinkHandlerRaw(callback, userData, name, filter));
+	}
+
+	/** @brief Register a member function that gets the raw message */
+	template <class C>
+	void add(uint8_t msgid, void (C::*callback) (const mavlink_message_t*), C* object,
+			const std::string& name, const MAVLinkFilter& filter = MAVLinkFilter())
+	{
+		table[msgid].handlers.push_back(new MAVLinkHandlerClassRaw<C>(callback, object, name, filter));
+	}
+
+	/** @brief Register a handler that gets the struct decoded by @p decode */
+	template <typename T>
+	void add(uint8_t msgid, void (*decode) (const mavlink_message_t*, T*),
+			void (*callback) (const mavlink_message_t*, const T*, void*), void* userData,
+			const std::string& name, const MAVLinkFilter& filter = MAVLinkFilter())
+	{
+		table[msgid].handlers.push_back(new MAVLinkHandlerDecoded<T>(decoder(msgid, decode), callback, userData, name, filter));
+	}
+
+	/** @brief Register a member function that gets the struct decoded by @p decode */
+	template <class C, typename T>
+	void add(uint8_t msgid, void (*decode) (const mavlink_message_t*, T*),
+			void (C::*callback) (const mavlink_message_t*, const T*), C* object,
+			const std::string& name, const MAVLinkFilter& filter = MAVLinkFilter())
+	{
+		table[msgid].handlers.push_back(new MAVLinkHandlerClassDecoded<C, T>(decoder(msgid, decode), callback, object, name, filter));
+	}
+
+	/** @brief Whether any handler is registered for @p msgid */
+	inline bool wants(uint8_t msgid) const
+	{
+		return !table[msgid].handlers.empty();
+	}
+
+	/**
+	 * @brief Run all handlers of @p msg whose filter accepts it
+	 *
+	 * @return true if at least one handler was called
+	 */
+	bool dispatch(const mavlink_message_t* msg)
+	{
+		__atomic_add_fetch(&messages, 1, __ATOMIC_RELAXED);
+		Entry& entry = table[msg->msgid];
+		bool handled = false;
+		uint64_t round = ++entry.round;
+		for (size_t i = 0; i < entry.handlers.size(); ++i)
+		{
+			MAVLinkHandler* handler = entry.handlers[i];
+			if (!handler->filter.matches(msg))
+			{
+				++handler->filtered;
+				continue;
+			}
+			uint64_t start = now();
+			(*handler)(msg, round);
+			handler->usecs += now() - start;
+			++handler->calls;
+			handled = true;
+		}
+		if (!handled) __atomic_add_fetch(&unhandled, 1, __ATOMIC_RELAXED);
+		return handled;
+	}
+
+	/** @brief LCM handler, pass the dispatcher as user pointer */
+	static void lcmHandler(const lcm_recv_buf_t* rbuf, const char* channel, const mavconn_mavlink_msg_container_t* container, void* user)
+	{
+		static_cast<MAVLinkDispatcher*>(user)->dispatch(getMAVLinkMsgPtr(container));
+	}
+
+	/**
+	 * @brief Copy the counters of all handlers
+	 *
+	 * The counters are updated without locking by the dispatching thread,
+	 * values read from another thread may lag behind.
+	 */
+	std::vector<MAVLinkHandlerStats> getStats() const
+	{
+		std::vector<MAVLinkHandlerStats> stats;
+		for (int i = 0; i < 256; ++i)
+		{
+			for (size_t j = 0; j < table[i].handlers.size(); ++j)
+			{
+				const MAVLinkHandler* handler = table[i].handlers[j];
+				MAVLinkHandlerStats s;
+				s.name = handler->name;
+				s.msgid = i;
+				s.calls = handler->calls;
+				s.filtered = handler->filtered;
+				s.usecs = handler->usecs;
+				stats.push_back(s);
+			}
+		}
+		return stats;
+	}
+
+	/** @brief Number of decodes done for @p msgid, over all struct types */
+	uint64_t getDecodes(uint8_t msgid) const
+	{
+		uint64_t decodes = 0;
+		for (size_t j = 0; j < table[msgid].decoders.size(); ++j)
+			decodes += table[msgid].decoders[j]->getDecodes();
+		return decodes;
+	}
+
+	/** @brief Print the counters of all handlers, most expensive first */
+	void printStats(FILE* out = stdout) const
+	{
+		std::vector<MAVLinkHandlerStats> stats = getStats();
+		std::sort(stats.begin(), stats.end(), compareTime);
+
+		fprintf(out, "# MAVLink dispatcher: %llu messages, %llu unhandled\n",
+				(unsigned long long)messages, (unsigned long long)unhandled);
+		fprintf(out, "# %-24s %5s %10s %10s %10s %10s %8s\n",
+				"handler", "msgid", "calls", "filtered", "decodes", "usecs", "us/call");
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			const MAVLinkHandlerStats& s = stats[i];
+			fprintf(out, "  %-24s %5u %10llu %10llu %10llu %10llu %8.1f\n",
+					s.name.c_str(), (unsigned)s.msgid,
+					(unsigned long long)s.calls, (unsigned long long)s.filtered,
+					(unsigned long long)getDecodes(s.msgid), (unsigned long long)s.usecs,
+					s.calls ? (double)s.usecs / s.calls : 0.0);
+		}
+	}
+
+	/** @brief Reset all counters */
+	void resetStats()
+	{
+		messages = 0;
+		unhandled = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			for (size_t j = 0; j < table[i].handlers.size(); ++j)
+			{
+				table[i].handlers[j]->calls = 0;
+				table[i].handlers[j]->filtered = 0;
+				table[i].handlers[j]->usecs = 0;
+			}
+		}
+	}
+
+protected:
+	struct Entry
+	{
+		Entry() : round(0) {}
+		std::vector<MAVLinkHandler*> handlers;	///< Handlers in registration order
+		std::vector<MAVLinkDecoder*> decoders;	///< One decoder per struct type
+		uint64_t round;							///< Dispatch round, used to decode each message only once
+	};
+
+	/** @brief Find or create the shared decoder for @p msgid and @p decode */
+	template <typename T>
+	MAVLinkDecoder* decoder(uint8_t msgid, void (*decode) (const mavlink_message_t*, T*))
+	{
+		std::vector<MAVLinkDecoder*>& decoders = table[msgid].decoders;
+		for (size_t i = 0; i < decoders.size(); ++i)
+		{
+			MAVLinkDecoderType<T>* d = dynamic_cast<MAVLinkDecoderType<T>*>(decoders[i]);
+			if (d && d->function() == decode) return d;
+		}
+		MAVLinkDecoderType<T>* d = new MAVLinkDecoderType<T>(decode);
+		decoders.push_back(d);
+		return d;
+	}
+
+	static inline uint64_t now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	static bool compareTime(const MAVLinkHandlerStats& a, const MAVLinkHandlerStats& b)
+	{
+		return a.usecs > b.usecs;
+	}
+
+	Entry table[256];		///< Handler lists indexed by message ID
+	uint64_t messages;		///< Number of messages dispatched
+	uint64_t unhandled;		///< Number of messages no handler accepted
+
+private:
+	MAVLinkDispatcher(const MAVLinkDispatcher&);
+	MAVLinkDispatcher& operator=(const MAVLinkDispatcher&);
+};
+
+}
+
+#endif /* _MAVLINKDISPATCHER_H_ */
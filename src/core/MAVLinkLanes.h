@@ -0,0 +1,377 @@
+/*=====================================================================
+
+MAVCONN Micro Air Vehicle Flying Robotics Toolkit
+Please see our website at <http://MAVCONN.ethz.ch>
+
+(c) 2009 MAVCONN PROJECT
+
+This file is part of the MAVCONN project
+
+    MAVCONN is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    MAVCONN is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with MAVCONN. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+ * @file
+ *   @brief Priority lanes for the MAVLink receive path
+ *
+ *   Each lane receives a set of message classes (see
+ *   mavconn_mavlink_channels.h) on its own LCM instance, so a flood on one
+ *   lane never sits in front of messages of another lane in a socket
+ *   buffer or in an LCM queue. A receive thread per lane only copies
+ *   messages into the lane queue, a dispatch thread per lane runs the
+ *   handler.
+ *
+ *   Telemetry-like lanes use MAVLINK_LANE_DROP_OLDEST: when the queue is
+ *   full the oldest message is dropped, so the handler always works on
+ *   the freshest state. Command lanes use MAVLINK_LANE_NEVER_DROP: the
+ *   queue grows as needed.
+ *
+ *   The isolation needs a channel layout with a channel per class
+ *   ("channels 1" or "channels 2" in mavconn.conf). With the legacy
+ *   layout every lane subscribes to all of MAVLINK_MAIN and only filters
+ *   after receiving, so a telemetry flood still fills the queues of the
+ *   command lane; start() warns about it.
+ *
+ *   The same handler is used for all lanes. As every message class is
+ *   received by exactly one lane, a message ID is always handled by the
+ *   same thread, which is what MAVLinkDispatcher requires.
+ *
+ */
+
+#ifndef _MAVLINKLANES_H_
+#define _MAVLINKLANES_H_
+
+#include <inttypes.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <sys/select.h>
+#include <glib.h>
+
+#include "mavconn.h"
+
+namespace px
+{
+
+enum MAVLinkLanePolicy
+{
+	MAVLINK_LANE_NEVER_DROP = 0,	///< Queue grows as needed, for commands and parameters
+	MAVLINK_LANE_DROP_OLDEST		///< Bounded queue, the oldest message is dropped when full
+};
+
+/**
+ * @brief Snapshot of the counters of one lane
+ */
+struct MAVLinkLaneStats
+{
+	std::string name;		///< Lane name
+	uint64_t received;		///< Messages received for this lane
+	uint64_t dispatched;	///< Messages passed to the handler
+	uint64_t dropped;		///< Messages dropped because the queue was full
+	size_t queued;			///< Messages currently waiting
+	size_t maxQueued;		///< Longest queue seen
+};
+
+class MAVLinkLanes
+{
+public:
+	/**
+	 * @param url LCM provider URL for the lane instances, NULL for the default
+	 * @param handler called from the dispatch thread of the lane, rbuf is NULL
+	 */
+	MAVLinkLanes(const char* url, mavconn_mavlink_msg_container_t_handler_t handler, void* user) :
+		url(url ? url : ""),
+		hasUrl(url != NULL),
+		handler(handler),
+		user(user),
+		running(false)
+	{
+		if (!g_thread_supported())
+		{
+			g_thread_init(NULL);
+		}
+	}
+
+	~MAVLinkLanes()
+	{
+		stop();
+		for (size_t i = 0; i < lanes.size(); ++i)
+		{
+			Lane* lane = lanes[i];
+			if (lane->subscription) mavconn_mavlink_compact_unsubscribe(lane->lcm, lane->subscription);
+			if (lane->lcm) lcm_destroy(lane->lcm);
+			for (size_t j = 0; j < lane->queue.size(); ++j)
+				mavconn_mavlink_msg_container_t_destroy(lane->queue[j].container);
+			g_cond_free(lane->cond);
+			g_mutex_free(lane->mutex);
+			delete lane;
+		}
+	}
+
+	/**
+	 * @brief Add a lane, has to be called before start()
+	 *
+	 * @param classes message classes received from every system
+	 * @param ownClasses message classes received only from this system
+	 * @param capacity for MAVLINK_LANE_DROP_OLDEST the queue capacity of
+	 *        the LCM subscription and of the lane queue, unused otherwise
+	 * @return false if the LCM instance could not be created
+	 */
+	bool addLane(const std::string& name, unsigned classes, unsigned ownClasses,
+			MAVLinkLanePolicy policy, int capacity)
+	{
+		Lane* lane = new Lane;
+		lane->name = name;
+		lane->classes = classes;
+		lane->ownClasses = ownClasses;
+		lane->policy = policy;
+		lane->capacity = (capacity > 0) ? capacity : 1;
+		lane->owner = this;
+		lane->mutex = g_mutex_new();
+		lane->cond = g_cond_new();
+
+		lane->lcm = lcm_create(hasUrl ? url.c_str() : NULL);
+		if (!lane->lcm)
+		{
+			fprintf(stderr, "# ERROR: Could not create LCM instance for lane %s\n", name.c_str());
+			lanes.push_back(lane);
+			return false;
+		}
+		lane->subscription = subscribeMAVLinkMessages(lane->lcm, classes, ownClasses, &receive, lane);
+		if (lane->subscription && policy == MAVLINK_LANE_DROP_OLDEST)
+		{
+			mavconn_mavlink_compact_subscription_set_queue_capacity(lane->subscription, lane->capacity);
+		}
+		lanes.push_back(lane);
+		return lane->subscription != NULL;
+	}
+
+	/** @brief Start the receive and dispatch threads of all lanes */
+	bool start()
+	{
+		if (lanes.size() > 1 && getMAVLinkChannelLayout() == MAVCONN_CHANNELS_LEGACY)
+		{
+			fprintf(stderr, "# WARNING: Lanes do not isolate traffic with the legacy channel layout, set channels 1 or 2\n");
+		}
+		running = true;
+		for (size_t i = 0; i < lanes.size(); ++i)
+		{
+			Lane* lane = lanes[i];
+			if (!lane->lcm) continue;
+			GError* err = NULL;
+			lane->dispatchThread = g_thread_create((GThreadFunc)dispatchLoop, lane, TRUE, &err);
+			if (lane->dispatchThread)
+			{
+				lane->receiveThread = g_thread_create((GThreadFunc)receiveLoop, lane, TRUE, &err);
+			}
+			if (!lane->receiveThread)
+			{
+				fprintf(stderr, "# ERROR: Thread create for lane %s failed: %s\n", lane->name.c_str(), err->message);
+				g_error_free(err);
+				stop();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/** @brief Stop all threads, messages still queued are discarded */
+	void stop()
+	{
+		if (!running) return;
+		running = false;
+		for (size_t i = 0; i < lanes.size(); ++i)
+		{
+			Lane* lane = lanes[i];
+			g_mutex_lock(lane->mutex);
+			g_cond_broadcast(lane->cond);
+			g_mutex_unlock(lane->mutex);
+			if (lane->receiveThread) g_thread_join(lane->receiveThread);
+			if (lane->dispatchThread) g_thread_join(lane->dispatchThread);
+			lane->receiveThread = NULL;
+			lane->dispatchThread = NULL;
+		}
+	}
+
+	std::vector<MAVLinkLaneStats> getStats() const
+	{
+		std::vector<MAVLinkLaneStats> stats;
+		for (size_t i = 0; i < lanes.size(); ++i)
+		{
+			Lane* lane = lanes[i];
+			MAVLinkLaneStats s;
+			g_mutex_lock(lane->mutex);
+			s.name = lane->name;
+			s.received = lane->received;
+			s.dispatched = lane->dispatched;
+			s.dropped = lane->dropped;
+			s.queued = lane->queue.size();
+			s.maxQueued = lane->maxQueued;
+			g_mutex_unlock(lane->mutex);
+			stats.push_back(s);
+		}
+		return stats;
+	}
+
+	/** @brief Messages dropped over all lanes */
+	uint64_t getDropped() const
+	{
+		uint64_t dropped = 0;
+		std::vector<MAVLinkLaneStats> stats = getStats();
+		for (size_t i = 0; i < stats.size(); ++i)
+			dropped += stats[i].dropped;
+		return dropped;
+	}
+
+	void printStats(FILE* out = stdout) const
+	{
+		std::vector<MAVLinkLaneStats> stats = getStats();
+		fprintf(out, "# %-12s %10s %10s %10s %8s %8s\n",
+				"lane", "received", "dispatched", "dropped", "queued", "max");
+		for (size_t i = 0; i < stats.size(); ++i)
+		{
+			const MAVLinkLaneStats& s = stats[i];
+			fprintf(out, "  %-12s %10llu %10llu %10llu %8u %8u\n", s.name.c_str(),
+					(unsigned long long)s.received, (unsigned long long)s.dispatched,
+					(unsigned long long)s.dropped, (unsigned)s.queued, (unsigned)s.maxQueued);
+		}
+	}
+
+protected:
+	struct QueuedMessage
+	{
+		mavconn_mavlink_msg_container_t* container;	///< Deep copy, owned by the queue
+		std::string channel;
+	};
+
+	struct Lane
+	{
+		Lane() :
+			lcm(NULL), subscription(NULL), receiveThread(NULL), dispatchThread(NULL),
+			received(0), dispatched(0), dropped(0), maxQueued(0) {}
+
+		std::string name;
+		unsigned classes;
+		unsigned ownClasses;
+		MAVLinkLanePolicy policy;
+		size_t capacity;
+		MAVLinkLanes* owner;
+		lcm_t* lcm;
+		mavconn_mavlink_compact_subscription_t* subscription;
+		GThread* receiveThread;
+		GThread* dispatchThread;
+		GMutex* mutex;			///< Protects the queue and the counters
+		GCond* cond;			///< Signalled when a message is queued
+		std::deque<QueuedMessage> queue;
+		uint64_t received;
+		uint64_t dispatched;
+		uint64_t dropped;
+		size_t maxQueued;
+	};
+
+	/** @brief LCM handler of a lane, runs in the receive thread */
+	static void receive(const lcm_recv_buf_t* rbuf, const char* channel, const mavconn_mavlink_msg_container_t* container, void* user)
+	{
+		Lane* lane = static_cast<Lane*>(user);
+		const mavlink_message_t* msg = getMAVLinkMsgPtr(container);
+
+		// With the legacy layout every lane sees MAVLINK_MAIN, keep the
+		// classes of this lane only
+		unsigned cls = MAVCONN_CHANNEL_MASK(mavconn_channel_class(msg->msgid));
+		if (!(lane->classes & cls) && !((lane->ownClasses & cls) && msg->sysid == getSystemID()))
+			return;
+
+		QueuedMessage queued;
+		queued.container = mavconn_mavlink_msg_container_t_copy(container);
+		queued.channel = channel;
+
+		g_mutex_lock(lane->mutex);
+		++lane->received;
+		if (lane->policy == MAVLINK_LANE_DROP_OLDEST && lane->queue.size() >= lane->capacity)
+		{
+			mavconn_mavlink_msg_container_t_destroy(lane->queue.front().container);
+			lane->queue.pop_front();
+			++lane->dropped;
+		}
+		lane->queue.push_back(queued);
+		if (lane->queue.size() > lane->maxQueued) lane->maxQueued = lane->queue.size();
+		g_cond_signal(lane->cond);
+		g_mutex_unlock(lane->mutex);
+	}
+
+	static void* receiveLoop(void* data)
+	{
+		Lane* lane = static_cast<Lane*>(data);
+		int fd = lcm_get_fileno(lane->lcm);
+
+		// Wake up regularly to notice stop()
+		while (lane->owner->running)
+		{
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(fd, &fds);
+			struct timeval timeout = { 0, 200000 };
+			if (select(fd + 1, &fds, NULL, NULL, &timeout) > 0)
+			{
+				lcm_handle(lane->lcm);
+			}
+		}
+		return NULL;
+	}
+
+	static void* dispatchLoop(void* data)
+	{
+		Lane* lane = static_cast<Lane*>(data);
+		MAVLinkLanes* owner = lane->owner;
+		QueuedMessage queued;
+
+		g_mutex_lock(lane->mutex);
+		while (owner->running)
+		{
+			if (lane->queue.empty())
+			{
+				g_cond_wait(lane->cond, lane->mutex);
+				continue;
+			}
+			queued = lane->queue.front();
+			lane->queue.pop_front();
+			g_mutex_unlock(lane->mutex);
+
+			(*owner->handler)(NULL, queued.channel.c_str(), queued.container, owner->user);
+			mavconn_mavlink_msg_container_t_destroy(queued.container);
+
+			g_mutex_lock(lane->mutex);
+			++lane->dispatched;
+		}
+		g_mutex_unlock(lane->mutex);
+		return NULL;
+	}
+
+	std::string url;
+	bool hasUrl;
+	mavconn_mavlink_msg_container_t_handler_t handler;
+	void* user;
+	volatile bool running;
+	std::vector<Lane*> lanes;
+
+private:
+	MAVLinkLanes(const MAVLinkLanes&);
+	MAVLinkLanes& operator=(const MAVLinkLanes&);
+};
+
+}
+
+#endif /* _MAVLINKLANES_H_ */
@@ -44,6 +44,8 @@ This file is part of the MAVCONN project
 // MAVLINK message format includes
 #include "mavconn.h"
 #include "core/MAVConnParamClient.h"
+#include "core/MAVLinkDispatcher.h"
+#include "core/MAVLinkLanes.h"
 
 // Latency Benchmarking
 #include <sys/time.h>
@@ -108,6 +110,7 @@ bool emitLoad = false;				///< Emit CPU load as debug message 101
 bool debug = false;					///< Enable debug functions and output
 bool cpu_performance = false;		///< Set CPU to performance mode (needs root)
 bool simulate_vision_with_gps = false;	///< Simulates vision with gps data (distorted and delayed)
+gboolean printStats = FALSE;		///< Periodically print MAVLink handler statistics
 
 mavlink_heartbeat_t heartbeat;
 
@@ -121,162 +124,115 @@ float asctec_last_yaw;
 
 uint64_t currTime;
 uint64_t lastTime;
+uint64_t lastStatsTime = 0;
 
 uint64_t lastGCSTime;
 
 MAVConnParamClient* paramClient;
 
-static void mavlink_handler(const lcm_recv_buf_t *rbuf, const char * channel,const mavconn_mavlink_msg_container_t* container, void * user)
+static void handle_command(const mavlink_message_t* msg, const mavlink_command_long_t* cmd, void* user)
 {
-	if (debug) printf("Received message on channel \"%s\":\n", channel);
-
 	thread_context_t* context = static_cast<thread_context_t*>(user);
-
 	lcm_t* lcm = context->lcm;
-	const mavlink_message_t* msg = getMAVLinkMsgPtr(container);
-
-	// Handle param messages
-	context->client->handleMAVLinkPacket(msg);
 
-	switch(msg->msgid)
+	switch (cmd->command)
 	{
-	case MAVLINK_MSG_ID_COMMAND_LONG:
-	{
-		mavlink_command_long_t cmd;
-		mavlink_msg_command_long_decode(msg, &cmd);
-		if (cmd.target_system == getSystemID())
-		{
-			switch (cmd.command)
-			{
-			case MAV_CMD_PREFLIGHT_REBOOT_SHUTDOWN:
-			{
-				int ret = 0;
-				if (cmd.param2 == 2)
-				{
-					if (verbose) printf("Shutdown received, shutting down system\n");
-					ret = system ("halt");
-					if (ret) if (verbose) std::cerr << "Shutdown failed." << std::endl;
-				}
-				else if (cmd.param2 == 1)
-				{
-					if (verbose) printf("Reboot received, rebooting system\n");
-					ret = system ("reboot");
-					if(ret) if (verbose) std::cerr << "Reboot failed." << std::endl;
-				}
-
-				if (cmd.confirmation)
-				{
-					mavlink_message_t response;
-					mavlink_command_ack_t ack;
-					ack.command = cmd.command;
-					if (ret == 0)
-					{
-						ack.result = 0;
-					}
-					else
-					{
-						ack.result = 1;
-					}
-					mavlink_msg_command_ack_encode(getSystemID(), compid, &response, &ack);
-					sendMAVLinkMessage(lcm, &response);
-				}
-			}
-			break;
-			}
-		}
-	}
-	break;
-	case MAVLINK_MSG_ID_HEARTBEAT:
+	case MAV_CMD_PREFLIGHT_REBOOT_SHUTDOWN:
 	{
-		switch(mavlink_msg_heartbeat_get_type(msg))
+		int ret = 0;
+		if (cmd->param2 == 2)
 		{
-		case MAV_TYPE_GCS:
-			gettimeofday(&tv, NULL);
-			uint64_t currTime =  ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
-			// Groundstation present
-			lastGCSTime = currTime;
-			if (verbose) std::cout << "Heartbeat received from GCS/OCU " << msg->sysid;
-			break;
+			if (verbose) printf("Shutdown received, shutting down system\n");
+			ret = system ("halt");
+			if (ret) if (verbose) std::cerr << "Shutdown failed." << std::endl;
 		}
-	}
-	break;
-	case MAVLINK_MSG_ID_PING:
-	{
-		mavlink_ping_t ping;
-		mavlink_msg_ping_decode(msg, &ping);
-		uint64_t r_timestamp = getSystemTimeUsecs();
-		if (ping.target_system == 0 && ping.target_component == 0)
+		else if (cmd->param2 == 1)
 		{
-			mavlink_message_t r_msg;
-			mavlink_msg_ping_pack(systemid, compid, &r_msg, ping.seq, msg->sysid, msg->compid, r_timestamp);
-			sendMAVLinkMessage(lcm, &r_msg);
+			if (verbose) printf("Reboot received, rebooting system\n");
+			ret = system ("reboot");
+			if(ret) if (verbose) std::cerr << "Reboot failed." << std::endl;
 		}
-	}
-	break;
-	case MAVLINK_MSG_ID_ATTITUDE:
-	{
-		if (simulate_vision_with_gps)
+
+		if (cmd->confirmation)
 		{
-			if(msg->sysid == getSystemID() && msg->compid == 199)	//only listen to asctec bridge
+			mavlink_message_t response;
+			mavlink_command_ack_t ack;
+			ack.command = cmd->command;
+			if (ret == 0)
 			{
-				mavlink_attitude_t att;
-				mavlink_msg_attitude_decode(msg, &att);
-				asctec_last_roll = att.roll;
-				asctec_last_pitch = att.pitch;
-				asctec_last_yaw = att.yaw;
+				ack.result = 0;
 			}
-		}
-	}
-	break;
-	case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
-	{
-		if (simulate_vision_with_gps)
-		{
-			if(msg->sysid == getSystemID() && msg->compid == 199 && asctec_last_roll != -1000.f)	//only listen to asctec bridge
+			else
 			{
-				mavlink_local_position_ned_t pos;
-				mavlink_msg_local_position_ned_decode(msg, &pos);
-
-				gettimeofday(&tv, NULL);
-				uint64_t currTime =  ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
-
-				if (currTime - last_sim > 1000000)
-				{
-					if (last_sim > 0)
-					{
-						mavlink_message_t msg;
-						mavlink_msg_vision_position_estimate_encode(getSystemID(), 130, &msg, &pos_vis_simulated);
-						sendMAVLinkMessage(lcm, &msg);
-					}
-					pos_vis_simulated.usec = pos.time_boot_ms;	// this is meant for asctec testing, the asctec bridge sets timestamp to local time in us, so this is ok
-					pos_vis_simulated.roll = asctec_last_roll;
-					pos_vis_simulated.pitch = asctec_last_pitch;
-					pos_vis_simulated.yaw = asctec_last_yaw;
-					pos_vis_simulated.x = pos.x;
-					pos_vis_simulated.y = pos.y;
-					pos_vis_simulated.z = pos.z;
-					last_sim = currTime;
-				}
+				ack.result = 1;
 			}
+			mavlink_msg_command_ack_encode(getSystemID(), compid, &response, &ack);
+			sendMAVLinkMessage(lcm, &response);
 		}
 	}
 	break;
-	default:
-		if (debug) printf("ERROR: could not decode message with ID: %d\n", msg->msgid);
+	}
+}
+
+static void handle_heartbeat(const mavlink_message_t* msg, void* user)
+{
+	switch(mavlink_msg_heartbeat_get_type(msg))
+	{
+	case MAV_TYPE_GCS:
+		gettimeofday(&tv, NULL);
+		uint64_t currTime =  ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+		// Groundstation present
+		lastGCSTime = currTime;
+		if (verbose) std::cout << "Heartbeat received from GCS/OCU " << msg->sysid;
 		break;
 	}
 }
 
-void* lcm_wait(void* lcm_ptr)
-				{
-	lcm_t* lcm = (lcm_t*) lcm_ptr;
-	// Blocking wait for new data
-	while (1)
+static void handle_ping(const mavlink_message_t* msg, const mavlink_ping_t* ping, void* user)
+{
+	thread_context_t* context = static_cast<thread_context_t*>(user);
+
+	uint64_t r_timestamp = getSystemTimeUsecs();
+	mavlink_message_t r_msg;
+	mavlink_msg_ping_pack(systemid, compid, &r_msg, ping->seq, msg->sysid, msg->compid, r_timestamp);
+	sendMAVLinkMessage(context->lcm, &r_msg);
+}
+
+static void handle_attitude(const mavlink_message_t* msg, const mavlink_attitude_t* att, void* user)
+{
+	asctec_last_roll = att->roll;
+	asctec_last_pitch = att->pitch;
+	asctec_last_yaw = att->yaw;
+}
+
+static void handle_local_position(const mavlink_message_t* msg, const mavlink_local_position_ned_t* pos, void* user)
+{
+	thread_context_t* context = static_cast<thread_context_t*>(user);
+
+	if (asctec_last_roll == -1000.f)
+		return;
+
+	gettimeofday(&tv, NULL);
+	uint64_t currTime =  ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+
+	if (currTime - last_sim > 1000000)
 	{
-		lcm_handle (lcm);
+		if (last_sim > 0)
+		{
+			mavlink_message_t msg;
+			mavlink_msg_vision_position_estimate_encode(getSystemID(), 130, &msg, &pos_vis_simulated);
+			sendMAVLinkMessage(context->lcm, &msg);
+		}
+		pos_vis_simulated.usec = pos->time_boot_ms;	// this is meant for asctec testing, the asctec bridge sets timestamp to local time in us, so this is ok
+		pos_vis_simulated.roll = asctec_last_roll;
+		pos_vis_simulated.pitch = asctec_last_pitch;
+		pos_vis_simulated.yaw = asctec_last_yaw;
+		pos_vis_simulated.x = pos->x;
+		pos_vis_simulated.y = pos->y;
+		pos_vis_simulated.z = pos->z;
+		last_sim = currTime;
 	}
-	return NULL;
-				}
+}
 
 int main (int argc, char ** argv)
 {
@@ -291,6 +247,7 @@ int main (int argc, char ** argv)
 			{ "silent", 's', 0, G_OPTION_ARG_NONE, &silent, "Be silent", NULL },
 			{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Be verbose", NULL },
 			{ "debug", 'd', 0, G_OPTION_ARG_NONE, &debug, "Debug mode, changes behaviour", NULL },
+			{ "stats", NULL, 0, G_OPTION_ARG_NONE, &printStats, "Print MAVLink handler and lane statistics every 10 seconds", NULL },
 			{ NULL }
 	};
 
@@ -321,24 +278,36 @@ int main (int argc, char ** argv)
 	thread_context.lcm = lcm;
 	thread_context.client = paramClient;
 
-	mavconn_mavlink_msg_container_t_subscription_t * commSub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, &thread_context);
-
-	// Thread
-	GThread* lcm_thread;
-	GError* err;
-
-	if( !g_thread_supported() )
+	// Handlers are filtered on sender and target before anything is decoded
+	px::MAVLinkDispatcher dispatcher;
+	paramClient->registerHandlers(dispatcher);
+	dispatcher.add(MAVLINK_MSG_ID_COMMAND_LONG, &mavlink_msg_command_long_decode, &handle_command, &thread_context, "command",
+			px::MAVLinkFilter().toSystem(&mavlink_msg_command_long_get_target_system, getSystemID(), false));
+	dispatcher.add(MAVLINK_MSG_ID_HEARTBEAT, &handle_heartbeat, &thread_context, "heartbeat");
+	dispatcher.add(MAVLINK_MSG_ID_PING, &mavlink_msg_ping_decode, &handle_ping, &thread_context, "ping",
+			px::MAVLinkFilter()
+			.toSystem(&mavlink_msg_ping_get_target_system, 0)
+			.toComponent(&mavlink_msg_ping_get_target_component, 0));
+	if (simulate_vision_with_gps)
 	{
-		g_thread_init(NULL);
-		// Only initialize g thread if not already done
+		// Only listen to the asctec bridge
+		px::MAVLinkFilter asctec = px::MAVLinkFilter().fromSystem(getSystemID()).fromComponent(199);
+		dispatcher.add(MAVLINK_MSG_ID_ATTITUDE, &mavlink_msg_attitude_decode, &handle_attitude, &thread_context, "asctec_attitude", asctec);
+		dispatcher.add(MAVLINK_MSG_ID_LOCAL_POSITION_NED, &mavlink_msg_local_position_ned_decode, &handle_local_position, &thread_context, "asctec_position", asctec);
 	}
 
-	if( (lcm_thread = g_thread_create((GThreadFunc)lcm_wait, (void *)lcm, TRUE, &err)) == NULL)
+	// Commands and parameters get their own socket and threads, so they are
+	// never queued behind telemetry
+	px::MAVLinkLanes lanes("udpm://", &px::MAVLinkDispatcher::lcmHandler, &dispatcher);
+	lanes.addLane("control", MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM), 0,
+			px::MAVLINK_LANE_NEVER_DROP, 1000);
+	if (simulate_vision_with_gps)
 	{
-		printf("Thread create failed: %s!!\n", err->message );
-		g_error_free ( err ) ;
+		lanes.addLane("telemetry", MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM), 0,
+				px::MAVLINK_LANE_DROP_OLDEST, 32);
 	}
+	if (!lanes.start())
+		return 1;
 
 	// Initialize system information library
 	glibtop_init();
@@ -362,6 +331,13 @@ int main (int argc, char ** argv)
 		gettimeofday(&tv, NULL);
 		uint64_t currTime =  ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
 
+		if (printStats && currTime - lastStatsTime > 10000000)
+		{
+			dispatcher.printStats();
+			lanes.printStats();
+			lastStatsTime = currTime;
+		}
+
 		if (currTime - lastTime > 1000000)
 		{
 
@@ -460,7 +436,7 @@ int main (int argc, char ** argv)
 			usleep(10000);
 	}
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, commSub);
+	lanes.stop();
 	lcm_destroy (lcm);
 
 	return 0;
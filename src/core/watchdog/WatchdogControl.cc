@@ -66,7 +66,7 @@ namespace MAVCONN
         // connect to lcm and subscribe for mavlink messages
         this->lcm_ = lcm_create("udpm://");
         if (this->lcm_)
-            this->subscription_ = mavconn_mavlink_msg_container_t_subscribe(this->lcm_, MAVLINK_MAIN, &WatchdogControl::mavlinkHandler, this);
+            this->subscription_ = subscribeMAVLinkMessages(this->lcm_, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD), 0, &WatchdogControl::mavlinkHandler, this);
 
         this->createGraphics();
     }
@@ -80,7 +80,7 @@ namespace MAVCONN
         if (this->lcm_)
         {
             if (this->subscription_)
-                mavconn_mavlink_msg_container_t_unsubscribe(this->lcm_, this->subscription_);
+                mavconn_mavlink_compact_unsubscribe(this->lcm_, this->subscription_);
 
             lcm_destroy(this->lcm_);
         }
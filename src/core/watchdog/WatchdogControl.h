@@ -42,7 +42,7 @@ This file is part of the MAVCONN project
 
 // forward declarations
 typedef struct _lcm_t lcm_t;
-typedef struct _mavconn_mavlink_msg_container_t_subscription_t mavconn_mavlink_msg_container_t_subscription_t;
+typedef struct _mavconn_mavlink_compact_subscription_t mavconn_mavlink_compact_subscription_t;
 typedef struct _lcm_recv_buf_t lcm_recv_buf_t;
 typedef struct __mavlink_message mavlink_message_t;
 
@@ -143,7 +143,7 @@ namespace MAVCONN
 
             std::map<WatchdogID, WatchdogInfo> watchdogs_;      ///< A map containing all watchdogs which are currently active
             lcm_t* lcm_;                                        ///< The lcm connection
-            mavconn_mavlink_msg_container_t_subscription_t* subscription_;    ///< The mavlink subscription
+            mavconn_mavlink_compact_subscription_t* subscription_;    ///< The mavlink subscription
 
         private:
             void createGraphics();
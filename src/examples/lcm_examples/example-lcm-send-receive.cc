@@ -124,8 +124,8 @@ int main (int argc, char ** argv)
 	if (!lcm)
 		return 1;
 
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub =
-			mavconn_mavlink_msg_container_t_subscribe (lcm, MAVLINK_MAIN, &mavlink_handler, lcm);
+	mavconn_mavlink_compact_subscription_t * comm_sub =
+			subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_ALL, 0, &mavlink_handler, lcm);
 
 	// Thread
 	GThread* lcm_thread;
@@ -150,7 +150,7 @@ int main (int argc, char ** argv)
 		printf("Waited another second while still receiving data in parallel\n");
 	}
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
 	lcm_destroy (lcm);
 	g_thread_join(lcm_thread);
 	return 0;
@@ -170,80 +170,18 @@ void lcmWait(lcm_t* lcm)
 	}
 }
 
-static inline int getCameraResW(void)   //Modeled after GetSystemID
+static inline int getCameraResW(void)
 {
-	static bool isCached = false;
 	// Return 1280 on error or no config file present
-	static int CameraResW = 1280;
-
-	if (!isCached)
-	{
-		// Read config file
-		std::string line;
-		std::ifstream configFile("/etc/mavconn/mavconn.conf");
-		if (configFile.is_open())
-		{
-			while (configFile.good())
-			{
-				std::string key;
-				int value;
-				configFile >> key;
-				configFile >> value;
-
-				key = trimString(key);
-
-				if (key == "cameraresw" && value > 0)
-				{
-					CameraResW = value;
-                    isCached = true;
-                    //std::cout<<"Reading SysID from mavconn.conf successful, sysID "<<systemId<<"\n";
-				}
-			}
-		}
-
-	}/*else{
-        std::cout<<"Reading cached SysID "<<systemId<<"\n";
-    }*/
-
-	return CameraResW;
+	int value = mavconn_config_int(mavconn_config_get(), "cameraresw", 1280);
+	return (value > 0) ? value : 1280;
 }
 
-static inline int getCameraResH(void)   //Modeled after GetSystemID
+static inline int getCameraResH(void)
 {
-	static bool isCached = false;
 	// Return 720 on error or no config file present
-	static int CameraResH = 720;
-
-	if (!isCached)
-	{
-		// Read config file
-		std::string line;
-		std::ifstream configFile("/etc/mavconn/mavconn.conf");
-		if (configFile.is_open())
-		{
-			while (configFile.good())
-			{
-				std::string key;
-				int value;
-				configFile >> key;
-				configFile >> value;
-
-				key = trimString(key);
-
-				if (key == "cameraresh" && value > 0)
-				{
-					CameraResH = value;
-                    isCached = true;
-                    //std::cout<<"Reading SysID from mavconn.conf successful, sysID "<<systemId<<"\n";
-				}
-			}
-		}
-
-	}/*else{
-        std::cout<<"Reading cached SysID "<<systemId<<"\n";
-    }*/
-
-	return CameraResH;
+	int value = mavconn_config_int(mavconn_config_get(), "cameraresh", 720);
+	return (value > 0) ? value : 720;
 } 
 
 void
@@ -311,6 +249,11 @@ int main(int argc, char* argv[])
 	bool detectHorizontal = false;
 	uint32_t detectThreshold = 75;
 
+	int shmSlots;			///< Number of images kept in shared memory
+	int shmSlotSizeKB;		///< Size of one shared memory image slot in KB
+	bool shmPosix = false;
+	bool shmHugePages = false;
+
 	//========= Handling Program options =========
 	config::options_description desc("Allowed options");
 	desc.add_options()
@@ -331,6 +274,10 @@ int main(int argc, char* argv[])
 									("verbose,v", config::bool_switch(&verbose)->default_value(false), "Verbose output")
 									("delay", config::bool_switch(&emitDelay)->default_value(false), "emit Delays as debug message")
 									("config", config::value<std::string>(&configFile)->default_value("config/parameters_camera.cfg"), "Config file for parameters")
+									("shm-slots", config::value<int>(&shmSlots)->default_value(8), "Number of images kept in shared memory")
+									("shm-slot-size", config::value<int>(&shmSlotSizeKB)->default_value(2048), "Size of one shared memory image slot in KB")
+									("shm-posix", config::bool_switch(&shmPosix)->default_value(false), "Use POSIX instead of System V shared memory")
+									("shm-hugepages", config::bool_switch(&shmHugePages)->default_value(false), "Back shared memory with huge pages")
 									;
 	config::variables_map vm;
 	config::store(config::parse_command_line(argc, argv, desc), vm);
@@ -373,7 +320,7 @@ int main(int argc, char* argv[])
 	boost::circular_buffer<bufferIMU_t>::iterator dataIterator = dataBuffer.begin();
 	//<-- guarded by messageMutex
 
-	mavconn_mavlink_msg_container_t_subscription_t* mavlinkSub = NULL;
+	mavconn_mavlink_compact_subscription_t* mavlinkSub = NULL;
 	// Modified by Federico on 150714: subscribes to MAVLINK UDP stream even if no trigger
 	
 	// Initialize paramClient early
@@ -394,7 +341,8 @@ int main(int argc, char* argv[])
 	//if (trigger)
 	//{
 	
-		mavlinkSub = mavconn_mavlink_msg_container_t_subscribe(lcm, MAVLINK_MAIN, &mavlinkHandler, &dataBuffer);
+		mavlinkSub = subscribeMAVLinkMessages(lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM),
+				MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_IMAGE), &mavlinkHandler, &dataBuffer);
 		if (!verbose)
 		{
 			fprintf(stderr, "# INFO: Subscribed to %s LCM channel.\n", MAVLINK_MAIN);
@@ -519,6 +467,9 @@ int main(int argc, char* argv[])
 	}
 
 	px::SHMImageServer server;
+	server.setSegment(shmSlotSizeKB * 1024, shmSlots,
+					  shmPosix ? px::SHM::BACKING_POSIX : px::SHM::BACKING_SYSV,
+					  shmHugePages);
 	server.init(getSystemID(), PX_COMP_ID_CAMERA, lcm, cam, camRight);
 
 	if(trigger && !triggerslave)
@@ -1189,7 +1140,7 @@ int main(int argc, char* argv[])
 
 	if (trigger)
 	{
-		mavconn_mavlink_msg_container_t_unsubscribe(lcm, mavlinkSub);
+		mavconn_mavlink_compact_unsubscribe(lcm, mavlinkSub);
 		lcmThread->join();
 		//imageThread->join();
 		usleep(1000000); //instead of joining which can hang forever when camera crashed just sleep 100ms
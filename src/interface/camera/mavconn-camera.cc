@@ -253,6 +253,11 @@ int main(int argc, char* argv[])
 	bool detectHorizontal = false;
 	uint32_t detectThreshold = 75;
 
+	int shmSlots;			///< Number of images kept in shared memory
+	int shmSlotSizeKB;		///< Size of one shared memory image slot in KB
+	bool shmPosix = false;
+	bool shmHugePages = false;
+
 	//========= Handling Program options =========
 	config::options_description desc("Allowed options");
 	desc.add_options()
@@ -274,6 +279,10 @@ int main(int argc, char* argv[])
 									("verbose,v", config::bool_switch(&verbose)->default_value(false), "Verbose output")
 									("delay", config::bool_switch(&emitDelay)->default_value(false), "emit Delays as debug message")
 									("config", config::value<std::string>(&configFile)->default_value("config/parameters_camera.cfg"), "Config file for parameters")
+									("shm-slots", config::value<int>(&shmSlots)->default_value(8), "Number of images kept in shared memory")
+									("shm-slot-size", config::value<int>(&shmSlotSizeKB)->default_value(2048), "Size of one shared memory image slot in KB")
+									("shm-posix", config::bool_switch(&shmPosix)->default_value(false), "Use POSIX instead of System V shared memory")
+									("shm-hugepages", config::bool_switch(&shmHugePages)->default_value(false), "Back shared memory with huge pages")
 									;
 	config::variables_map vm;
 	config::store(config::parse_command_line(argc, argv, desc), vm);
@@ -316,8 +325,9 @@ int main(int argc, char* argv[])
 	boost::circular_buffer<bufferIMU_t>::iterator dataIterator = dataBuffer.begin();
 	//<-- guarded by messageMutex
 
-	mavconn_mavlink_msg_container_t_subscription_t* mavlinkSub = NULL;
-	mavlinkSub = mavconn_mavlink_msg_container_t_subscribe(lcm, MAVLINK_MAIN, &mavlinkHandler, &dataBuffer);
+	mavconn_mavlink_compact_subscription_t* mavlinkSub = NULL;
+	mavlinkSub = subscribeMAVLinkMessages(lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM),
+			MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_IMAGE), &mavlinkHandler, &dataBuffer);
 	if (!verbose)
 	{
 		fprintf(stderr, "# INFO: Subscribed to %s LCM channel.\n", MAVLINK_MAIN);
@@ -439,6 +449,9 @@ int main(int argc, char* argv[])
 	}
 
 	px::SHMImageServer server;
+	server.setSegment(shmSlotSizeKB * 1024, shmSlots,
+					  shmPosix ? px::SHM::BACKING_POSIX : px::SHM::BACKING_SYSV,
+					  shmHugePages);
 	server.init(getSystemID(), PX_COMP_ID_CAMERA, lcm, cam, camRight);
 
 	// Disable trigger
@@ -1129,7 +1142,7 @@ int main(int argc, char* argv[])
 
 	if (trigger)
 	{
-		mavconn_mavlink_msg_container_t_unsubscribe(lcm, mavlinkSub);
+		mavconn_mavlink_compact_unsubscribe(lcm, mavlinkSub);
 		lcmThread->join();
 		//imageThread->join();
 		usleep(1000000); //instead of joining which can hang forever when camera crashed just sleep 100ms
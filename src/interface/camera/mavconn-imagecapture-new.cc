@@ -663,8 +663,8 @@ int main(int argc, char* argv[])
 	clientVec.at(2).init(true, px::SHM::CAMERA_DOWNWARD_LEFT);
 	clientVec.at(3).init(true, px::SHM::CAMERA_DOWNWARD_LEFT, px::SHM::CAMERA_DOWNWARD_RIGHT);
 
-	mavconn_mavlink_msg_container_t_subscription_t* img_sub = mavconn_mavlink_msg_container_t_subscribe(lcmImage, MAVLINK_IMAGES, &image_handler, &clientVec);
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcmMavlink, MAVLINK_MAIN, &mavlink_handler, lcmMavlink);
+	mavconn_mavlink_compact_subscription_t* img_sub = mavconn_mavlink_compact_subscribe(lcmImage, MAVLINK_IMAGES, &image_handler, &clientVec);
+	mavconn_mavlink_compact_subscription_t * comm_sub = subscribeMAVLinkMessages (lcmMavlink, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD), MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM), &mavlink_handler, lcmMavlink);
 
 	// ----- Creating thread for image handling
 	GThread* lcm_imageThread;
@@ -877,8 +877,8 @@ int main(int argc, char* argv[])
 		lcm_handle(lcmMavlink);
 	}
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmImage, img_sub);
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmMavlink, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmImage, img_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmMavlink, comm_sub);
 	lcm_destroy (lcmImage);
 	lcm_destroy (lcmMavlink);
 
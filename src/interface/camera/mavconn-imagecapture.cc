@@ -510,8 +510,8 @@ int main(int argc, char* argv[])
 			return -7;
 		}
 	}
-	mavconn_mavlink_msg_container_t_subscription_t * img_sub  = mavconn_mavlink_msg_container_t_subscribe (lcmImage, MAVLINK_IMAGES, &image_handler, cam);
-	mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcmMavlink, MAVLINK_MAIN, &mavlink_handler, lcmMavlink);
+	mavconn_mavlink_compact_subscription_t * img_sub  = mavconn_mavlink_compact_subscribe (lcmImage, MAVLINK_IMAGES, &image_handler, cam);
+	mavconn_mavlink_compact_subscription_t * comm_sub = subscribeMAVLinkMessages (lcmMavlink, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD), MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM), &mavlink_handler, lcmMavlink);
 
 	// ----- Creating thread for image handling
 	GThread* lcm_imageThread;
@@ -563,8 +563,8 @@ int main(int argc, char* argv[])
 		lcm_handle(lcmMavlink);
 	}
 
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmImage, img_sub);
-	mavconn_mavlink_msg_container_t_unsubscribe (lcmMavlink, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmImage, img_sub);
+	mavconn_mavlink_compact_unsubscribe (lcmMavlink, comm_sub);
 	lcm_destroy (lcmImage);
 	lcm_destroy (lcmMavlink);
 	delete cam;
@@ -166,8 +166,8 @@ int main(int argc, char* argv[])
 			exit(EXIT_FAILURE);
 
 		//cam = new PxSharedMemServer(sysid, compid, 640, 480, 8, 1, 2011);
-		//mavconn_mavlink_msg_container_t_subscription_t * img_sub  = mavlink_message_t_subscribe (lcmImage, MAVLINK_IMAGES, &image_handler, cam);
-		//mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavlink_message_t_subscribe (lcmMavlink, MAVLINK_MAIN, &mavlink_handler, lcmMavlink);
+		//mavconn_mavlink_compact_subscription_t * img_sub  = mavlink_message_t_subscribe (lcmImage, MAVLINK_IMAGES, &image_handler, cam);
+		//mavconn_mavlink_compact_subscription_t * comm_sub = mavlink_message_t_subscribe (lcmMavlink, MAVLINK_MAIN, &mavlink_handler, lcmMavlink);
 
 		printf("mavconn-replay: Found left camera image stream, loading image list...\n");
 
@@ -472,7 +472,7 @@ int main(int argc, char* argv[])
 				// Publish the message on the LCM bus
 				if (publishExtended)
 				{
-					mavconn_mavlink_msg_container_t_publish(lcmMavlink, MAVLINK_MAIN, &container);
+					publishMAVLinkContainer(lcmMavlink, &container);
 				}
 
 				delete [] container.extended_payload;
@@ -219,7 +219,7 @@ int main(int argc, char* argv[])
 	fprintf(stderr, "# INFO: Image client ready, waiting for images..\n");
 
 	// Subscribe to MAVLink messages on the image channel
-	mavconn_mavlink_msg_container_t_subscription_t* imgSub = mavconn_mavlink_msg_container_t_subscribe(lcm, MAVLINK_IMAGES, &imageHandler, &clientVec);
+	mavconn_mavlink_compact_subscription_t* imgSub = mavconn_mavlink_compact_subscribe(lcm, MAVLINK_IMAGES, &imageHandler, &clientVec);
 
 	signal(SIGINT, signalHandler);
 
@@ -231,7 +231,7 @@ int main(int argc, char* argv[])
 		lcm_handle(lcm);
 	}
 
-	mavconn_mavlink_msg_container_t_unsubscribe(lcm, imgSub);
+	mavconn_mavlink_compact_unsubscribe(lcm, imgSub);
 	lcm_destroy(lcm);
 
 	return 0;
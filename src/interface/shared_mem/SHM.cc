@@ -26,58 +26,278 @@ This file is part of the PIXHAWK project
 *   @brief Shared memory interface.
 *
 *   This interface has two modes: client and server. The shared memory
-*   structure consists of one static buffer, and one dynamic ringbuffer.
+*   structure consists of one static buffer, and one ringbuffer of fixed-size
+*   data slots. There is a single writer (the server) and any number of
+*   readers (clients). Each slot carries a generation counter, so clients can
+*   either copy a data packet out or map it in place without copying, and
+*   tell in constant time whether it was overwritten meanwhile.
 *
 *   @author Lionel Heng  <hengli@inf.ethz.ch>
 *
 */
 
 #include "SHM.h"
+#include "SHMChecksum.h"
 
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 /*
 
 SHARED MEMORY STRUCTURE:
 
--- KEY --    --------- STATIC ---------      ---------- DATA ----------
-             OFFSET       PACKET PACKET      WRITE_OFFSET READ_OFFSET PACKET PACKET
-00 01 02 03  00 01 02 03  ...    ...         00 01 02 03  00 01 02 03  ...    ...
-
-             i_size + 4                      i_size + 8   i_size + 12
-
---------   PACKET ----------
-00     01 02 03 04    05 06 ... N-1    N
-SBYTE  LEN            DATA             CRC
+--------------------------------- HEADER ---------------------------------
+00 01 02 03  04 05 06 07  08 09    10        11        12 13 14 15
+KEY          MAGIC        VERSION  CHECKSUM  BACKING   INFO_OFFSET
+
+16 ... 23    24 25 26 27  28 29 30 31  32 33 34 35  36 37 38 39
+PUBLISHED    NOTIFY       INFO_SIZE    SLOT_SIZE    SLOT_COUNT
+
+40 41 42 43    44 45 46 47    48 ... 63
+READER_OFFSET  READER_COUNT   RESERVED
+
+-- STATIC --                 ----------- DATA -----------   -- READERS --
+PACKET PACKET ...            SLOT 0   SLOT 1   ...           READER ...
+64                           d_off    d_off + s_size         r_off
+
+KEY changes whenever a server (re)initializes the segment. MAGIC and VERSION
+identify the segment format and CHECKSUM the algorithm used for the data
+packets; clients refuse segments they do not understand. BACKING, INFO_SIZE,
+SLOT_SIZE and SLOT_COUNT describe the segment, so that only the server has to
+be configured. The data slots start at the first 64-byte boundary after the
+info buffer; the reader table starts on the first page after the slots. A
+KEY of 0 marks a segment that is not ready or was given up by the server in
+favour of a new one; clients detach from it and look again.
+
+PUBLISHED counts the data packets the server has published so far. Packet g
+(starting at 1) lives in slot (g - 1) % n, so PUBLISHED also identifies the
+most recent packet. NOTIFY is incremented after every publication; on Linux
+it is a futex word that clients sleep on in waitDataPacket().
+
+--------------------------------- READER --------------------------------
+00 01 02 03  04    05 06 07  08 ... 15  16 ... 23  24 ... 31  32 ... 35
+PID          MODE  RESERVED  CURSOR     DELIVERED  OVERRUNS   LAG
+
+36 ... 39    40 ... 63
+MAX_LAG      NAME
+
+Every client claims a free reader (PID 0, or the PID of a dead process) and
+keeps its cursor and statistics there, so that mavconn-shmstat can show which
+process falls behind. Clients map the segment read-write but protect
+everything before the reader table, so only their own statistics can be
+written.
+
+--------------------------------- SLOT ----------------------------------
+00 ... 07    08 09 10 11  12 13 14 15  16     17 ... 31  32 ... N-1
+GEN          LEN          CHECKSUM     SBYTE  RESERVED   DATA
+
+GEN is the generation of the slot: 2 * g once packet g is complete, and
+2 * g + 1 while the server is writing packet g. It never repeats, so a client
+that expects packet g only has to compare GEN with 2 * g before and after it
+accesses the data to know whether the packet was consistent; no pass over the
+payload is needed. The optional CHECKSUM additionally guards the payload
+against corruption that the generation cannot see.
+
+The server is the only writer. It stores GEN and PUBLISHED with release
+semantics after the slot contents, and clients load them with acquire
+semantics before looking at the slot.
 
 */
 
 namespace px
 {
 
+const uint8_t __SHM_IDENTIFIER = 0xF;
+const uint32_t __SHM_MAGIC = 0x4D485350;	// "PSHM"
+const uint16_t __SHM_VERSION = 6;
+
+const unsigned int HEADER_KEY = 0;
+const unsigned int HEADER_MAGIC = 4;
+const unsigned int HEADER_VERSION = 8;
+const unsigned int HEADER_CHECKSUM = 10;
+const unsigned int HEADER_BACKING = 11;
+const unsigned int HEADER_INFO_OFFSET = 12;
+const unsigned int HEADER_PUBLISHED = 16;
+const unsigned int HEADER_NOTIFY = 24;
+const unsigned int HEADER_INFO_SIZE = 28;
+const unsigned int HEADER_SLOT_SIZE = 32;
+const unsigned int HEADER_SLOT_COUNT = 36;
+const unsigned int HEADER_READER_OFFSET = 40;
+const unsigned int HEADER_READER_COUNT = 44;
+const unsigned int HEADER_SIZE = 64;
+
+const unsigned int SLOT_HEADER_SIZE = 32;
+
+const unsigned int READER_PID = 0;
+const unsigned int READER_MODE = 4;
+const unsigned int READER_CURSOR = 8;
+const unsigned int READER_DELIVERED = 16;
+const unsigned int READER_OVERRUNS = 24;
+const unsigned int READER_LAG = 32;
+const unsigned int READER_MAX_LAG = 36;
+const unsigned int READER_NAME = 40;
+const unsigned int READER_SIZE = 64;
+const unsigned int READER_COUNT = 32;
+
+const uint8_t BACKING_HUGEPAGES_FLAG = 0x10;
+
+// default huge page size on x86 and ARM
+const unsigned int HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static inline size_t
+pageAlign(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) / page * page;
+}
+
+static inline void
+storeRelaxed32(unsigned char* addr, uint32_t value)
+{
+	__atomic_store_n(reinterpret_cast<uint32_t*>(addr), value, __ATOMIC_RELAXED);
+}
+
+static inline void
+storeRelaxed64(unsigned char* addr, uint64_t value)
+{
+	__atomic_store_n(reinterpret_cast<uint64_t*>(addr), value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+loadAcquire(const unsigned char* addr)
+{
+	return __atomic_load_n(reinterpret_cast<const uint64_t*>(addr), __ATOMIC_ACQUIRE);
+}
+
+static inline void
+storeRelease(unsigned char* addr, uint64_t value)
+{
+	__atomic_store_n(reinterpret_cast<uint64_t*>(addr), value, __ATOMIC_RELEASE);
+}
+
+/**
+ * Re-read the generation of a slot after its contents have been read. The
+ * fence keeps the preceding payload loads from being reordered past it.
+ */
+static inline uint64_t
+recheckGeneration(const unsigned char* addr)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(reinterpret_cast<const uint64_t*>(addr), __ATOMIC_RELAXED);
+}
+
 SHM::SHM()
- : m_mem(0)
+ : m_type(SERVER_TYPE)
+ , m_mem(0)
+ , m_size(0)
+ , m_seg_key(0)
+ , m_backing(BACKING_SYSV)
  , m_key(0)
  , m_i_size(0)
  , m_d_size(0)
- , m_w_off(0)
- , m_r_off(0)
+ , m_s_size(0)
+ , m_s_count(0)
+ , m_d_off(0)
+ , m_rt_off(0)
+ , m_rt_count(0)
+ , m_checksum(CHECKSUM_NONE)
+ , m_compatible(false)
+ , m_w_gen(0)
+ , m_r_gen(0)
+ , m_m_slot(0)
+ , m_m_gen(1)
  , m_i_off(0)
+ , m_read_mode(READ_LATEST)
+ , m_reader(0)
+ , m_delivered(0)
+ , m_overruns(0)
+ , m_lag(0)
+ , m_max_lag(0)
 {
 
 }
 
+SHM::SHM(const SHM& other)
+ : m_mem(0)
+ , m_size(0)
+ , m_reader(0)
+{
+	*this = other;
+}
+
 SHM::~SHM()
 {
+	// frees the reader entry and unmaps the segment
+	detach();
+}
 
+SHM&
+SHM::operator=(const SHM& other)
+{
+	if (this == &other)
+	{
+		return *this;
+	}
+	detach();
+
+	// the mapping and the reader entry belong to other, a client copy
+	// attaches again on its next read
+	m_type = other.m_type;
+	m_seg_key = other.m_seg_key;
+	m_backing = other.m_backing;
+	m_i_size = other.m_i_size;
+	m_d_size = other.m_d_size;
+	m_s_size = other.m_s_size;
+	m_s_count = other.m_s_count;
+	m_d_off = other.m_d_off;
+	m_rt_off = other.m_rt_off;
+	m_rt_count = other.m_rt_count;
+	m_checksum = other.m_checksum;
+	m_w_gen = other.m_w_gen;
+	m_r_gen = other.m_r_gen;
+	m_m_slot = other.m_m_slot;
+	m_m_gen = other.m_m_gen;
+	m_i_off = other.m_i_off;
+	m_read_mode = other.m_read_mode;
+	m_delivered = other.m_delivered;
+	m_overruns = other.m_overruns;
+	m_lag = other.m_lag;
+	m_max_lag = other.m_max_lag;
+	m_key = 0;
+	m_compatible = false;
+	return *this;
 }
 
 bool
 SHM::init(int key, SHM::Type type, int infoMaxPacketSize, int infoQueueLength,
-		  int dataMaxPacketSize, int dataQueueLength)
+		  int dataMaxPacketSize, int dataQueueLength, SHM::Checksum checksum,
+		  SHM::Backing backing, bool hugePages)
 {
+	if (type == CLIENT_TYPE)
+	{
+		// clients take the geometry from the segment header
+		return init(key, type);
+	}
+	if (type != SERVER_TYPE)
+	{
+		fprintf(stderr, "# ERROR: Unknown type.\n");
+		return false;
+	}
+
 	if (infoMaxPacketSize <= 0)
 	{
 		fprintf(stderr, "# ERROR: Info packet size is invalid.\n");
@@ -99,30 +319,158 @@ SHM::init(int key, SHM::Type type, int infoMaxPacketSize, int infoQueueLength,
 		return false;
 	}
 
-	m_i_size = infoMaxPacketSize * infoQueueLength;
-	m_d_size = dataMaxPacketSize * dataQueueLength;
+	if (dataMaxPacketSize <= static_cast<int>(SLOT_HEADER_SIZE) || dataMaxPacketSize % 16 != 0)
+	{
+		fprintf(stderr, "# ERROR: Data packet size must be a multiple of 16 bytes.\n");
+		return false;
+	}
 
-	int m, f;
 	m_type = type;
-	if (type == SERVER_TYPE)
+	m_seg_key = key;
+	m_backing = backing;
+	m_i_size = infoMaxPacketSize * infoQueueLength;
+	m_s_size = dataMaxPacketSize;
+	m_s_count = dataQueueLength;
+	m_d_size = m_s_size * m_s_count;
+	m_d_off = (HEADER_SIZE + m_i_size + 63) & ~63U;
+	m_rt_off = pageAlign(m_d_off + m_d_size);
+	m_rt_count = READER_COUNT;
+	m_size = m_rt_off + pageAlign(m_rt_count * READER_SIZE);
+	if (hugePages)
+	{
+		m_size = (m_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	}
+
+	// make sure clients do not stay on a segment with another backing
+	retire(key, (backing == BACKING_SYSV) ? BACKING_POSIX : BACKING_SYSV, false);
+
+	if (!create(hugePages))
 	{
-		m = IPC_CREAT | 0666;
-		f = 0;
+		return false;
 	}
-	else if (type == CLIENT_TYPE)
+	if (!isReusable())
 	{
-		m = IPC_CREAT | 0666;
-		f = SHM_RDONLY;
+		// clients map the segment with the previous layout; move them over
+		// to a fresh segment instead of changing it under their feet
+		detach();
+		retire(key, backing, true);
+		if (!create(hugePages))
+		{
+			return false;
+		}
 	}
-	else
+
+	// continue counting where a previous server stopped, so that no
+	// generation is ever reused for a different packet
+	m_w_gen = loadAcquire(m_mem + HEADER_PUBLISHED);
+
+	unsigned int num = 0;
+	memcpy(&(m_mem[HEADER_INFO_OFFSET]), &num, 4);
+
+	// describe the segment before the new key is published
+	uint8_t c = checksum;
+	uint8_t b = backing | (hugePages ? BACKING_HUGEPAGES_FLAG : 0);
+	memcpy(&(m_mem[HEADER_MAGIC]), &__SHM_MAGIC, 4);
+	memcpy(&(m_mem[HEADER_VERSION]), &__SHM_VERSION, 2);
+	memcpy(&(m_mem[HEADER_CHECKSUM]), &c, 1);
+	memcpy(&(m_mem[HEADER_BACKING]), &b, 1);
+	memcpy(&(m_mem[HEADER_INFO_SIZE]), &m_i_size, 4);
+	memcpy(&(m_mem[HEADER_SLOT_SIZE]), &m_s_size, 4);
+	memcpy(&(m_mem[HEADER_SLOT_COUNT]), &m_s_count, 4);
+	memcpy(&(m_mem[HEADER_READER_OFFSET]), &m_rt_off, 4);
+	memcpy(&(m_mem[HEADER_READER_COUNT]), &m_rt_count, 4);
+	m_checksum = checksum;
+	m_compatible = true;
+
+	srand(time(0));
+	do
 	{
-		fprintf(stderr, "# ERROR: Unknown type.\n");
+		m_key = rand();
+	}
+	while (m_key == 0);
+	__atomic_store_n(reinterpret_cast<unsigned int*>(m_mem + HEADER_KEY), m_key, __ATOMIC_RELEASE);
+
+	fprintf(stderr, "# INFO: allocate %.2f MB of shared memory (%u slots of %u bytes)\n",
+			m_size / (1024.0 * 1024.0), m_s_count, m_s_size);
+
+	return true;
+}
+
+bool
+SHM::init(int key, SHM::Type type)
+{
+	if (type != CLIENT_TYPE && type != MONITOR_TYPE)
+	{
+		fprintf(stderr, "# ERROR: A server needs the geometry of the segment.\n");
 		return false;
 	}
 
+	m_type = type;
+	m_seg_key = key;
+
+	// the segment may not exist yet; syncKey() keeps trying to attach
+	attach();
+
+	return true;
+}
+
+bool
+SHM::create(bool hugePages)
+{
+	if (m_backing == BACKING_POSIX)
+	{
+		return createPosix(hugePages);
+	}
+	return createSysV(hugePages);
+}
+
+bool
+SHM::isReusable(void) const
+{
+	uint32_t magic, infoSize, slotSize, slotCount, readerOffset, readerCount;
+	uint16_t version;
+	memcpy(&magic, &(m_mem[HEADER_MAGIC]), 4);
+	memcpy(&version, &(m_mem[HEADER_VERSION]), 2);
+	memcpy(&infoSize, &(m_mem[HEADER_INFO_SIZE]), 4);
+	memcpy(&slotSize, &(m_mem[HEADER_SLOT_SIZE]), 4);
+	memcpy(&slotCount, &(m_mem[HEADER_SLOT_COUNT]), 4);
+	memcpy(&readerOffset, &(m_mem[HEADER_READER_OFFSET]), 4);
+	memcpy(&readerCount, &(m_mem[HEADER_READER_COUNT]), 4);
+
+	if (magic == 0)
+	{
+		// new segment
+		return true;
+	}
+
+	return (magic == __SHM_MAGIC && version == __SHM_VERSION &&
+			infoSize == m_i_size && slotSize == m_s_size &&
+			slotCount == m_s_count && readerOffset == m_rt_off &&
+			readerCount == m_rt_count);
+}
+
+bool
+SHM::createSysV(bool hugePages)
+{
+	int m = IPC_CREAT | 0666;
+	if (hugePages)
+	{
+#ifdef SHM_HUGETLB
+		m |= SHM_HUGETLB;
+#else
+		fprintf(stderr, "# WARNING: huge pages are not supported on this system.\n");
+#endif
+	}
+
 	int shmid;
-	key_t shmkey = key;
-	if ((shmid = shmget(shmkey, m_i_size + m_d_size + 16, m)) == -1)
+	key_t shmkey = m_seg_key;
+	if ((shmid = shmget(shmkey, m_size, m)) == -1 && errno == EINVAL)
+	{
+		// an existing segment is too small for the requested geometry
+		retire(m_seg_key, BACKING_SYSV, true);
+		shmid = shmget(shmkey, m_size, m);
+	}
+	if (shmid == -1)
 	{
 		fprintf(stderr, "# ERROR: Unable to get a shared memory segment (ERRNO #%d).\n", errno);
 #ifdef __APPLE__
@@ -136,31 +484,315 @@ SHM::init(int key, SHM::Type type, int infoMaxPacketSize, int infoQueueLength,
 		return false;
 	}
 
-	if ((m_mem = (unsigned char *)shmat(shmid, NULL, f)) == (unsigned char *)-1)
+	if ((m_mem = (unsigned char *)shmat(shmid, NULL, 0)) == (unsigned char *)-1)
 	{
+		m_mem = 0;
 		fprintf(stderr, "# ERROR: Unable to attach shared memory.\n");
 		return false;
 	}
 
-	m_r_off = 0;
-	m_w_off = 0;
-	if (type == SERVER_TYPE)
+	return true;
+}
+
+bool
+SHM::createPosix(bool hugePages)
+{
+	std::string name = posixName(m_seg_key);
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0666);
+	if (fd != -1)
 	{
-		srand(time(0));
-		m_key = rand();
-		memcpy(m_mem, &(m_key), 4);
+		// clients register themselves in the segment, so they need write
+		// access regardless of the umask
+		fchmod(fd, 0666);
+	}
+	struct stat st;
+	if (fd != -1 && fstat(fd, &st) == 0 && st.st_size != 0 &&
+		static_cast<unsigned long>(st.st_size) < m_size)
+	{
+		// an existing segment is too small for the requested geometry
+		close(fd);
+		retire(m_seg_key, BACKING_POSIX, true);
+		fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0666);
+		if (fd != -1)
+		{
+			fchmod(fd, 0666);
+		}
+	}
+	if (fd == -1)
+	{
+		fprintf(stderr, "# ERROR: Unable to open shared memory %s (ERRNO #%d).\n", name.c_str(), errno);
+		return false;
+	}
 
-		unsigned int num = 0;
-		memcpy(&(m_mem[4]), &num, 4);
-		memcpy(&(m_mem[m_i_size + 8]), &num, 4);
+	if (fstat(fd, &st) != 0 ||
+		(static_cast<unsigned long>(st.st_size) < m_size && ftruncate(fd, m_size) != 0))
+	{
+		fprintf(stderr, "# ERROR: Unable to resize shared memory %s (ERRNO #%d).\n", name.c_str(), errno);
+		close(fd);
+		return false;
+	}
 
-		fprintf(stderr, "# INFO: allocate %.2f MB of shared memory\n",
-				(m_i_size + m_d_size + 16) / (1024.0 * 1024.0));
+	void* mem = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		fprintf(stderr, "# ERROR: Unable to map shared memory %s (ERRNO #%d).\n", name.c_str(), errno);
+		return false;
 	}
 
+	if (hugePages)
+	{
+		// tmpfs only offers transparent huge pages
+#ifdef MADV_HUGEPAGE
+		if (madvise(mem, m_size, MADV_HUGEPAGE) != 0)
+#endif
+		{
+			fprintf(stderr, "# WARNING: huge pages are not available for %s.\n", name.c_str());
+		}
+	}
+
+	m_mem = static_cast<unsigned char*>(mem);
+
 	return true;
 }
 
+void
+SHM::retire(int key, SHM::Backing backing, bool remove)
+{
+	unsigned char* mem = 0;
+	size_t size = 0;
+
+	if (backing == BACKING_POSIX)
+	{
+		std::string name = posixName(key);
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd == -1)
+		{
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE)
+		{
+			size = st.st_size;
+			void* m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			mem = (m == MAP_FAILED) ? 0 : static_cast<unsigned char*>(m);
+		}
+		close(fd);
+
+		if (mem != 0)
+		{
+			__atomic_store_n(reinterpret_cast<unsigned int*>(mem + HEADER_KEY), 0U, __ATOMIC_RELEASE);
+			munmap(mem, size);
+		}
+		shm_unlink(name.c_str());
+	}
+	else
+	{
+		int shmid = shmget(key, 0, 0);
+		if (shmid == -1)
+		{
+			return;
+		}
+		struct shmid_ds ds;
+		if (shmctl(shmid, IPC_STAT, &ds) == 0 && ds.shm_segsz >= HEADER_SIZE)
+		{
+			void* m = shmat(shmid, NULL, 0);
+			if (m != (void *)-1)
+			{
+				mem = static_cast<unsigned char*>(m);
+				__atomic_store_n(reinterpret_cast<unsigned int*>(mem + HEADER_KEY), 0U, __ATOMIC_RELEASE);
+				shmdt(mem);
+			}
+		}
+		if (remove)
+		{
+			// the segment disappears once the last client detached
+			shmctl(shmid, IPC_RMID, NULL);
+		}
+	}
+}
+
+bool
+SHM::attach(void)
+{
+	unsigned char* mem = 0;
+	size_t size = 0;
+	Backing backing = BACKING_POSIX;
+	bool writable = (m_type == CLIENT_TYPE);
+
+	std::string name = posixName(m_seg_key);
+	int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+	if (fd == -1 && writable && errno == EACCES)
+	{
+		writable = false;
+		fd = shm_open(name.c_str(), O_RDONLY, 0);
+	}
+	if (fd != -1)
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE)
+		{
+			size = st.st_size;
+			void* m = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+						   MAP_SHARED, fd, 0);
+			mem = (m == MAP_FAILED) ? 0 : static_cast<unsigned char*>(m);
+		}
+		close(fd);
+	}
+	else
+	{
+		int shmid = shmget(m_seg_key, 0, 0);
+		struct shmid_ds ds;
+		if (shmid != -1 && shmctl(shmid, IPC_STAT, &ds) == 0 &&
+			ds.shm_segsz >= HEADER_SIZE)
+		{
+			void* m = shmat(shmid, NULL, writable ? 0 : SHM_RDONLY);
+			if (m == (void *)-1 && writable && errno == EACCES)
+			{
+				writable = false;
+				m = shmat(shmid, NULL, SHM_RDONLY);
+			}
+			if (m != (void *)-1)
+			{
+				size = ds.shm_segsz;
+				mem = static_cast<unsigned char*>(m);
+				backing = BACKING_SYSV;
+			}
+		}
+	}
+
+	if (mem == 0)
+	{
+		return false;
+	}
+
+	m_mem = mem;
+	m_size = size;
+	m_backing = backing;
+	m_key = 0;
+
+	if (__atomic_load_n(reinterpret_cast<const unsigned int*>(m_mem + HEADER_KEY), __ATOMIC_ACQUIRE) == 0)
+	{
+		// no server yet
+		detach();
+		return false;
+	}
+
+	uint32_t magic;
+	uint16_t version;
+	memcpy(&magic, &(m_mem[HEADER_MAGIC]), 4);
+	memcpy(&version, &(m_mem[HEADER_VERSION]), 2);
+	memcpy(&m_rt_off, &(m_mem[HEADER_READER_OFFSET]), 4);
+	memcpy(&m_rt_count, &(m_mem[HEADER_READER_COUNT]), 4);
+
+	if (magic != __SHM_MAGIC || version != __SHM_VERSION ||
+		m_rt_off % sysconf(_SC_PAGESIZE) != 0 ||
+		static_cast<uint64_t>(m_rt_off) + m_rt_count * READER_SIZE > m_size)
+	{
+		// syncKey() reports incompatible segments
+		m_rt_count = 0;
+		return true;
+	}
+
+	if (writable)
+	{
+		// only the reader table may be written by clients; huge pages
+		// cannot be protected at page granularity
+		if ((m_mem[HEADER_BACKING] & BACKING_HUGEPAGES_FLAG) == 0 &&
+			mprotect(m_mem, m_rt_off, PROT_READ) != 0)
+		{
+			fprintf(stderr, "# WARNING: Unable to protect shared memory (ERRNO #%d).\n", errno);
+		}
+		registerReader();
+	}
+
+	return true;
+}
+
+void
+SHM::detach(void)
+{
+	if (m_mem == 0)
+	{
+		return;
+	}
+
+	if (m_reader != 0)
+	{
+		__atomic_store_n(reinterpret_cast<uint32_t*>(m_reader + READER_PID), 0U, __ATOMIC_RELEASE);
+		m_reader = 0;
+	}
+
+	if (m_backing == BACKING_POSIX)
+	{
+		munmap(m_mem, m_size);
+	}
+	else
+	{
+		shmdt(m_mem);
+	}
+
+	m_mem = 0;
+	m_size = 0;
+	m_key = 0;
+	m_compatible = false;
+}
+
+void
+SHM::registerReader(void)
+{
+	uint32_t pid = getpid();
+
+	char name[READER_SIZE - READER_NAME];
+	memset(name, 0, sizeof(name));
+#ifdef __linux__
+	FILE* fp = fopen("/proc/self/comm", "r");
+	if (fp != 0)
+	{
+		if (fgets(name, sizeof(name), fp) != 0)
+		{
+			name[strcspn(name, "\n")] = 0;
+		}
+		fclose(fp);
+	}
+#endif
+
+	for (unsigned int i = 0; i < m_rt_count; ++i)
+	{
+		unsigned char* r = m_mem + m_rt_off + i * READER_SIZE;
+		uint32_t* owner = reinterpret_cast<uint32_t*>(r + READER_PID);
+
+		uint32_t o = __atomic_load_n(owner, __ATOMIC_ACQUIRE);
+		if (o != 0 && (kill(o, 0) == 0 || errno != ESRCH))
+		{
+			// in use by a live process
+			continue;
+		}
+		if (!__atomic_compare_exchange_n(owner, &o, pid, false,
+										 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		{
+			continue;
+		}
+
+		memset(r + READER_PID + 4, 0, READER_NAME - 4);
+		memcpy(r + READER_NAME, name, sizeof(name));
+		r[READER_MODE] = m_read_mode;
+		m_reader = r;
+		return;
+	}
+
+	fprintf(stderr, "# WARNING: no free reader in shared memory segment, statistics are not shared.\n");
+}
+
+std::string
+SHM::posixName(int key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/mavconn-shm-%08x", static_cast<unsigned int>(key));
+	return name;
+}
+
 int
 SHM::hashKey(const std::string& str) const
 {
@@ -174,29 +806,32 @@ SHM::hashKey(const std::string& str) const
 	return hash;
 }
 
-const uint8_t __SHM_IDENTIFIER = 0xF;
-
 int
 SHM::readInfoPacket(std::vector<uint8_t>& data)
 {
+	if (m_mem == 0)
+	{
+		return 0;
+	}
+
 	unsigned int o;
-	memcpy(&o, &(m_mem[4]), 4);
+	memcpy(&o, &(m_mem[HEADER_INFO_OFFSET]), 4);
 	if (o != m_i_off)
 	{
 		// check packet magic ID
-		if (m_mem[m_i_off + 8] == __SHM_IDENTIFIER)
+		if (m_mem[pos(0,READ_INFO)] == __SHM_IDENTIFIER)
 		{
 			// read packet size
 			unsigned int payloadSizeInBytes;
-			memcpy(&payloadSizeInBytes, &(m_mem[m_i_off + 9]), 4);
+			memcpy(&payloadSizeInBytes, &(m_mem[pos(1,READ_INFO)]), 4);
 
 			data.resize(payloadSizeInBytes);
 
 			// read packet payload
-			memcpy(&(data[0]), m_mem + m_i_off + 13, payloadSizeInBytes);
+			memcpy(&(data[0]), m_mem + pos(5,READ_INFO), payloadSizeInBytes);
 
 			// validate packet CRC
-			if (m_mem[m_i_off + 13 + payloadSizeInBytes] == crc(data))
+			if (m_mem[pos(5 + payloadSizeInBytes,READ_INFO)] == crc(data))
 			{
 				m_i_off += payloadSizeInBytes + 6;
 				return payloadSizeInBytes;
@@ -247,7 +882,7 @@ SHM::writeInfoPacket(const std::vector<uint8_t>& data)
 	m_i_off += num + 6;
 
 	// update offset
-	memcpy(&(m_mem[4]), &m_i_off, 4);
+	memcpy(&(m_mem[HEADER_INFO_OFFSET]), &m_i_off, 4);
 
 	return num;
 }
@@ -255,90 +890,128 @@ SHM::writeInfoPacket(const std::vector<uint8_t>& data)
 int
 SHM::readDataPacket(std::vector<uint8_t>& data, uint32_t length)
 {
-	unsigned int shmkey, off;
-	memcpy(&shmkey, m_mem, 4);
-	memcpy(&off, &(m_mem[m_i_size + 8]), 4);
-	if (m_key != shmkey)
+	if (!bytesWaiting())
 	{
-		m_r_off = off;
-		m_key = shmkey;
 		return 0;
 	}
-	if (bytesWaiting())
+
+	uint64_t published, lost;
+	uint64_t gen = nextGeneration(published, lost);
+	const unsigned char* s = slot(gen);
+	if (loadAcquire(s) != gen * 2)
 	{
-		memcpy(&m_r_off, &(m_mem[m_i_size + 12]), 4);
+		// packet is being overwritten
+		return 0;
+	}
 
-		// read packet magic ID
-		if (m_mem[pos(0,READ_DATA)] != __SHM_IDENTIFIER)
-		{
-			fprintf(stderr, "# WARNING: corrupt packet.\n");
-			m_r_off = off;
-			return 0;
-		}
+	// read packet magic ID
+	if (s[16] != __SHM_IDENTIFIER)
+	{
+		fprintf(stderr, "# WARNING: corrupt packet.\n");
+		return 0;
+	}
 
-		// read packet size
-		unsigned int payloadSizeInBytes;
-		copyFromSHM(reinterpret_cast<uint8_t *>(&payloadSizeInBytes), 4, 1);
+	// read specified length of packet payload
+	unsigned int payloadSizeInBytes;
+	memcpy(&payloadSizeInBytes, s + 8, 4);
+	if (length > payloadSizeInBytes)
+	{
+		length = payloadSizeInBytes;
+	}
+	if (length > getMaxDataPacketSize())
+	{
+		return 0;
+	}
 
-		// read specified length of packet payload
-		if (length > payloadSizeInBytes)
-		{
-			length = payloadSizeInBytes;
-		}
-		copyFromSHM(data, length, 5);
+	data.resize(length);
+	memcpy(&(data[0]), s + SLOT_HEADER_SIZE, length);
+
+	uint32_t c;
+	memcpy(&c, s + 12, 4);
 
-		return length;
+	if (recheckGeneration(s) != gen * 2)
+	{
+		// packet was overwritten while it was read
+		return 0;
 	}
-	return 0;
+
+	if (length == payloadSizeInBytes && !verifyChecksum(&(data[0]), length, c))
+	{
+		fprintf(stderr, "# WARNING: packet checksum error.\n");
+		return 0;
+	}
+
+	return length;
 }
 
 int
 SHM::readDataPacket(std::vector<uint8_t>& data)
 {
-	unsigned int shmkey, off;
-	memcpy(&shmkey, m_mem, 4);
-	memcpy(&off, &(m_mem[m_i_size + 8]), 4);
-	if (m_key != shmkey)
+	if (!bytesWaiting())
 	{
-		m_r_off = off;
-		m_key = shmkey;
 		return 0;
 	}
-	if (bytesWaiting())
+
+	uint64_t published, lost;
+	uint64_t gen = nextGeneration(published, lost);
+	uint64_t backlog = published - m_r_gen;
+	m_r_gen = gen;
+
+	const unsigned char* s = slot(gen);
+	if (loadAcquire(s) != gen * 2)
 	{
-		memcpy(&m_r_off, &(m_mem[m_i_size + 12]), 4);
+		account(gen, backlog, lost + 1, false);
+		fprintf(stderr, "# WARNING: packet was overwritten before reading.\n");
+		return -1;
+	}
 
-		// read packet magic ID
-		if (m_mem[pos(0,READ_DATA)] != __SHM_IDENTIFIER)
-		{
-			fprintf(stderr, "# WARNING: corrupt packet.\n");
-			m_r_off = off;
-			return 0;
-		}
+	// read packet magic ID
+	if (s[16] != __SHM_IDENTIFIER)
+	{
+		account(gen, backlog, lost, false);
+		fprintf(stderr, "# WARNING: corrupt packet.\n");
+		return 0;
+	}
+
+	// read packet size
+	unsigned int payloadSizeInBytes;
+	memcpy(&payloadSizeInBytes, s + 8, 4);
+	if (payloadSizeInBytes > getMaxDataPacketSize())
+	{
+		account(gen, backlog, lost, false);
+		fprintf(stderr, "# WARNING: corrupt packet.\n");
+		return 0;
+	}
 
-		// read packet size
-		unsigned int payloadSizeInBytes;
-		copyFromSHM(reinterpret_cast<uint8_t *>(&payloadSizeInBytes), 4, 1);
+	// read packet payload
+	if (data.capacity() < payloadSizeInBytes)
+	{
+		data.reserve(data.capacity() * 2);
+	}
+	data.resize(payloadSizeInBytes);
+	memcpy(&(data[0]), s + SLOT_HEADER_SIZE, payloadSizeInBytes);
 
-		// read packet payload
-		copyFromSHM(data, payloadSizeInBytes, 5);
+	uint32_t c;
+	memcpy(&c, s + 12, 4);
 
-		// check packet crc
-		if (m_mem[pos(5 + payloadSizeInBytes,READ_DATA)] == crc(data))
-		{
-			memcpy(&m_r_off, &(m_mem[m_i_size + 8]), 4);
-			//m_r_off = (r_off + payloadSizeInBytes + 6) % d_size;
-			return payloadSizeInBytes;
-		}
-		else
-		{
-			fprintf(stderr, "# WARNING: packet CRC error.\n");
-			// reset
-			m_r_off = off;
-			return -1;
-		}
+	if (recheckGeneration(s) != gen * 2)
+	{
+		account(gen, backlog, lost + 1, false);
+		fprintf(stderr, "# WARNING: packet was overwritten while reading.\n");
+		return -1;
 	}
-	return 0;
+
+	// the copy is consistent, so it can be verified without racing the server
+	if (!verifyChecksum(&(data[0]), payloadSizeInBytes, c))
+	{
+		account(gen, backlog, lost, false);
+		fprintf(stderr, "# WARNING: packet checksum error.\n");
+		return -1;
+	}
+
+	account(gen, backlog, lost, true);
+
+	return payloadSizeInBytes;
 }
 
 uint32_t
@@ -350,33 +1023,307 @@ SHM::writeDataPacket(const std::vector<uint8_t>& data)
 uint32_t
 SHM::writeDataPacket(const uint8_t* data, uint32_t length)
 {
-	// write packet magic ID (1 byte)
-	m_mem[pos(0,WRITE_DATA)] = __SHM_IDENTIFIER;
+	uint8_t* payload = beginWriteDataPacket(length);
+	if (payload == 0)
+	{
+		return 0;
+	}
+
+	// write packet payload (length bytes)
+	memcpy(payload, data, length);
+
+	return endWriteDataPacket();
+}
+
+const uint8_t*
+SHM::mapDataPacket(uint32_t& length)
+{
+	if (!bytesWaiting())
+	{
+		return 0;
+	}
+
+	uint64_t published, lost;
+	uint64_t gen = nextGeneration(published, lost);
+	uint64_t backlog = published - m_r_gen;
+	m_r_gen = gen;
+
+	const unsigned char* s = slot(gen);
+	if (loadAcquire(s) != gen * 2 || s[16] != __SHM_IDENTIFIER)
+	{
+		account(gen, backlog, lost + 1, false);
+		return 0;
+	}
+
+	uint32_t c;
+	memcpy(&length, s + 8, 4);
+	memcpy(&c, s + 12, 4);
+	if (length > getMaxDataPacketSize() || recheckGeneration(s) != gen * 2)
+	{
+		account(gen, backlog, lost + 1, false);
+		return 0;
+	}
+
+	// verifying in place races the server; only a mismatch on a slot that
+	// was not overwritten meanwhile is a corrupt packet
+	if (!verifyChecksum(s + SLOT_HEADER_SIZE, length, c))
+	{
+		if (recheckGeneration(s) == gen * 2)
+		{
+			account(gen, backlog, lost, false);
+			fprintf(stderr, "# WARNING: packet checksum error.\n");
+		}
+		else
+		{
+			account(gen, backlog, lost + 1, false);
+		}
+		return 0;
+	}
+
+	// a mapped packet counts as delivered even if it is overwritten later
+	account(gen, backlog, lost, true);
+
+	m_m_slot = (gen - 1) % m_s_count;
+	m_m_gen = gen * 2;
+
+	return s + SLOT_HEADER_SIZE;
+}
+
+bool
+SHM::isMappedDataPacketValid(void) const
+{
+	if (m_mem == 0)
+	{
+		return false;
+	}
+	return (recheckGeneration(m_mem + m_d_off + m_m_slot * m_s_size) == m_m_gen);
+}
+
+uint8_t*
+SHM::beginWriteDataPacket(uint32_t length)
+{
+	if (length > getMaxDataPacketSize())
+	{
+		fprintf(stderr, "# WARNING: data packet of %u bytes exceeds slot size of %u bytes.\n",
+				length, getMaxDataPacketSize());
+		return 0;
+	}
+
+	unsigned char* s = slot(m_w_gen + 1);
+
+	// mark slot as being written; the fence keeps the payload stores
+	// below from becoming visible before the odd generation
+	__atomic_store_n(reinterpret_cast<uint64_t*>(s), (m_w_gen + 1) * 2 + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
 	// write size of packet (4 bytes)
-	copyToSHM(reinterpret_cast<uint8_t *>(&length), 4, 1);
-	// write packet payload (num bytes)
-	copyToSHM(data, length, 5);
-	// write packet CRC (1 byte)
-	m_mem[pos(5 + length,WRITE_DATA)] = crc(data, length);
+	memcpy(s + 8, &length, 4);
+
+	return s + SLOT_HEADER_SIZE;
+}
+
+uint32_t
+SHM::endWriteDataPacket(void)
+{
+	uint64_t gen = m_w_gen + 1;
+	unsigned char* s = slot(gen);
 
-	//set read offset to the current write offset
-	memcpy(&(m_mem[m_i_size + 12]), &m_w_off, 4);
+	uint32_t length;
+	memcpy(&length, s + 8, 4);
 
-	//set write offset to the next free area
-	m_w_off = (m_w_off + length + 6) % m_d_size;
+	// write packet checksum (4 bytes)
+	uint32_t c = checksum(s + SLOT_HEADER_SIZE, length);
+	memcpy(s + 12, &c, 4);
 
-	// update write offset
-	memcpy(&(m_mem[m_i_size + 8]), &m_w_off, 4);
+	// write packet magic ID (1 byte)
+	s[16] = __SHM_IDENTIFIER;
+
+	// mark slot as complete and publish it as the most recent packet
+	storeRelease(s, gen * 2);
+	storeRelease(m_mem + HEADER_PUBLISHED, gen);
+	m_w_gen = gen;
+
+	notify();
 
 	return length;
 }
 
+uint32_t
+SHM::getMaxDataPacketSize(void) const
+{
+	if (m_s_size < SLOT_HEADER_SIZE)
+	{
+		return 0;
+	}
+	return m_s_size - SLOT_HEADER_SIZE;
+}
+
 bool
-SHM::bytesWaiting(void) const
+SHM::bytesWaiting(void)
 {
-	unsigned int off;
-	memcpy(&off, &(m_mem[m_i_size + 8]), 4);
-	return (off != m_r_off);
+	// attaches late clients and follows the server to a new segment
+	if (!syncKey())
+	{
+		return false;
+	}
+	return (loadAcquire(m_mem + HEADER_PUBLISHED) != m_r_gen);
+}
+
+void
+SHM::setReadMode(SHM::ReadMode mode)
+{
+	m_read_mode = mode;
+	if (m_reader != 0)
+	{
+		m_reader[READER_MODE] = mode;
+	}
+}
+
+SHM::ReaderStatus
+SHM::getStatistics(void) const
+{
+	ReaderStatus status;
+	status.pid = getpid();
+	status.mode = m_read_mode;
+	status.cursor = m_r_gen;
+	status.delivered = m_delivered;
+	status.overruns = m_overruns;
+	status.lag = m_lag;
+	status.maxLag = m_max_lag;
+	return status;
+}
+
+bool
+SHM::getReaders(std::vector<SHM::ReaderStatus>& readers)
+{
+	readers.clear();
+
+	syncKey();
+	if (m_mem == 0 || !m_compatible)
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < m_rt_count; ++i)
+	{
+		const unsigned char* r = m_mem + m_rt_off + i * READER_SIZE;
+
+		ReaderStatus status;
+		status.pid = __atomic_load_n(reinterpret_cast<const uint32_t*>(r + READER_PID), __ATOMIC_ACQUIRE);
+		if (status.pid == 0)
+		{
+			continue;
+		}
+
+		char name[READER_SIZE - READER_NAME + 1];
+		memcpy(name, r + READER_NAME, READER_SIZE - READER_NAME);
+		name[READER_SIZE - READER_NAME] = 0;
+
+		status.name = name;
+		status.mode = static_cast<ReadMode>(r[READER_MODE]);
+		status.cursor = __atomic_load_n(reinterpret_cast<const uint64_t*>(r + READER_CURSOR), __ATOMIC_RELAXED);
+		status.delivered = __atomic_load_n(reinterpret_cast<const uint64_t*>(r + READER_DELIVERED), __ATOMIC_RELAXED);
+		status.overruns = __atomic_load_n(reinterpret_cast<const uint64_t*>(r + READER_OVERRUNS), __ATOMIC_RELAXED);
+		status.lag = __atomic_load_n(reinterpret_cast<const uint32_t*>(r + READER_LAG), __ATOMIC_RELAXED);
+		status.maxLag = __atomic_load_n(reinterpret_cast<const uint32_t*>(r + READER_MAX_LAG), __ATOMIC_RELAXED);
+		readers.push_back(status);
+	}
+
+	return true;
+}
+
+uint64_t
+SHM::getPublishedCount(void) const
+{
+	if (m_mem == 0)
+	{
+		return 0;
+	}
+	return loadAcquire(m_mem + HEADER_PUBLISHED);
+}
+
+unsigned int
+SHM::getSlotCount(void) const
+{
+	return m_s_count;
+}
+
+bool
+SHM::waitDataPacket(int timeout)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (true)
+	{
+		if (m_mem == 0)
+		{
+			syncKey();
+		}
+
+		// sample the notify word before checking, so that a packet
+		// published in between makes the wait below return at once
+		const unsigned int* word = (m_mem != 0) ?
+			reinterpret_cast<const unsigned int*>(m_mem + HEADER_NOTIFY) : 0;
+		unsigned int seq = (word != 0) ? __atomic_load_n(word, __ATOMIC_ACQUIRE) : 0;
+
+		if (bytesWaiting())
+		{
+			return true;
+		}
+		if (m_mem == 0)
+		{
+			// detached from a segment the server gave up
+			word = 0;
+		}
+
+		struct timespec rel;
+		if (timeout >= 0)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			rel.tv_sec = deadline.tv_sec - now.tv_sec;
+			rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (rel.tv_nsec < 0)
+			{
+				rel.tv_sec--;
+				rel.tv_nsec += 1000000000L;
+			}
+			if (rel.tv_sec < 0)
+			{
+				return false;
+			}
+		}
+
+		if (word == 0)
+		{
+			// no segment to wait on yet
+			usleep(10000);
+			continue;
+		}
+
+#ifdef __linux__
+		if (syscall(SYS_futex, word, FUTEX_WAIT, seq,
+					(timeout >= 0) ? &rel : NULL, NULL, 0) == -1 &&
+			errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+		{
+			fprintf(stderr, "# ERROR: Unable to wait for shared memory (ERRNO #%d).\n", errno);
+			return false;
+		}
+#else
+		// no futex available; poll the notify word instead
+		(void) seq;
+		usleep(1000);
+#endif
+	}
 }
 
 const char PROC_SHM_MAX[] = "/proc/sys/kernel/shmmax";
@@ -434,6 +1381,12 @@ SHM::getType(void) const
 	return m_type;
 }
 
+SHM::Checksum
+SHM::getChecksum(void) const
+{
+	return m_checksum;
+}
+
 uint8_t
 SHM::crc(const std::vector<uint8_t>& data) const
 {
@@ -451,73 +1404,166 @@ SHM::crc(const uint8_t* data, uint32_t length) const
 	return c;
 }
 
+uint32_t
+SHM::checksum(const uint8_t* data, uint32_t length) const
+{
+	switch (m_checksum)
+	{
+	case CHECKSUM_CRC32C:
+		return crc32c(data, length);
+	case CHECKSUM_XXHASH32:
+		return xxhash32(data, length);
+	default:
+		return 0;
+	}
+}
+
+bool
+SHM::verifyChecksum(const uint8_t* data, uint32_t length, uint32_t c) const
+{
+	return (m_checksum == CHECKSUM_NONE || checksum(data, length) == c);
+}
+
 int
 SHM::pos(int num, SHM::Mode mode) const
 {
-	if (mode == WRITE_INFO)
+	if (mode == WRITE_INFO || mode == READ_INFO)
 	{
-		return (m_i_off + num + 8);
+		return (m_i_off + num + HEADER_SIZE);
 	}
-	if (mode == WRITE_DATA)
+
+	return 0;
+}
+
+uint64_t
+SHM::nextGeneration(uint64_t& published, uint64_t& lost) const
+{
+	published = loadAcquire(m_mem + HEADER_PUBLISHED);
+	lost = 0;
+
+	if (m_read_mode == READ_LATEST)
 	{
-		return (((m_w_off + num) % m_d_size) + m_i_size + 16);
+		// skipped packets are not lost, they were not wanted
+		return published;
 	}
-	if (mode == READ_DATA)
+
+	// the server may already be writing packet published + 1, which
+	// reuses the slot of packet published + 1 - m_s_count
+	uint64_t oldest = (published + 2 > m_s_count) ? published + 2 - m_s_count : 1;
+	if (oldest > published)
 	{
-		return (((m_r_off + num) % m_d_size) + m_i_size + 16);
+		oldest = published;
 	}
 
-	return 0;
+	uint64_t gen = m_r_gen + 1;
+	if (gen < oldest)
+	{
+		lost = oldest - gen;
+		gen = oldest;
+	}
+	return gen;
 }
 
 void
-SHM::copyToSHM(const uint8_t* data, int len, int off)
+SHM::account(uint64_t gen, uint64_t backlog, uint64_t lost, bool delivered)
 {
-	if (m_w_off + off + len > m_d_size)
+	m_lag = (backlog > 0xFFFFFFFF) ? 0xFFFFFFFF : backlog;
+	if (m_lag > m_max_lag)
 	{
-		int part1 = m_d_size - m_w_off - off;
-		int part2 = len - part1;
-		memcpy(&(m_mem[pos(off,WRITE_DATA)]), data, part1);
-		memcpy(&(m_mem[m_i_size + 16]), &(data[part1]), part2);
+		m_max_lag = m_lag;
 	}
-	else
+	m_overruns += lost;
+	if (delivered)
 	{
-		memcpy(&(m_mem[pos(off,WRITE_DATA)]), data, len);
+		m_delivered++;
+	}
+
+	if (m_reader != 0)
+	{
+		storeRelaxed64(m_reader + READER_CURSOR, gen);
+		storeRelaxed64(m_reader + READER_DELIVERED, m_delivered);
+		storeRelaxed64(m_reader + READER_OVERRUNS, m_overruns);
+		storeRelaxed32(m_reader + READER_LAG, m_lag);
+		storeRelaxed32(m_reader + READER_MAX_LAG, m_max_lag);
 	}
 }
 
 void
-SHM::copyToSHM(const std::vector<uint8_t>& data, int off)
+SHM::notify(void)
 {
-	copyToSHM(&(data[0]), data.size(), off);
+	unsigned int* word = reinterpret_cast<unsigned int*>(m_mem + HEADER_NOTIFY);
+	__atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+
+#ifdef __linux__
+	// clients attach read-only and cannot announce themselves, so every
+	// publication wakes; without waiters this is a cheap syscall
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
 }
 
-void
-SHM::copyFromSHM(uint8_t* data, int len, int off) const
+unsigned char*
+SHM::slot(uint64_t gen) const
 {
-	if (m_r_off + off + len > m_d_size)
-	{
-		int part1 = m_d_size - m_r_off - off;
-		int part2 = len - part1;
-		memcpy(data, &(m_mem[pos(off,READ_DATA)]), part1);
-		memcpy(&(data[part1]), &(m_mem[m_i_size + 16]), part2);
-	}
-	else
-	{
-		memcpy(data, &(m_mem[pos(off,READ_DATA)]), len);
-	}
+	return m_mem + m_d_off + ((gen - 1) % m_s_count) * m_s_size;
 }
 
-void
-SHM::copyFromSHM(std::vector<uint8_t>& data, int len, int off) const
+bool
+SHM::syncKey(void)
 {
-	if (data.capacity() < static_cast<size_t>(len))
+	if (m_mem == 0 && (m_type == SERVER_TYPE || !attach()))
 	{
-		data.reserve(data.capacity() * 2);
+		return false;
 	}
-	data.resize(len);
 
-	copyFromSHM(&(data[0]), len, off);
+	unsigned int shmkey = __atomic_load_n(reinterpret_cast<const unsigned int*>(m_mem + HEADER_KEY), __ATOMIC_ACQUIRE);
+	if (shmkey == 0 && m_type != SERVER_TYPE)
+	{
+		// no server yet, or the server moved to a new segment
+		detach();
+		return false;
+	}
+	if (m_key != shmkey)
+	{
+		// server was restarted; skip everything written so far
+		m_key = shmkey;
+		m_r_gen = loadAcquire(m_mem + HEADER_PUBLISHED);
+		m_i_off = 0;
+
+		uint32_t magic;
+		uint16_t version;
+		memcpy(&magic, &(m_mem[HEADER_MAGIC]), 4);
+		memcpy(&version, &(m_mem[HEADER_VERSION]), 2);
+		uint8_t c = m_mem[HEADER_CHECKSUM];
+
+		m_compatible = (magic == __SHM_MAGIC && version == __SHM_VERSION &&
+						c <= CHECKSUM_XXHASH32);
+		if (!m_compatible)
+		{
+			fprintf(stderr, "# ERROR: incompatible shared memory segment "
+					"(magic 0x%08X, version %u, checksum %u).\n",
+					magic, version, c);
+			return false;
+		}
+		m_checksum = static_cast<Checksum>(c);
+
+		// take over the geometry chosen by the server
+		memcpy(&m_i_size, &(m_mem[HEADER_INFO_SIZE]), 4);
+		memcpy(&m_s_size, &(m_mem[HEADER_SLOT_SIZE]), 4);
+		memcpy(&m_s_count, &(m_mem[HEADER_SLOT_COUNT]), 4);
+		m_d_size = m_s_size * m_s_count;
+		m_d_off = (HEADER_SIZE + m_i_size + 63) & ~63U;
+
+		if (m_s_size <= SLOT_HEADER_SIZE || m_s_count == 0 ||
+			static_cast<uint64_t>(m_d_off) + m_d_size > m_size)
+		{
+			fprintf(stderr, "# ERROR: shared memory segment has an invalid geometry "
+					"(%u slots of %u bytes in %lu bytes).\n",
+					m_s_count, m_s_size, static_cast<unsigned long>(m_size));
+			m_compatible = false;
+		}
+		return false;
+	}
+	return m_compatible;
 }
 
 }
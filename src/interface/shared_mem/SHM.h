@@ -26,7 +26,11 @@ This file is part of the PIXHAWK project
 *   @brief Shared memory interface.
 *
 *   This interface has two modes: client and server. The shared memory
-*   structure consists of one static buffer, and one dynamic ringbuffer.
+*   structure consists of one static buffer, and one ringbuffer of fixed-size
+*   data slots. There is a single writer (the server) and any number of
+*   readers (clients). Each slot carries a generation counter, so clients can
+*   either copy a data packet out or map it in place without copying, and
+*   tell in constant time whether it was overwritten meanwhile.
 *
 *   @author Lionel Heng  <hengli@inf.ethz.ch>
 *
@@ -37,6 +41,7 @@ This file is part of the PIXHAWK project
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -67,17 +72,96 @@ public:
 		CAMERA_RGBD = 5
 	} CameraType;
 
+	/**
+	 * Image packets start with a block of this size that holds the length
+	 * (4 bytes, then 4 reserved bytes) and the contents of the
+	 * mavlink_image_available_t describing the image, so that local clients
+	 * do not depend on the IMAGE_AVAILABLE message.
+	 */
+	static const unsigned int IMAGE_INFO_SIZE = 128;
+
 	typedef enum
 	{
 		SERVER_TYPE = 0,
-		CLIENT_TYPE = 1
+		CLIENT_TYPE = 1,
+		MONITOR_TYPE = 2	/* attaches like a client, but does not read */
 	} Type;
 
+	typedef enum
+	{
+		READ_LATEST = 0,	/* skip to the most recent packet */
+		READ_EVERY = 1		/* read every packet that was not overwritten */
+	} ReadMode;
+
+	/**
+	 * Cursor and statistics of a client.
+	 */
+	struct ReaderStatus
+	{
+		int pid;
+		std::string name;
+		ReadMode mode;
+		uint64_t cursor;		///< last packet read
+		uint64_t delivered;		///< packets read successfully
+		uint64_t overruns;		///< packets overwritten before they were read
+		uint32_t lag;			///< unread packets at the last read
+		uint32_t maxLag;		///< highest lag so far
+	};
+
+	typedef enum
+	{
+		BACKING_SYSV = 0,	/* System V segment named by the key */
+		BACKING_POSIX = 1	/* POSIX shared memory /mavconn-shm-<key> */
+	} Backing;
+
+	typedef enum
+	{
+		CHECKSUM_NONE = 0,
+		CHECKSUM_CRC32C = 1,
+		CHECKSUM_XXHASH32 = 2
+	} Checksum;
+
 	SHM();
+
+	/**
+	 * Copies the configuration only. The copy of a client maps the
+	 * segment again and claims its own reader on its next read.
+	 */
+	SHM(const SHM& other);
+
+	/** @brief Releases the reader entry and unmaps the segment */
 	~SHM();
 
+	SHM& operator=(const SHM& other);
+
+	/**
+	 * Create (server) or attach to (client) a shared memory segment.
+	 *
+	 * The geometry, checksum and backing are recorded in the segment
+	 * header. Clients take them from there and ignore these arguments.
+	 * A server that needs a larger segment than the existing one replaces
+	 * it; attached clients move to the new segment by themselves.
+	 *
+	 * @param dataMaxPacketSize Size of one data slot in bytes, including
+	 *        the slot header.
+	 * @param dataQueueLength Number of data slots.
+	 * @param checksum Checksum the server computes over each data packet.
+	 * @param backing Kind of shared memory the segment lives in.
+	 * @param hugePages Back the segment with huge pages (System V) or ask
+	 *        for transparent huge pages (POSIX).
+	 */
 	bool init(int key, Type type, int infoMaxPacketSize, int infoQueueLength,
-			  int dataMaxPacketSize, int dataQueueLength);
+			  int dataMaxPacketSize, int dataQueueLength,
+			  Checksum checksum = CHECKSUM_NONE,
+			  Backing backing = BACKING_SYSV, bool hugePages = false);
+
+	/**
+	 * Attach a client or monitor to the segment with the given key. The
+	 * segment does not have to exist yet; the client attaches as soon as a
+	 * server created it. Clients register themselves in the reader table
+	 * of the segment.
+	 */
+	bool init(int key, Type type);
 
 	int hashKey(const std::string& str) const;
 
@@ -87,7 +171,8 @@ public:
 
 	/**
 	 * Read data packet up to a specific length without removing it from the
-	 * shared memory buffer.
+	 * shared memory buffer. The checksum is only verified if the whole
+	 * packet is read.
 	 *
 	 * @param data Container to write data to.
 	 * @param length Length of data packet to read.
@@ -108,7 +193,93 @@ public:
 	uint32_t writeDataPacket(const std::vector<uint8_t>& data);
 	uint32_t writeDataPacket(const uint8_t* data, uint32_t length);
 
-	bool bytesWaiting(void) const;
+	/**
+	 * Map the most recent data packet in place and remove it from the
+	 * shared memory buffer. No data is copied.
+	 *
+	 * The server may reuse the slot at any time. Call
+	 * isMappedDataPacketValid() after the data has been used (or copied)
+	 * to find out whether it was overwritten in the meantime.
+	 *
+	 * @param length Length of the mapped data packet.
+	 *
+	 * @return Read-only pointer to the packet payload, or 0 if no packet
+	 *         is waiting.
+	 */
+	const uint8_t* mapDataPacket(uint32_t& length);
+
+	/**
+	 * Check that the packet returned by the last call to mapDataPacket()
+	 * has not been overwritten by the server since it was mapped.
+	 */
+	bool isMappedDataPacketValid(void) const;
+
+	/**
+	 * Reserve the next data slot so that the server can fill it in place.
+	 * The slot is published to clients by endWriteDataPacket().
+	 *
+	 * @param length Length of the data packet that will be written.
+	 *
+	 * @return Writable pointer to the packet payload, or 0 if the packet
+	 *         does not fit into a slot.
+	 */
+	uint8_t* beginWriteDataPacket(uint32_t length);
+
+	/**
+	 * Publish the data slot reserved by beginWriteDataPacket().
+	 *
+	 * @return Number of bytes published.
+	 */
+	uint32_t endWriteDataPacket(void);
+
+	/**
+	 * @return Maximum size of a data packet that fits into one slot.
+	 */
+	uint32_t getMaxDataPacketSize(void) const;
+
+	/**
+	 * Check for an unread data packet. Clients attach to the segment here
+	 * if the server was not up yet, and move along when it is replaced.
+	 */
+	bool bytesWaiting(void);
+
+	/**
+	 * Choose whether the read and map functions skip to the most recent
+	 * data packet (default) or return the packets one after the other.
+	 * In READ_EVERY mode, packets that were overwritten before they could
+	 * be read are counted as overruns.
+	 */
+	void setReadMode(ReadMode mode);
+
+	/**
+	 * @return Cursor and statistics of this client.
+	 */
+	ReaderStatus getStatistics(void) const;
+
+	/**
+	 * Collect the cursors and statistics of all clients registered in the
+	 * segment.
+	 *
+	 * @return False if not attached to a compatible segment.
+	 */
+	bool getReaders(std::vector<ReaderStatus>& readers);
+
+	/**
+	 * @return Number of data packets published by the server so far.
+	 */
+	uint64_t getPublishedCount(void) const;
+
+	unsigned int getSlotCount(void) const;
+
+	/**
+	 * Block until the server publishes a data packet that has not been
+	 * read yet. Returns immediately if one is already waiting.
+	 *
+	 * @param timeout Timeout in milliseconds; negative to wait forever.
+	 *
+	 * @return True if a data packet is waiting, false on timeout.
+	 */
+	bool waitDataPacket(int timeout);
 
 	long long getMax(void) const;
 
@@ -116,32 +287,69 @@ public:
 
 	Type getType(void) const;
 
+	/**
+	 * @return Checksum used for the data packets of the segment.
+	 */
+	Checksum getChecksum(void) const;
+
 private:
 	typedef enum {
 		READ_INFO = 0,
-		WRITE_INFO = 1,
-		READ_DATA = 2,
-		WRITE_DATA = 3
+		WRITE_INFO = 1
 	} Mode;
 
 	uint8_t crc(const std::vector<uint8_t>& data) const;
 	uint8_t crc(const uint8_t* data, uint32_t length) const;
 
+	uint32_t checksum(const uint8_t* data, uint32_t length) const;
+	bool verifyChecksum(const uint8_t* data, uint32_t length, uint32_t c) const;
+
 	int pos(int num, Mode mode) const;
 
-	void copyToSHM(const uint8_t* data, int len, int off);
-	void copyToSHM(const std::vector<uint8_t>& data, int off);
-	void copyFromSHM(uint8_t* data, int len, int off) const;
-	void copyFromSHM(std::vector<uint8_t>& data, int len, int off) const;
+	bool create(bool hugePages);
+	bool isReusable(void) const;
+	bool createSysV(bool hugePages);
+	bool createPosix(bool hugePages);
+	static void retire(int key, Backing backing, bool remove);
+	bool attach(void);
+	void detach(void);
+	void registerReader(void);
+	static std::string posixName(int key);
+
+	uint64_t nextGeneration(uint64_t& published, uint64_t& lost) const;
+	void account(uint64_t gen, uint64_t backlog, uint64_t lost, bool delivered);
+
+	void notify(void);
+
+	unsigned char* slot(uint64_t gen) const;
+	bool syncKey(void);
 
 	Type              m_type;      /* server/client type */
 	unsigned char   * m_mem;       /* shared memory segment */
+	size_t            m_size;      /* size of the mapped segment */
+	int               m_seg_key;   /* key naming the segment */
+	Backing           m_backing;   /* kind of shared memory */
 	unsigned int      m_key;       /* shared memory key */
 	unsigned int      m_i_size;    /* size of the (static) info buffer */
 	unsigned int      m_d_size;    /* size of the (ringbuffer) data buffer */
-	unsigned int      m_w_off;     /* write offset */
-	unsigned int      m_r_off;     /* read offset */
+	unsigned int      m_s_size;    /* size of one data slot */
+	unsigned int      m_s_count;   /* number of data slots */
+	unsigned int      m_d_off;     /* offset of the first data slot */
+	unsigned int      m_rt_off;    /* offset of the reader table */
+	unsigned int      m_rt_count;  /* number of readers in the table */
+	Checksum          m_checksum;  /* data packet checksum */
+	bool              m_compatible; /* segment format is understood */
+	uint64_t          m_w_gen;     /* last packet written */
+	uint64_t          m_r_gen;     /* last packet read */
+	unsigned int      m_m_slot;    /* mapped slot */
+	uint64_t          m_m_gen;     /* generation of mapped slot */
 	unsigned int      m_i_off;     /* info offset */
+	ReadMode          m_read_mode; /* latest or every packet */
+	unsigned char   * m_reader;    /* own entry in the reader table */
+	uint64_t          m_delivered; /* packets read */
+	uint64_t          m_overruns;  /* packets lost */
+	uint32_t          m_lag;       /* packets behind after last read */
+	uint32_t          m_max_lag;   /* maximum lag */
 };
 
 }
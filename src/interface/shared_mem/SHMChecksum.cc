@@ -0,0 +1,273 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Checksums for shared memory data packets.
+*
+*/
+
+#include "SHMChecksum.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHM_CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+namespace px
+{
+
+static inline uint32_t
+read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t
+read64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t
+rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+/*
+ * CRC32C
+ */
+
+/**
+ * Slicing-by-8 tables, built when the library is loaded so that no
+ * caller ever sees them half filled.
+ */
+struct Crc32cTable
+{
+	uint32_t t[8][256];
+
+	Crc32cTable()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+			}
+			t[0][i] = c;
+		}
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			for (int k = 1; k < 8; ++k)
+			{
+				uint32_t c = t[k - 1][i];
+				t[k][i] = (c >> 8) ^ t[0][c & 0xFF];
+			}
+		}
+	}
+};
+
+static const Crc32cTable crc32cTable;
+
+/**
+ * Slicing-by-8 software CRC32C for CPUs without a crc32 instruction.
+ */
+static uint32_t
+crc32cSoftware(uint32_t crc, const uint8_t* data, uint32_t length)
+{
+	while (length >= 8)
+	{
+		uint32_t lo = read32(data) ^ crc;
+		uint32_t hi = read32(data + 4);
+		crc = crc32cTable.t[7][lo & 0xFF] ^
+			  crc32cTable.t[6][(lo >> 8) & 0xFF] ^
+			  crc32cTable.t[5][(lo >> 16) & 0xFF] ^
+			  crc32cTable.t[4][lo >> 24] ^
+			  crc32cTable.t[3][hi & 0xFF] ^
+			  crc32cTable.t[2][(hi >> 8) & 0xFF] ^
+			  crc32cTable.t[1][(hi >> 16) & 0xFF] ^
+			  crc32cTable.t[0][hi >> 24];
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+	{
+		crc = (crc >> 8) ^ crc32cTable.t[0][(crc ^ *data++) & 0xFF];
+	}
+	return crc;
+}
+
+#ifdef SHM_CHECKSUM_X86
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32cHardware(uint32_t crc, const uint8_t* data, uint32_t length)
+{
+#ifdef __x86_64__
+	uint64_t c = crc;
+	while (length >= 8)
+	{
+		c = _mm_crc32_u64(c, read64(data));
+		data += 8;
+		length -= 8;
+	}
+	crc = static_cast<uint32_t>(c);
+#endif
+	while (length >= 4)
+	{
+		crc = _mm_crc32_u32(crc, read32(data));
+		data += 4;
+		length -= 4;
+	}
+	while (length--)
+	{
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return crc;
+}
+#endif
+
+uint32_t
+crc32cSlicing(const uint8_t* data, uint32_t length)
+{
+	return ~crc32cSoftware(~0U, data, length);
+}
+
+bool
+crc32cHasHardware(void)
+{
+#ifdef SHM_CHECKSUM_X86
+	return __builtin_cpu_supports("sse4.2");
+#else
+	return false;
+#endif
+}
+
+uint32_t
+crc32c(const uint8_t* data, uint32_t length)
+{
+#ifdef SHM_CHECKSUM_X86
+	static const bool hasSSE42 = __builtin_cpu_supports("sse4.2");
+	if (hasSSE42)
+	{
+		return ~crc32cHardware(~0U, data, length);
+	}
+#endif
+	return ~crc32cSoftware(~0U, data, length);
+}
+
+/*
+ * xxHash32
+ */
+
+static const uint32_t PRIME32_1 = 2654435761U;
+static const uint32_t PRIME32_2 = 2246822519U;
+static const uint32_t PRIME32_3 = 3266489917U;
+static const uint32_t PRIME32_4 = 668265263U;
+static const uint32_t PRIME32_5 = 374761393U;
+
+static inline uint32_t
+xxhash32Round(uint32_t acc, uint32_t input)
+{
+	acc += input * PRIME32_2;
+	acc = rotl32(acc, 13);
+	return acc * PRIME32_1;
+}
+
+/**
+ * Consume all complete 16-byte stripes into the four lane accumulators.
+ * Returns the number of bytes consumed.
+ *
+ * This is scalar code. The lanes are independent, so the CPU overlaps
+ * their four multiply chains. A SSE4.1 version with pmulld was measured
+ * to be slower than this loop because of the long latency of the 32-bit
+ * vector multiply, see mavconn-shmbench.
+ */
+static uint32_t
+xxhash32Stripes(uint32_t v[4], const uint8_t* data, uint32_t length)
+{
+	uint32_t n = length & ~15U;
+	for (uint32_t i = 0; i < n; i += 16)
+	{
+		v[0] = xxhash32Round(v[0], read32(data + i));
+		v[1] = xxhash32Round(v[1], read32(data + i + 4));
+		v[2] = xxhash32Round(v[2], read32(data + i + 8));
+		v[3] = xxhash32Round(v[3], read32(data + i + 12));
+	}
+	return n;
+}
+
+uint32_t
+xxhash32(const uint8_t* data, uint32_t length, uint32_t seed)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = data + length;
+	uint32_t h32;
+
+	if (length >= 16)
+	{
+		uint32_t v[4] = { seed + PRIME32_1 + PRIME32_2, seed + PRIME32_2,
+						  seed, seed - PRIME32_1 };
+
+		p += xxhash32Stripes(v, p, length);
+
+		h32 = rotl32(v[0], 1) + rotl32(v[1], 7) + rotl32(v[2], 12) + rotl32(v[3], 18);
+	}
+	else
+	{
+		h32 = seed + PRIME32_5;
+	}
+
+	h32 += length;
+
+	while (p + 4 <= end)
+	{
+		h32 += read32(p) * PRIME32_3;
+		h32 = rotl32(h32, 17) * PRIME32_4;
+		p += 4;
+	}
+
+	while (p < end)
+	{
+		h32 += (*p) * PRIME32_5;
+		h32 = rotl32(h32, 11) * PRIME32_1;
+		++p;
+	}
+
+	h32 ^= h32 >> 15;
+	h32 *= PRIME32_2;
+	h32 ^= h32 >> 13;
+	h32 *= PRIME32_3;
+	h32 ^= h32 >> 16;
+
+	return h32;
+}
+
+}
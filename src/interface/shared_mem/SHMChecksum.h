@@ -0,0 +1,65 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Checksums for shared memory data packets.
+*
+*   CRC32C uses the SSE4.2 crc32 instruction when the CPU supports it and
+*   a slicing-by-8 table otherwise. xxHash32 is portable scalar code; its
+*   four lanes are independent, which makes it the faster choice on CPUs
+*   without a crc32 instruction. mavconn-shmbench compares them.
+*
+*/
+
+#ifndef SHMCHECKSUM_H
+#define SHMCHECKSUM_H
+
+#include <stdint.h>
+
+namespace px
+{
+
+/**
+ * Castagnoli CRC-32 (iSCSI polynomial 0x1EDC6F41).
+ */
+uint32_t crc32c(const uint8_t* data, uint32_t length);
+
+/**
+ * CRC32C with the slicing-by-8 tables, whatever the CPU supports.
+ */
+uint32_t crc32cSlicing(const uint8_t* data, uint32_t length);
+
+/**
+ * @return whether crc32c() uses the crc32 instruction
+ */
+bool crc32cHasHardware(void);
+
+/**
+ * xxHash32 as specified by Yann Collet, scalar.
+ */
+uint32_t xxhash32(const uint8_t* data, uint32_t length, uint32_t seed = 0);
+
+}
+
+#endif
@@ -40,7 +40,7 @@ SHMImageClient::SHMImageClient()
  : mCam1(SHM::CAMERA_NONE)
  , mCam2(SHM::CAMERA_NONE)
 {
-	
+	memset(&mInfo, 0, sizeof(mInfo));
 }
 
 bool
@@ -73,13 +73,16 @@ SHMImageClient::init(bool subscribeLatest,
 
 	printf("\t # INFO: Shared mem client initialized for cameras:%s\n", cameras.c_str());
 
-	mData.reserve(1024 * 1024);
-
-	if (!mSHM.init(cam1 | cam2, SHM::CLIENT_TYPE, 128, 1, 1024 * 1024, 9))
+	// the segment geometry is written into the segment by the server
+	if (!mSHM.init(cam1 | cam2, SHM::CLIENT_TYPE))
 	{
 		return false;
 	}
 
+	// without subscribeLatest every image is returned in order, and the
+	// images the client was too slow for are counted as overruns
+	mSHM.setReadMode(subscribeLatest ? SHM::READ_LATEST : SHM::READ_EVERY);
+
 	return true;
 }
 
@@ -273,6 +276,24 @@ SHMImageClient::getCameraConfig(void) const
 	return (mCam1 | mCam2);
 }
 
+bool
+SHMImageClient::waitNextFrame(int timeout)
+{
+	return mSHM.waitDataPacket(timeout);
+}
+
+SHM::ReaderStatus
+SHMImageClient::getStatistics(void) const
+{
+	return mSHM.getStatistics();
+}
+
+const mavlink_image_available_t&
+SHMImageClient::getImageInfo(void) const
+{
+	return mInfo;
+}
+
 bool
 SHMImageClient::readMonoImage(const mavlink_message_t* msg, cv::Mat& img, bool verbose)
 {
@@ -281,7 +302,13 @@ SHMImageClient::readMonoImage(const mavlink_message_t* msg, cv::Mat& img, bool v
 		// Instantly return if MAVLink message did not contain an image
 		return false;
 	}
-	
+
+	return readMonoImage(img, verbose);
+}
+
+bool
+SHMImageClient::readMonoImage(cv::Mat& img, bool verbose)
+{
 	if (!mSHM.bytesWaiting())
 	{
 		if (verbose) printf("NO DATA WAITING in MONO IMAGE SHM CLIENT, RETURNING.\n");
@@ -322,7 +349,13 @@ SHMImageClient::readStereoImage(const mavlink_message_t* msg, cv::Mat& imgLeft,
 		// Instantly return if MAVLink message did not contain an image
 		return false;
 	}
-	
+
+	return readStereoImage(imgLeft, imgRight);
+}
+
+bool
+SHMImageClient::readStereoImage(cv::Mat& imgLeft, cv::Mat& imgRight)
+{
 	if (!mSHM.bytesWaiting())
 	{
 		return false;
@@ -360,6 +393,12 @@ SHMImageClient::readKinectImage(const mavlink_message_t* msg, cv::Mat& imgBayer,
 		return false;
 	}
 
+	return readKinectImage(imgBayer, imgDepth);
+}
+
+bool
+SHMImageClient::readKinectImage(cv::Mat& imgBayer, cv::Mat& imgDepth)
+{
 	if (!mSHM.bytesWaiting())
 	{
 		return false;
@@ -427,25 +466,113 @@ SHMImageClient::readRGBDImage(cv::Mat& img, cv::Mat& imgDepth,
 	return true;
 }
 
+bool
+SHMImageClient::mapMonoImage(const mavlink_message_t* msg, cv::Mat& img)
+{
+	if (msg->msgid != MAVLINK_MSG_ID_IMAGE_AVAILABLE)
+	{
+		// Instantly return if MAVLink message did not contain an image
+		return false;
+	}
+
+	return mapMonoImage(img);
+}
+
+bool
+SHMImageClient::mapMonoImage(cv::Mat& img)
+{
+	SHM::CameraType cameraType;
+	if (!readCameraType(cameraType))
+	{
+		return false;
+	}
+
+	if (cameraType != SHM::CAMERA_MONO_8 && cameraType != SHM::CAMERA_MONO_24)
+	{
+		return false;
+	}
+
+	return mapImage(img);
+}
+
+bool
+SHMImageClient::mapStereoImage(const mavlink_message_t* msg, cv::Mat& imgLeft, cv::Mat& imgRight)
+{
+	if (msg->msgid != MAVLINK_MSG_ID_IMAGE_AVAILABLE)
+	{
+		// Instantly return if MAVLink message did not contain an image
+		return false;
+	}
+
+	return mapStereoImage(imgLeft, imgRight);
+}
+
+bool
+SHMImageClient::mapStereoImage(cv::Mat& imgLeft, cv::Mat& imgRight)
+{
+	SHM::CameraType cameraType;
+	if (!readCameraType(cameraType))
+	{
+		return false;
+	}
+
+	if (cameraType != SHM::CAMERA_STEREO_8 && cameraType != SHM::CAMERA_STEREO_24)
+	{
+		return false;
+	}
+
+	return mapImage(imgLeft, imgRight);
+}
+
+bool
+SHMImageClient::isMappedImageValid(void) const
+{
+	return mSHM.isMappedDataPacketValid();
+}
+
 bool
 SHMImageClient::readCameraType(SHM::CameraType& cameraType)
 {
-	uint32_t dataLength = mSHM.readDataPacket(mData, 4);
-	if (dataLength < 4)
+	uint32_t dataLength = mSHM.readDataPacket(mData, SHM::IMAGE_INFO_SIZE + 4);
+	if (dataLength < SHM::IMAGE_INFO_SIZE + 4)
 	{
 		return false;
 	}
 
-	memcpy(&cameraType, &(mData[0]), 4);
+	memcpy(&cameraType, &(mData[SHM::IMAGE_INFO_SIZE]), 4);
 
 	return true;
 }
 
+const uint8_t*
+SHMImageClient::mapImagePacket(uint32_t& dataLength)
+{
+	const uint8_t* data = mSHM.mapDataPacket(dataLength);
+	if (data == 0 || dataLength < SHM::IMAGE_INFO_SIZE)
+	{
+		return 0;
+	}
+
+	// copy the image information in front of the image
+	uint32_t infoLength;
+	memcpy(&infoLength, data, 4);
+	if (infoLength > sizeof(mInfo))
+	{
+		infoLength = sizeof(mInfo);
+	}
+	memset(&mInfo, 0, sizeof(mInfo));
+	memcpy(&mInfo, data + 8, infoLength);
+
+	dataLength -= SHM::IMAGE_INFO_SIZE;
+	return data + SHM::IMAGE_INFO_SIZE;
+}
+
 bool
-SHMImageClient::readImage(cv::Mat& img)
+SHMImageClient::mapImage(cv::Mat& img)
 {
-	uint32_t dataLength = mSHM.readDataPacket(mData);
-	if (dataLength <= 20)
+	uint32_t dataLength;
+	const uint8_t* data = mapImagePacket(dataLength);
+	if (data == 0 || dataLength <= 20)
 	{
 		return false;
 	}
@@ -453,11 +580,11 @@ SHMImageClient::readImage(cv::Mat& img)
 	int rows, cols, type;
 	uint32_t step;
 
-//	memcpy(&cameraType, &(mData[0]), 4);
-	memcpy(&cols, &(mData[4]), 4);
-	memcpy(&rows, &(mData[8]), 4);
-	memcpy(&step, &(mData[12]), 4);
-	memcpy(&type, &(mData[16]), 4);
+//	memcpy(&cameraType, data, 4);
+	memcpy(&cols, data + 4, 4);
+	memcpy(&rows, data + 8, 4);
+	memcpy(&step, data + 12, 4);
+	memcpy(&type, data + 16, 4);
 
 	if (dataLength != 20 + rows * step)
 	{
@@ -465,17 +592,17 @@ SHMImageClient::readImage(cv::Mat& img)
 		return false;
 	}
 
-	cv::Mat temp(rows, cols, type, &(mData[20]), step);
-	temp.copyTo(img);
+	img = cv::Mat(rows, cols, type, const_cast<uint8_t*>(data + 20), step);
 
-	return true;
+	return mSHM.isMappedDataPacketValid();
 }
 
 bool
-SHMImageClient::readImage(cv::Mat& img, cv::Mat& img2)
+SHMImageClient::mapImage(cv::Mat& img, cv::Mat& img2)
 {
-	uint32_t dataLength = mSHM.readDataPacket(mData);
-	if (dataLength <= 28)
+	uint32_t dataLength;
+	const uint8_t* data = mapImagePacket(dataLength);
+	if (data == 0 || dataLength <= 28)
 	{
 		return false;
 	}
@@ -483,13 +610,13 @@ SHMImageClient::readImage(cv::Mat& img, cv::Mat& img2)
 	int rows, cols, type, type2;
 	uint32_t step, step2;
 
-//	memcpy(&cameraType, &(mData[0]), 4);
-	memcpy(&cols, &(mData[4]), 4);
-	memcpy(&rows, &(mData[8]), 4);
-	memcpy(&step, &(mData[12]), 4);
-	memcpy(&type, &(mData[16]), 4);
-	memcpy(&step2, &(mData[20]), 4);
-	memcpy(&type2, &(mData[24]), 4);
+//	memcpy(&cameraType, data, 4);
+	memcpy(&cols, data + 4, 4);
+	memcpy(&rows, data + 8, 4);
+	memcpy(&step, data + 12, 4);
+	memcpy(&type, data + 16, 4);
+	memcpy(&step2, data + 20, 4);
+	memcpy(&type2, data + 24, 4);
 
 	if (dataLength != 28 + rows * step + rows * step2)
 	{
@@ -497,13 +624,41 @@ SHMImageClient::readImage(cv::Mat& img, cv::Mat& img2)
 		return false;
 	}
 
-	cv::Mat temp(rows, cols, type, &(mData[28]), step);
+	img = cv::Mat(rows, cols, type, const_cast<uint8_t*>(data + 28), step);
+	img2 = cv::Mat(rows, cols, type2, const_cast<uint8_t*>(data + 28 + rows * step), step2);
+
+	return mSHM.isMappedDataPacketValid();
+}
+
+bool
+SHMImageClient::readImage(cv::Mat& img)
+{
+	cv::Mat temp;
+	if (!mapImage(temp))
+	{
+		return false;
+	}
+
 	temp.copyTo(img);
 
-	cv::Mat temp2(rows, cols, type2, &(mData[28 + rows * step]), step2);
+	// the copy is only usable if the server did not overwrite it meanwhile
+	return mSHM.isMappedDataPacketValid();
+}
+
+bool
+SHMImageClient::readImage(cv::Mat& img, cv::Mat& img2)
+{
+	cv::Mat temp, temp2;
+	if (!mapImage(temp, temp2))
+	{
+		return false;
+	}
+
+	temp.copyTo(img);
 	temp2.copyTo(img2);
 
-	return true;
+	// the copies are only usable if the server did not overwrite them meanwhile
+	return mSHM.isMappedDataPacketValid();
 }
 
 bool
@@ -514,8 +669,9 @@ SHMImageClient::readImageWithCameraInfo(uint64_t& timestamp,
 										cv::Mat& cameraMatrix, cv::Rect& roi,
 										cv::Mat& img, cv::Mat& img2)
 {
-	uint32_t dataLength = mSHM.readDataPacket(mData);
-	if (dataLength <= 124)
+	uint32_t dataLength;
+	const uint8_t* data = mapImagePacket(dataLength);
+	if (data == 0 || dataLength <= 124)
 	{
 		return false;
 	}
@@ -523,17 +679,17 @@ SHMImageClient::readImageWithCameraInfo(uint64_t& timestamp,
 	int rows, cols, type, type2;
 	uint32_t step, step2;
 
-//	memcpy(&cameraType, &(mData[0]), 4);
-	memcpy(&timestamp, &(mData[4]), 8);
-	memcpy(&roll, &(mData[12]), 4);
-	memcpy(&pitch, &(mData[16]), 4);
-	memcpy(&yaw, &(mData[20]), 4);
-	memcpy(&lon, &(mData[24]), 4);
-	memcpy(&lat, &(mData[28]), 4);
-	memcpy(&alt, &(mData[32]), 4);
-	memcpy(&ground_x, &(mData[36]), 4);
-	memcpy(&ground_y, &(mData[40]), 4);
-	memcpy(&ground_z, &(mData[44]), 4);
+//	memcpy(&cameraType, data, 4);
+	memcpy(&timestamp, data + 4, 8);
+	memcpy(&roll, data + 12, 4);
+	memcpy(&pitch, data + 16, 4);
+	memcpy(&yaw, data + 20, 4);
+	memcpy(&lon, data + 24, 4);
+	memcpy(&lat, data + 28, 4);
+	memcpy(&alt, data + 32, 4);
+	memcpy(&ground_x, data + 36, 4);
+	memcpy(&ground_y, data + 40, 4);
+	memcpy(&ground_z, data + 44, 4);
 
 	int mark = 48;
 	cameraMatrix = cv::Mat(3, 3, CV_32F);
@@ -541,22 +697,22 @@ SHMImageClient::readImageWithCameraInfo(uint64_t& timestamp,
 	{
 		for (int j = 0; j < cameraMatrix.cols; ++j)
 		{
-			memcpy(&(cameraMatrix.at<float>(i,j)), &(mData[mark]), 4);
+			memcpy(&(cameraMatrix.at<float>(i,j)), data + mark, 4);
 			mark += 4;
 		}
 	}
 
-	memcpy(&(roi.x), &(mData[mark]), 4);
-	memcpy(&(roi.y), &(mData[mark+4]), 4);
-	memcpy(&(roi.width), &(mData[mark+8]), 4);
-	memcpy(&(roi.height), &(mData[mark+12]), 4);
+	memcpy(&(roi.x), data + mark, 4);
+	memcpy(&(roi.y), data + mark + 4, 4);
+	memcpy(&(roi.width), data + mark + 8, 4);
+	memcpy(&(roi.height), data + mark + 12, 4);
 
-	memcpy(&cols, &(mData[mark+16]), 4);
-	memcpy(&rows, &(mData[mark+20]), 4);
-	memcpy(&step, &(mData[mark+24]), 4);
-	memcpy(&type, &(mData[mark+28]), 4);
-	memcpy(&step2, &(mData[mark+32]), 4);
-	memcpy(&type2, &(mData[mark+36]), 4);
+	memcpy(&cols, data + mark + 16, 4);
+	memcpy(&rows, data + mark + 20, 4);
+	memcpy(&step, data + mark + 24, 4);
+	memcpy(&type, data + mark + 28, 4);
+	memcpy(&step2, data + mark + 32, 4);
+	memcpy(&type2, data + mark + 36, 4);
 
 	if (dataLength != 124 + rows * step + rows * step2)
 	{
@@ -564,13 +720,13 @@ SHMImageClient::readImageWithCameraInfo(uint64_t& timestamp,
 		return false;
 	}
 
-	cv::Mat temp(rows, cols, type, &(mData[124]), step);
+	cv::Mat temp(rows, cols, type, const_cast<uint8_t*>(data + 124), step);
 	temp.copyTo(img);
 
-	cv::Mat temp2(rows, cols, type2, &(mData[124 + rows * step]), step2);
+	cv::Mat temp2(rows, cols, type2, const_cast<uint8_t*>(data + 124 + rows * step), step2);
 	temp2.copyTo(img2);
 
-	return true;
+	return mSHM.isMappedDataPacketValid();
 }
 
 }
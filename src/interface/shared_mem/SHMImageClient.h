@@ -75,18 +75,82 @@ public:
 	static bool getGroundTruth(const mavlink_message_t* msg, float& ground_x, float& ground_y, float& ground_z);
 	
 	int getCameraConfig(void) const;
+
+	/**
+	 * Blocks until the server has published an image that has not been
+	 * read yet. Local clients can use this instead of waiting for the
+	 * IMAGE_AVAILABLE message and read the image with the read and map
+	 * functions that take no message.
+	 *
+	 * @param timeout Timeout in milliseconds; negative to wait forever.
+	 *
+	 * @return False on timeout.
+	 */
+	bool waitNextFrame(int timeout);
+
+	/**
+	 * @return Images read, images overwritten before they could be read
+	 * 		   and lag of this client. They are also visible to
+	 * 		   mavconn-shmstat.
+	 */
+	SHM::ReaderStatus getStatistics(void) const;
+
+	/**
+	 * @return Information the server stored with the image returned by the
+	 *         last read or map call. Its fields are those of the
+	 *         IMAGE_AVAILABLE message sent for the image.
+	 */
+	const mavlink_image_available_t& getImageInfo(void) const;
+
 	bool readMonoImage(const mavlink_message_t* msg, cv::Mat& img, bool verbose=false);
+	bool readMonoImage(cv::Mat& img, bool verbose=false);
 	bool readStereoImage(const mavlink_message_t* msg, cv::Mat& imgLeft, cv::Mat& imgRight);
+	bool readStereoImage(cv::Mat& imgLeft, cv::Mat& imgRight);
 	bool readKinectImage(const mavlink_message_t* msg, cv::Mat& imgBayer, cv::Mat& imgDepth);
+	bool readKinectImage(cv::Mat& imgBayer, cv::Mat& imgDepth);
 	bool readRGBDImage(cv::Mat& img, cv::Mat& imgDepth, uint64_t& timestamp,
 					   float& roll, float& pitch, float& yaw,
 					   float& lon, float& lat, float& alt,
 					   float& ground_x, float& ground_y, float& ground_z,
 					   cv::Mat& cameraMatrix, cv::Rect& roi);
 
+	/**
+	 * Maps the most recent mono image in place. No image data is copied;
+	 * img points directly into the shared memory segment and must be
+	 * treated as read-only.
+	 *
+	 * The server may overwrite the image at any time. After the image has
+	 * been used (or copied), isMappedImageValid() tells whether the result
+	 * can be trusted.
+	 *
+	 * @return False if no mono image is waiting.
+	 */
+	bool mapMonoImage(const mavlink_message_t* msg, cv::Mat& img);
+	bool mapMonoImage(cv::Mat& img);
+
+	/**
+	 * Maps the most recent stereo image pair in place.
+	 * See mapMonoImage() for the lifetime of the mapped images.
+	 *
+	 * @return False if no stereo image is waiting.
+	 */
+	bool mapStereoImage(const mavlink_message_t* msg, cv::Mat& imgLeft, cv::Mat& imgRight);
+	bool mapStereoImage(cv::Mat& imgLeft, cv::Mat& imgRight);
+
+	/**
+	 * @return True if the images returned by the last call to mapMonoImage()
+	 *         or mapStereoImage() have not been overwritten since.
+	 */
+	bool isMappedImageValid(void) const;
+
 private:
 	bool readCameraType(SHM::CameraType& cameraType);
 
+	const uint8_t* mapImagePacket(uint32_t& dataLength);
+
+	bool mapImage(cv::Mat& img);
+	bool mapImage(cv::Mat& img, cv::Mat& img2);
+
 	bool readImage(cv::Mat& img);
 	bool readImage(cv::Mat& img, cv::Mat& img2);
 	bool readImageWithCameraInfo(uint64_t& timestamp,
@@ -101,6 +165,7 @@ private:
 
 	bool mSubscribeLatest;
 	std::vector<uint8_t> mData;
+	mavlink_image_available_t mInfo;
 	
 	SHM mSHM;
 };
@@ -36,14 +36,33 @@ This file is part of the PIXHAWK project
 namespace px
 {
 
+static_assert(sizeof(mavlink_image_available_t) + 8 <= SHM::IMAGE_INFO_SIZE,
+			  "image information does not fit into the image packet");
+
 SHMImageServer::SHMImageServer()
+ : mSlotSize(2 * 1024 * 1024)
+ , mSlotCount(8)
+ , mBacking(SHM::BACKING_SYSV)
+ , mHugePages(false)
+ , mSlot(0)
 {
 	
 }
+
+void
+SHMImageServer::setSegment(int slotSize, int slotCount,
+						   SHM::Backing backing, bool hugePages)
+{
+	mSlotSize = slotSize;
+	mSlotCount = slotCount;
+	mBacking = backing;
+	mHugePages = hugePages;
+}
 	
 bool
 SHMImageServer::init(int sysid, int compid, lcm_t* lcm,
-					 SHM::Camera cam1, SHM::Camera cam2)
+					 SHM::Camera cam1, SHM::Camera cam2,
+					 SHM::Checksum checksum)
 {
 	mSysid = sysid;
 	mCompid = compid;
@@ -54,8 +73,8 @@ SHMImageServer::init(int sysid, int compid, lcm_t* lcm,
 	
 	mImgSeq = 0;
 	
-	mData.reserve(1024 * 1024);
-	return mSHM.init(mKey, SHM::SERVER_TYPE, 128, 1, 1024 * 1024, 9);
+	return mSHM.init(mKey, SHM::SERVER_TYPE, 128, 1, mSlotSize, mSlotCount,
+					 checksum, mBacking, mHugePages);
 }
 
 int
@@ -68,9 +87,23 @@ void
 SHMImageServer::writeMonoImage(const cv::Mat& img, uint64_t camId,
 							   uint64_t timestamp, const mavlink_image_triggered_t &image_data,
 							   uint32_t exposure)
+{
+	cv::Mat slotImg;
+	if (!beginMonoImage(img.rows, img.cols, img.type(), slotImg))
+	{
+		return;
+	}
+
+	img.copyTo(slotImg);
+
+	commitMonoImage(camId, timestamp, image_data, exposure);
+}
+
+bool
+SHMImageServer::beginMonoImage(int rows, int cols, int type, cv::Mat& img)
 {
 	SHM::CameraType cameraType;
-	if (img.channels() == 1)
+	if (CV_MAT_CN(type) == 1)
 	{
 		cameraType = SHM::CAMERA_MONO_8;
 	}
@@ -79,8 +112,21 @@ SHMImageServer::writeMonoImage(const cv::Mat& img, uint64_t camId,
 		cameraType = SHM::CAMERA_MONO_24;
 	}
 
-	writeImage(cameraType, img);
-	
+	if (!beginImage(cameraType, rows, cols, type))
+	{
+		return false;
+	}
+
+	img = mImg;
+
+	return true;
+}
+
+void
+SHMImageServer::commitMonoImage(uint64_t camId,
+								uint64_t timestamp, const mavlink_image_triggered_t &image_data,
+								uint32_t exposure)
+{
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	uint64_t now = ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
@@ -93,10 +139,10 @@ SHMImageServer::writeMonoImage(const cv::Mat& img, uint64_t camId,
 	imginfo.valid_until = valid_until;
 	imginfo.img_seq = mImgSeq;
 	imginfo.img_buf_index = 1;	//FIXME
-	imginfo.width = img.cols;
-	imginfo.height = img.rows;
-	imginfo.depth = img.depth();
-	imginfo.channels = img.channels();
+	imginfo.width = mImg.cols;
+	imginfo.height = mImg.rows;
+	imginfo.depth = mImg.depth();
+	imginfo.channels = mImg.channels();
 	imginfo.key = mKey;
 	imginfo.exposure = exposure;
 	imginfo.gain = 1;//gain;
@@ -111,11 +157,8 @@ SHMImageServer::writeMonoImage(const cv::Mat& img, uint64_t camId,
 	imginfo.ground_x = image_data.ground_x;
 	imginfo.ground_y = image_data.ground_y;
 	imginfo.ground_z = image_data.ground_z;
-	
-	mavlink_message_t msg;
-	mavlink_msg_image_available_encode(mSysid, mCompid, &msg, &imginfo);
-	sendMAVLinkImageMessage(mLCM, &msg);
-	
+
+	commitImage(imginfo, true);
 
 	mImgSeq++;
 }
@@ -125,9 +168,32 @@ SHMImageServer::writeStereoImage(const cv::Mat& imgLeft, uint64_t camIdLeft,
 								 const cv::Mat& imgRight, uint64_t camIdRight,
 								 uint64_t timestamp, const mavlink_image_triggered_t &image_data,
 								 uint32_t exposure)
+{
+	if (imgLeft.size() != imgRight.size() || imgLeft.type() != imgRight.type())
+	{
+		fprintf(stderr, "# WARNING: stereo images differ in size or type.\n");
+		return;
+	}
+
+	cv::Mat slotImgLeft, slotImgRight;
+	if (!beginStereoImage(imgLeft.rows, imgLeft.cols, imgLeft.type(),
+						  slotImgLeft, slotImgRight))
+	{
+		return;
+	}
+
+	imgLeft.copyTo(slotImgLeft);
+	imgRight.copyTo(slotImgRight);
+
+	commitStereoImage(camIdLeft, timestamp, image_data, exposure);
+}
+
+bool
+SHMImageServer::beginStereoImage(int rows, int cols, int type,
+								 cv::Mat& imgLeft, cv::Mat& imgRight)
 {
 	SHM::CameraType cameraType;
-	if (imgLeft.channels() == 1)
+	if (CV_MAT_CN(type) == 1)
 	{
 		cameraType = SHM::CAMERA_STEREO_8;
 	}
@@ -136,8 +202,22 @@ SHMImageServer::writeStereoImage(const cv::Mat& imgLeft, uint64_t camIdLeft,
 		cameraType = SHM::CAMERA_STEREO_24;
 	}
 
-	writeImage(cameraType, imgLeft, imgRight);
-	
+	if (!beginImage(cameraType, rows, cols, type, type))
+	{
+		return false;
+	}
+
+	imgLeft = mImg;
+	imgRight = mImg2;
+
+	return true;
+}
+
+void
+SHMImageServer::commitStereoImage(uint64_t camIdLeft,
+								  uint64_t timestamp, const mavlink_image_triggered_t &image_data,
+								  uint32_t exposure)
+{
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	uint64_t now = ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
@@ -150,10 +230,10 @@ SHMImageServer::writeStereoImage(const cv::Mat& imgLeft, uint64_t camIdLeft,
 	imginfo.valid_until = valid_until;
 	imginfo.img_seq = mImgSeq;
 	imginfo.img_buf_index = 2;	//FIXME
-	imginfo.width = imgLeft.cols;
-	imginfo.height = imgLeft.rows;
-	imginfo.depth = imgLeft.depth();
-	imginfo.channels = imgLeft.channels();
+	imginfo.width = mImg.cols;
+	imginfo.height = mImg.rows;
+	imginfo.depth = mImg.depth();
+	imginfo.channels = mImg.channels();
 	imginfo.key = mKey;
 	imginfo.exposure = exposure;
 	imginfo.gain = 1;//gain;
@@ -169,9 +249,7 @@ SHMImageServer::writeStereoImage(const cv::Mat& imgLeft, uint64_t camIdLeft,
 	imginfo.ground_y = image_data.ground_y;
 	imginfo.ground_z = image_data.ground_z;
 
-	mavlink_message_t msg;
-	mavlink_msg_image_available_encode(mSysid, mCompid, &msg, &imginfo);
-	sendMAVLinkImageMessage(mLCM, &msg);
+	commitImage(imginfo, true);
 	
 	mImgSeq++;
 }
@@ -181,8 +259,6 @@ SHMImageServer::writeKinectImage(const cv::Mat& imgBayer, const cv::Mat& imgDept
 								 uint64_t timestamp, float roll, float pitch, float yaw,
 								 float z, float lon, float lat, float alt, float ground_x, float ground_y, float ground_z)
 {
-	writeImage(SHM::CAMERA_KINECT, imgBayer, imgDepth);
-	
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
 	uint64_t now = ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
@@ -213,9 +289,10 @@ SHMImageServer::writeKinectImage(const cv::Mat& imgBayer, const cv::Mat& imgDept
 	imginfo.ground_y = ground_y;
 	imginfo.ground_z = ground_z;
 	
-	mavlink_message_t msg;
-	mavlink_msg_image_available_encode(mSysid, mCompid, &msg, &imginfo);
-	sendMAVLinkImageMessage(mLCM, &msg);
+	if (!writeImage(SHM::CAMERA_KINECT, imginfo, imgBayer, imgDepth))
+	{
+		return;
+	}
 	
 	mImgSeq++;
 }
@@ -228,7 +305,27 @@ SHMImageServer::writeRGBDImage(const cv::Mat& img, const cv::Mat& imgDepth,
 							   const cv::Mat& cameraMatrix,
 							   const cv::Rect& roi)
 {
-	writeImageWithCameraInfo(SHM::CAMERA_RGBD,
+	mavlink_image_available_t imginfo;
+	memset(&imginfo, 0, sizeof(imginfo));
+	imginfo.cam_no = mCam1;
+	imginfo.timestamp = timestamp;
+	imginfo.img_seq = mImgSeq;
+	imginfo.width = img.cols;
+	imginfo.height = img.rows;
+	imginfo.depth = img.depth();
+	imginfo.channels = img.channels();
+	imginfo.key = mKey;
+	imginfo.roll = roll;
+	imginfo.pitch = pitch;
+	imginfo.yaw = yaw;
+	imginfo.lon = lon;
+	imginfo.lat = lat;
+	imginfo.alt = alt;
+	imginfo.ground_x = ground_x;
+	imginfo.ground_y = ground_y;
+	imginfo.ground_z = ground_z;
+
+	writeImageWithCameraInfo(SHM::CAMERA_RGBD, imginfo,
 							 timestamp, roll, pitch, yaw,
 							 lon, lat, alt,
 							 ground_x, ground_y, ground_z, cameraMatrix, roi,
@@ -238,10 +335,10 @@ SHMImageServer::writeRGBDImage(const cv::Mat& img, const cv::Mat& imgDepth,
 }
 
 bool
-SHMImageServer::writeImage(SHM::CameraType cameraType, const cv::Mat& img,
-						   const cv::Mat& img2)
+SHMImageServer::beginImage(SHM::CameraType cameraType, int rows, int cols,
+						   int type, int type2)
 {
-	if (img.empty())
+	if (rows <= 0 || cols <= 0)
 	{
 		fprintf(stderr, "# WARNING: img parameter should not be empty.\n");
 		return false;
@@ -254,7 +351,7 @@ SHMImageServer::writeImage(SHM::CameraType cameraType, const cv::Mat& img,
 		cameraType == SHM::CAMERA_KINECT ||
 		cameraType == SHM::CAMERA_RGBD)
 	{
-		if (img2.empty())
+		if (type2 < 0)
 		{
 			fprintf(stderr, "# WARNING: img2 parameter should not be empty.\n");
 			return false;
@@ -262,48 +359,97 @@ SHMImageServer::writeImage(SHM::CameraType cameraType, const cv::Mat& img,
 
 		headerLength += 8;
 	}
+	else
+	{
+		type2 = -1;
+	}
 
-	uint32_t dataLength = headerLength + img.step[0] * img.rows +
-						  img2.step[0] * img2.rows;
+	uint32_t step = cols * CV_ELEM_SIZE(type);
+	uint32_t step2 = (type2 < 0) ? 0 : cols * CV_ELEM_SIZE(type2);
+	uint32_t dataLength = headerLength + step * rows + step2 * rows;
 
-	while (mData.capacity() < dataLength)
+	uint8_t* data = mSHM.beginWriteDataPacket(SHM::IMAGE_INFO_SIZE + dataLength);
+	if (data == 0)
 	{
-		mData.reserve(mData.capacity() * 2);
+		return false;
 	}
 
-	mData.resize(dataLength);
-
-	int type = img.type();
+	// the image information is filled in by commitImage()
+	mSlot = data;
+	data += SHM::IMAGE_INFO_SIZE;
 
 	// write header
-	memcpy(&(mData[0]), &cameraType, 4);
-	memcpy(&(mData[4]), &(img.cols), 4);
-	memcpy(&(mData[8]), &(img.rows), 4);
-	memcpy(&(mData[12]), img.step.p, 4);
-	memcpy(&(mData[16]), &type, 4);
+	memcpy(data, &cameraType, 4);
+	memcpy(data + 4, &cols, 4);
+	memcpy(data + 8, &rows, 4);
+	memcpy(data + 12, &step, 4);
+	memcpy(data + 16, &type, 4);
 
-	//char dummy[img.step[0] * img.rows];
-	memcpy(&(mData[headerLength]), img.data, img.step[0] * img.rows);
-	//memcpy(&(mData[headerLength]), img.data, img.step[0] * img.rows);
+	mImg = cv::Mat(rows, cols, type, data + headerLength, step);
 
-	if (!img2.empty())
+	if (type2 >= 0)
 	{
-		memcpy(&(mData[20]), img2.step.p, 4);
+		memcpy(data + 20, &step2, 4);
+		memcpy(data + 24, &type2, 4);
 
-		type = img2.type();
-		memcpy(&(mData[24]), &type, 4);
+		mImg2 = cv::Mat(rows, cols, type2, data + headerLength + step * rows, step2);
+	}
+	else
+	{
+		mImg2 = cv::Mat();
+	}
 
-		memcpy(&(mData[headerLength + img.step[0] * img.rows]), img2.data,
-			   img2.step[0] * img2.rows);
+	return true;
+}
+
+void
+SHMImageServer::commitImage(const mavlink_image_available_t& imginfo, bool announce)
+{
+	uint32_t infoLength = sizeof(imginfo);
+	memcpy(mSlot, &infoLength, 4);
+	memcpy(mSlot + 8, &imginfo, infoLength);
+
+	mSHM.endWriteDataPacket();
+
+	if (announce)
+	{
+		mavlink_message_t msg;
+		mavlink_msg_image_available_encode(mSysid, mCompid, &msg, &imginfo);
+		sendMAVLinkImageMessage(mLCM, &msg);
+	}
+}
+
+bool
+SHMImageServer::writeImage(SHM::CameraType cameraType,
+						   const mavlink_image_available_t& imginfo,
+						   const cv::Mat& img, const cv::Mat& img2)
+{
+	if (!img2.empty() && img2.size() != img.size())
+	{
+		fprintf(stderr, "# WARNING: img2 parameter should have the size of img.\n");
+		return false;
+	}
+
+	if (!beginImage(cameraType, img.rows, img.cols, img.type(),
+					img2.empty() ? -1 : img2.type()))
+	{
+		return false;
 	}
 
-	mSHM.writeDataPacket(mData);
+	img.copyTo(mImg);
+	if (!mImg2.empty())
+	{
+		img2.copyTo(mImg2);
+	}
+
+	commitImage(imginfo, true);
 
 	return true;
 }
 
 bool
 SHMImageServer::writeImageWithCameraInfo(SHM::CameraType cameraType,
+										 const mavlink_image_available_t& imginfo,
 										 uint64_t timestamp,
 										 float roll, float pitch, float yaw,
 										 float lon, float lat, float alt,
@@ -338,27 +484,29 @@ SHMImageServer::writeImageWithCameraInfo(SHM::CameraType cameraType,
 	uint32_t dataLength = headerLength + img.step[0] * img.rows +
 						  img2.step[0] * img2.rows;
 
-	while (mData.capacity() < dataLength)
+	uint8_t* data = mSHM.beginWriteDataPacket(SHM::IMAGE_INFO_SIZE + dataLength);
+	if (data == 0)
 	{
-		mData.reserve(mData.capacity() * 2);
+		return false;
 	}
 
-	mData.resize(dataLength);
+	mSlot = data;
+	data += SHM::IMAGE_INFO_SIZE;
 
 	int type = img.type();
 
 	// write header
-	memcpy(&(mData[0]), &cameraType, 4);
-	memcpy(&(mData[4]), &timestamp, 8);
-	memcpy(&(mData[12]), &roll, 4);
-	memcpy(&(mData[16]), &pitch, 4);
-	memcpy(&(mData[20]), &yaw, 4);
-	memcpy(&(mData[24]), &lon, 4);
-	memcpy(&(mData[28]), &lat, 4);
-	memcpy(&(mData[32]), &alt, 4);
-	memcpy(&(mData[36]), &ground_x, 4);
-	memcpy(&(mData[40]), &ground_y, 4);
-	memcpy(&(mData[44]), &ground_z, 4);
+	memcpy(data, &cameraType, 4);
+	memcpy(data + 4, &timestamp, 8);
+	memcpy(data + 12, &roll, 4);
+	memcpy(data + 16, &pitch, 4);
+	memcpy(data + 20, &yaw, 4);
+	memcpy(data + 24, &lon, 4);
+	memcpy(data + 28, &lat, 4);
+	memcpy(data + 32, &alt, 4);
+	memcpy(data + 36, &ground_x, 4);
+	memcpy(data + 40, &ground_y, 4);
+	memcpy(data + 44, &ground_z, 4);
 
 	assert(cameraMatrix.rows == 3);
 	assert(cameraMatrix.cols == 3);
@@ -368,39 +516,40 @@ SHMImageServer::writeImageWithCameraInfo(SHM::CameraType cameraType,
 	{
 		for (int j = 0; j < cameraMatrix.cols; ++j)
 		{
-			memcpy(&(mData[mark]), &(cameraMatrix.at<float>(i,j)), 4);
+			memcpy(data + mark, &(cameraMatrix.at<float>(i,j)), 4);
 			mark += 4;
 		}
 	}
 
-	memcpy(&(mData[mark]), &(roi.x), 4);
-	memcpy(&(mData[mark+4]), &(roi.y), 4);
-	memcpy(&(mData[mark+8]), &(roi.width), 4);
-	memcpy(&(mData[mark+12]), &(roi.height), 4);
+	memcpy(data + mark, &(roi.x), 4);
+	memcpy(data + mark + 4, &(roi.y), 4);
+	memcpy(data + mark + 8, &(roi.width), 4);
+	memcpy(data + mark + 12, &(roi.height), 4);
 
 	mark += 16;
 
-	memcpy(&(mData[mark]), &(img.cols), 4);
-	memcpy(&(mData[mark+4]), &(img.rows), 4);
-	memcpy(&(mData[mark+8]), img.step.p, 4);
-	memcpy(&(mData[mark+12]), &type, 4);
+	memcpy(data + mark, &(img.cols), 4);
+	memcpy(data + mark + 4, &(img.rows), 4);
+	memcpy(data + mark + 8, img.step.p, 4);
+	memcpy(data + mark + 12, &type, 4);
 
 	mark += 16;
 
-	memcpy(&(mData[headerLength]), img.data, img.step[0] * img.rows);
+	memcpy(data + headerLength, img.data, img.step[0] * img.rows);
 
 	if (!img2.empty())
 	{
-		memcpy(&(mData[mark]), img2.step.p, 4);
+		memcpy(data + mark, img2.step.p, 4);
 
 		type = img2.type();
-		memcpy(&(mData[mark+4]), &type, 4);
+		memcpy(data + mark + 4, &type, 4);
 
-		memcpy(&(mData[headerLength + img.step[0] * img.rows]), img2.data,
+		memcpy(data + headerLength + img.step[0] * img.rows, img2.data,
 			   img2.step[0] * img2.rows);
 	}
 
-	mSHM.writeDataPacket(mData);
+	// RGBD images have never been announced over LCM
+	commitImage(imginfo, false);
 
 	return true;
 }
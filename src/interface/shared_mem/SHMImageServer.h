@@ -56,23 +56,68 @@ public:
 	 * @param cam1 Camera 1. If it is part of a stereo rig, it is the left camera.
 	 * @param cam2 Camera 2. If it is part of a stereo rig, it is the right camera.
 	 * 						 Otherwise, leave the parameter empty.
+	 * @param checksum Checksum computed over each image. Clients pick it up
+	 * 				   from the shared memory segment.
 	 *
 	 * @return Result of shared memory segment access.
 	 */
 	bool init(int sysid, int compid, lcm_t* lcm,
-			  SHM::Camera cam1, SHM::Camera cam2 = SHM::CAMERA_NONE);
+			  SHM::Camera cam1, SHM::Camera cam2 = SHM::CAMERA_NONE,
+			  SHM::Checksum checksum = SHM::CHECKSUM_NONE);
 	
+	/**
+	 * Sets the geometry and backing of the shared memory segment. Has to
+	 * be called before init(); clients pick the values up from the segment.
+	 *
+	 * @param slotSize Size of one image slot in bytes, a multiple of 16.
+	 * 				   It has to hold the largest image (or image pair)
+	 * 				   plus about 200 bytes of headers.
+	 * @param slotCount Number of images kept in the ring.
+	 */
+	void setSegment(int slotSize, int slotCount,
+					SHM::Backing backing = SHM::BACKING_SYSV,
+					bool hugePages = false);
+
 	int getCameraConfig(void) const;
 
 	void writeMonoImage(const cv::Mat& img, uint64_t camId,
 						uint64_t timestamp, const mavlink_image_triggered_t &image_data,
 						uint32_t exposure);
-	
+
+	/**
+	 * Reserves a shared memory slot for a mono image so that the image can
+	 * be filled in place, e.g. by a camera driver or a color conversion,
+	 * without any further copy. The image is published by commitMonoImage().
+	 *
+	 * @param img Image header that points into the reserved slot.
+	 *
+	 * @return False if the image does not fit into a slot.
+	 */
+	bool beginMonoImage(int rows, int cols, int type, cv::Mat& img);
+
+	void commitMonoImage(uint64_t camId,
+						 uint64_t timestamp, const mavlink_image_triggered_t &image_data,
+						 uint32_t exposure);
+
 	void writeStereoImage(const cv::Mat& imgLeft, uint64_t camIdLeft,
 						  const cv::Mat& imgRight, uint64_t camIdRight,
 						  uint64_t timestamp, const mavlink_image_triggered_t &image_data,
 						  uint32_t exposure);
-	
+
+	/**
+	 * Reserves a shared memory slot for a stereo image pair so that both
+	 * images can be filled in place. The pair is published by
+	 * commitStereoImage().
+	 *
+	 * @return False if the image pair does not fit into a slot.
+	 */
+	bool beginStereoImage(int rows, int cols, int type,
+						  cv::Mat& imgLeft, cv::Mat& imgRight);
+
+	void commitStereoImage(uint64_t camIdLeft,
+						   uint64_t timestamp, const mavlink_image_triggered_t &image_data,
+						   uint32_t exposure);
+
 	void writeKinectImage(const cv::Mat& imgBayer, const cv::Mat& imgDepth,
 						  uint64_t timestamp, float roll, float pitch, float yaw,
 						  float z, float lon, float lat, float alt, float ground_x, float ground_y, float ground_z);
@@ -85,10 +130,22 @@ public:
 						const cv::Rect& roi = cv::Rect());
 
 private:
-	bool writeImage(SHM::CameraType cameraType, const cv::Mat& img,
-					const cv::Mat& img2 = cv::Mat());
+	bool beginImage(SHM::CameraType cameraType, int rows, int cols,
+					int type, int type2 = -1);
+
+	/**
+	 * Stores the image information in the slot reserved by beginImage(),
+	 * publishes the slot and, if announce is set, sends the IMAGE_AVAILABLE
+	 * message for remote clients.
+	 */
+	void commitImage(const mavlink_image_available_t& imginfo, bool announce);
+
+	bool writeImage(SHM::CameraType cameraType,
+					const mavlink_image_available_t& imginfo,
+					const cv::Mat& img, const cv::Mat& img2 = cv::Mat());
 
 	bool writeImageWithCameraInfo(SHM::CameraType cameraType,
+								  const mavlink_image_available_t& imginfo,
 								  uint64_t timestamp,
 								  float roll, float pitch, float yaw,
 								  float lon, float lat, float alt,
@@ -106,8 +163,14 @@ private:
 	
 	SHM mSHM;
 	int mKey;
-	
-	std::vector<uint8_t> mData;
+	int mSlotSize;
+	int mSlotCount;
+	SHM::Backing mBacking;
+	bool mHugePages;
+
+	uint8_t* mSlot;
+	cv::Mat mImg;
+	cv::Mat mImg2;
 
 	unsigned int mImgSeq;
 };
@@ -0,0 +1,162 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Time per frame of the SHM packet checksums
+*
+*   Checksums mono8 frames of 640x480 and 1280x960 pixels, and of any
+*   additional size given, with the 8-bit sum SHM used before, CRC32C
+*   with and without the crc32 instruction and xxHash32.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <sys/time.h>
+#include <boost/program_options.hpp>
+
+#include "SHMChecksum.h"
+
+namespace config = boost::program_options;
+
+static uint64_t now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/**
+ * The checksum of SHM before it became configurable.
+ */
+static uint32_t sum8(const uint8_t* data, uint32_t length)
+{
+	uint8_t c = 0;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		c += data[i];
+	}
+	return c;
+}
+
+static uint32_t xxhash32(const uint8_t* data, uint32_t length)
+{
+	return px::xxhash32(data, length);
+}
+
+typedef uint32_t (*ChecksumFunction)(const uint8_t* data, uint32_t length);
+
+/** @return milliseconds per call */
+static double bench(ChecksumFunction f, const std::vector<uint8_t>& frame, int repeat, uint32_t& result)
+{
+	// one call to warm the caches
+	result = f(&frame[0], frame.size());
+
+	uint64_t start = now_us();
+	for (int i = 0; i < repeat; ++i)
+	{
+		result ^= f(&frame[0], frame.size());
+	}
+	return (now_us() - start) / 1000.0 / repeat;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> widths;
+	std::vector<int> heights;
+	int repeat;
+
+	config::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("width,w", config::value< std::vector<int> >(&widths)->composing(), "Width of an additional frame size (may be repeated)")
+		("height,h", config::value< std::vector<int> >(&heights)->composing(), "Height of an additional frame size (may be repeated)")
+		("repeat,n", config::value<int>(&repeat)->default_value(200), "Frames checksummed per function")
+		;
+	config::variables_map vm;
+	config::store(config::parse_command_line(argc, argv, desc), vm);
+	config::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+	if (widths.size() != heights.size() || repeat < 1)
+	{
+		fprintf(stderr, "# ERROR: Give as many --width as --height, --repeat must be positive\n");
+		return 1;
+	}
+
+	widths.insert(widths.begin(), 1280);
+	heights.insert(heights.begin(), 960);
+	widths.insert(widths.begin(), 640);
+	heights.insert(heights.begin(), 480);
+
+	const char* names[] = { "sum8 (old)", "crc32c", "crc32c (slicing)", "xxhash32" };
+	ChecksumFunction functions[] = { sum8, px::crc32c, px::crc32cSlicing, xxhash32 };
+	const int count = sizeof(functions) / sizeof(functions[0]);
+
+	printf("crc32c uses the %s\n", px::crc32cHasHardware() ? "crc32 instruction" : "slicing-by-8 tables");
+
+	srand(1);
+	for (size_t s = 0; s < widths.size(); ++s)
+	{
+		if (widths.at(s) < 1 || heights.at(s) < 1)
+		{
+			fprintf(stderr, "# ERROR: Frame size %dx%d is empty\n", widths.at(s), heights.at(s));
+			return 1;
+		}
+
+		std::vector<uint8_t> frame((size_t)widths.at(s) * heights.at(s));
+		for (size_t i = 0; i < frame.size(); ++i)
+		{
+			frame[i] = rand() & 0xFF;
+		}
+
+		printf("%dx%d mono8, %lu bytes\n", widths.at(s), heights.at(s), (unsigned long)frame.size());
+		for (int f = 0; f < count; ++f)
+		{
+			uint32_t result;
+			double ms = bench(functions[f], frame, repeat, result);
+			printf("  %-18s %8.3f ms %8.1f MB/s  (%08x)\n", names[f], ms,
+				   frame.size() / (ms * 1000.0), result);
+		}
+	}
+
+	// Both CRC32C paths have to agree
+	std::vector<uint8_t> check(1021);
+	for (size_t i = 0; i < check.size(); ++i)
+	{
+		check[i] = rand() & 0xFF;
+	}
+	if (px::crc32c(&check[0], check.size()) != px::crc32cSlicing(&check[0], check.size()))
+	{
+		fprintf(stderr, "# ERROR: crc32c and crc32cSlicing disagree\n");
+		return 1;
+	}
+	return 0;
+}
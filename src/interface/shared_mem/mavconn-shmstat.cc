@@ -0,0 +1,146 @@
+/*=====================================================================
+
+PIXHAWK Micro Air Vehicle Flying Robotics Toolkit
+
+(c) 2009-2011 PIXHAWK PROJECT  <http://pixhawk.ethz.ch>
+
+This file is part of the PIXHAWK project
+
+    PIXHAWK is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PIXHAWK is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with PIXHAWK. If not, see <http://www.gnu.org/licenses/>.
+
+======================================================================*/
+
+/**
+* @file
+*   @brief Shows the readers of shared memory segments and how far they lag
+*
+*   For every segment, the number of published packets and the publication
+*   rate are shown, followed by one line per registered client with its read
+*   mode, delivered packets, delivery rate, overruns and current and maximum
+*   lag in packets.
+*
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+
+#include "SHM.h"
+
+namespace config = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> keys;
+	int interval;
+	bool once = false;
+
+	config::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("key,k", config::value< std::vector<int> >(&keys)->composing(), "Key of a segment to show (may be repeated). Default: all camera segments")
+		("interval,i", config::value<int>(&interval)->default_value(1000), "Refresh interval in milliseconds")
+		("once", config::bool_switch(&once)->default_value(false), "Print once and exit")
+		;
+	config::variables_map vm;
+	config::store(config::parse_command_line(argc, argv, desc), vm);
+	config::notify(vm);
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 1;
+	}
+
+	if (keys.empty())
+	{
+		// segments of SHMImageServer, keyed by cam1 | cam2
+		keys.push_back(px::SHM::CAMERA_FORWARD_LEFT);
+		keys.push_back(px::SHM::CAMERA_FORWARD_LEFT | px::SHM::CAMERA_FORWARD_RIGHT);
+		keys.push_back(px::SHM::CAMERA_DOWNWARD_LEFT);
+		keys.push_back(px::SHM::CAMERA_DOWNWARD_LEFT | px::SHM::CAMERA_DOWNWARD_RIGHT);
+		keys.push_back(px::SHM::CAMERA_FORWARD_RGBD);
+		keys.push_back(px::SHM::CAMERA_DOWNWARD_RGBD);
+	}
+
+	std::vector<px::SHM> segments(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		segments.at(i).init(keys.at(i), px::SHM::MONITOR_TYPE);
+	}
+
+	// previous counts to compute rates, per segment and per reader pid
+	std::vector<uint64_t> lastPublished(keys.size(), 0);
+	std::vector< std::map<int, uint64_t> > lastDelivered(keys.size());
+
+	while (true)
+	{
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			std::vector<px::SHM::ReaderStatus> readers;
+			if (!segments.at(i).getReaders(readers))
+			{
+				continue;
+			}
+
+			uint64_t published = segments.at(i).getPublishedCount();
+			if (lastPublished.at(i) == 0)
+			{
+				lastPublished.at(i) = published;
+			}
+			printf("segment 0x%02X: %llu published (%.1f/s), %u slots of %u bytes\n",
+				   keys.at(i), (unsigned long long) published,
+				   (published - lastPublished.at(i)) * 1000.0 / interval,
+				   segments.at(i).getSlotCount(),
+				   segments.at(i).getMaxDataPacketSize());
+			lastPublished.at(i) = published;
+
+			printf("  %7s %-16s %-6s %12s %9s %10s %6s %6s\n",
+				   "PID", "NAME", "MODE", "DELIVERED", "RATE", "OVERRUNS", "LAG", "MAXLAG");
+
+			std::map<int, uint64_t> delivered;
+			for (size_t j = 0; j < readers.size(); ++j)
+			{
+				const px::SHM::ReaderStatus& r = readers.at(j);
+
+				std::map<int, uint64_t>::const_iterator it = lastDelivered.at(i).find(r.pid);
+				uint64_t last = (it != lastDelivered.at(i).end()) ? it->second : r.delivered;
+
+				printf("  %7d %-16s %-6s %12llu %7.1f/s %10llu %6u %6u\n",
+					   r.pid, r.name.c_str(),
+					   (r.mode == px::SHM::READ_EVERY) ? "every" : "latest",
+					   (unsigned long long) r.delivered,
+					   (r.delivered - last) * 1000.0 / interval,
+					   (unsigned long long) r.overruns, r.lag, r.maxLag);
+
+				delivered[r.pid] = r.delivered;
+			}
+			lastDelivered.at(i) = delivered;
+		}
+
+		if (once)
+		{
+			break;
+		}
+
+		printf("\n");
+		fflush(stdout);
+		usleep(interval * 1000);
+	}
+
+	return 0;
+}
@@ -38,6 +38,8 @@ This file is part of the MAVCONN project
 #define _MAVCONN_H_
 
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -55,6 +57,9 @@ This file is part of the MAVCONN project
 #include <lcm/lcm.h>
 #include "comm/lcm/mavconn_mavlink_message_t.h"
 #include "comm/lcm/mavconn_mavlink_msg_container_t.h"
+#include "comm/lcm/mavconn_mavlink_compact.h"
+#include "comm/lcm/mavconn_mavlink_channels.h"
+#include "comm/lcm/mavconn_config.h"
 
 // Time
 #include <sys/time.h>
@@ -120,61 +125,227 @@ inline std::string trimString(std::string& str)
 	return str;
 }
 
-// FIXME
+/**
+ * @brief System ID of this host, "systemid <1..255>" in the configuration
+ *
+ * The value is cached per thread and configuration snapshot, so a call
+ * only compares the snapshot pointer unless the file changed.
+ */
 static inline int getSystemID(void)
 {
-	static bool isCached = false;
+	static __thread const mavconn_config_t* cached = NULL;
 	// Return 42 on error or no config file present
-	static int systemId = 42;
+	static __thread int systemId = 42;
 
-	if (!isCached)
+	const mavconn_config_t* config = mavconn_config_get();
+	if (config != cached)
 	{
-		// Read config file
-		std::string line;
-		std::ifstream configFile("/etc/mavconn/mavconn.conf");
-		if (configFile.is_open())
-		{
-			while (configFile.good())
-			{
-				std::string key;
-				int value;
-				configFile >> key;
-				configFile >> value;
-
-				key = trimString(key);
-
-				if (key == "systemid" && value > 0 && value < 256)
-				{
-					systemId = value;
-                    isCached = true;
-                    //std::cout<<"Reading SysID from mavconn.conf successful, sysID "<<systemId<<"\n";
-				}
-			}
-		}
-
-	}/*else{
-        std::cout<<"Reading cached SysID "<<systemId<<"\n";
-    }*/
+		int value = mavconn_config_int(config, "systemid", 42);
+		systemId = (value > 0 && value < 256) ? value : 42;
+		cached = config;
+	}
 
 	return systemId;
 }
 
+/**
+ * @brief LCM channel layout of this host, see mavconn_mavlink_channels.h
+ *
+ * Set with "channels 1" (partitioned plus MAVLINK_MAIN) or "channels 2"
+ * (partitioned only) in /etc/mavconn/mavconn.conf. All processes on the
+ * host have to agree on it.
+ */
+static inline int readMAVLinkChannelLayout(void)
+{
+	const mavconn_config_t* config = mavconn_config_get();
+	int layout = mavconn_config_int(config, "channels", -1);
+
+	if (layout >= MAVCONN_CHANNELS_LEGACY && layout <= MAVCONN_CHANNELS_PARTITIONED)
+	{
+		return layout;
+	}
+	const char* value = mavconn_config_string(config, "channels", NULL);
+	if (value != NULL)
+	{
+		fprintf(stderr, "# WARNING: Invalid channel layout \"%s\" in the configuration, using the legacy layout\n", value);
+	}
+	return MAVCONN_CHANNELS_LEGACY;
+}
+
+static inline mavconn_channel_layout_t getMAVLinkChannelLayout(void)
+{
+	// Read once, changing it needs a restart of all processes anyway
+	static const int layout = readMAVLinkChannelLayout();
+
+	return static_cast<mavconn_channel_layout_t>(layout);
+}
+
+/**
+ * @brief Smallest extended payload that is passed through the blob pool
+ *
+ * Set with "blobs <bytes>" in /etc/mavconn/mavconn.conf, 0 (the default)
+ * keeps all payloads inline. Blob handles can only be resolved on the
+ * publishing host, so this is only safe if LCM traffic stays on the host
+ * (udpm with ttl=0 or shm://) and bridges carry it elsewhere. Blobs are
+ * only published with "compact 1", see getMAVLinkCompact().
+ */
+static inline int getMAVLinkBlobThreshold(void)
+{
+	static __thread const mavconn_config_t* cached = NULL;
+	static __thread int threshold = 0;
+
+	const mavconn_config_t* config = mavconn_config_get();
+	if (config != cached)
+	{
+		int value = mavconn_config_int(config, "blobs", 0);
+		threshold = (value >= 0) ? value : 0;
+		cached = config;
+	}
+
+	return threshold;
+}
+
+/**
+ * @brief Whether containers are published in the compact encoding
+ *
+ * Set with "compact 1" in /etc/mavconn/mavconn.conf once every process on
+ * the bus subscribes with mavconn_mavlink_compact_subscribe(). The default
+ * 0 keeps the generated encoding, which lcm::LCM subscribers and
+ * getMAVLinkMessage() in mavconn.hpp decode. Batches and blobs are only
+ * used with the compact encoding.
+ */
+static inline bool getMAVLinkCompact(void)
+{
+	static __thread const mavconn_config_t* cached = NULL;
+	static __thread bool compact = false;
+
+	const mavconn_config_t* config = mavconn_config_get();
+	if (config != cached)
+	{
+		compact = mavconn_config_int(config, "compact", 0) != 0;
+		cached = config;
+	}
+
+	return compact;
+}
+
+static inline void
+publishMAVLinkEncoded(lcm_t * lcm, const char* channel, const mavconn_mavlink_msg_container_t* container)
+{
+	if (getMAVLinkCompact()) mavconn_mavlink_compact_publish (lcm, channel, container);
+	else mavconn_mavlink_msg_container_t_publish (lcm, channel, container);
+}
+
+/**
+ * @brief Publish a container on the channels of the configured layout
+ *
+ * With the compact encoding, extended payloads of at least
+ * getMAVLinkBlobThreshold() bytes are written once into the blob pool of
+ * this process and only their handle is published. If the pool is full
+ * they are sent inline.
+ */
+static inline void
+publishMAVLinkContainer(lcm_t * lcm, const mavconn_mavlink_msg_container_t* container)
+{
+	mavconn_blob_handle_t blob;
+	int threshold = getMAVLinkBlobThreshold();
+	bool useBlob = threshold > 0 && container->extended_payload_len >= threshold && getMAVLinkCompact() &&
+			mavconn_blob_put(container->extended_payload, container->extended_payload_len, &blob) == 0;
+
+	mavconn_channel_layout_t layout = getMAVLinkChannelLayout();
+	if (layout != MAVCONN_CHANNELS_PARTITIONED)
+	{
+		if (useBlob) mavconn_mavlink_compact_publish_blob (lcm, MAVLINK_MAIN, container, &blob);
+		else publishMAVLinkEncoded (lcm, MAVLINK_MAIN, container);
+	}
+	if (layout != MAVCONN_CHANNELS_LEGACY)
+	{
+		const mavconn_mavlink_message_t* msg = &container->msg;
+		const char* channel = mavconn_channel_name(msg->sysid, mavconn_channel_class(msg->msgid));
+		if (useBlob) mavconn_mavlink_compact_publish_blob (lcm, channel, container, &blob);
+		else publishMAVLinkEncoded (lcm, channel, container);
+	}
+}
+
 static inline void
 sendMAVLinkMessage(lcm_t * lcm, const mavlink_message_t* msg, MAVCONN_LINK_TYPE link_type=MAVCONN_LINK_TYPE_LCM);
 
 static inline void
 sendMAVLinkMessage(lcm_t * lcm, const mavlink_message_t* msg, MAVCONN_LINK_TYPE link_type)
 {
-	// Pack a new container
-	static mavconn_mavlink_msg_container_t container;
+	// Pack a new container, on the stack so that threads may send concurrently
+	mavconn_mavlink_msg_container_t container;
 	container.link_component_id = 0;
 	container.link_network_source = link_type;
 	container.extended_payload_len = 0;
 	container.extended_payload = 0;
-	memcpy(&(container.msg), msg, sizeof(container.msg));
+	// The compact encoding only reads header, payload and checksum bytes
+	size_t size = getMAVLinkCompact() ? offsetof(mavlink_message_t, payload64) + msg->len + MAVLINK_NUM_CHECKSUM_BYTES : sizeof(container.msg);
+	memcpy(&(container.msg), msg, size);
 
 	// Publish the message on the LCM bus
-	mavconn_mavlink_msg_container_t_publish (lcm, MAVLINK_MAIN, &container);
+	publishMAVLinkContainer (lcm, &container);
+}
+
+/**
+ * @brief Send several messages with as few LCM messages as possible
+ *
+ * Meant for bursts such as parameter lists or image fragments, which
+ * would otherwise pay the LCM overhead once per message. Subscribers
+ * still see one container per message. Without the compact encoding the
+ * messages are sent one by one.
+ */
+static inline void
+sendMAVLinkMessages(lcm_t * lcm, const mavlink_message_t* msgs, size_t count, MAVCONN_LINK_TYPE link_type=MAVCONN_LINK_TYPE_LCM);
+
+static inline void
+sendMAVLinkMessages(lcm_t * lcm, const mavlink_message_t* msgs, size_t count, MAVCONN_LINK_TYPE link_type)
+{
+	// mavlink_message_t and its LCM type share the layout, see getMAVLinkMsgPtr()
+	const mavconn_mavlink_message_t* lcmMsgs = (const mavconn_mavlink_message_t*) msgs;
+
+	if (!getMAVLinkCompact())
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			sendMAVLinkMessage(lcm, &msgs[i], link_type);
+		}
+		return;
+	}
+
+	mavconn_channel_layout_t layout = getMAVLinkChannelLayout();
+	if (layout != MAVCONN_CHANNELS_PARTITIONED)
+	{
+		mavconn_mavlink_compact_publish_batch (lcm, MAVLINK_MAIN, link_type, lcmMsgs, count);
+	}
+	if (layout != MAVCONN_CHANNELS_LEGACY)
+	{
+		// one batch per run of messages for the same channel
+		size_t start = 0;
+		while (start < count)
+		{
+			const char* channel = mavconn_channel_name(msgs[start].sysid, mavconn_channel_class(msgs[start].msgid));
+			size_t end = start + 1;
+			while (end < count && mavconn_channel_name(msgs[end].sysid, mavconn_channel_class(msgs[end].msgid)) == channel)
+			{
+				++end;
+			}
+			mavconn_mavlink_compact_publish_batch (lcm, channel, link_type, lcmMsgs + start, end - start);
+			start = end;
+		}
+	}
+}
+
+static inline void
+sendMAVLinkMessages(lcm_t * lcm, const std::vector<mavlink_message_t>& msgs, MAVCONN_LINK_TYPE link_type=MAVCONN_LINK_TYPE_LCM);
+
+static inline void
+sendMAVLinkMessages(lcm_t * lcm, const std::vector<mavlink_message_t>& msgs, MAVCONN_LINK_TYPE link_type)
+{
+	if (!msgs.empty())
+	{
+		sendMAVLinkMessages(lcm, &msgs[0], msgs.size(), link_type);
+	}
 }
 
 #ifdef PROTOBUF_FOUND
@@ -185,7 +356,7 @@ static inline void
 sendMAVLinkExtendedMessage(lcm_t * lcm, const mavlink_extended_message_t* msg, MAVCONN_LINK_TYPE link_type)
 {
 	// Pack a new container
-	static mavconn_mavlink_msg_container_t container;
+	mavconn_mavlink_msg_container_t container;
 	container.link_component_id = 0;
 	container.link_network_source = link_type;
 	memcpy(&(container.msg), &(msg->base_msg), MAVLINK_MAX_PACKET_LEN);
@@ -193,7 +364,7 @@ sendMAVLinkExtendedMessage(lcm_t * lcm, const mavlink_extended_message_t* msg, M
 	container.extended_payload = (int8_t*)msg->extended_payload;
 
 	// Publish the message on the LCM bus
-	mavconn_mavlink_msg_container_t_publish (lcm, MAVLINK_MAIN, &container);
+	publishMAVLinkContainer (lcm, &container);
 }
 
 static inline void
@@ -207,7 +378,7 @@ sendMAVLinkExtendedMessage(lcm_t * lcm, const std::vector<mavlink_extended_messa
 		const mavlink_extended_message_t& fragment = msg.at(i);
 
 		// Pack a new container
-		static mavconn_mavlink_msg_container_t container;
+		mavconn_mavlink_msg_container_t container;
 		container.link_component_id = 0;
 		container.link_network_source = link_type;
 		memcpy(&(container.msg), &(fragment.base_msg), MAVLINK_MAX_PACKET_LEN);
@@ -215,7 +386,7 @@ sendMAVLinkExtendedMessage(lcm_t * lcm, const std::vector<mavlink_extended_messa
 		container.extended_payload = (int8_t*)fragment.extended_payload;
 
 		// Publish the message on the LCM bus
-		mavconn_mavlink_msg_container_t_publish (lcm, MAVLINK_MAIN, &container);
+		publishMAVLinkContainer (lcm, &container);
 	}
 }
 #endif
@@ -227,12 +398,40 @@ static inline void
 sendMAVLinkImageMessage(lcm_t * lcm, const mavlink_message_t* msg, MAVCONN_LINK_TYPE link_type)
 {
 	// Pack a new container
-	static mavconn_mavlink_msg_container_t container;
+	mavconn_mavlink_msg_container_t container;
+	container.link_component_id = 0;
 	container.link_network_source = link_type;
-	memcpy(&(container.msg), msg, MAVLINK_MAX_PACKET_LEN);
+	container.extended_payload_len = 0;
+	container.extended_payload = 0;
+	size_t size = getMAVLinkCompact() ? offsetof(mavlink_message_t, payload64) + msg->len + MAVLINK_NUM_CHECKSUM_BYTES : sizeof(container.msg);
+	memcpy(&(container.msg), msg, size);
 
 	// Publish the message on the LCM bus
-	mavconn_mavlink_msg_container_t_publish (lcm, MAVLINK_IMAGES, &container);
+	publishMAVLinkEncoded (lcm, MAVLINK_IMAGES, &container);
+}
+
+/**
+ * @brief Subscribe to MAVLink messages of the given classes
+ *
+ * With the legacy layout this is a subscription to MAVLINK_MAIN and the
+ * handler still has to filter. Otherwise only the channels of the given
+ * classes are received.
+ *
+ * @param classes MAVCONN_CHANNEL_MASK() bits of the classes wanted from all systems
+ * @param ownClasses classes wanted only from this system, see getSystemID()
+ */
+static inline mavconn_mavlink_compact_subscription_t*
+subscribeMAVLinkMessages(lcm_t * lcm, unsigned classes, unsigned ownClasses,
+		mavconn_mavlink_msg_container_t_handler_t handler, void* user)
+{
+	if (getMAVLinkChannelLayout() == MAVCONN_CHANNELS_LEGACY)
+	{
+		return mavconn_mavlink_compact_subscribe (lcm, MAVLINK_MAIN, handler, user);
+	}
+
+	char pattern[128];
+	mavconn_channel_pattern (pattern, sizeof(pattern), classes, getSystemID(), ownClasses);
+	return mavconn_mavlink_compact_subscribe (lcm, pattern, handler, user);
 }
 
 
@@ -86,15 +86,26 @@ sendMAVLinkMessage(lcm::LCM& lcm, const mavlink_message_t* msg, MAVCONN_LINK_TYP
 static inline void
 sendMAVLinkMessage(lcm::LCM& lcm, const mavlink_message_t* msg, MAVCONN_LINK_TYPE link_type)
 {
-	// Pack a new container
-	static mavconn::mavlink_msg_container_t container;
-	container.link_component_id = 0;
-	container.link_network_source = link_type;
-	container.extended_payload_len = 0;
-	copyMAVLinkMessage(container.msg, *msg);
-
-	// Publish the message on the LCM bus
-	lcm.publish(MAVLINK_MAIN, &container);
+	// The C encoder packs on the stack of the calling thread
+	sendMAVLinkMessage(lcm.getUnderlyingLCM(), msg, link_type);
+}
+
+static inline void
+sendMAVLinkMessages(lcm::LCM& lcm, const mavlink_message_t* msgs, size_t count, MAVCONN_LINK_TYPE link_type=MAVCONN_LINK_TYPE_LCM);
+
+static inline void
+sendMAVLinkMessages(lcm::LCM& lcm, const mavlink_message_t* msgs, size_t count, MAVCONN_LINK_TYPE link_type)
+{
+	sendMAVLinkMessages(lcm.getUnderlyingLCM(), msgs, count, link_type);
+}
+
+static inline void
+sendMAVLinkMessages(lcm::LCM& lcm, const std::vector<mavlink_message_t>& msgs, MAVCONN_LINK_TYPE link_type=MAVCONN_LINK_TYPE_LCM);
+
+static inline void
+sendMAVLinkMessages(lcm::LCM& lcm, const std::vector<mavlink_message_t>& msgs, MAVCONN_LINK_TYPE link_type)
+{
+	sendMAVLinkMessages(lcm.getUnderlyingLCM(), msgs, link_type);
 }
 
 #ifdef PROTOBUF_FOUND
@@ -104,16 +115,7 @@ sendMAVLinkExtendedMessage(lcm::LCM& lcm, const mavlink_extended_message_t* msg,
 static inline void
 sendMAVLinkExtendedMessage(lcm::LCM& lcm, const mavlink_extended_message_t* msg, MAVCONN_LINK_TYPE link_type)
 {
-	// Pack a new container
-	static mavconn::mavlink_msg_container_t container;
-	container.link_component_id = 0;
-	container.link_network_source = link_type;
-	copyMAVLinkMessage(container.msg, msg->base_msg);
-	container.extended_payload_len = msg->extended_payload_len;
-	container.extended_payload.assign(msg->extended_payload, msg->extended_payload + msg->extended_payload_len);
-
-	// Publish the message on the LCM bus
-	lcm.publish(MAVLINK_MAIN, &container);
+	sendMAVLinkExtendedMessage(lcm.getUnderlyingLCM(), msg, link_type);
 }
 
 static inline void
@@ -122,21 +124,7 @@ sendMAVLinkExtendedMessage(lcm::LCM& lcm, const std::vector<mavlink_extended_mes
 static inline void
 sendMAVLinkExtendedMessage(lcm::LCM& lcm, const std::vector<mavlink_extended_message_t>& msg, MAVCONN_LINK_TYPE link_type)
 {
-	for (size_t i = 0; i < msg.size(); ++i)
-	{
-		const mavlink_extended_message_t& fragment = msg.at(i);
-
-		// Pack a new container
-		static mavconn::mavlink_msg_container_t container;
-		container.link_component_id = 0;
-		container.link_network_source = link_type;
-		copyMAVLinkMessage(container.msg, fragment.base_msg);
-		container.extended_payload_len = fragment.extended_payload_len;
-		container.extended_payload.assign(fragment.extended_payload, fragment.extended_payload + fragment.extended_payload_len);
-
-		// Publish the message on the LCM bus
-		lcm.publish(MAVLINK_MAIN, &container);
-	}
+	sendMAVLinkExtendedMessage(lcm.getUnderlyingLCM(), msg, link_type);
 }
 #endif
 
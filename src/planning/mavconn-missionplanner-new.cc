@@ -30,7 +30,7 @@
 namespace config = boost::program_options;
 
 lcm_t* lcm;
-mavconn_mavlink_msg_container_t_subscription_t* comm_sub;
+mavconn_mavlink_compact_subscription_t* comm_sub;
 
 
 bool debug;             	///< boolean for debug output or behavior
@@ -2081,7 +2081,8 @@ int main(int argc, char* argv[])
     	printf("LCM failed.\n");
     	return NULL;
     }
-    comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcm, "MAVLINK", &mavlink_handler, NULL);
+    comm_sub = subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_MISSION) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM),
+            MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM), &mavlink_handler, NULL);
 
 
     /**********************************
@@ -2200,7 +2201,7 @@ int main(int argc, char* argv[])
     /**********************************
     * Terminate the LCM
     **********************************/
-	mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+	mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
 	lcm_destroy (lcm);
 	printf("WAYPOINTPLANNER TERMINATED\n");
 
@@ -881,7 +881,8 @@ int main(int argc, char* argv[])
     if (!lcm)
         return 1;
 
-    mavconn_mavlink_msg_container_t_subscription_t * comm_sub = mavconn_mavlink_msg_container_t_subscribe (lcm, "MAVLINK", &mavlink_handler, NULL);
+    mavconn_mavlink_compact_subscription_t * comm_sub = subscribeMAVLinkMessages (lcm, MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_MISSION) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_CMD) | MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_PARAM),
+            MAVCONN_CHANNEL_MASK(MAVCONN_CHANNEL_TELEM), &mavlink_handler, NULL);
 
     paramClient = new MAVConnParamClient(systemid, compid, lcm, configFile, verbose);
     paramClient->setParamValue("POSFILTER", 1.f);
@@ -1006,6 +1007,6 @@ int main(int argc, char* argv[])
         lcm_handle (lcm);
     }
 
-    mavconn_mavlink_msg_container_t_unsubscribe (lcm, comm_sub);
+    mavconn_mavlink_compact_unsubscribe (lcm, comm_sub);
     lcm_destroy (lcm);
 }